@@ -0,0 +1,553 @@
+#define _XOPEN_SOURCE 700
+// blockmed-bench: micro and macro benchmarks of the hot paths. Every
+// benchmark reports operations per second and latency percentiles; results
+// can be written as JSON and compared against a stored baseline, failing
+// when any benchmark got slower than the threshold.
+//
+//   make bench                        (compares with bench/baseline.json)
+//   make bench-baseline               (records bench/baseline.json)
+//   ./blockmed-bench [--sizes 1000,10000,100000] [--max-difficulty 4]
+//                    [--users 100000] [--filter NAME] [--min-time 0.5]
+//                    [--json FILE] [--baseline FILE] [--threshold 10]
+#include "storage.h"
+#include "pow.h"
+#include "auth.h"
+#include "user_store.h"
+#include "log.h"
+#include "metrics.h"
+#include "client.h"
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_MAX_SAMPLES 200000
+#define BENCH_MAX_RESULTS 64
+#define BENCH_MAX_SIZES 8
+#define BENCH_DEFAULT_MIN_SECONDS 0.5
+#define BENCH_DEFAULT_THRESHOLD 10.0
+#define BENCH_DEFAULT_USERS 100000
+#define BENCH_DEFAULT_MAX_DIFFICULTY 4
+
+// one timed operation; returns 0 on failure
+typedef int (*bench_fn)(void *context, long iteration);
+// untimed clean-up after each operation (may be NULL)
+typedef void (*bench_after_fn)(void *context);
+
+typedef struct {
+    char name[64];
+    long iterations;
+    long items;                 // work items per operation, e.g. blocks
+    double ops_per_sec;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} bench_result_t;
+
+typedef struct {
+    long sizes[BENCH_MAX_SIZES];
+    int size_count;
+    int max_difficulty;
+    long users;
+    double min_seconds;
+    double threshold;
+    const char *filter;
+    char json_path[4096];
+    char baseline_path[4096];
+} bench_options_t;
+
+static bench_options_t options;
+static bench_result_t results[BENCH_MAX_RESULTS];
+static int result_count = 0;
+static uint64_t samples[BENCH_MAX_SAMPLES];
+
+static int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// function to print a duration with a readable unit
+static void format_duration(uint64_t ns, char *text, size_t size) {
+    if (ns < 10000) {
+        snprintf(text, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 10000000) {
+        snprintf(text, size, "%.1fus", (double)ns / 1e3);
+    } else if (ns < 10000000000ULL) {
+        snprintf(text, size, "%.1fms", (double)ns / 1e6);
+    } else {
+        snprintf(text, size, "%.2fs", (double)ns / 1e9);
+    }
+}
+
+// Run `fn` at least `min_iterations` times and for at least the minimum
+// time (at most `max_iterations`), timing every call. Returns 0 if an
+// operation failed; a benchmark excluded by --filter counts as passed.
+static int run_bench(const char *name, long items, bench_fn fn, bench_after_fn after,
+                     void *context, long min_iterations, long max_iterations) {
+    if (options.filter && !strstr(name, options.filter)) return 1;
+    if (result_count == BENCH_MAX_RESULTS) {
+        printf("Error: Too many benchmarks\n");
+        return 0;
+    }
+    if (max_iterations > BENCH_MAX_SAMPLES) max_iterations = BENCH_MAX_SAMPLES;
+
+    uint64_t min_ns = (uint64_t)(options.min_seconds * 1e9);
+    uint64_t busy = 0;
+    long count = 0;
+
+    while (count < max_iterations && (count < min_iterations || busy < min_ns)) {
+        uint64_t start = metrics_now_ns();
+        int ok = fn(context, count);
+        uint64_t elapsed = metrics_now_ns() - start;
+        if (after) after(context);
+        if (!ok) {
+            printf("Error: Benchmark %s failed\n", name);
+            return 0;
+        }
+        samples[count++] = elapsed;
+        busy += elapsed;
+    }
+
+    qsort(samples, (size_t)count, sizeof(uint64_t), compare_samples);
+
+    bench_result_t *result = &results[result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->iterations = count;
+    result->items = items;
+    result->ops_per_sec = busy > 0 ? (double)count * 1e9 / (double)busy : 0.0;
+    result->p50_ns = samples[(count - 1) * 50 / 100];
+    result->p90_ns = samples[(count - 1) * 90 / 100];
+    result->p99_ns = samples[(count - 1) * 99 / 100];
+    result->max_ns = samples[count - 1];
+
+    char p50[16], p90[16], p99[16];
+    format_duration(result->p50_ns, p50, sizeof(p50));
+    format_duration(result->p90_ns, p90, sizeof(p90));
+    format_duration(result->p99_ns, p99, sizeof(p99));
+    printf("%-30s %8ld %14.1f ops/s   p50 %-9s p90 %-9s p99 %s\n",
+           name, count, result->ops_per_sec, p50, p90, p99);
+    fflush(stdout);
+    return 1;
+}
+
+// --- benchmark bodies -----------------------------------------------------
+
+// the note stays in a static buffer until create_block copies it
+static void fill_transaction(medical_transaction_t *tx, long n) {
+    static char note[128];
+    char patient[32];
+    snprintf(patient, sizeof(patient), "P-%06ld", n % 5000);
+    snprintf(note, sizeof(note), "Follow-up visit %ld. Vital signs stable, advised to return if "
+             "symptoms worsen.", n);
+    memset(tx, 0, sizeof(medical_transaction_t));
+    create_transaction(tx, patient, "bench.doctor@alueducation.com", "Malaria",
+                       "Artemether-lumefantrine 80/480mg twice daily", note);
+}
+
+static int bench_sha256(void *context, long iteration) {
+    (void)iteration;
+    char hash[HASH_SIZE];
+    sha256_hash(context, hash);
+    return 1;
+}
+
+static int bench_block_hash(void *context, long iteration) {
+    block_t *block = context;
+    block->nonce = (unsigned long)iteration;
+    calculate_block_hash(block);
+    return 1;
+}
+
+typedef struct {
+    block_t block;
+    int difficulty;
+} mine_context_t;
+
+static int bench_mine(void *context, long iteration) {
+    mine_context_t *mine = context;
+    // a different block each time, so the nonce search varies like in use
+    mine->block.index = (int)iteration + 1;
+    return mine_block(&mine->block, mine->difficulty);
+}
+
+typedef struct {
+    blockchain_t *chain;
+    blockchain_t *loaded;
+    const char *file;
+} chain_context_t;
+
+// function to build a chain of `length` blocks without proof of work
+static blockchain_t *build_chain(long length) {
+    blockchain_t *chain = allocate_blockchain();
+    if (!chain) return NULL;
+
+    char previous[HASH_SIZE];
+    strcpy(previous, "0000000000000000000000000000000000000000000000000000000000000000");
+    for (long i = 0; i < length; i++) {
+        medical_transaction_t tx;
+        fill_transaction(&tx, i);
+        block_t *block = create_block((int)i, &tx, previous);
+        if (!block) {
+            free_blockchain(chain);
+            return NULL;
+        }
+        calculate_block_hash(block);
+        strcpy(previous, block->current_hash);
+        add_block_to_chain(chain, block);
+    }
+    return chain;
+}
+
+static int bench_save(void *context, long iteration) {
+    (void)iteration;
+    chain_context_t *ctx = context;
+    return save_blockchain(ctx->chain, ctx->file);
+}
+
+static int bench_load(void *context, long iteration) {
+    (void)iteration;
+    chain_context_t *ctx = context;
+    ctx->loaded = load_blockchain(ctx->file);
+    return ctx->loaded != NULL && ctx->loaded->length == ctx->chain->length;
+}
+
+static int bench_hash_file(void *context, long iteration) {
+    (void)iteration;
+    chain_context_t *ctx = context;
+    char hash[HASH_SIZE];
+    return calculate_file_hash(ctx->file, hash);
+}
+
+static void free_loaded(void *context) {
+    chain_context_t *ctx = context;
+    if (ctx->loaded) free_blockchain(ctx->loaded);
+    ctx->loaded = NULL;
+}
+
+static int bench_validate(void *context, long iteration) {
+    (void)iteration;
+    chain_context_t *ctx = context;
+    return validate_blockchain(ctx->chain);
+}
+
+// pseudo-random but repeatable user picks
+static long pick_user(long iteration) {
+    return (long)(((unsigned long)iteration * 2654435761UL) % (unsigned long)options.users);
+}
+
+static int bench_authenticate(void *context, long iteration) {
+    (void)context;
+    long n = pick_user(iteration);
+    char email[MAX_EMAIL_SIZE], password[32];
+    snprintf(email, sizeof(email), "user%07ld@alueducation.com", n);
+    snprintf(password, sizeof(password), "password-%ld", n);
+
+    user_t user;
+    return authenticate_user(email, password, &user);
+}
+
+static int bench_user_reload(void *context, long iteration) {
+    user_store_close();
+    return bench_authenticate(context, iteration);
+}
+
+static int bench_log(void *context, long iteration) {
+    (void)context;
+    (void)iteration;
+    log_operation(LOG_INFO, "bench.doctor@alueducation.com", "Viewed blockchain");
+    return 1;
+}
+
+// function to write a users.csv with `count` staff accounts
+static int write_users_file(long count) {
+    FILE *file = fopen(USERS_FILE, "w");
+    if (!file) {
+        printf("Error: Could not write '%s': %s\n", USERS_FILE, strerror(errno));
+        return 0;
+    }
+    for (long n = 0; n < count; n++) {
+        char password[32], hash[HASH_SIZE];
+        snprintf(password, sizeof(password), "password-%ld", n);
+        hash_password(password, hash);
+        fprintf(file, "user%07ld@alueducation.com,%s,STAFF\n", n, hash);
+    }
+    return fclose(file) == 0;
+}
+
+// --- suites ---------------------------------------------------------------
+
+static int run_hash_benchmarks(void) {
+    block_t block;
+    memset(&block, 0, sizeof(block));
+    fill_transaction(&block.transaction, 1);
+    get_timestamp(block.timestamp);
+    strcpy(block.previous_hash, "0000000000000000000000000000000000000000000000000000000000000000");
+
+    char input[2048];
+    transaction_to_string(&block.transaction, input);
+
+    int ok = run_bench("sha256_hash", 1, bench_sha256, NULL, input, 1000, BENCH_MAX_SAMPLES);
+    ok = ok && run_bench("calculate_block_hash", 1, bench_block_hash, NULL, &block, 1000,
+                         BENCH_MAX_SAMPLES);
+
+    mine_context_t mine;
+    mine.block = block;
+    for (int difficulty = 1; ok && difficulty <= options.max_difficulty; difficulty++) {
+        char name[64];
+        snprintf(name, sizeof(name), "mine_block/difficulty=%d", difficulty);
+        mine.difficulty = difficulty;
+        ok = run_bench(name, 1, bench_mine, NULL, &mine, difficulty < 4 ? 20 : 3, 10000);
+    }
+    return ok;
+}
+
+static int run_chain_benchmarks(void) {
+    int ok = 1;
+    for (int i = 0; ok && i < options.size_count; i++) {
+        long size = options.sizes[i];
+        char save_name[64], load_name[64], hash_name[64], validate_name[64];
+        snprintf(save_name, sizeof(save_name), "save_blockchain/%ld", size);
+        snprintf(load_name, sizeof(load_name), "load_blockchain/%ld", size);
+        snprintf(hash_name, sizeof(hash_name), "calculate_file_hash/%ld", size);
+        snprintf(validate_name, sizeof(validate_name), "validate_blockchain/%ld", size);
+        if (options.filter && !strstr(save_name, options.filter) &&
+            !strstr(load_name, options.filter) && !strstr(hash_name, options.filter) &&
+            !strstr(validate_name, options.filter)) {
+            continue;
+        }
+
+        chain_context_t ctx = {build_chain(size), NULL, "data/blockchain.dat"};
+        if (!ctx.chain) {
+            printf("Error: Could not build a chain of %ld blocks\n", size);
+            return 0;
+        }
+
+        ok = run_bench(save_name, size, bench_save, NULL, &ctx, 3, 1000);
+        // load needs the file even when save was filtered out
+        if (ok && !save_blockchain(ctx.chain, ctx.file)) ok = 0;
+        ok = ok && run_bench(load_name, size, bench_load, free_loaded, &ctx, 3, 1000);
+        ok = ok && run_bench(hash_name, size, bench_hash_file, NULL, &ctx, 3, 1000);
+        ok = ok && run_bench(validate_name, size, bench_validate, NULL, &ctx, 3, 1000);
+
+        free_blockchain(ctx.chain);
+        remove(ctx.file);
+    }
+    return ok;
+}
+
+static int run_user_benchmarks(void) {
+    char auth_name[64], reload_name[64];
+    snprintf(auth_name, sizeof(auth_name), "authenticate_user/%ld", options.users);
+    snprintf(reload_name, sizeof(reload_name), "user_store_reload/%ld", options.users);
+    if (options.filter && !strstr(auth_name, options.filter) && !strstr(reload_name, options.filter)) {
+        return 1;
+    }
+
+    if (!write_users_file(options.users)) return 0;
+    int ok = run_bench(reload_name, 1, bench_user_reload, NULL, NULL, 3, 1000);
+    ok = ok && run_bench(auth_name, 1, bench_authenticate, NULL, NULL, 1000, BENCH_MAX_SAMPLES);
+    user_store_close();
+    return ok;
+}
+
+static int run_log_benchmarks(void) {
+    if (options.filter && !strstr("log_operation", options.filter)) return 1;
+
+    init_logging();
+    int ok = run_bench("log_operation", 1, bench_log, NULL, NULL, 1000, BENCH_MAX_SAMPLES);
+    shutdown_logging();
+    if (log_dropped_events() > 0) {
+        printf("  (%lu log records dropped: the writer could not keep up)\n", log_dropped_events());
+    }
+    return ok;
+}
+
+// --- results --------------------------------------------------------------
+
+static int write_results(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("Error: Could not write '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    // one benchmark per line, so the baseline reader can go line by line
+    fprintf(file, "{\"benchmarks\":[\n");
+    for (int i = 0; i < result_count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(file, "{\"name\":\"%s\",\"iterations\":%ld,\"ops_per_sec\":%.3f,"
+                "\"items_per_sec\":%.3f,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,"
+                "\"max_ns\":%llu}%s\n",
+                r->name, r->iterations, r->ops_per_sec, r->ops_per_sec * (double)r->items,
+                (unsigned long long)r->p50_ns, (unsigned long long)r->p90_ns,
+                (unsigned long long)r->p99_ns, (unsigned long long)r->max_ns,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+}
+
+// Compare throughput with a baseline written by --json. Returns the number
+// of regressions above the threshold, or -1 if the baseline is unreadable.
+static int compare_baseline(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Error: Could not open baseline '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    printf("\nCompared with %s (threshold %.1f%%):\n", path, options.threshold);
+    int compared = 0, regressions = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        char name[64], value[64];
+        if (!client_json_field(line, "name", name, sizeof(name)) ||
+            !client_json_field(line, "ops_per_sec", value, sizeof(value))) {
+            continue;
+        }
+        double before = strtod(value, NULL);
+
+        for (int i = 0; i < result_count; i++) {
+            if (strcmp(results[i].name, name) != 0 || before <= 0) continue;
+
+            double change = (results[i].ops_per_sec - before) / before * 100.0;
+            int regressed = -change > options.threshold;
+            printf("  %-30s %14.1f -> %14.1f ops/s  %+7.1f%%%s\n", name, before,
+                   results[i].ops_per_sec, change, regressed ? "  REGRESSION" : "");
+            compared++;
+            regressions += regressed;
+        }
+    }
+    fclose(file);
+
+    printf("%d benchmarks compared, %d regressed by more than %.1f%%\n",
+           compared, regressions, options.threshold);
+    return regressions;
+}
+
+// --- setup ----------------------------------------------------------------
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static int parse_sizes(const char *text) {
+    options.size_count = 0;
+    const char *p = text;
+    while (*p) {
+        char *end;
+        long size = strtol(p, &end, 10);
+        if (end == p || size <= 0 || size > INT32_MAX || options.size_count == BENCH_MAX_SIZES) {
+            return 0;
+        }
+        options.sizes[options.size_count++] = size;
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return 0;
+    }
+    return options.size_count > 0;
+}
+
+static void print_usage(void) {
+    printf("Usage: blockmed-bench [--sizes N,N,...] [--max-difficulty 1-8] [--users N]\n"
+           "                      [--filter NAME] [--min-time SECONDS] [--json FILE]\n"
+           "                      [--baseline FILE] [--threshold PERCENT]\n");
+}
+
+// function to read the command line into `options`
+static int parse_options(int argc, char *argv[]) {
+    options.sizes[0] = 1000;
+    options.sizes[1] = 10000;
+    options.sizes[2] = 100000;
+    options.size_count = 3;
+    options.max_difficulty = BENCH_DEFAULT_MAX_DIFFICULTY;
+    options.users = BENCH_DEFAULT_USERS;
+    options.min_seconds = BENCH_DEFAULT_MIN_SECONDS;
+    options.threshold = BENCH_DEFAULT_THRESHOLD;
+
+    for (int i = 1; i < argc; i++) {
+        const char *name = argv[i];
+        const char *value = i + 1 < argc ? argv[++i] : NULL;
+        char *end = NULL;
+        if (!value) {
+            printf("Error: Unknown option or missing value: %s\n", name);
+            return 0;
+        }
+
+        if (strcmp(name, "--sizes") == 0) {
+            if (!parse_sizes(value)) end = (char *)value;
+        } else if (strcmp(name, "--max-difficulty") == 0) {
+            options.max_difficulty = (int)strtol(value, &end, 10);
+            if (options.max_difficulty < 1 || options.max_difficulty > 8) end = (char *)value;
+        } else if (strcmp(name, "--users") == 0) {
+            options.users = strtol(value, &end, 10);
+            if (options.users < 1) end = (char *)value;
+        } else if (strcmp(name, "--min-time") == 0) {
+            options.min_seconds = strtod(value, &end);
+            if (options.min_seconds < 0) end = (char *)value;
+        } else if (strcmp(name, "--threshold") == 0) {
+            options.threshold = strtod(value, &end);
+            if (options.threshold < 0) end = (char *)value;
+        } else if (strcmp(name, "--filter") == 0) {
+            options.filter = value;
+        } else if (strcmp(name, "--json") == 0) {
+            // resolved now: the benchmarks run in a scratch directory
+            if (!client_absolute_path(value, options.json_path, sizeof(options.json_path))) {
+                end = (char *)value;
+            }
+        } else if (strcmp(name, "--baseline") == 0) {
+            if (!client_absolute_path(value, options.baseline_path, sizeof(options.baseline_path))) {
+                end = (char *)value;
+            }
+        } else {
+            printf("Error: Unknown option %s\n", name);
+            return 0;
+        }
+
+        if (end && *end != '\0') {
+            printf("Error: Invalid value for %s: %s\n", name, value);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (!parse_options(argc, argv)) {
+        print_usage();
+        return 2;
+    }
+    set_quiet_mode(1);
+
+    // chain files, users.csv and the audit log go to a scratch directory
+    char cwd[4096];
+    char scratch[] = "/tmp/blockmed-bench-XXXXXX";
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(scratch) || chdir(scratch) != 0 ||
+        mkdir("data", 0700) != 0) {
+        printf("Error: Could not set up a scratch directory: %s\n", strerror(errno));
+        return 1;
+    }
+
+    printf("%-30s %8s %20s\n", "benchmark", "runs", "throughput");
+    int ok = run_hash_benchmarks() && run_chain_benchmarks() && run_user_benchmarks() &&
+             run_log_benchmarks();
+
+    if (chdir(cwd) != 0 || nftw(scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+        printf("Warning: Could not remove '%s'\n", scratch);
+    }
+    if (!ok) return 1;
+
+    if (options.json_path[0] && write_results(options.json_path)) {
+        printf("\nResults written to %s\n", options.json_path);
+    }
+
+    if (options.baseline_path[0]) {
+        int regressions = compare_baseline(options.baseline_path);
+        if (regressions != 0) return 1;
+    }
+    return 0;
+}
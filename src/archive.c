@@ -0,0 +1,357 @@
+#define _POSIX_C_SOURCE 200809L
+#include "archive.h"
+#include "storage.h"
+#include "cipher.h"
+#include "epoch.h"
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// segments a thread keeps faulted in: a walk holds at most a block and its
+// successor, which may sit in the next segment
+#define CACHE_SLOTS 2
+
+// what stays in memory of a sealed segment
+typedef struct {
+    char hashes[ARCHIVE_SEGMENT_BLOCKS][HASH_SIZE];
+} archive_segment_t;
+
+// sealed segments by number. The writer replaces a full directory with a
+// bigger copy and retires the old one (epoch.h).
+typedef struct {
+    long capacity;
+    archive_segment_t *segments[];
+} segment_directory_t;
+
+struct archive {
+    unsigned long id;                   // tells cached segments of archives apart
+    _Atomic(segment_directory_t *) directory;
+    long sealed;                        // writer only
+    int failed;                         // writer only: sealing gave up
+};
+
+// a segment faulted in by this thread
+typedef struct {
+    unsigned long archive_id;
+    long segment;
+    block_t *blocks;
+    char *records;                      // the records the blocks point into
+} cache_slot_t;
+
+static char archive_directory[4096] = ARCHIVE_DIR;
+static int resident_blocks = 0;
+static atomic_ulong next_archive_id = 1;
+
+static __thread cache_slot_t cache[CACHE_SLOTS];
+static __thread int cache_victim = 0;  // the slot used least recently
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+// function to free a thread's cached segments when the thread exits
+static void free_cache(void *value) {
+    cache_slot_t *slots = value;
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        free(slots[i].blocks);
+        free(slots[i].records);
+        slots[i].blocks = NULL;
+        slots[i].records = NULL;
+    }
+}
+
+static void create_cache_key(void) {
+    pthread_key_create(&cache_key, free_cache);
+}
+
+// Turn tiering on for chains allocated from now on: keep about `resident`
+// blocks in memory and archive older ones under `directory` (0 turns it off)
+void archive_configure(const char *directory, int resident) {
+    snprintf(archive_directory, sizeof(archive_directory), "%s",
+             directory ? directory : ARCHIVE_DIR);
+    resident_blocks = resident > 0 ? resident : 0;
+}
+
+int archive_resident_blocks(void) {
+    return resident_blocks;
+}
+
+// Create the archive of a new chain, NULL while tiering is off
+archive_t *archive_create(void) {
+    if (resident_blocks == 0) return NULL;
+
+    archive_t *archive = malloc(sizeof(archive_t));
+    if (!archive) return NULL;
+
+    archive->id = atomic_fetch_add(&next_archive_id, 1);
+    atomic_init(&archive->directory, NULL);
+    archive->sealed = 0;
+    archive->failed = 0;
+    return archive;
+}
+
+// Free the resident part of an archive; the segment files stay
+void archive_free(archive_t *archive) {
+    if (!archive) return;
+
+    segment_directory_t *directory = atomic_load(&archive->directory);
+    if (directory) {
+        for (long i = 0; i < directory->capacity; i++) {
+            free(directory->segments[i]);
+        }
+        free(directory);
+    }
+    free(archive);
+}
+
+// archive_free as an epoch release callback
+void archive_release(void *ptr) {
+    archive_free(ptr);
+}
+
+static int segment_path(long segment, char *path, size_t size) {
+    return snprintf(path, size, "%s/blocks-%08ld.z", archive_directory, segment) < (int)size;
+}
+
+// function to check whether a segment file sealed earlier (before a
+// restart, say) already holds these blocks, encrypted if a key is loaded
+static int segment_file_matches(const char *path, long first, const char *last_hash) {
+    if (cipher_file_encrypted(path) != cipher_enabled()) return 0;
+    FILE *file = cipher_fopen(path, "rb");
+    if (!file) return 0;
+
+    archive_header_t header;
+    long size;
+    int matches = fread(&header, sizeof(header), 1, file) == 1 &&
+                  cipher_file_size(file, &size) &&
+                  memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) == 0 &&
+                  header.first == first && header.count == ARCHIVE_SEGMENT_BLOCKS &&
+                  header.record_size == (int32_t)BLOCK_RECORD_SIZE &&
+                  (uint64_t)size == sizeof(header) + header.compressed_size &&
+                  strncmp(header.last_hash, last_hash, HASH_SIZE) == 0;
+    fclose(file);
+    return matches;
+}
+
+// function to compress a segment's block records into a new segment file,
+// written to a temporary file and renamed into place
+static int write_segment(const char *path, const block_t *first, const char *last_hash) {
+    char *raw = NULL;
+    size_t raw_size = 0;
+    FILE *records = open_memstream(&raw, &raw_size);
+    if (!records) return 0;
+
+    int count = 0;
+    for (const block_t *block = first; block && count < ARCHIVE_SEGMENT_BLOCKS;
+         block = block->next) {
+        if (!write_block_record(records, block)) break;
+        count++;
+    }
+    if (fclose(records) != 0 || count != ARCHIVE_SEGMENT_BLOCKS) {
+        free(raw);
+        return 0;
+    }
+
+    uLongf compressed_size = compressBound(raw_size);
+    unsigned char *compressed = malloc(compressed_size);
+    int ok = compressed && compress2(compressed, &compressed_size, (const Bytef *)raw,
+                                     raw_size, Z_DEFAULT_COMPRESSION) == Z_OK;
+    free(raw);
+
+    archive_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.first = first->index;
+    header.count = ARCHIVE_SEGMENT_BLOCKS;
+    header.record_size = (int32_t)BLOCK_RECORD_SIZE;
+    header.compressed_size = compressed_size;
+    strncpy(header.last_hash, last_hash, HASH_SIZE - 1);
+
+    char temp[4100];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *file = ok ? cipher_fopen(temp, "wb") : NULL;
+    ok = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(compressed, compressed_size, 1, file) == 1 && cipher_sync(file, temp);
+    if (file && fclose(file) != 0) ok = 0;
+    free(compressed);
+
+    if (!ok || rename(temp, path) != 0) {
+        unlink(temp);
+        return 0;
+    }
+    return 1;
+}
+
+// function to record a sealed segment's hashes, growing the directory
+static int store_segment(archive_t *archive, long segment, archive_segment_t *resident) {
+    segment_directory_t *directory = atomic_load(&archive->directory);
+
+    if (!directory || segment >= directory->capacity) {
+        long capacity = directory ? directory->capacity * 2 : 16;
+        while (capacity <= segment) capacity *= 2;
+
+        segment_directory_t *grown = calloc(1, sizeof(segment_directory_t) +
+                                               (size_t)capacity * sizeof(archive_segment_t *));
+        if (!grown) return 0;
+        grown->capacity = capacity;
+        if (directory) {
+            memcpy(grown->segments, directory->segments,
+                   (size_t)directory->capacity * sizeof(archive_segment_t *));
+        }
+        atomic_store(&archive->directory, grown);
+        epoch_retire(directory, free);
+        directory = grown;
+    }
+
+    directory->segments[segment] = resident;
+    return 1;
+}
+
+// Seal the ARCHIVE_SEGMENT_BLOCKS blocks starting at `first`, the oldest
+// block still in memory, into the next segment. Only the writer thread
+// calls this; it unlinks the blocks once this succeeds. After a failure
+// (disk full, say) the archive stops sealing and the blocks stay resident.
+int archive_seal(archive_t *archive, const block_t *first) {
+    if (!archive || archive->failed || !first) return 0;
+
+    long segment = archive->sealed;
+    archive_segment_t *resident = malloc(sizeof(archive_segment_t));
+    if (!resident || first->index != segment * ARCHIVE_SEGMENT_BLOCKS) {
+        free(resident);
+        return 0;
+    }
+
+    uint64_t span = trace_begin();
+    const block_t *block = first;
+    int count = 0;
+    for (; block && count < ARCHIVE_SEGMENT_BLOCKS; block = block->next) {
+        memcpy(resident->hashes[count++], block->current_hash, HASH_SIZE);
+    }
+    const char *last_hash = resident->hashes[ARCHIVE_SEGMENT_BLOCKS - 1];
+
+    char path[4200];
+    int ok = count == ARCHIVE_SEGMENT_BLOCKS && segment_path(segment, path, sizeof(path)) &&
+             (mkdir(archive_directory, 0700) == 0 || errno == EEXIST);
+    ok = ok && (segment_file_matches(path, first->index, last_hash) ||
+                write_segment(path, first, last_hash));
+    ok = ok && store_segment(archive, segment, resident);
+    trace_end("archive_seal", span);
+
+    if (!ok) {
+        printf("Error: Could not archive blocks %ld-%ld to '%s' - keeping them in memory\n",
+               segment * ARCHIVE_SEGMENT_BLOCKS, (segment + 1) * ARCHIVE_SEGMENT_BLOCKS - 1,
+               archive_directory);
+        free(resident);
+        archive->failed = 1;
+        return 0;
+    }
+
+    archive->sealed++;
+    return 1;
+}
+
+// function to decompress a segment's records into `records` and decode
+// them into `blocks`, checking every block against the hashes kept in
+// memory
+static int read_segment(long segment, const archive_segment_t *resident, block_t *blocks,
+                        char *records) {
+    char path[4200];
+    if (!segment_path(segment, path, sizeof(path))) return 0;
+
+    FILE *file = cipher_fopen(path, "rb");
+    archive_header_t header;
+    size_t raw_size = (size_t)ARCHIVE_SEGMENT_BLOCKS * BLOCK_RECORD_SIZE;
+    int ok = file && fread(&header, sizeof(header), 1, file) == 1 &&
+             memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) == 0 &&
+             header.first == segment * ARCHIVE_SEGMENT_BLOCKS &&
+             header.count == ARCHIVE_SEGMENT_BLOCKS &&
+             header.record_size == (int32_t)BLOCK_RECORD_SIZE &&
+             header.compressed_size <= compressBound(raw_size);
+
+    unsigned char *compressed = ok ? malloc(header.compressed_size) : NULL;
+    uLongf inflated = raw_size;
+    ok = compressed && fread(compressed, header.compressed_size, 1, file) == 1 &&
+         uncompress((Bytef *)records, &inflated, compressed, header.compressed_size) == Z_OK &&
+         inflated == raw_size;
+    if (file) fclose(file);
+    free(compressed);
+
+    for (int i = 0; ok && i < ARCHIVE_SEGMENT_BLOCKS; i++) {
+        decode_block_record(records + (size_t)i * BLOCK_RECORD_SIZE, &blocks[i]);
+        ok = blocks[i].index == header.first + i &&
+             strncmp(blocks[i].current_hash, resident->hashes[i], HASH_SIZE) == 0;
+    }
+
+    if (!ok) {
+        printf("Error: Archive segment '%s' is missing or does not match the chain\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Block `index` of an archive, faulted in when this thread does not have
+// its segment cached. The block stays valid until the thread has faulted
+// in two other segments. NULL if the segment cannot be read.
+const block_t *archive_block(const archive_t *archive, long index) {
+    if (!archive || index < 0) return NULL;
+
+    long segment = index / ARCHIVE_SEGMENT_BLOCKS;
+    int offset = (int)(index % ARCHIVE_SEGMENT_BLOCKS);
+    const segment_directory_t *directory = atomic_load(&((archive_t *)archive)->directory);
+    if (!directory || segment >= directory->capacity || !directory->segments[segment]) {
+        return NULL;
+    }
+
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        if (cache[i].blocks && cache[i].archive_id == archive->id && cache[i].segment == segment) {
+            cache_victim = (i + 1) % CACHE_SLOTS;
+            return &cache[i].blocks[offset];
+        }
+    }
+
+    // replace the segment used least recently, never the one holding the
+    // block a walk is on
+    cache_slot_t *slot = &cache[cache_victim];
+    cache_victim = (cache_victim + 1) % CACHE_SLOTS;
+    if (!slot->blocks) {
+        slot->blocks = malloc(ARCHIVE_SEGMENT_BLOCKS * sizeof(block_t));
+        slot->records = malloc((size_t)ARCHIVE_SEGMENT_BLOCKS * BLOCK_RECORD_SIZE);
+        if (!slot->blocks || !slot->records) {
+            free(slot->blocks);
+            free(slot->records);
+            slot->blocks = NULL;
+            slot->records = NULL;
+            return NULL;
+        }
+        pthread_once(&cache_key_once, create_cache_key);
+        pthread_setspecific(cache_key, cache);
+    }
+
+    uint64_t span = trace_begin();
+    slot->segment = -1;
+    if (!read_segment(segment, directory->segments[segment], slot->blocks, slot->records)) {
+        return NULL;
+    }
+    slot->archive_id = archive->id;
+    slot->segment = segment;
+    trace_end("archive.fault", span);
+    return &slot->blocks[offset];
+}
+
+// Index of a block returned by archive_block on this thread, -1 for any
+// other block
+long archive_cached_index(const block_t *block) {
+    uintptr_t address = (uintptr_t)block;
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        uintptr_t start = (uintptr_t)cache[i].blocks;
+        if (cache[i].blocks && cache[i].segment >= 0 && address >= start &&
+            address < start + ARCHIVE_SEGMENT_BLOCKS * sizeof(block_t)) {
+            return cache[i].segment * ARCHIVE_SEGMENT_BLOCKS +
+                   (long)((address - start) / sizeof(block_t));
+        }
+    }
+    return -1;
+}
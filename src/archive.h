@@ -0,0 +1,39 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "blockchain.h"
+#include <stdint.h>
+
+// Cold tier of a chain. Once more than the resident horizon of blocks are
+// in memory, the oldest ARCHIVE_SEGMENT_BLOCKS are sealed into a compressed
+// segment file (data/archive/blocks-NNNNNNNN.z, numbered from the start of
+// the chain) and unlinked from the in-memory list. Their hashes stay
+// resident; a reader that reaches an archived block gets it faulted back in
+// from the segment into a small per-thread cache.
+#define ARCHIVE_DIR "data/archive"
+#define ARCHIVE_SEGMENT_BLOCKS 256
+#define ARCHIVE_MAGIC "BMARC01"
+
+// header at the start of every segment file, followed by the zlib stream
+// of its block records (storage.c format)
+typedef struct {
+    char magic[8];
+    int64_t first;                      // index of the first block
+    int32_t count;
+    int32_t record_size;                // BLOCK_RECORD_SIZE of the writer
+    uint64_t compressed_size;
+    char last_hash[HASH_SIZE];          // hash of the last block
+    char reserved[7];
+} archive_header_t;
+
+// Function prototypes
+void archive_configure(const char *directory, int resident_blocks);
+int archive_resident_blocks(void);
+archive_t *archive_create(void);
+void archive_free(archive_t *archive);
+void archive_release(void *ptr);
+int archive_seal(archive_t *archive, const block_t *first);
+const block_t *archive_block(const archive_t *archive, long index);
+long archive_cached_index(const block_t *block);
+
+#endif
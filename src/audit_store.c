@@ -0,0 +1,563 @@
+#define _POSIX_C_SOURCE 200809L
+#include "audit_store.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define AUDIT_INDEX_MAGIC "BMAIDX1"
+#define AUDIT_RECORD_HEADER 12          // int64 time, uint8 level, uint8 user, uint16 op
+#define AUDIT_MAX_RECORD (AUDIT_RECORD_HEADER + MAX_EMAIL_SIZE + LOG_MAX_OPERATION)
+
+static int read_entry(FILE *file, audit_entry_t *entry);
+static int index_record(audit_writer_t *writer, const audit_entry_t *entry, uint32_t offset);
+
+static void segment_path(unsigned int segment, const char *ext, char *path, size_t size) {
+    snprintf(path, size, "%s/audit-%06u.%s", AUDIT_DIR, segment, ext);
+}
+
+// function to list existing segment numbers in ascending order
+static int list_segments(unsigned int **segments) {
+    *segments = NULL;
+    DIR *dir = opendir(AUDIT_DIR);
+    if (!dir) return 0;
+
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        unsigned int number;
+        char ext[8];
+        if (sscanf(entry->d_name, "audit-%u.%7s", &number, ext) != 2 || strcmp(ext, "log") != 0) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            unsigned int *grown = realloc(*segments, capacity * sizeof(unsigned int));
+            if (!grown) break;
+            *segments = grown;
+        }
+        (*segments)[count++] = number;
+    }
+    closedir(dir);
+
+    // insertion sort, segment lists are short and mostly ordered
+    for (int i = 1; i < count; i++) {
+        unsigned int value = (*segments)[i];
+        int j = i - 1;
+        while (j >= 0 && (*segments)[j] > value) {
+            (*segments)[j + 1] = (*segments)[j];
+            j--;
+        }
+        (*segments)[j + 1] = value;
+    }
+    return count;
+}
+
+// function to reset the per-segment index kept while writing
+static void reset_segment_index(audit_writer_t *writer) {
+    for (uint32_t i = 0; i < writer->users.count; i++) {
+        free(writer->user_offsets[i].offsets);
+    }
+    free(writer->user_offsets);
+    free(writer->time_marks);
+    if (writer->users.slots) {
+        strdict_free(&writer->users);
+    }
+
+    writer->user_offsets = NULL;
+    writer->user_capacity = 0;
+    writer->time_marks = NULL;
+    writer->time_mark_count = 0;
+    writer->time_mark_capacity = 0;
+    writer->records = 0;
+    writer->min_time = 0;
+    writer->max_time = 0;
+}
+
+// function to start a new, empty segment. The file is created exclusively
+// and locked, so concurrent processes never share a segment.
+static int open_segment(audit_writer_t *writer, unsigned int segment) {
+    char path[256];
+    int fd = -1;
+
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        segment_path(segment, "log", path, sizeof(path));
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0600);
+        if (fd >= 0 || errno != EEXIST) break;
+        segment++;
+    }
+
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0 || !(writer->file = fdopen(fd, "ab"))) {
+        fprintf(stderr, "Error opening audit segment '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    writer->segment = segment;
+    writer->size = 0;
+    writer->opened_at = time(NULL);
+    return strdict_init(&writer->users);
+}
+
+// function to reopen the newest segment if it was sealed cleanly and is
+// still small and young, so short-lived processes (batch commands) do not
+// leave one tiny segment each. Its index is rebuilt by scanning it.
+static int resume_segment(audit_writer_t *writer, unsigned int segment) {
+    char path[256], index_path[256];
+    segment_path(segment, "log", path, sizeof(path));
+    segment_path(segment, "idx", index_path, sizeof(index_path));
+
+    struct stat st;
+    if (stat(path, &st) != 0 || st.st_size == 0 || st.st_size >= AUDIT_REUSE_MAX_BYTES ||
+        access(index_path, F_OK) != 0) {
+        return 0;
+    }
+
+    // a segment still locked belongs to a running process
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd < 0) return 0;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file || !strdict_init(&writer->users)) {
+        if (file) fclose(file);
+        close(fd);
+        return 0;
+    }
+
+    audit_entry_t entry;
+    long offset = 0;
+    int status;
+    while ((status = read_entry(file, &entry)) == 1) {
+        if (!index_record(writer, &entry, (uint32_t)offset)) {
+            status = -1;
+            break;
+        }
+        offset = ftell(file);
+    }
+    fclose(file);
+
+    if (status != 0 || offset != (long)st.st_size ||
+        time(NULL) - (time_t)writer->min_time >= AUDIT_MAX_SEGMENT_AGE ||
+        !(writer->file = fdopen(fd, "ab"))) {
+        reset_segment_index(writer);
+        close(fd);
+        return 0;
+    }
+
+    // the index no longer covers the segment, it is rewritten on sealing
+    remove(index_path);
+
+    writer->segment = segment;
+    writer->size = offset;
+    writer->opened_at = (time_t)writer->min_time;
+    return 1;
+}
+
+// function to write the index of the active segment (temp file + rename)
+static int write_segment_index(const audit_writer_t *writer) {
+    char path[256], tmp_path[260];
+    segment_path(writer->segment, "idx", path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) return 0;
+
+    fwrite(AUDIT_INDEX_MAGIC, 1, 8, file);
+    fwrite(&writer->records, sizeof(uint32_t), 1, file);
+    fwrite(&writer->min_time, sizeof(int64_t), 1, file);
+    fwrite(&writer->max_time, sizeof(int64_t), 1, file);
+    fwrite(&writer->time_mark_count, sizeof(uint32_t), 1, file);
+    fwrite(writer->time_marks, sizeof(audit_time_mark_t), writer->time_mark_count, file);
+
+    fwrite(&writer->users.count, sizeof(uint32_t), 1, file);
+    for (uint32_t id = 0; id < writer->users.count; id++) {
+        const audit_user_offsets_t *user = &writer->user_offsets[id];
+        uint16_t length = (uint16_t)writer->users.entries[id].length;
+
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(writer->users.entries[id].str, 1, length, file);
+        fwrite(&user->first_time, sizeof(int64_t), 1, file);
+        fwrite(&user->last_time, sizeof(int64_t), 1, file);
+        fwrite(&user->count, sizeof(uint32_t), 1, file);
+        fwrite(user->offsets, sizeof(uint32_t), user->count, file);
+    }
+
+    int ok = !ferror(file);
+    if (fclose(file) != 0) ok = 0;
+    if (ok && rename(tmp_path, path) != 0) ok = 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+// function to seal the active segment: flush, fsync, write its index
+static void seal_segment(audit_writer_t *writer) {
+    if (!writer->file) return;
+
+    fflush(writer->file);
+    fsync(fileno(writer->file));
+    fclose(writer->file);
+    writer->file = NULL;
+
+    if (writer->records > 0) {
+        write_segment_index(writer);
+    } else {
+        // nothing was logged, do not leave empty segments behind
+        char path[256];
+        segment_path(writer->segment, "log", path, sizeof(path));
+        remove(path);
+    }
+    reset_segment_index(writer);
+}
+
+// Open the audit log, continuing the newest segment when it can be reused
+// and starting a new one after it otherwise
+int audit_writer_open(audit_writer_t *writer) {
+    if (!writer) return 0;
+    memset(writer, 0, sizeof(audit_writer_t));
+
+    if (mkdir(AUDIT_DIR, 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error creating '%s': %s\n", AUDIT_DIR, strerror(errno));
+        return 0;
+    }
+
+    unsigned int *segments;
+    int count = list_segments(&segments);
+    unsigned int newest = count > 0 ? segments[count - 1] : 0;
+    free(segments);
+
+    if (newest > 0 && resume_segment(writer, newest)) {
+        return 1;
+    }
+    return open_segment(writer, newest + 1);
+}
+
+// function to remember where a record of `user` was written
+static int index_record(audit_writer_t *writer, const audit_entry_t *entry, uint32_t offset) {
+    uint32_t id;
+    int added = strdict_intern(&writer->users, entry->user, strlen(entry->user), &id);
+    if (added < 0) return 0;
+
+    if (added) {
+        if (id >= writer->user_capacity) {
+            uint32_t capacity = writer->user_capacity ? writer->user_capacity * 2 : 32;
+            audit_user_offsets_t *grown = realloc(writer->user_offsets,
+                                                  capacity * sizeof(audit_user_offsets_t));
+            if (!grown) return 0;
+            writer->user_offsets = grown;
+            writer->user_capacity = capacity;
+        }
+        memset(&writer->user_offsets[id], 0, sizeof(audit_user_offsets_t));
+        writer->user_offsets[id].first_time = entry->time;
+    }
+
+    audit_user_offsets_t *user = &writer->user_offsets[id];
+    if (user->count == user->capacity) {
+        uint32_t capacity = user->capacity ? user->capacity * 2 : 16;
+        uint32_t *grown = realloc(user->offsets, capacity * sizeof(uint32_t));
+        if (!grown) return 0;
+        user->offsets = grown;
+        user->capacity = capacity;
+    }
+    user->offsets[user->count++] = offset;
+    user->last_time = entry->time;
+
+    if (writer->records % AUDIT_TIME_INDEX_STRIDE == 0) {
+        if (writer->time_mark_count == writer->time_mark_capacity) {
+            uint32_t capacity = writer->time_mark_capacity ? writer->time_mark_capacity * 2 : 64;
+            audit_time_mark_t *grown = realloc(writer->time_marks, capacity * sizeof(audit_time_mark_t));
+            if (!grown) return 0;
+            writer->time_marks = grown;
+            writer->time_mark_capacity = capacity;
+        }
+        writer->time_marks[writer->time_mark_count].time = entry->time;
+        writer->time_marks[writer->time_mark_count].offset = offset;
+        writer->time_mark_count++;
+    }
+
+    if (writer->records == 0 || entry->time < writer->min_time) writer->min_time = entry->time;
+    if (writer->records == 0 || entry->time > writer->max_time) writer->max_time = entry->time;
+    writer->records++;
+    return 1;
+}
+
+// Append one record as [uint32 length][int64 time][uint8 level][uint8 user
+// length][uint16 operation length][user][operation], rotating first when the
+// segment is too large or too old.
+int audit_writer_append(audit_writer_t *writer, const audit_entry_t *entry) {
+    if (!writer || !entry) return 0;
+
+    if (writer->file && writer->records > 0 &&
+        (writer->size >= AUDIT_MAX_SEGMENT_BYTES ||
+         time(NULL) - writer->opened_at >= AUDIT_MAX_SEGMENT_AGE)) {
+        unsigned int next = writer->segment + 1;
+        seal_segment(writer);
+        if (!open_segment(writer, next)) return 0;
+    }
+    if (!writer->file) return 0;
+
+    size_t user_length = strlen(entry->user);
+    size_t operation_length = strlen(entry->operation);
+    unsigned char record[AUDIT_MAX_RECORD + 4];
+    uint32_t payload = (uint32_t)(AUDIT_RECORD_HEADER + user_length + operation_length);
+    int64_t timestamp = entry->time;
+    uint8_t level = (uint8_t)entry->level;
+    uint8_t stored_user_length = (uint8_t)user_length;
+    uint16_t stored_operation_length = (uint16_t)operation_length;
+
+    unsigned char *p = record;
+    memcpy(p, &payload, 4); p += 4;
+    memcpy(p, &timestamp, 8); p += 8;
+    *p++ = level;
+    *p++ = stored_user_length;
+    memcpy(p, &stored_operation_length, 2); p += 2;
+    memcpy(p, entry->user, user_length); p += user_length;
+    memcpy(p, entry->operation, operation_length); p += operation_length;
+
+    uint32_t offset = (uint32_t)writer->size;
+    size_t length = (size_t)(p - record);
+    if (fwrite(record, 1, length, writer->file) != length) return 0;
+    writer->size += (long)length;
+
+    return index_record(writer, entry, offset);
+}
+
+// Flush the active segment, optionally forcing it to disk
+int audit_writer_flush(audit_writer_t *writer, int sync) {
+    if (!writer || !writer->file) return 0;
+
+    if (fflush(writer->file) != 0) return 0;
+    if (sync && fsync(fileno(writer->file)) != 0) return 0;
+    return 1;
+}
+
+// Seal the active segment and release the writer
+void audit_writer_close(audit_writer_t *writer) {
+    if (!writer) return;
+    seal_segment(writer);
+}
+
+// function to read the record at the current position. Returns 1 on
+// success, 0 at end of file and -1 for a corrupt record.
+static int read_entry(FILE *file, audit_entry_t *entry) {
+    uint32_t payload;
+    if (fread(&payload, sizeof(payload), 1, file) != 1) return 0;
+    if (payload < AUDIT_RECORD_HEADER || payload > AUDIT_MAX_RECORD) return -1;
+
+    unsigned char record[AUDIT_MAX_RECORD];
+    if (fread(record, 1, payload, file) != payload) return -1;
+
+    int64_t timestamp;
+    uint16_t operation_length;
+    memcpy(&timestamp, record, 8);
+    uint8_t level = record[8];
+    uint8_t user_length = record[9];
+    memcpy(&operation_length, record + 10, 2);
+
+    if (AUDIT_RECORD_HEADER + (uint32_t)user_length + operation_length != payload ||
+        user_length >= MAX_EMAIL_SIZE || operation_length >= LOG_MAX_OPERATION ||
+        level > LOG_SECURITY) {
+        return -1;
+    }
+
+    entry->time = (time_t)timestamp;
+    entry->level = (log_level_t)level;
+    memcpy(entry->user, record + AUDIT_RECORD_HEADER, user_length);
+    entry->user[user_length] = '\0';
+    memcpy(entry->operation, record + AUDIT_RECORD_HEADER + user_length, operation_length);
+    entry->operation[operation_length] = '\0';
+    return 1;
+}
+
+static int entry_matches(const audit_query_t *query, const audit_entry_t *entry) {
+    if (query->from && entry->time < query->from) return 0;
+    if (query->to && entry->time > query->to) return 0;
+    if (query->user && query->user[0] && strcmp(query->user, entry->user) != 0) return 0;
+    return 1;
+}
+
+// segment index as read back for a query
+typedef struct {
+    int64_t min_time;
+    int64_t max_time;
+    uint32_t records;
+    uint32_t start_offset;      // where a time-bounded scan can begin
+    uint32_t *user_offsets;     // offsets of the queried user's records
+    uint32_t user_count;
+} segment_index_t;
+
+// function to load what a query needs from an .idx file.
+// Returns 1 if loaded, 0 if the segment has no (valid) index.
+static int load_segment_index(unsigned int segment, const audit_query_t *query,
+                              segment_index_t *index) {
+    char path[256];
+    segment_path(segment, "idx", path, sizeof(path));
+    memset(index, 0, sizeof(segment_index_t));
+
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+
+    char magic[8];
+    uint32_t mark_count, user_count;
+    int ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, AUDIT_INDEX_MAGIC, 8) == 0 &&
+             fread(&index->records, sizeof(uint32_t), 1, file) == 1 &&
+             fread(&index->min_time, sizeof(int64_t), 1, file) == 1 &&
+             fread(&index->max_time, sizeof(int64_t), 1, file) == 1 &&
+             fread(&mark_count, sizeof(uint32_t), 1, file) == 1;
+
+    // last time mark at or before the start of the range
+    for (uint32_t i = 0; ok && i < mark_count; i++) {
+        audit_time_mark_t mark;
+        if (fread(&mark, sizeof(mark), 1, file) != 1) {
+            ok = 0;
+        } else if (!query->from || mark.time <= (int64_t)query->from) {
+            index->start_offset = mark.offset;
+        }
+    }
+
+    if (ok && query->user && query->user[0]) {
+        ok = fread(&user_count, sizeof(uint32_t), 1, file) == 1;
+        for (uint32_t i = 0; ok && i < user_count; i++) {
+            uint16_t length;
+            char name[MAX_EMAIL_SIZE];
+            int64_t first_time, last_time;
+            uint32_t count;
+
+            if (fread(&length, sizeof(length), 1, file) != 1 || length >= MAX_EMAIL_SIZE ||
+                fread(name, 1, length, file) != length ||
+                fread(&first_time, sizeof(int64_t), 1, file) != 1 ||
+                fread(&last_time, sizeof(int64_t), 1, file) != 1 ||
+                fread(&count, sizeof(uint32_t), 1, file) != 1) {
+                ok = 0;
+                break;
+            }
+            name[length] = '\0';
+
+            if (strcmp(name, query->user) != 0) {
+                fseek(file, (long)count * (long)sizeof(uint32_t), SEEK_CUR);
+                continue;
+            }
+
+            index->user_offsets = malloc((count ? count : 1) * sizeof(uint32_t));
+            if (!index->user_offsets || fread(index->user_offsets, sizeof(uint32_t), count, file) != count) {
+                ok = 0;
+                break;
+            }
+            index->user_count = count;
+            break;
+        }
+    }
+
+    fclose(file);
+    if (!ok) {
+        free(index->user_offsets);
+        index->user_offsets = NULL;
+    }
+    return ok;
+}
+
+// Run a query over all audit segments. Segments whose index shows no
+// overlap with the time range or no record of the user are never opened;
+// with a user filter only that user's records are read. Segments without
+// an index (the active one, or one left by a crash) are scanned.
+// Returns the number of matching records, or -1 on error.
+int audit_query(const audit_query_t *query, audit_visit_fn visit, void *ctx,
+                audit_query_stats_t *stats) {
+    if (!query || !visit) return -1;
+
+    audit_query_stats_t local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(audit_query_stats_t));
+
+    unsigned int *segments;
+    int count = list_segments(&segments);
+    stats->segments_total = count;
+    int by_user = query->user && query->user[0];
+    int stop = 0;
+
+    for (int i = 0; i < count && !stop; i++) {
+        segment_index_t index;
+        int indexed = load_segment_index(segments[i], query, &index);
+
+        if (indexed) {
+            int outside = index.records == 0 ||
+                          (query->from && index.max_time < (int64_t)query->from) ||
+                          (query->to && index.min_time > (int64_t)query->to);
+            if (outside || (by_user && index.user_count == 0)) {
+                free(index.user_offsets);
+                continue;
+            }
+        }
+
+        char path[256];
+        segment_path(segments[i], "log", path, sizeof(path));
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            free(index.user_offsets);
+            continue;
+        }
+        stats->segments_opened++;
+
+        audit_entry_t entry;
+        if (indexed && by_user) {
+            for (uint32_t j = 0; j < index.user_count && !stop; j++) {
+                if (fseek(file, index.user_offsets[j], SEEK_SET) != 0 ||
+                    read_entry(file, &entry) != 1) {
+                    break;
+                }
+                if (!entry_matches(query, &entry)) continue;
+                stats->records_matched++;
+                stop = !visit(&entry, ctx);
+            }
+        } else {
+            if (indexed) fseek(file, index.start_offset, SEEK_SET);
+            while (!stop && read_entry(file, &entry) == 1) {
+                if (!entry_matches(query, &entry)) continue;
+                stats->records_matched++;
+                stop = !visit(&entry, ctx);
+            }
+        }
+
+        fclose(file);
+        free(index.user_offsets);
+    }
+
+    free(segments);
+    return (int)stats->records_matched;
+}
+
+// Parse "YYYY-MM-DD" or "YYYY-MM-DD HH:MM:SS" (local time). A bare date
+// means the start of that day, or its last second if end_of_day is set.
+int audit_parse_time(const char *text, int end_of_day, time_t *out) {
+    if (!text || !out) return 0;
+
+    struct tm tm_info;
+    memset(&tm_info, 0, sizeof(tm_info));
+    int fields = sscanf(text, "%d-%d-%d %d:%d:%d", &tm_info.tm_year, &tm_info.tm_mon,
+                        &tm_info.tm_mday, &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec);
+
+    if (fields == 3) {
+        if (end_of_day) {
+            tm_info.tm_hour = 23;
+            tm_info.tm_min = 59;
+            tm_info.tm_sec = 59;
+        }
+    } else if (fields != 6) {
+        return 0;
+    }
+
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon -= 1;
+    tm_info.tm_isdst = -1;
+
+    time_t value = mktime(&tm_info);
+    if (value == (time_t)-1) return 0;
+    *out = value;
+    return 1;
+}
@@ -0,0 +1,81 @@
+#ifndef AUDIT_STORE_H
+#define AUDIT_STORE_H
+
+#include "log.h"
+#include "strdict.h"
+#include <stdint.h>
+
+// binary audit segments live in data/audit as audit-NNNNNN.log, each sealed
+// segment has an audit-NNNNNN.idx with its time range and per-user offsets
+#define AUDIT_DIR "data/audit"
+#define AUDIT_MAX_SEGMENT_BYTES (8L * 1024 * 1024)
+#define AUDIT_MAX_SEGMENT_AGE (24 * 60 * 60)
+#define AUDIT_TIME_INDEX_STRIDE 256
+#define AUDIT_REUSE_MAX_BYTES (1L * 1024 * 1024)  // reopen a sealed segment below this size
+
+// a decoded audit record
+typedef struct {
+    time_t time;
+    log_level_t level;
+    char user[MAX_EMAIL_SIZE];
+    char operation[LOG_MAX_OPERATION];
+} audit_entry_t;
+
+// offsets of one user's records in the active segment
+typedef struct {
+    uint32_t *offsets;
+    uint32_t count;
+    uint32_t capacity;
+    int64_t first_time;
+    int64_t last_time;
+} audit_user_offsets_t;
+
+// sparse time index entry: time of every AUDIT_TIME_INDEX_STRIDE-th record
+typedef struct {
+    int64_t time;
+    uint32_t offset;
+} audit_time_mark_t;
+
+// writer for the active segment, owned by the log writer thread
+typedef struct {
+    FILE *file;
+    unsigned int segment;
+    long size;
+    time_t opened_at;
+    uint32_t records;
+    int64_t min_time;
+    int64_t max_time;
+    strdict_t users;                    // user -> id into user_offsets
+    audit_user_offsets_t *user_offsets;
+    uint32_t user_capacity;
+    audit_time_mark_t *time_marks;
+    uint32_t time_mark_count;
+    uint32_t time_mark_capacity;
+} audit_writer_t;
+
+// filter for audit_query; empty user and zero times mean "any"
+typedef struct {
+    const char *user;
+    time_t from;
+    time_t to;
+} audit_query_t;
+
+typedef struct {
+    int segments_total;
+    int segments_opened;
+    long records_matched;
+} audit_query_stats_t;
+
+// callback for matching records; return 0 to stop the query
+typedef int (*audit_visit_fn)(const audit_entry_t *entry, void *ctx);
+
+// Function prototypes
+int audit_writer_open(audit_writer_t *writer);
+int audit_writer_append(audit_writer_t *writer, const audit_entry_t *entry);
+int audit_writer_flush(audit_writer_t *writer, int sync);
+void audit_writer_close(audit_writer_t *writer);
+int audit_query(const audit_query_t *query, audit_visit_fn visit, void *ctx,
+                audit_query_stats_t *stats);
+int audit_parse_time(const char *text, int end_of_day, time_t *out);
+
+#endif
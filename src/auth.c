@@ -1,4 +1,8 @@
 #include "auth.h"
+#include "user_store.h"
+#include "metrics.h"
+#include "trace.h"
+#include <openssl/crypto.h>
 
 user_role_t get_role_from_email(const char *email) {
     if (!email) return ROLE_INVALID;
@@ -17,53 +21,49 @@ user_role_t get_role_from_email(const char *email) {
 void hash_password(const char *password, char *hash) {
     if (!password || !hash) return;
 
+    uint64_t span = trace_begin();
+
     // Simple password hashing for demonstration purposes
     char salted_password[MAX_PASSWORD_SIZE + 20];
     snprintf(salted_password, sizeof(salted_password), "ALU_SALT_%s_2024", password);
 
     sha256_hash(salted_password, hash);
+    trace_end("hash_password", span);
+}
+
+// function to check credentials against the user directory
+static int check_credentials(const char *email, const char *password, user_t *user) {
+    // O(1) lookup in the in-memory user directory
+    user_t stored;
+    if (!user_store_lookup(email, &stored)) return 0;
+
+    char input_hash[HASH_SIZE];
+    hash_password(password, input_hash);
+
+    if (CRYPTO_memcmp(input_hash, stored.password_hash, HASH_SIZE - 1) != 0) {
+        return 0; // Authentication failed
+    }
+
+    strcpy(user->email, stored.email);
+    strcpy(user->password_hash, stored.password_hash);
+    user->role = get_role_from_email(stored.email);
+    return 1; // Authentication successful
 }
 
 int authenticate_user(const char *email, const char *password, user_t *user) {
     if (!email || !password || !user) return 0;
 
-    FILE *file = fopen("data/users.csv", "r");
-    if (!file) {
-        // create the file if it doesn't exist
-        file = fopen("data/users.csv", "w");
-        if (file) {
-            char admin_hash[HASH_SIZE];
-            hash_password("admin123", admin_hash);
-            fprintf(file, "admin@alueducation.com,%s,STAFF\n", admin_hash);
-            fclose(file);
-        }
-        file = fopen("data/users.csv", "r");
-        if (!file) return 0;
-    }
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    int authenticated = check_credentials(email, password, user);
+    trace_end("authenticate_user", span);
 
-    char line[512];
-    char stored_email[MAX_EMAIL_SIZE];
-    char stored_hash[HASH_SIZE];
-    char role_str[20];
-
-    while (fgets(line, sizeof(line), file)) {
-        if (sscanf(line, "%99[^,],%64[^,],%19s", stored_email, stored_hash, role_str) == 3) {
-            if (strcmp(email, stored_email) == 0) {
-                char input_hash[HASH_SIZE];
-                hash_password(password, input_hash);
-
-                if (strcmp(input_hash, stored_hash) == 0) {
-                    strcpy(user->email, email);
-                    strcpy(user->password_hash, stored_hash);
-                    user->role = get_role_from_email(email);
-                    fclose(file);
-                    return 1; // Authentication successful
-                }
-            }
-        }
+    metrics_counter_add(METRIC_LOGINS, 1);
+    if (!authenticated) {
+        metrics_counter_add(METRIC_LOGIN_FAILURES, 1);
     }
-    fclose(file);
-    return 0; // Authentication failed
+    metrics_observe(METRIC_LOGIN_LATENCY, metrics_now_ns() - start);
+    return authenticated;
 }
 
 int register_user(const char *email, const char *password) {
@@ -75,16 +75,18 @@ int register_user(const char *email, const char *password) {
         return 0;
     }
 
-    FILE *file = fopen("data/users.csv", "a");
-    if (!file) return 0;
-
     char hash[HASH_SIZE];
     hash_password(password, hash);
 
-    fprintf(file, "%s,%s,%s\n", email, hash, role_to_string(role));
-    fclose(file);
+    uint64_t span = trace_begin();
+    int result = user_store_add(email, hash, role);
+    trace_end("register.store_user", span);
+    if (result < 0) {
+        printf("An account with this email address already exists.\n");
+        return 0;
+    }
 
-    return 1; // Registration successful
+    return result; // 1 if registration was successful
 }
 
 int has_write_permission(user_role_t role) {
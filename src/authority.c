@@ -0,0 +1,505 @@
+#define _POSIX_C_SOURCE 200809L
+#include "authority.h"
+#include "storage.h"
+#include "cipher.h"
+#include "pow.h"
+#include "epoch.h"
+#include "metrics.h"
+#include "trace.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEX_KEY_LENGTH (2 * AUTHORITY_KEY_SIZE)
+#define HEX_HASH_LENGTH (HASH_SIZE - 1)
+
+// one verifier thread: every `step`-th check from `start`
+typedef struct {
+    const seal_table_t *seals;
+    const seal_check_t *checks;
+    long count;
+    long start;
+    long step;
+    long failed;                        // first bad seal, or -1
+} verify_job_t;
+
+static char key_path[4096] = AUTHORITY_KEY_FILE;
+static EVP_PKEY *signer_key = NULL;
+static unsigned char signer_public[AUTHORITY_KEY_SIZE];
+
+// Path of the signer key in use (BLOCKMED_SIGNER_KEY or data/signer.key)
+const char *authority_key_path(void) {
+    return key_path;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// function to decode `length` bytes of hex, 0 if it is not hex
+static int decode_hex(const char *hex, unsigned char *out, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        int high = hex_value(hex[2 * i]), low = hex_value(hex[2 * i + 1]);
+        if (high < 0 || low < 0) return 0;
+        out[i] = (unsigned char)(high << 4 | low);
+    }
+    return 1;
+}
+
+static void encode_hex(const unsigned char *data, size_t length, char *hex) {
+    for (size_t i = 0; i < length; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", data[i]);
+    }
+}
+
+// Load this node's signer key from `key_file` (NULL: BLOCKMED_SIGNER_KEY or
+// the default). Without a key file the node cannot add blocks to
+// proof-of-authority chains and 1 is returned; a key file that is
+// malformed or readable by others returns 0.
+int authority_configure(const char *key_file) {
+    const char *path = key_file ? key_file : getenv("BLOCKMED_SIGNER_KEY");
+    snprintf(key_path, sizeof(key_path), "%s", path && path[0] ? path : AUTHORITY_KEY_FILE);
+    EVP_PKEY_free(signer_key);
+    signer_key = NULL;
+
+    struct stat st;
+    if (stat(key_path, &st) != 0) {
+        if (errno == ENOENT) return 1;
+        printf("Error: Could not read signer key '%s': %s\n", key_path, strerror(errno));
+        return 0;
+    }
+    if (st.st_mode & (S_IRWXG | S_IRWXO)) {
+        printf("Error: Signer key '%s' must not be accessible by others (chmod 600)\n", key_path);
+        return 0;
+    }
+
+    FILE *file = fopen(key_path, "r");
+    char text[HEX_KEY_LENGTH + 2];
+    unsigned char seed[AUTHORITY_KEY_SIZE];
+    size_t length = file ? fread(text, 1, sizeof(text), file) : 0;
+    if (file) fclose(file);
+
+    int ok = length >= HEX_KEY_LENGTH &&
+             (length == HEX_KEY_LENGTH || text[HEX_KEY_LENGTH] == '\n') &&
+             decode_hex(text, seed, AUTHORITY_KEY_SIZE);
+    if (ok) {
+        signer_key = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, seed, sizeof(seed));
+        size_t public_length = sizeof(signer_public);
+        ok = signer_key &&
+             EVP_PKEY_get_raw_public_key(signer_key, signer_public, &public_length) == 1;
+    }
+    OPENSSL_cleanse(text, sizeof(text));
+    OPENSSL_cleanse(seed, sizeof(seed));
+    if (!ok) {
+        EVP_PKEY_free(signer_key);
+        signer_key = NULL;
+        printf("Error: Signer key '%s' must hold %d hex characters\n", key_path, HEX_KEY_LENGTH);
+        return 0;
+    }
+    return 1;
+}
+
+// Write a new random signer key to `key_file`, which must not exist yet,
+// and its public key (hex) to `public_hex` (HEX_KEY_LENGTH + 1 bytes)
+int authority_generate_key(const char *key_file, char *public_hex) {
+    unsigned char seed[AUTHORITY_KEY_SIZE], public_key[AUTHORITY_KEY_SIZE];
+    char text[HEX_KEY_LENGTH + 1];
+    size_t public_length = sizeof(public_key);
+    EVP_PKEY *key = NULL;
+    if (RAND_bytes(seed, sizeof(seed)) != 1 ||
+        !(key = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, seed, sizeof(seed))) ||
+        EVP_PKEY_get_raw_public_key(key, public_key, &public_length) != 1) {
+        printf("Error: Could not generate a signer key\n");
+        EVP_PKEY_free(key);
+        OPENSSL_cleanse(seed, sizeof(seed));
+        return 0;
+    }
+    EVP_PKEY_free(key);
+    encode_hex(seed, sizeof(seed), text);
+    text[HEX_KEY_LENGTH] = '\n';
+
+    int fd = open(key_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    int ok = fd >= 0 && write(fd, text, sizeof(text)) == (ssize_t)sizeof(text) && fsync(fd) == 0;
+    if (fd < 0) {
+        printf("Error: Could not create signer key '%s': %s\n", key_file, strerror(errno));
+    } else if (!ok) {
+        printf("Error: Could not write signer key '%s'\n", key_file);
+        unlink(key_file);
+    }
+    if (fd >= 0) close(fd);
+    OPENSSL_cleanse(seed, sizeof(seed));
+    OPENSSL_cleanse(text, sizeof(text));
+    if (ok) encode_hex(public_key, sizeof(public_key), public_hex);
+    return ok;
+}
+
+// This node's public key as hex, 0 if it has no signer key
+int authority_public_key(char *public_hex) {
+    if (!signer_key) return 0;
+    encode_hex(signer_public, sizeof(signer_public), public_hex);
+    return 1;
+}
+
+// function to read a list of hex public keys separated by white space.
+// Returns how many, or -1 if the list is malformed, too long or repeats one.
+static int parse_signers(const char *text, unsigned char keys[][AUTHORITY_KEY_SIZE]) {
+    int count = 0;
+    const char *p = text;
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0') break;
+
+        size_t length = 0;
+        while (p[length] && !isspace((unsigned char)p[length])) length++;
+        if (length != HEX_KEY_LENGTH || count == AUTHORITY_MAX_SIGNERS ||
+            !decode_hex(p, keys[count], AUTHORITY_KEY_SIZE)) {
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (memcmp(keys[i], keys[count], AUTHORITY_KEY_SIZE) == 0) return -1;
+        }
+        count++;
+        p += length;
+    }
+    return count;
+}
+
+// Check whether a block is the genesis block of a proof-of-authority chain
+int authority_genesis(const block_t *block) {
+    return block && block->index == 0 && strcmp(block->transaction.patient_id, "GENESIS") == 0 &&
+           strcmp(block->transaction.prescription, AUTHORITY_PRESCRIPTION) == 0;
+}
+
+// Create the genesis block of a proof-of-authority chain signed by the
+// given public keys (hex, separated by white space)
+block_t *authority_genesis_block(const char *signers) {
+    unsigned char keys[AUTHORITY_MAX_SIGNERS][AUTHORITY_KEY_SIZE];
+    int count = signers ? parse_signers(signers, keys) : -1;
+    if (count < 1) {
+        printf("Error: Give between 1 and %d distinct signer public keys (%d hex characters each)\n",
+               AUTHORITY_MAX_SIGNERS, HEX_KEY_LENGTH);
+        return NULL;
+    }
+
+    char note[AUTHORITY_MAX_SIGNERS * (HEX_KEY_LENGTH + 1)];
+    for (int i = 0; i < count; i++) {
+        encode_hex(keys[i], AUTHORITY_KEY_SIZE, note + i * (HEX_KEY_LENGTH + 1));
+        note[i * (HEX_KEY_LENGTH + 1) + HEX_KEY_LENGTH] = i + 1 < count ? ' ' : '\0';
+    }
+
+    medical_transaction_t tx;
+    block_t *genesis = NULL;
+    if (create_transaction(&tx, "GENESIS", "system@alueducation.com", "Genesis Block",
+                           AUTHORITY_PRESCRIPTION, note)) {
+        genesis = create_block(0, &tx, "0000000000000000000000000000000000000000000000000000000000000000");
+    }
+    if (!genesis) {
+        printf("Error: Memory allocation failed for genesis block\n");
+        return NULL;
+    }
+    calculate_block_hash(genesis);
+    return genesis;
+}
+
+// Create the seal table of the chain that starts with `genesis` (a
+// proof-of-authority genesis block). NULL if its signer list is malformed.
+seal_table_t *seals_create(const block_t *genesis) {
+    if (!authority_genesis(genesis)) return NULL;
+
+    seal_table_t *seals = calloc(1, sizeof(seal_table_t));
+    if (!seals) return NULL;
+    seals->signer_count = parse_signers(genesis->transaction.visit_note, seals->signers);
+    seals->local_signer = -1;
+    atomic_init(&seals->directory, NULL);
+    if (seals->signer_count < 1) {
+        printf("Error: The genesis block lists no valid signers\n");
+        free(seals);
+        return NULL;
+    }
+
+    for (int i = 0; i < seals->signer_count; i++) {
+        seals->keys[i] = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, seals->signers[i],
+                                                     AUTHORITY_KEY_SIZE);
+        if (!seals->keys[i]) {
+            seals_free(seals);
+            return NULL;
+        }
+        if (signer_key && memcmp(seals->signers[i], signer_public, AUTHORITY_KEY_SIZE) == 0) {
+            seals->local_signer = i;
+        }
+    }
+    return seals;
+}
+
+void seals_free(seal_table_t *seals) {
+    if (!seals) return;
+
+    for (int i = 0; i < seals->signer_count; i++) {
+        EVP_PKEY_free(seals->keys[i]);
+    }
+    seal_directory_t *directory = atomic_load(&seals->directory);
+    if (directory) {
+        for (long chunk = 0; chunk < directory->capacity; chunk++) {
+            free(directory->chunks[chunk]);
+        }
+        free(directory);
+    }
+    free(seals);
+}
+
+// seals_free as an epoch release callback
+void seals_release(void *ptr) {
+    seals_free(ptr);
+}
+
+// Seal of block `index`, NULL if none was stored
+const unsigned char *seals_get(const seal_table_t *seals, long index) {
+    const seal_directory_t *directory = atomic_load(&((seal_table_t *)seals)->directory);
+    long chunk = index >> AUTHORITY_CHUNK_SHIFT;
+    if (index < 1 || !directory || chunk >= directory->capacity || !directory->chunks[chunk]) {
+        return NULL;
+    }
+    return directory->chunks[chunk][index & (AUTHORITY_CHUNK_SEALS - 1)];
+}
+
+// Store the seal of block `index` before the block is published. Only one
+// thread at a time stores seals.
+int seals_put(seal_table_t *seals, long index, const unsigned char *seal) {
+    seal_directory_t *directory = atomic_load(&seals->directory);
+    long chunk = index >> AUTHORITY_CHUNK_SHIFT;
+    if (index < 1) return 0;
+
+    if (!directory || chunk >= directory->capacity) {
+        long capacity = directory ? directory->capacity * 2 : 4;
+        while (capacity <= chunk) capacity *= 2;
+
+        seal_directory_t *grown = calloc(1, sizeof(seal_directory_t) +
+                                            (size_t)capacity * sizeof(authority_seal_t *));
+        if (!grown) return 0;
+        grown->capacity = capacity;
+        if (directory) {
+            memcpy(grown->chunks, directory->chunks,
+                   (size_t)directory->capacity * sizeof(authority_seal_t *));
+        }
+        // readers may still be looking seals up in the old directory
+        atomic_store(&seals->directory, grown);
+        epoch_retire(directory, free);
+        directory = grown;
+    }
+
+    if (!directory->chunks[chunk]) {
+        directory->chunks[chunk] = calloc(AUTHORITY_CHUNK_SEALS, sizeof(authority_seal_t));
+        if (!directory->chunks[chunk]) return 0;
+    }
+    memcpy(directory->chunks[chunk][index & (AUTHORITY_CHUNK_SEALS - 1)], seal,
+           AUTHORITY_SEAL_SIZE);
+    return 1;
+}
+
+// function to sign a block of a proof-of-authority chain with this node's
+// key and store the seal
+static int sign_block(seal_table_t *seals, block_t *block) {
+    if (!signer_key) {
+        printf("Error: No signer key ('%s') - this node cannot add blocks to the chain\n", key_path);
+        return 0;
+    }
+    if (seals->local_signer < 0) {
+        printf("Error: This node's signer key is not one of the chain's authorities\n");
+        return 0;
+    }
+
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    block->nonce = (unsigned long)seals->local_signer;
+    calculate_block_hash(block);
+
+    authority_seal_t seal;
+    size_t length = sizeof(seal);
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int ok = ctx && EVP_DigestSignInit(ctx, NULL, NULL, NULL, signer_key) == 1 &&
+             EVP_DigestSign(ctx, seal, &length, (const unsigned char *)block->current_hash,
+                            HEX_HASH_LENGTH) == 1 &&
+             length == sizeof(seal) && seals_put(seals, block->index, seal);
+    EVP_MD_CTX_free(ctx);
+    if (!ok) {
+        printf("Error: Could not sign block %d\n", block->index);
+        return 0;
+    }
+
+    if (!is_quiet_mode()) {
+        printf("Block signed by authority %d! Hash: %s\n", seals->local_signer, block->current_hash);
+    }
+    metrics_counter_add(METRIC_BLOCKS_SIGNED, 1);
+    metrics_observe(METRIC_SIGN_LATENCY, metrics_now_ns() - start);
+    trace_end("sign_block", span);
+    return 1;
+}
+
+// Seal a new block the way its chain requires: signed if the chain has
+// seals (proof of authority), mined at `difficulty` otherwise
+int seal_block(seal_table_t *seals, block_t *block, int difficulty) {
+    if (!block) return 0;
+    return seals ? sign_block(seals, block) : mine_block(block, difficulty);
+}
+
+// function to check one seal against the chain's signers
+static int seal_valid(const seal_table_t *seals, const seal_check_t *check) {
+    if (check->signer >= (unsigned long)seals->signer_count ||
+        strlen(check->hash) != HEX_HASH_LENGTH) {
+        return 0;
+    }
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int ok = ctx && EVP_DigestVerifyInit(ctx, NULL, NULL, NULL, seals->keys[check->signer]) == 1 &&
+             EVP_DigestVerify(ctx, check->seal, AUTHORITY_SEAL_SIZE,
+                              (const unsigned char *)check->hash, HEX_HASH_LENGTH) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+static void *verify_worker(void *arg) {
+    verify_job_t *job = arg;
+    job->failed = -1;
+    for (long i = job->start; i < job->count; i += job->step) {
+        if (!seal_valid(job->seals, &job->checks[i])) {
+            job->failed = i;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Check a batch of seals on AUTHORITY_VERIFY_THREADS threads. Returns the
+// first check that fails, or -1.
+long seals_verify(const seal_table_t *seals, const seal_check_t *checks, long count) {
+    verify_job_t jobs[AUTHORITY_VERIFY_THREADS];
+    pthread_t threads[AUTHORITY_VERIFY_THREADS];
+    int started = 0;
+    uint64_t span = trace_begin();
+
+    int workers = count < AUTHORITY_VERIFY_THREADS ? (int)count : AUTHORITY_VERIFY_THREADS;
+    for (int i = 0; i < workers; i++) {
+        jobs[i] = (verify_job_t){seals, checks, count, i, workers, -1};
+        if (i > 0 && pthread_create(&threads[i], NULL, verify_worker, &jobs[i]) == 0) {
+            started |= 1 << i;
+        }
+    }
+    // this thread takes the first share and any a thread could not start for
+    for (int i = 0; i < workers; i++) {
+        if (!(started & (1 << i))) verify_worker(&jobs[i]);
+    }
+
+    long failed = -1;
+    for (int i = 0; i < workers; i++) {
+        if (started & (1 << i)) pthread_join(threads[i], NULL);
+        if (jobs[i].failed >= 0 && (failed < 0 || jobs[i].failed < failed)) failed = jobs[i].failed;
+    }
+    metrics_counter_add(METRIC_SEALS_VERIFIED, (uint64_t)count);
+    trace_end("seals_verify", span);
+    return failed;
+}
+
+// Path of the seal file kept beside `chain_file`
+int seals_path(const char *chain_file, char *path, size_t size) {
+    return snprintf(path, size, "%s%s", chain_file, AUTHORITY_SEALS_SUFFIX) < (int)size;
+}
+
+// Write the seals of blocks [from, to) to the seal file of `chain_file`,
+// creating it if needed, and sync it
+int seals_write(const seal_table_t *seals, const char *chain_file, long from, long to) {
+    char path[4096];
+    if (!seals_path(chain_file, path, sizeof(path))) {
+        printf("Error: Chain path '%s' is too long\n", chain_file);
+        return 0;
+    }
+
+    FILE *file = fopen(path, "r+b");
+    if (!file && errno == ENOENT) file = fopen(path, "w+b");
+    if (!file) {
+        printf("Error: Could not open seal file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    static const authority_seal_t unsealed;
+    int ok = fseek(file, from * AUTHORITY_SEAL_SIZE, SEEK_SET) == 0;
+    for (long i = from; ok && i < to; i++) {
+        const unsigned char *seal = seals_get(seals, i);
+        ok = fwrite(seal ? seal : unsealed, AUTHORITY_SEAL_SIZE, 1, file) == 1;
+    }
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) {
+        printf("Error: Failed to write seal file '%s': %s\n", path, strerror(errno));
+    }
+    return ok;
+}
+
+// Move the seal file of `from_chain` to go with `to_chain`, after the chain
+// file itself was renamed; without one, a stale seal file of `to_chain` is
+// removed
+int seals_rename(const char *from_chain, const char *to_chain) {
+    char from[4096], to[4096];
+    if (!seals_path(from_chain, from, sizeof(from)) || !seals_path(to_chain, to, sizeof(to))) {
+        return 0;
+    }
+    if (rename(from, to) == 0) return 1;
+    if (errno != ENOENT) {
+        printf("Error: Could not move seal file '%s': %s\n", from, strerror(errno));
+        return 0;
+    }
+    return unlink(to) == 0 || errno == ENOENT;
+}
+
+// Give a chain loaded from `chain_file` its seal table if the file holds a
+// proof-of-authority chain, reading the seals of all chain->length blocks.
+// Only the writer calls this, while loading. Returns 1 for proof-of-work
+// chains too, 0 if the seals cannot be read.
+int seals_load(blockchain_t *chain, const char *chain_file) {
+    FILE *file = cipher_fopen(chain_file, "rb");
+    char record[BLOCK_RECORD_SIZE];
+    int length;
+    block_t genesis;
+    if (!file || fread(&length, sizeof(int), 1, file) != 1 || !read_block_record(file, record)) {
+        printf("Error: Could not read the genesis block of '%s'\n", chain_file);
+        if (file) fclose(file);
+        return 0;
+    }
+    fclose(file);
+    decode_block_record(record, &genesis);
+    if (!authority_genesis(&genesis)) return 1;
+
+    seal_table_t *seals = seals_create(&genesis);
+    if (!seals) return 0;
+
+    char path[4096];
+    file = seals_path(chain_file, path, sizeof(path)) ? fopen(path, "rb") : NULL;
+    if (!file && chain->length > 1) {
+        printf("Error: Could not open seal file '%s': %s\n", path, strerror(errno));
+        seals_free(seals);
+        return 0;
+    }
+
+    authority_seal_t seal;
+    int ok = !file || fseek(file, AUTHORITY_SEAL_SIZE, SEEK_SET) == 0;
+    long index = 1;
+    for (; ok && index < chain->length; index++) {
+        ok = fread(seal, sizeof(seal), 1, file) == 1 && seals_put(seals, index, seal);
+    }
+    if (file) fclose(file);
+    if (!ok) {
+        printf("Error: Seal file '%s' is missing the seal of block %ld\n", path, index - 1);
+        seals_free(seals);
+        return 0;
+    }
+
+    seals_free(chain->seals);
+    chain->seals = seals;
+    return chain_publish(chain);
+}
@@ -0,0 +1,75 @@
+#ifndef AUTHORITY_H
+#define AUTHORITY_H
+
+#include "blockchain.h"
+#include <openssl/evp.h>
+#include <stdatomic.h>
+
+// Proof-of-authority consensus. A chain chooses it at genesis: its genesis
+// block carries AUTHORITY_PRESCRIPTION and, as its note, the Ed25519 public
+// keys (hex, space separated) of the nodes allowed to add blocks. Every
+// later block is signed instead of mined: its nonce is the signer's
+// position in that list and its seal, an Ed25519 signature over the block
+// hash, is kept beside the chain file in <chain file>.seals, one
+// AUTHORITY_SEAL_SIZE slot per block (slot 0, the genesis block, unused).
+// Seals are written before the blocks they sign, so the seal file may run
+// ahead of the chain file but never behind it.
+#define AUTHORITY_PRESCRIPTION "Proof of Authority"
+#define AUTHORITY_KEY_FILE "data/signer.key"
+#define AUTHORITY_SEALS_SUFFIX ".seals"
+#define AUTHORITY_KEY_SIZE 32
+#define AUTHORITY_SEAL_SIZE 64
+#define AUTHORITY_MAX_SIGNERS 15
+#define AUTHORITY_VERIFY_THREADS 4
+#define AUTHORITY_VERIFY_BATCH 4096     // seals checked per round of threads
+#define AUTHORITY_CHUNK_SHIFT 12
+#define AUTHORITY_CHUNK_SEALS (1L << AUTHORITY_CHUNK_SHIFT)
+
+typedef unsigned char authority_seal_t[AUTHORITY_SEAL_SIZE];
+
+// chunks of seals; the writer replaces a full directory with a bigger copy
+// and retires the old one (epoch.h), chunks never move
+typedef struct {
+    long capacity;
+    authority_seal_t *chunks[];
+} seal_directory_t;
+
+// the signers of a chain and the seals of its blocks. Seal i is stored
+// before block i is published, and readers look up only the blocks of
+// their view, so they never see a seal change.
+struct seal_table {
+    int signer_count;
+    unsigned char signers[AUTHORITY_MAX_SIGNERS][AUTHORITY_KEY_SIZE];
+    EVP_PKEY *keys[AUTHORITY_MAX_SIGNERS];
+    int local_signer;                   // this node's position, -1 if not a signer
+    _Atomic(seal_directory_t *) directory;
+};
+
+// one block whose seal is to be checked
+typedef struct {
+    long index;
+    unsigned long signer;
+    char hash[HASH_SIZE];
+    authority_seal_t seal;
+} seal_check_t;
+
+// Function prototypes
+const char *authority_key_path(void);
+int authority_configure(const char *key_file);
+int authority_generate_key(const char *key_file, char *public_hex);
+int authority_public_key(char *public_hex);
+int authority_genesis(const block_t *block);
+block_t *authority_genesis_block(const char *signers);
+seal_table_t *seals_create(const block_t *genesis);
+void seals_free(seal_table_t *seals);
+void seals_release(void *ptr);
+const unsigned char *seals_get(const seal_table_t *seals, long index);
+int seals_put(seal_table_t *seals, long index, const unsigned char *seal);
+int seal_block(seal_table_t *seals, block_t *block, int difficulty);
+long seals_verify(const seal_table_t *seals, const seal_check_t *checks, long count);
+int seals_path(const char *chain_file, char *path, size_t size);
+int seals_write(const seal_table_t *seals, const char *chain_file, long from, long to);
+int seals_rename(const char *from_chain, const char *to_chain);
+int seals_load(blockchain_t *chain, const char *chain_file);
+
+#endif
@@ -0,0 +1,1469 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "storage.h"
+#include "pow.h"
+#include "log.h"
+#include "import.h"
+#include "export.h"
+#include "audit_store.h"
+#include "snapshot.h"
+#include "patients.h"
+#include "cipher.h"
+#include "authority.h"
+#include "dedup.h"
+#include "replica.h"
+#include "shard.h"
+#include "daemon.h"
+#include "client.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef int (*batch_handler_t)(const char *command, const batch_args_t *args, const user_t *user);
+
+typedef struct {
+    const char *name;
+    batch_handler_t run;
+    int public;                     // runs without credentials (and locally)
+    int local;                      // runs locally even while a daemon runs
+    const char *options[10];        // accepted option names, NULL-terminated
+} batch_command_t;
+
+// JSON results go to the original stdout; everything the rest of the
+// program prints is sent to stderr so stdout stays machine-readable
+static FILE *json_out = NULL;
+
+static int batch_add(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_mine(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_validate(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_export(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_query(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_import(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_audit(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_status(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_root(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_proof(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_verify_proof(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_patient(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_verify_patients(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_keygen(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_encrypt(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_sync(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_init(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_shard_init(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_shard_import(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_shard_anchor(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_shard_query(const char *command, const batch_args_t *args, const user_t *user);
+static int batch_shard_validate(const char *command, const batch_args_t *args, const user_t *user);
+
+static const batch_command_t commands[] = {
+    {"add", batch_add, 0, 0, {"patient", "diagnosis", "prescription", "note", "stdin", NULL}},
+    {"mine", batch_mine, 0, 0, {"chain", "difficulty", "batch-size", NULL}},
+    {"validate", batch_validate, 0, 0, {"chain", NULL}},
+    {"export", batch_export, 0, 0, {"chain", "format", "output", "from", "to", "fields", NULL}},
+    {"query", batch_query, 0, 0, {"chain", "patient", "doctor", "from", "to", "limit", NULL}},
+    {"import", batch_import, 0, 0, {"chain", "file", "difficulty", "batch-size", NULL}},
+    {"audit", batch_audit, 0, 0, {"user", "from", "to", NULL}},
+    {"status", batch_status, 0, 0, {"chain", NULL}},
+    {"root", batch_root, 0, 0, {"chain", "height", NULL}},
+    {"proof", batch_proof, 0, 0, {"chain", "height", NULL}},
+    {"verify-proof", batch_verify_proof, 1, 1, {"proof", "root", NULL}},
+    {"patient", batch_patient, 0, 0, {"chain", "patient", NULL}},
+    {"verify-patients", batch_verify_patients, 0, 0, {"chain", NULL}},
+    {"keygen", batch_keygen, 0, 1, {"kind", NULL}},
+    {"encrypt", batch_encrypt, 0, 1, {"chain", NULL}},
+    {"sync", batch_sync, 0, 0, {"chain", "peer", "batch-size", NULL}},
+    {"init", batch_init, 0, 1, {"chain", "consensus", "signers", NULL}},
+    {"shard-init", batch_shard_init, 0, 1, {"names", NULL}},
+    {"shard-import", batch_shard_import, 0, 1, {"file", "shard", "difficulty", "batch-size", NULL}},
+    {"shard-anchor", batch_shard_anchor, 0, 1, {"difficulty", NULL}},
+    {"shard-query", batch_shard_query, 0, 1, {"patient", "doctor", "limit", NULL}},
+    {"shard-validate", batch_shard_validate, 0, 1, {NULL}}
+};
+
+#define COMMAND_COUNT ((int)(sizeof(commands) / sizeof(commands[0])))
+
+// function to send stdout to stderr, keeping a handle on the real stdout
+static int redirect_output(void) {
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0) return 0;
+
+    json_out = fdopen(fd, "w");
+    if (!json_out) {
+        close(fd);
+        return 0;
+    }
+    return dup2(STDERR_FILENO, STDOUT_FILENO) >= 0;
+}
+
+// Start the JSON result object of a command
+void batch_json_begin(FILE *out, const char *command, int ok) {
+    fprintf(out, "{\"command\":");
+    write_json_string(out, command);
+    fprintf(out, ",\"ok\":%s", ok ? "true" : "false");
+}
+
+void batch_json_string(FILE *out, const char *key, const char *value) {
+    fprintf(out, ",\"%s\":", key);
+    write_json_string(out, value);
+}
+
+void batch_json_long(FILE *out, const char *key, long value) {
+    fprintf(out, ",\"%s\":%ld", key, value);
+}
+
+void batch_json_end(FILE *out) {
+    fprintf(out, "}\n");
+}
+
+// Report a failed command and return its exit code
+int batch_fail(FILE *out, const char *command, int code, const char *message) {
+    batch_json_begin(out, command, 0);
+    batch_json_string(out, "error", message);
+    batch_json_long(out, "exit_code", code);
+    batch_json_end(out);
+    return code;
+}
+
+static void json_begin(const char *command, int ok) {
+    batch_json_begin(json_out, command, ok);
+}
+
+static void json_string(const char *key, const char *value) {
+    batch_json_string(json_out, key, value);
+}
+
+static void json_long(const char *key, long value) {
+    batch_json_long(json_out, key, value);
+}
+
+static void json_end(void) {
+    batch_json_end(json_out);
+}
+
+static int fail(const char *command, int code, const char *message) {
+    return batch_fail(json_out, command, code, message);
+}
+
+// Split the `--name value` pairs following argv[1]; `--stdin` takes no value
+int batch_parse_options(int argc, char *argv[], batch_args_t *args) {
+    args->count = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0 || args->count == BATCH_MAX_OPTIONS) return 0;
+
+        batch_option_t *option = &args->items[args->count++];
+        option->name = argv[i] + 2;
+        if (strcmp(option->name, "stdin") == 0 || strcmp(option->name, "allow-remote") == 0) {
+            option->value = "1";
+        } else if (i + 1 < argc) {
+            option->value = argv[++i];
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const char *batch_get_option(const batch_args_t *args, const char *name) {
+    for (int i = 0; i < args->count; i++) {
+        if (strcmp(args->items[i].name, name) == 0) return args->items[i].value;
+    }
+    return NULL;
+}
+
+// Find an option that is not in the NULL-terminated `accepted` list
+const char *batch_unknown_option(const batch_args_t *args, const char *const accepted[]) {
+    for (int i = 0; i < args->count; i++) {
+        int known = 0;
+        for (int j = 0; accepted[j]; j++) {
+            if (strcmp(args->items[i].name, accepted[j]) == 0) known = 1;
+        }
+        if (!known) return args->items[i].name;
+    }
+    return NULL;
+}
+
+// Read a non-negative integer option (default when absent)
+int batch_int_option(const batch_args_t *args, const char *name, long fallback, long *value) {
+    const char *text = batch_get_option(args, name);
+    if (!text) {
+        *value = fallback;
+        return 1;
+    }
+
+    char *end;
+    errno = 0;
+    *value = strtol(text, &end, 10);
+    return errno == 0 && end != text && *end == '\0' && *value >= 0;
+}
+
+// function to authenticate from BLOCKMED_EMAIL / BLOCKMED_PASSWORD
+static int batch_login(user_t *user) {
+    const char *email = getenv("BLOCKMED_EMAIL");
+    const char *password = getenv("BLOCKMED_PASSWORD");
+    if (!email || !password) return 0;
+
+    if (!authenticate_user(email, password, user)) {
+        log_security_event(email, "Failed login attempt (batch)");
+        return 0;
+    }
+    return 1;
+}
+
+// function to lock a file for appending under an exclusive lock (creating
+// it with mode 0600), making sure it was not renamed away (claimed by
+// `mine`) between open and lock. Returns the descriptor holding the lock
+// and sets *size to the file's size; -1 on failure.
+static int lock_pending(const char *path, off_t *size) {
+    for (int attempt = 0; attempt < 10; attempt++) {
+        int fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) return -1;
+
+        struct stat opened, current;
+        if (flock(fd, LOCK_EX) == 0 && fstat(fd, &opened) == 0 &&
+            stat(path, &current) == 0 && opened.st_ino == current.st_ino &&
+            opened.st_dev == current.st_dev) {
+            *size = opened.st_size;
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+// function to open the locked pending file (of `size` bytes) to append
+// records. It goes through the cipher like the chain: a new file is
+// encrypted while a key is loaded, and plaintext records queued before the
+// key was created must be mined before more are queued.
+static FILE *open_pending_append(const char *path, off_t size) {
+    if (size == 0) return cipher_fopen(path, "wb");
+    if (cipher_enabled() && cipher_file_encrypted(path) != 1) {
+        printf("Error: '%s' holds records queued before the key was created; "
+               "mine them first\n", path);
+        return NULL;
+    }
+
+    FILE *file = cipher_fopen(path, "r+b");
+    if (file && fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+// blockmed add: queue records for the next `mine`
+static int batch_add(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to add record without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    const char *patient = batch_get_option(args, "patient");
+    int from_stdin = batch_get_option(args, "stdin") != NULL;
+    if (from_stdin == (patient != NULL)) {
+        return fail(command, BATCH_EXIT_USAGE, "give either --patient ... or --stdin");
+    }
+
+    const char *diagnosis = batch_get_option(args, "diagnosis");
+    const char *prescription = batch_get_option(args, "prescription");
+    const char *note = batch_get_option(args, "note");
+    if (!from_stdin &&
+        (patient[0] == '\0' ||
+         strlen(patient) >= MAX_PATIENT_ID_SIZE ||
+         (diagnosis && strlen(diagnosis) >= MAX_DIAGNOSIS_SIZE) ||
+         (prescription && strlen(prescription) >= MAX_PRESCRIPTION_SIZE) ||
+         (note && strlen(note) >= MAX_NOTES_SIZE))) {
+        return fail(command, BATCH_EXIT_USAGE, "invalid or oversized record fields");
+    }
+
+    off_t size;
+    int lock = lock_pending(BATCH_PENDING_FILE, &size);
+    FILE *pending = lock >= 0 ? open_pending_append(BATCH_PENDING_FILE, size) : NULL;
+    if (!pending) {
+        if (lock >= 0) close(lock);
+        return fail(command, BATCH_EXIT_FAILURE, "could not open " BATCH_PENDING_FILE);
+    }
+
+    long added = 0;
+    if (from_stdin) {
+        // rows in the bulk import format are queued as they are and checked
+        // when mined; an empty doctor column means the mining user
+        char line[MAX_INPUT_SIZE * 4];
+        while (fgets(line, sizeof(line), stdin)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || strncasecmp(line, "patient_id", 10) == 0) continue;
+            fprintf(pending, "%s\n", line);
+            added++;
+        }
+    } else {
+        char timestamp[20];
+        get_timestamp(timestamp);
+
+        const char *fields[] = {patient, user->email, diagnosis ? diagnosis : "",
+                                prescription ? prescription : "", note ? note : "", timestamp};
+        for (int i = 0; i < 6; i++) {
+            if (i > 0) fputc(',', pending);
+            write_csv_string(pending, fields[i]);
+        }
+        fputc('\n', pending);
+        added = 1;
+    }
+
+    int ok = fflush(pending) == 0 && !ferror(pending);
+    if (fclose(pending) != 0) ok = 0;
+    close(lock);
+    if (!ok) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not write " BATCH_PENDING_FILE);
+    }
+
+    log_operation(LOG_INFO, user->email, "Created new medical record (batch)");
+    json_begin(command, 1);
+    json_long("added", added);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// function to load the newest block of the chain, writing the genesis block
+// when the file is new; the caller holds the chain file lock, which left
+// a new file empty
+static blockchain_t *open_chain_tail(const char *chain_file) {
+    struct stat st;
+    if (stat(chain_file, &st) == 0 && st.st_size > 0) {
+        return load_blockchain_tail(chain_file);
+    }
+
+    blockchain_t *chain = create_blockchain();
+    if (chain && !save_blockchain(chain, chain_file)) {
+        free_blockchain(chain);
+        return NULL;
+    }
+    return chain;
+}
+
+// function to mine a CSV into the chain file and report the result
+static int mine_csv(const char *command, const batch_args_t *args, const user_t *user,
+                    const char *csv_path, int *interrupted) {
+    long difficulty, batch_size;
+    if (!batch_int_option(args, "difficulty", get_mining_difficulty(), &difficulty) ||
+        difficulty < 1 || difficulty > 8 ||
+        !batch_int_option(args, "batch-size", IMPORT_DEFAULT_BATCH_SIZE, &batch_size)) {
+        return fail(command, BATCH_EXIT_USAGE, "invalid --difficulty or --batch-size");
+    }
+
+    const char *chain_file = batch_get_option(args, "chain");
+    if (!chain_file) chain_file = BATCH_CHAIN_FILE;
+
+    // another process appending at the same time would leave the file out
+    // of sync with this chain, so it stays locked until the filter is saved
+    int lock = lock_chain_file(chain_file, LOCK_EX, 1);
+    if (lock < 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not lock the blockchain file");
+    }
+    blockchain_t *chain = open_chain_tail(chain_file);
+    if (!chain) {
+        unlock_chain_file(lock);
+        return fail(command, BATCH_EXIT_FAILURE, "could not open the blockchain file");
+    }
+
+    import_options_t opts;
+    init_import_options(&opts);
+    opts.chain_file = chain_file;
+    opts.batch_size = (int)batch_size;
+    opts.show_progress = 0;
+    opts.chain_file_synced = 1;
+
+    set_mining_difficulty((int)difficulty);
+    import_stats_t stats;
+    int ok = import_records_csv(chain, csv_path, user, &opts, &stats);
+    int height = chain->length;
+    // the next run starts from the filter of this one
+    dedup_save(chain, chain_file);
+    free_blockchain(chain);
+    unlock_chain_file(lock);
+
+    *interrupted = stats.interrupted;
+    if (!ok) {
+        return fail(command, BATCH_EXIT_FAILURE, "mining failed");
+    }
+
+    json_begin(command, 1);
+    json_long("mined", stats.records_imported);
+    json_long("rejected", stats.rows_rejected);
+    json_long("duplicates", stats.rows_duplicate);
+    json_long("skipped", stats.rows_skipped);
+    json_long("height", height);
+    fprintf(json_out, ",\"records_per_second\":%.1f", stats.records_per_second);
+    fprintf(json_out, ",\"interrupted\":%s", stats.interrupted ? "true" : "false");
+    json_end();
+    return stats.interrupted ? BATCH_EXIT_FAILURE : BATCH_EXIT_OK;
+}
+
+// Claim the pending records by renaming them to BATCH_MINING_FILE; a claim
+// left by an interrupted run is resumed first. The claim is held under an
+// exclusive lock on BATCH_CLAIM_FILE, so a second miner (a batch run or
+// the daemon) waits instead of mining the same file again. Returns 1 if
+// there is a claimed file to mine, with `claim` set for
+// batch_release_claim, 0 if nothing is pending and -1 on error.
+int batch_claim_pending(int *claim) {
+    *claim = open(BATCH_CLAIM_FILE, O_RDWR | O_CREAT, 0600);
+    if (*claim < 0) return -1;
+    if (flock(*claim, LOCK_EX) != 0) {
+        close(*claim);
+        return -1;
+    }
+    if (access(BATCH_MINING_FILE, F_OK) == 0) return 1;
+
+    off_t size;
+    int lock = lock_pending(BATCH_PENDING_FILE, &size);
+    int empty = lock >= 0 && size == 0;
+    int claimed = lock >= 0 && !empty && rename(BATCH_PENDING_FILE, BATCH_MINING_FILE) == 0;
+    if (lock >= 0) close(lock);
+
+    if (claimed) return 1;
+    batch_release_claim(*claim, 0);
+    return empty ? 0 : -1;
+}
+
+// Give up a claim, removing the claimed file first once it is `mined`
+void batch_release_claim(int claim, int mined) {
+    if (mined) remove(BATCH_MINING_FILE);
+    flock(claim, LOCK_UN);
+    close(claim);
+}
+
+// blockmed mine: mine every pending record
+static int batch_mine(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to mine block without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    int claim;
+    int claimed = batch_claim_pending(&claim);
+    if (claimed < 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not claim pending records");
+    }
+    if (claimed == 0) {
+        json_begin(command, 1);
+        json_long("mined", 0);
+        json_end();
+        return BATCH_EXIT_OK;
+    }
+
+    int interrupted = 0;
+    int result = mine_csv(command, args, user, BATCH_MINING_FILE, &interrupted);
+    batch_release_claim(claim, result == BATCH_EXIT_OK && !interrupted);
+    return result;
+}
+
+// blockmed import: mine a CSV file straight into the chain
+static int batch_import(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to bulk import without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    const char *file = batch_get_option(args, "file");
+    if (!file) {
+        return fail(command, BATCH_EXIT_USAGE, "--file is required");
+    }
+
+    int interrupted = 0;
+    return mine_csv(command, args, user, file, &interrupted);
+}
+
+// blockmed validate: check every hash and link of the chain file
+static int batch_validate(const char *command, const batch_args_t *args, const user_t *user) {
+    const char *chain_file = batch_get_option(args, "chain");
+    if (!chain_file) chain_file = BATCH_CHAIN_FILE;
+
+    blockchain_t *chain = load_blockchain(chain_file);
+    if (!chain) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+    }
+
+    int valid = validate_blockchain(chain);
+    int height = chain->length;
+    free_blockchain(chain);
+
+    log_operation(LOG_INFO, user->email, valid ? "Validated blockchain - VALID" :
+                                                  "Validated blockchain - INVALID");
+    json_begin(command, 1);
+    fprintf(json_out, ",\"valid\":%s", valid ? "true" : "false");
+    json_long("height", height);
+    json_end();
+    return valid ? BATCH_EXIT_OK : BATCH_EXIT_INVALID;
+}
+
+// blockmed export: same formats as the Export menu, read from the file
+static int batch_export(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to export blockchain without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    export_options_t opts;
+    init_export_options(&opts);
+
+    const char *output = batch_get_option(args, "output");
+    const char *format = batch_get_option(args, "format");
+    const char *fields = batch_get_option(args, "fields");
+    const char *chain_file = batch_get_option(args, "chain");
+    long from, to;
+
+    if (!output || (format && !parse_export_format(format, &opts.format)) ||
+        (fields && !parse_export_fields(fields, &opts.fields)) ||
+        !batch_int_option(args, "from", 0, &from) || !batch_int_option(args, "to", -1, &to)) {
+        return fail(command, BATCH_EXIT_USAGE, "invalid export options (--output is required)");
+    }
+    if (strcmp(output, "-") == 0) {
+        return fail(command, BATCH_EXIT_USAGE, "--output must be a file or directory");
+    }
+    opts.from_height = (int)from;
+    opts.to_height = batch_get_option(args, "to") ? (int)to : -1;
+
+    long rows = export_blockchain_file(chain_file ? chain_file : BATCH_CHAIN_FILE, output, &opts);
+    if (rows < 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "export failed");
+    }
+
+    log_operation(LOG_INFO, user->email, "Exported blockchain");
+    json_begin(command, 1);
+    json_long("rows", rows);
+    json_string("output", output);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// function to write one block as a JSON object line, tagged with the shard
+// it comes from unless `shard` is NULL
+static void write_block_json(FILE *out, const char *shard, const block_t *block) {
+    const medical_transaction_t *tx = &block->transaction;
+
+    fprintf(out, "{\"index\":%d", block->index);
+    if (shard) batch_json_string(out, "shard", shard);
+    batch_json_string(out, "timestamp", block->timestamp);
+    batch_json_string(out, "patient_id", tx->patient_id);
+    batch_json_string(out, "doctor_email", tx->doctor_email);
+    batch_json_string(out, "diagnosis", tx->diagnosis);
+    batch_json_string(out, "prescription", tx->prescription);
+    batch_json_string(out, "visit_note", tx->visit_note);
+    batch_json_string(out, "record_timestamp", tx->timestamp);
+    batch_json_string(out, "hash", block->current_hash);
+    fprintf(out, "}\n");
+}
+
+// Write one block as a JSON object line
+void batch_write_block_json(FILE *out, const block_t *block) {
+    write_block_json(out, NULL, block);
+}
+
+// a query over the records of one chain file
+typedef struct {
+    const char *shard;                  // tags the record lines, NULL for none
+    const char *patient;
+    const char *doctor;
+    long from, to, limit;               // to -1: up to the tail; limit 0: no limit
+    FILE *out;
+    long matches, scanned;
+    const char *error;
+} record_scan_t;
+
+// function to write the records of a chain file matching a query as JSON
+// Lines; returns 0 with scan->error set on failure
+static int scan_records(const char *chain_file, record_scan_t *scan) {
+    FILE *file = cipher_fopen(chain_file, "rb");
+    int length;
+    if (!file || fread(&length, sizeof(int), 1, file) != 1 || length < 0) {
+        if (file) fclose(file);
+        scan->error = "could not read the blockchain file";
+        return 0;
+    }
+
+    long last = scan->to >= 0 && scan->to < length ? scan->to : length - 1;
+    if (scan->from < length &&
+        fseek(file, (long)sizeof(int) + scan->from * (long)BLOCK_RECORD_SIZE, SEEK_SET) != 0) {
+        fclose(file);
+        scan->error = "could not seek in the blockchain file";
+        return 0;
+    }
+
+    char record[BLOCK_RECORD_SIZE];
+    block_t block;
+    for (long height = scan->from;
+         height <= last && (scan->limit == 0 || scan->matches < scan->limit); height++) {
+        if (!read_block_record(file, record)) {
+            fclose(file);
+            scan->error = "could not read the blockchain file";
+            return 0;
+        }
+        decode_block_record(record, &block);
+        scan->scanned++;
+
+        if (scan->patient && strcmp(block.transaction.patient_id, scan->patient) != 0) continue;
+        if (scan->doctor && strcasecmp(block.transaction.doctor_email, scan->doctor) != 0) continue;
+        write_block_json(scan->out, scan->shard, &block);
+        scan->matches++;
+    }
+    fclose(file);
+    return 1;
+}
+
+// blockmed query: stream the records matching a patient and/or doctor as
+// JSON Lines, followed by the result object
+static int batch_query(const char *command, const batch_args_t *args, const user_t *user) {
+    const char *patient = batch_get_option(args, "patient");
+    const char *doctor = batch_get_option(args, "doctor");
+    const char *chain_file = batch_get_option(args, "chain");
+    long from, to, limit;
+
+    if (!batch_int_option(args, "from", 0, &from) || !batch_int_option(args, "to", -1, &to) ||
+        !batch_int_option(args, "limit", 0, &limit)) {
+        return fail(command, BATCH_EXIT_USAGE, "invalid --from, --to or --limit");
+    }
+    if (!batch_get_option(args, "to")) to = -1;
+
+    record_scan_t scan = {NULL, patient, doctor, from, to, limit, json_out, 0, 0, NULL};
+    if (!scan_records(chain_file ? chain_file : BATCH_CHAIN_FILE, &scan)) {
+        return fail(command, BATCH_EXIT_FAILURE, scan.error);
+    }
+
+    log_operation(LOG_INFO, user->email, "Queried blockchain (batch)");
+    json_begin(command, 1);
+    json_long("matches", scan.matches);
+    json_long("scanned", scan.scanned);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// Write one audit record as a JSON object line (audit_query callback;
+// ctx is the FILE to write to)
+int batch_write_audit_json(const audit_entry_t *entry, void *ctx) {
+    FILE *out = ctx;
+    fprintf(out, "{\"time\":%ld", (long)entry->time);
+    batch_json_string(out, "level", log_level_name(entry->level));
+    batch_json_string(out, "user", entry->user);
+    batch_json_string(out, "operation", entry->operation);
+    fprintf(out, "}\n");
+    return 1;
+}
+
+// blockmed audit: audit log query as JSON Lines (staff only)
+static int batch_audit(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_full_permission(user->role)) {
+        log_security_event(user->email, "Attempted to query audit log without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    audit_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.user = batch_get_option(args, "user");
+
+    const char *from = batch_get_option(args, "from");
+    const char *to = batch_get_option(args, "to");
+    if ((from && !audit_parse_time(from, 0, &query.from)) ||
+        (to && !audit_parse_time(to, 1, &query.to))) {
+        return fail(command, BATCH_EXIT_USAGE, "dates must be YYYY-MM-DD[ HH:MM:SS]");
+    }
+
+    audit_query_stats_t stats;
+    if (audit_query(&query, batch_write_audit_json, json_out, &stats) < 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "audit query failed");
+    }
+
+    log_operation(LOG_INFO, user->email, "Queried audit log");
+    json_begin(command, 1);
+    json_long("matches", stats.records_matched);
+    json_long("segments_scanned", stats.segments_opened);
+    json_long("segments_total", stats.segments_total);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// blockmed status: chain height and consensus when no daemon is running (a
+// running daemon answers with its own status)
+static int batch_status(const char *command, const batch_args_t *args, const user_t *user) {
+    (void)user;
+    const char *chain_file = batch_get_option(args, "chain");
+    FILE *file = cipher_fopen(chain_file ? chain_file : BATCH_CHAIN_FILE, "rb");
+    int length = 0;
+    char record[BLOCK_RECORD_SIZE];
+    block_t genesis;
+    if (file && fread(&length, sizeof(int), 1, file) != 1) length = 0;
+    int authority = length > 0 && read_block_record(file, record);
+    if (authority) {
+        decode_block_record(record, &genesis);
+        authority = authority_genesis(&genesis);
+    }
+    if (file) fclose(file);
+
+    json_begin(command, 1);
+    fprintf(json_out, ",\"daemon\":false");
+    json_long("height", length);
+    json_string("consensus", authority ? "authority" : "work");
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// Write the accumulator root of a chain view (of its first --height blocks
+// if given) as the result object
+int batch_write_root(FILE *out, const char *command, const chain_view_t *view,
+                     const batch_args_t *args) {
+    long height;
+    if (!batch_int_option(args, "height", view->length, &height) || height < 1 ||
+        height > view->length) {
+        return batch_fail(out, command, BATCH_EXIT_USAGE,
+                          "--height must be between 1 and the chain height");
+    }
+
+    mmr_hash_t root;
+    char hex[HASH_SIZE];
+    if (!view->mmr || !mmr_root(view->mmr, height, root)) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "the chain has no block accumulator");
+    }
+
+    mmr_hash_to_hex(root, hex);
+    batch_json_begin(out, command, 1);
+    batch_json_long(out, "height", height);
+    batch_json_string(out, "root", hex);
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// Write the inclusion proof of block `height` as the result object, in the
+// form `verify-proof` reads back
+int batch_write_proof(FILE *out, const char *command, const chain_view_t *view, long height) {
+    const block_t *block = height < view->length ? chain_view_block(view, (int)height) : NULL;
+    if (!block) {
+        return batch_fail(out, command, BATCH_EXIT_USAGE, "no block at --height");
+    }
+
+    mmr_proof_t proof;
+    mmr_hash_t root;
+    char hex[HASH_SIZE];
+    if (!view->mmr || !mmr_prove(view->mmr, view->length, height, &proof) ||
+        !mmr_root(view->mmr, view->length, root)) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "the chain has no block accumulator");
+    }
+
+    mmr_hash_to_hex(root, hex);
+    batch_json_begin(out, command, 1);
+    batch_json_string(out, "block_hash", block->current_hash);
+    mmr_write_proof_json(out, &proof);
+    batch_json_string(out, "root", hex);
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// function to load a whole chain file with its accumulator
+static blockchain_t *open_full_chain(const batch_args_t *args) {
+    const char *chain_file = batch_get_option(args, "chain");
+    return open_blockchain(chain_file ? chain_file : BATCH_CHAIN_FILE);
+}
+
+// blockmed root: the accumulator root committing to every block
+static int batch_root(const char *command, const batch_args_t *args, const user_t *user) {
+    blockchain_t *chain = open_full_chain(args);
+    if (!chain) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_root(json_out, command, &view, args);
+    chain_read_end();
+    free_blockchain(chain);
+
+    log_operation(LOG_INFO, user->email, "Read blockchain root");
+    return result;
+}
+
+// blockmed proof: inclusion proof of the block at --height
+static int batch_proof(const char *command, const batch_args_t *args, const user_t *user) {
+    long height;
+    if (!batch_get_option(args, "height") || !batch_int_option(args, "height", 0, &height)) {
+        return fail(command, BATCH_EXIT_USAGE, "--height is required");
+    }
+
+    blockchain_t *chain = open_full_chain(args);
+    if (!chain) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_proof(json_out, command, &view, height);
+    chain_read_end();
+    free_blockchain(chain);
+
+    log_operation(LOG_INFO, user->email, "Generated inclusion proof");
+    return result;
+}
+
+// blockmed verify-proof: check a saved proof against a trusted root. Needs
+// neither credentials nor the chain.
+static int batch_verify_proof(const char *command, const batch_args_t *args, const user_t *user) {
+    (void)user;
+    const char *path = batch_get_option(args, "proof");
+    const char *root_hex = batch_get_option(args, "root");
+    mmr_hash_t root;
+    if (!path || !root_hex || !mmr_hash_from_hex(root_hex, root)) {
+        return fail(command, BATCH_EXIT_USAGE,
+                    "--proof FILE and --root HASH (64 hex characters) are required");
+    }
+
+    // a proof is one short line; "-" reads it from stdin
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char json[16384];
+    size_t length = file ? fread(json, 1, sizeof(json) - 1, file) : 0;
+    if (file && file != stdin) fclose(file);
+    if (!file || length == 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not read the proof file");
+    }
+    json[length] = '\0';
+
+    mmr_proof_t proof;
+    char block_hash[HASH_SIZE];
+    if (!mmr_read_proof_json(json, &proof, block_hash, sizeof(block_hash))) {
+        return fail(command, BATCH_EXIT_USAGE, "malformed proof");
+    }
+
+    int valid = mmr_verify(&proof, block_hash, root);
+    json_begin(command, 1);
+    fprintf(json_out, ",\"valid\":%s", valid ? "true" : "false");
+    json_long("index", proof.index);
+    json_long("leaves", proof.leaves);
+    json_string("block_hash", block_hash);
+    json_end();
+    return valid ? BATCH_EXIT_OK : BATCH_EXIT_INVALID;
+}
+
+// Write a patient's summary: the active prescriptions as JSON Lines,
+// newest first, then the result object
+int batch_write_patient(FILE *out, const char *command, const chain_view_t *view,
+                        const char *patient_id) {
+    if (!view->patients) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "the chain has no patient summaries");
+    }
+    const patient_summary_t *summary = patients_find(view->patients, patient_id);
+    if (!summary) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "no records for this patient");
+    }
+
+    for (int i = 0; i < summary->prescription_count; i++) {
+        fprintf(out, "{\"rank\":%d", i + 1);
+        batch_json_string(out, "prescription", summary->prescriptions[i]);
+        fprintf(out, "}\n");
+    }
+
+    batch_json_begin(out, command, 1);
+    batch_json_string(out, "patient_id", summary->patient_id);
+    batch_json_long(out, "visits", summary->visits);
+    batch_json_long(out, "first_index", summary->first_index);
+    batch_json_long(out, "last_index", summary->last_index);
+    batch_json_string(out, "last_visit", summary->last_visit);
+    batch_json_string(out, "last_doctor", summary->last_doctor);
+    batch_json_string(out, "diagnosis", summary->diagnosis);
+    batch_json_long(out, "prescriptions", summary->prescription_count);
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// Rebuild the patient summaries of a view from its blocks and write
+// whether the maintained ones match as the result object
+int batch_write_patients_check(FILE *out, const char *command, const chain_view_t *view) {
+    if (!view->patients) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "the chain has no patient summaries");
+    }
+
+    long checked = 0;
+    int consistent = patients_verify(view->patients, view, &checked);
+    if (consistent < 0) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "could not rebuild the summaries");
+    }
+
+    batch_json_begin(out, command, 1);
+    fprintf(out, ",\"consistent\":%s", consistent ? "true" : "false");
+    batch_json_long(out, "patients", checked);
+    batch_json_long(out, "height", view->length);
+    batch_json_end(out);
+    return consistent ? BATCH_EXIT_OK : BATCH_EXIT_INVALID;
+}
+
+// blockmed patient: summary of one patient's records
+static int batch_patient(const char *command, const batch_args_t *args, const user_t *user) {
+    const char *patient = batch_get_option(args, "patient");
+    if (!patient || patient[0] == '\0') {
+        return fail(command, BATCH_EXIT_USAGE, "--patient is required");
+    }
+
+    blockchain_t *chain = open_full_chain(args);
+    if (!chain) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_patient(json_out, command, &view, patient);
+    chain_read_end();
+    free_blockchain(chain);
+
+    log_operation(LOG_INFO, user->email, "Viewed patient summary");
+    return result;
+}
+
+// blockmed verify-patients: check the patient summaries against the chain
+static int batch_verify_patients(const char *command, const batch_args_t *args, const user_t *user) {
+    blockchain_t *chain = open_full_chain(args);
+    if (!chain) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_patients_check(json_out, command, &view);
+    chain_read_end();
+    free_blockchain(chain);
+
+    log_operation(LOG_INFO, user->email, result == BATCH_EXIT_OK ?
+                  "Verified patient summaries - CONSISTENT" : "Verified patient summaries - FAILED");
+    return result;
+}
+
+// blockmed keygen: create the encryption key (staff only). From then on
+// every chain file, snapshot and archive segment is written encrypted.
+// With `--kind signer` it creates this node's signer key for
+// proof-of-authority chains instead and reports the public key.
+static int batch_keygen(const char *command, const batch_args_t *args, const user_t *user) {
+    const char *kind = batch_get_option(args, "kind");
+    if (kind && strcmp(kind, "signer") != 0 && strcmp(kind, "encryption") != 0) {
+        return fail(command, BATCH_EXIT_USAGE, "--kind must be encryption or signer");
+    }
+    if (!has_full_permission(user->role)) {
+        log_security_event(user->email, "Attempted to create the encryption key without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    if (kind && strcmp(kind, "signer") == 0) {
+        char public_hex[2 * AUTHORITY_KEY_SIZE + 1];
+        if (!authority_generate_key(authority_key_path(), public_hex)) {
+            return fail(command, BATCH_EXIT_FAILURE, "could not create the signer key");
+        }
+        log_operation(LOG_INFO, user->email, "Created signer key");
+        json_begin(command, 1);
+        json_string("key_file", authority_key_path());
+        json_string("public_key", public_hex);
+        json_end();
+        return BATCH_EXIT_OK;
+    }
+
+    if (!cipher_generate_key(cipher_key_path())) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not create the key file");
+    }
+
+    log_operation(LOG_INFO, user->email, "Created encryption key");
+    json_begin(command, 1);
+    json_string("key_file", cipher_key_path());
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// blockmed encrypt: rewrite an unencrypted chain file with the key (staff
+// only). Its snapshot is dropped; the next load writes an encrypted one.
+static int batch_encrypt(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_full_permission(user->role)) {
+        log_security_event(user->email, "Attempted to encrypt the blockchain without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+    if (!cipher_enabled()) {
+        return fail(command, BATCH_EXIT_FAILURE, "no encryption key (run `blockmed keygen`)");
+    }
+
+    // the daemon keeps appending to the file it opened
+    int daemon_fd = client_connect(daemon_socket_path());
+    if (daemon_fd >= 0) {
+        close(daemon_fd);
+        return fail(command, BATCH_EXIT_FAILURE, "stop the daemon before encrypting");
+    }
+
+    const char *chain_file = batch_get_option(args, "chain");
+    if (!chain_file) chain_file = BATCH_CHAIN_FILE;
+    int encrypted = cipher_file_encrypted(chain_file);
+    if (encrypted < 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not open the blockchain file");
+    }
+
+    int length = 0;
+    if (!encrypted) {
+        char temp[4100], snapshot[4096];
+        if (snprintf(temp, sizeof(temp), "%s.tmp", chain_file) >= (int)sizeof(temp) ||
+            !snapshot_path(chain_file, snapshot, sizeof(snapshot))) {
+            return fail(command, BATCH_EXIT_USAGE, "chain path is too long");
+        }
+
+        blockchain_t *chain = load_blockchain(chain_file);
+        if (!chain) {
+            return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+        }
+        length = chain->length;
+        int saved = save_blockchain(chain, temp);
+        free_blockchain(chain);
+        if (!saved || rename(temp, chain_file) != 0 || !seals_rename(temp, chain_file)) {
+            unlink(temp);
+            return fail(command, BATCH_EXIT_FAILURE, "could not write the encrypted chain");
+        }
+        unlink(snapshot);
+        // the duplicate filter is written again, encrypted, on the next save
+        char filter[4096];
+        if (dedup_path(chain_file, filter, sizeof(filter))) unlink(filter);
+        log_operation(LOG_INFO, user->email, "Encrypted blockchain file");
+    }
+
+    json_begin(command, 1);
+    json_long("height", length);
+    fprintf(json_out, ",\"already_encrypted\":%s", encrypted ? "true" : "false");
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// Bring `chain` (saved in `chain_file`) up to the chain of the daemon named
+// by --peer and write the result object. Only the chain's writer calls this.
+int batch_write_sync(FILE *out, const char *command, blockchain_t *chain,
+                     const char *chain_file, const batch_args_t *args) {
+    long batch_size;
+    if (!batch_int_option(args, "batch-size", REPLICA_DEFAULT_BATCH, &batch_size)) {
+        return batch_fail(out, command, BATCH_EXIT_USAGE, "invalid --batch-size");
+    }
+
+    replica_stats_t stats;
+    int result = replica_sync(chain, chain_file, batch_get_option(args, "peer"), batch_size,
+                              &stats);
+    if (result != BATCH_EXIT_OK) {
+        return batch_fail(out, command, result, stats.error);
+    }
+
+    batch_json_begin(out, command, 1);
+    batch_json_long(out, "peer_height", stats.peer_height);
+    batch_json_long(out, "common", stats.common);
+    batch_json_long(out, "fetched", stats.fetched);
+    batch_json_long(out, "batches", stats.batches);
+    batch_json_long(out, "probes", stats.probes);
+    batch_json_long(out, "height", chain->length);
+    fprintf(out, ",\"seconds\":%.3f", stats.seconds);
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// blockmed sync: fetch the blocks a peer daemon has and this chain lacks
+static int batch_sync(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to sync the blockchain without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+    if (!batch_get_option(args, "peer")) {
+        return fail(command, BATCH_EXIT_USAGE, "--peer HOST:PORT is required");
+    }
+
+    const char *chain_file = batch_get_option(args, "chain");
+    if (!chain_file) chain_file = BATCH_CHAIN_FILE;
+    blockchain_t *chain = access(chain_file, F_OK) == 0 ? open_blockchain(chain_file)
+                                                        : open_chain_tail(chain_file);
+    if (!chain) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the blockchain file");
+    }
+
+    int result = batch_write_sync(json_out, command, chain, chain_file, args);
+    free_blockchain(chain);
+
+    log_operation(LOG_INFO, user->email, result == BATCH_EXIT_OK ?
+                  "Synced blockchain from peer" : "Blockchain sync failed");
+    return result;
+}
+
+// function to read the signer list of a new proof-of-authority chain: the
+// --signers file (one public key per line), or else this node's own key
+static int read_signers(const batch_args_t *args, char *signers, size_t size) {
+    const char *path = batch_get_option(args, "signers");
+    if (!path) return authority_public_key(signers);
+
+    FILE *file = fopen(path, "r");
+    size_t length = file ? fread(signers, 1, size - 1, file) : 0;
+    int complete = file && !ferror(file) && feof(file);
+    if (file) fclose(file);
+    signers[length] = '\0';
+    return complete;
+}
+
+// blockmed init: create a new chain file (staff only) with the consensus it
+// keeps for good. `--consensus work` mines every block, as the chains other
+// commands create; `--consensus authority` (the default) has the nodes
+// whose keys the genesis block lists sign blocks instead.
+static int batch_init(const char *command, const batch_args_t *args, const user_t *user) {
+    const char *consensus = batch_get_option(args, "consensus");
+    if (!consensus) consensus = "authority";
+    int authority = strcmp(consensus, "authority") == 0;
+    if (!authority && strcmp(consensus, "work") != 0) {
+        return fail(command, BATCH_EXIT_USAGE, "--consensus must be authority or work");
+    }
+    if (!has_full_permission(user->role)) {
+        log_security_event(user->email, "Attempted to create a blockchain without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    const char *chain_file = batch_get_option(args, "chain");
+    if (!chain_file) chain_file = BATCH_CHAIN_FILE;
+    if (access(chain_file, F_OK) == 0) {
+        return fail(command, BATCH_EXIT_USAGE, "the blockchain file already exists");
+    }
+
+    char signers[AUTHORITY_MAX_SIGNERS * (2 * AUTHORITY_KEY_SIZE + 2) + 1];
+    if (authority && !read_signers(args, signers, sizeof(signers))) {
+        return fail(command, BATCH_EXIT_USAGE,
+                    "could not read --signers (or, without it, this node's signer key)");
+    }
+
+    block_t *genesis = authority ? authority_genesis_block(signers) : create_genesis_block();
+    blockchain_t *chain = genesis ? allocate_blockchain() : NULL;
+    if (chain && authority && !(chain->seals = seals_create(genesis))) {
+        free_blockchain(chain);
+        chain = NULL;
+    }
+    if (!chain) {
+        free(genesis);
+        return fail(command, authority ? BATCH_EXIT_USAGE : BATCH_EXIT_FAILURE,
+                    "could not create the genesis block");
+    }
+    add_block_to_chain(chain, genesis);
+
+    int saved = save_blockchain(chain, chain_file);
+    int signer_count = chain->seals ? chain->seals->signer_count : 0;
+    int local_signer = chain->seals ? chain->seals->local_signer : -1;
+    free_blockchain(chain);
+    if (!saved) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not write the blockchain file");
+    }
+
+    log_operation(LOG_INFO, user->email, authority ? "Created proof-of-authority blockchain" :
+                                                     "Created proof-of-work blockchain");
+    json_begin(command, 1);
+    json_string("chain", chain_file);
+    json_string("consensus", consensus);
+    json_long("signers", signer_count);
+    json_long("local_signer", local_signer);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// function to load the shard layout, failing the command if there is none
+static int load_layout(const char *command, shard_layout_t *layout) {
+    if (shard_layout_load(layout)) return BATCH_EXIT_OK;
+    return fail(command, BATCH_EXIT_USAGE, "no shards are set up (see shard-init)");
+}
+
+// function to write the result of an anchor attempt as a JSON Lines entry
+static void write_anchor_json(const shard_anchor_t *anchor) {
+    fprintf(json_out, "{\"anchored\":%s", anchor->anchored ? "true" : "false");
+    json_long("root_height", anchor->root_height);
+    fprintf(json_out, "}\n");
+}
+
+// blockmed shard-init: split the records over independent chains, one per
+// name in --names (comma separated), plus the root chain anchoring them
+static int batch_shard_init(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_full_permission(user->role)) {
+        log_security_event(user->email, "Attempted to create shards without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+    const char *names = batch_get_option(args, "names");
+    if (!names) {
+        return fail(command, BATCH_EXIT_USAGE, "--names is required");
+    }
+
+    shard_layout_t layout;
+    if (!shard_layout_create(&layout, names)) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not create the shards");
+    }
+
+    log_operation(LOG_INFO, user->email, "Created sharded chains");
+    json_begin(command, 1);
+    json_long("shards", layout.count);
+    json_string("root", SHARD_ROOT_FILE);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// function to read --difficulty and set it for the miners
+static int set_difficulty_option(const batch_args_t *args) {
+    long difficulty;
+    if (!batch_int_option(args, "difficulty", get_mining_difficulty(), &difficulty) ||
+        difficulty < 1 || difficulty > 8) {
+        return 0;
+    }
+    set_mining_difficulty((int)difficulty);
+    return 1;
+}
+
+// blockmed shard-import: mine a CSV into the shards, every shard on its own
+// miner at once, then anchor the new tips. Writes one JSON line per shard.
+static int batch_shard_import(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to bulk import without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    const char *file = batch_get_option(args, "file");
+    const char *name = batch_get_option(args, "shard");
+    long batch_size;
+    if (!file || !set_difficulty_option(args) ||
+        !batch_int_option(args, "batch-size", IMPORT_DEFAULT_BATCH_SIZE, &batch_size)) {
+        return fail(command, BATCH_EXIT_USAGE,
+                    "invalid --difficulty or --batch-size (--file is required)");
+    }
+
+    shard_layout_t layout;
+    int result = load_layout(command, &layout);
+    if (result != BATCH_EXIT_OK) return result;
+    int shard = name ? shard_find(&layout, name) : -1;
+    if (name && shard < 0) {
+        return fail(command, BATCH_EXIT_USAGE, "unknown --shard");
+    }
+
+    import_stats_t stats[SHARD_MAX];
+    int ok = shard_import(&layout, file, shard, user, (int)batch_size, stats);
+
+    long mined = 0, rejected = 0, duplicates = 0;
+    int interrupted = 0;
+    for (int i = 0; i < layout.count; i++) {
+        fprintf(json_out, "{\"shard\":");
+        write_json_string(json_out, layout.names[i]);
+        json_long("mined", stats[i].records_imported);
+        json_long("rejected", stats[i].rows_rejected);
+        json_long("duplicates", stats[i].rows_duplicate);
+        fprintf(json_out, ",\"records_per_second\":%.1f", stats[i].records_per_second);
+        fprintf(json_out, "}\n");
+        mined += stats[i].records_imported;
+        rejected += stats[i].rows_rejected;
+        duplicates += stats[i].rows_duplicate;
+        interrupted = interrupted || stats[i].interrupted;
+    }
+
+    // whatever was mined is anchored, even if a shard failed
+    shard_anchor_t anchor;
+    int anchored = mined > 0 && shard_anchor(&layout, user, &anchor);
+    if (anchored) write_anchor_json(&anchor);
+    if (!ok || (mined > 0 && !anchored)) {
+        return fail(command, BATCH_EXIT_FAILURE, "sharded import failed");
+    }
+
+    log_operation(LOG_INFO, user->email, "Bulk imported records into shards");
+    json_begin(command, 1);
+    json_long("mined", mined);
+    json_long("rejected", rejected);
+    json_long("duplicates", duplicates);
+    fprintf(json_out, ",\"interrupted\":%s", interrupted ? "true" : "false");
+    json_end();
+    return interrupted ? BATCH_EXIT_FAILURE : BATCH_EXIT_OK;
+}
+
+// blockmed shard-anchor: commit the shard tips to the root chain (meant to
+// run periodically; nothing is added while no shard moved)
+static int batch_shard_anchor(const char *command, const batch_args_t *args, const user_t *user) {
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to anchor shards without permission");
+        return fail(command, BATCH_EXIT_DENIED, "permission denied");
+    }
+    if (!set_difficulty_option(args)) {
+        return fail(command, BATCH_EXIT_USAGE, "invalid --difficulty");
+    }
+
+    shard_layout_t layout;
+    int result = load_layout(command, &layout);
+    if (result != BATCH_EXIT_OK) return result;
+
+    shard_anchor_t anchor;
+    if (!shard_anchor(&layout, user, &anchor)) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not anchor the shards");
+    }
+
+    if (anchor.anchored) log_operation(LOG_INFO, user->email, "Anchored shard tips");
+    json_begin(command, 1);
+    fprintf(json_out, ",\"anchored\":%s", anchor.anchored ? "true" : "false");
+    json_long("root_height", anchor.root_height);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// queries of shard-query, one per shard
+typedef struct {
+    record_scan_t scans[SHARD_MAX];
+    char *output[SHARD_MAX];
+    size_t output_size[SHARD_MAX];
+} shard_query_t;
+
+// function to run the query on one shard into memory (shard_fan_out task)
+static int query_shard(int shard, const char *chain_file, void *ctx) {
+    shard_query_t *query = ctx;
+    record_scan_t *scan = &query->scans[shard];
+
+    scan->out = open_memstream(&query->output[shard], &query->output_size[shard]);
+    if (!scan->out) {
+        scan->error = "out of memory";
+        return 0;
+    }
+    int ok = scan_records(chain_file, scan);
+    fclose(scan->out);
+    return ok;
+}
+
+// blockmed shard-query: query every shard at once; record lines carry the
+// shard they come from and --limit applies to each shard
+static int batch_shard_query(const char *command, const batch_args_t *args, const user_t *user) {
+    long limit;
+    if (!batch_int_option(args, "limit", 0, &limit) || limit < 0) {
+        return fail(command, BATCH_EXIT_USAGE, "invalid --limit");
+    }
+
+    shard_layout_t layout;
+    int result = load_layout(command, &layout);
+    if (result != BATCH_EXIT_OK) return result;
+
+    shard_query_t query;
+    memset(&query, 0, sizeof(query));
+    for (int i = 0; i < layout.count; i++) {
+        record_scan_t *scan = &query.scans[i];
+        scan->shard = layout.names[i];
+        scan->patient = batch_get_option(args, "patient");
+        scan->doctor = batch_get_option(args, "doctor");
+        scan->to = -1;
+        scan->limit = limit;
+    }
+    int ok = shard_fan_out(&layout, query_shard, &query);
+
+    long matches = 0, scanned = 0;
+    const char *error = NULL;
+    for (int i = 0; i < layout.count; i++) {
+        if (ok && query.output[i]) fwrite(query.output[i], 1, query.output_size[i], json_out);
+        free(query.output[i]);
+        matches += query.scans[i].matches;
+        scanned += query.scans[i].scanned;
+        if (query.scans[i].error) error = query.scans[i].error;
+    }
+    if (!ok) {
+        return fail(command, BATCH_EXIT_FAILURE, error ? error : "could not query the shards");
+    }
+
+    log_operation(LOG_INFO, user->email, "Queried sharded chains (batch)");
+    json_begin(command, 1);
+    json_long("matches", matches);
+    json_long("scanned", scanned);
+    json_long("shards", layout.count);
+    json_end();
+    return BATCH_EXIT_OK;
+}
+
+// blockmed shard-validate: validate the root chain and every shard at once,
+// and check the shards still hold the tips the anchors committed
+static int batch_shard_validate(const char *command, const batch_args_t *args, const user_t *user) {
+    (void)args;
+    shard_layout_t layout;
+    int result = load_layout(command, &layout);
+    if (result != BATCH_EXIT_OK) return result;
+
+    shard_verify_t verify;
+    int valid = shard_verify(&layout, &verify);
+    if (verify.root_height == 0) {
+        return fail(command, BATCH_EXIT_FAILURE, "could not load the root chain");
+    }
+
+    for (int i = 0; i < layout.count; i++) {
+        const shard_report_t *report = &verify.shards[i];
+        fprintf(json_out, "{\"shard\":");
+        write_json_string(json_out, layout.names[i]);
+        json_long("height", report->height);
+        fprintf(json_out, ",\"valid\":%s", report->valid ? "true" : "false");
+        json_long("anchored_height", report->anchored_height);
+        fprintf(json_out, ",\"anchors_match\":%s", report->anchors_match ? "true" : "false");
+        fprintf(json_out, "}\n");
+    }
+
+    log_operation(LOG_INFO, user->email, valid ? "Validated sharded chains - VALID" :
+                                                  "Validated sharded chains - INVALID");
+    json_begin(command, 1);
+    fprintf(json_out, ",\"valid\":%s", valid ? "true" : "false");
+    fprintf(json_out, ",\"root_valid\":%s", verify.root_valid ? "true" : "false");
+    json_long("root_height", verify.root_height);
+    json_long("anchors", verify.anchors);
+    json_end();
+    return valid ? BATCH_EXIT_OK : BATCH_EXIT_INVALID;
+}
+
+// function to find a batch command by name
+static const batch_command_t *find_command(const char *name) {
+    for (int i = 0; name && i < COMMAND_COUNT; i++) {
+        if (strcmp(commands[i].name, name) == 0) return &commands[i];
+    }
+    return NULL;
+}
+
+// Check whether argv[1] names a batch command
+int is_batch_command(const char *name) {
+    return find_command(name) != NULL;
+}
+
+// Check whether a batch command always runs in this process; such commands
+// are never forwarded to the daemon
+int is_local_batch_command(const char *name) {
+    const batch_command_t *command = find_command(name);
+    return command && command->local;
+}
+
+// Run one batch command. Credentials come from BLOCKMED_EMAIL and
+// BLOCKMED_PASSWORD; the result is one JSON object on stdout (after any
+// JSON Lines records) and the exit code tells success from failure.
+int run_batch(int argc, char *argv[]) {
+    if (!redirect_output()) {
+        fprintf(stderr, "Error: Could not set up batch output\n");
+        return BATCH_EXIT_FAILURE;
+    }
+    set_quiet_mode(1);
+
+    const char *name = argc > 1 ? argv[1] : "";
+    const batch_command_t *command = find_command(name);
+
+    int result;
+    batch_args_t args;
+    user_t user;
+    const char *unknown;
+
+    if (!command) {
+        result = fail(name, BATCH_EXIT_USAGE,
+                      "unknown command (add, mine, validate, export, query, import, audit, "
+                      "status, root, proof, verify-proof, patient, verify-patients, keygen, "
+                      "encrypt, sync, init, shard-init, shard-import, shard-anchor, "
+                      "shard-query, shard-validate)");
+    } else if (!batch_parse_options(argc, argv, &args)) {
+        result = fail(name, BATCH_EXIT_USAGE, "options must be given as --name value");
+    } else if ((unknown = batch_unknown_option(&args, command->options))) {
+        char message[128];
+        snprintf(message, sizeof(message), "unknown option --%s", unknown);
+        result = fail(name, BATCH_EXIT_USAGE, message);
+    } else if (!cipher_configure(NULL)) {
+        result = fail(name, BATCH_EXIT_FAILURE, "could not load the encryption key");
+    } else if (!authority_configure(NULL)) {
+        result = fail(name, BATCH_EXIT_FAILURE, "could not load the signer key");
+    } else if (!command->public && !batch_login(&user)) {
+        result = fail(name, BATCH_EXIT_DENIED,
+                      "set BLOCKMED_EMAIL and BLOCKMED_PASSWORD to valid credentials");
+    } else {
+        result = command->run(name, &args, &user);
+    }
+
+    fclose(json_out);
+    json_out = NULL;
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "blockchain.h"
+#include "auth.h"
+#include "audit_store.h"
+
+// records added with `blockmed add` wait here until `blockmed mine`; the
+// file uses the bulk import CSV format
+#define BATCH_PENDING_FILE "data/pending.csv"
+#define BATCH_MINING_FILE "data/pending.mining.csv"
+#define BATCH_CLAIM_FILE "data/pending.mining.lock"
+#define BATCH_CHAIN_FILE "data/blockchain.dat"
+#define BATCH_MAX_OPTIONS 16
+
+// exit codes of batch commands
+#define BATCH_EXIT_OK 0
+#define BATCH_EXIT_FAILURE 1        // the operation failed (I/O, mining, ...)
+#define BATCH_EXIT_USAGE 2          // unknown command or bad options
+#define BATCH_EXIT_DENIED 3         // missing credentials or permission
+#define BATCH_EXIT_INVALID 4        // validation found a tampered chain
+
+// `--name value` pairs given after the command
+typedef struct {
+    const char *name;
+    const char *value;
+} batch_option_t;
+
+typedef struct {
+    batch_option_t items[BATCH_MAX_OPTIONS];
+    int count;
+} batch_args_t;
+
+// Function prototypes
+int is_batch_command(const char *name);
+int is_local_batch_command(const char *name);
+int run_batch(int argc, char *argv[]);
+int batch_claim_pending(int *claim);
+void batch_release_claim(int claim, int mined);
+
+// shared with the daemon, which answers with the same JSON
+int batch_parse_options(int argc, char *argv[], batch_args_t *args);
+const char *batch_get_option(const batch_args_t *args, const char *name);
+const char *batch_unknown_option(const batch_args_t *args, const char *const accepted[]);
+int batch_int_option(const batch_args_t *args, const char *name, long fallback, long *value);
+void batch_json_begin(FILE *out, const char *command, int ok);
+void batch_json_string(FILE *out, const char *key, const char *value);
+void batch_json_long(FILE *out, const char *key, long value);
+void batch_json_end(FILE *out);
+int batch_fail(FILE *out, const char *command, int code, const char *message);
+void batch_write_block_json(FILE *out, const block_t *block);
+int batch_write_audit_json(const audit_entry_t *entry, void *ctx);
+int batch_write_root(FILE *out, const char *command, const chain_view_t *view,
+                     const batch_args_t *args);
+int batch_write_proof(FILE *out, const char *command, const chain_view_t *view, long height);
+int batch_write_patient(FILE *out, const char *command, const chain_view_t *view,
+                        const char *patient_id);
+int batch_write_patients_check(FILE *out, const char *command, const chain_view_t *view);
+int batch_write_sync(FILE *out, const char *command, blockchain_t *chain,
+                     const char *chain_file, const batch_args_t *args);
+
+#endif
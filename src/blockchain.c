@@ -1,4 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include "blockchain.h"
+#include "metrics.h"
+#include "trace.h"
+#include "epoch.h"
+#include "archive.h"
+#include "patients.h"
+#include "dedup.h"
+#include "authority.h"
+#include <sys/mman.h>
 
 // ANSI Color codes for beautiful terminal output
 #define RESET_COLOR     "\033[0m"
@@ -58,20 +67,47 @@ void print_chain_link() {
     printf("       ▼\n" RESET_COLOR);
 }
 
+// Allocate an empty chain (no genesis block)
+blockchain_t *allocate_blockchain(void) {
+    blockchain_t *chain = malloc(sizeof(blockchain_t));
+    if (!chain) return NULL;
+
+    chain->head = NULL;
+    chain->tail = NULL;
+    chain->length = 0;
+    atomic_init(&chain->published, NULL);
+    memset(&chain->image, 0, sizeof(chain->image));
+    atomic_init(&chain->validated, 0);
+    chain->mmr = mmr_create();
+    chain->patients = patients_create();
+    chain->seals = NULL;
+    chain->dedup = dedup_create();
+    chain->archive = archive_create();
+    chain->archived = 0;
+    memset(&chain->retiring, 0, sizeof(chain->retiring));
+    if (!chain->mmr || !chain->patients || !chain->dedup ||
+        (archive_resident_blocks() > 0 && !chain->archive)) {
+        mmr_free(chain->mmr);
+        patients_free(chain->patients);
+        dedup_free(chain->dedup);
+        archive_free(chain->archive);
+        free(chain);
+        return NULL;
+    }
+    return chain;
+}
+
 // Functions to create blockchain
 blockchain_t* create_blockchain(void) {
+    uint64_t span = trace_begin();
     printf(BRIGHT_BLUE "🔄 Initializing BlockMed Blockchain...\n" RESET_COLOR);
     
-    blockchain_t *chain = malloc(sizeof(blockchain_t));
+    blockchain_t *chain = allocate_blockchain();
     if (!chain) {
         printf(RED "❌ Failed to allocate memory for blockchain!\n" RESET_COLOR);
         return NULL;
     }
 
-    chain->head = NULL;
-    chain->tail = NULL;
-    chain->length = 0;
-
     printf(YELLOW "⚡ Creating Genesis Block...\n" RESET_COLOR);
     
     // Create the genesis block
@@ -82,16 +118,75 @@ blockchain_t* create_blockchain(void) {
         printf(BRIGHT_CYAN "🎉 Genesis block created with hash: " CYAN "%.16s...\n" RESET_COLOR, genesis->current_hash);
     } else {
         printf(RED "❌ Failed to create genesis block!\n" RESET_COLOR);
-        free(chain);
+        free_blockchain(chain);
         return NULL;
     }
     
+    trace_end("create_blockchain", span);
     return chain;
 }
 
+// function to copy a field of at most `size` - 1 bytes to `out`; returns
+// where the next one goes
+static char *copy_field(char *out, const char *value, size_t size, const char **field) {
+    const char *str = value ? value : "";
+    size_t length = strnlen(str, size - 1);
+    memcpy(out, str, length);
+    out[length] = '\0';
+    *field = out;
+    return out + length + 1;
+}
+
+// function to allocate a block holding `tx`, whose doctor and diagnosis
+// must be interned. The patient, prescription and visit note are copied in
+// behind the block, in the same allocation, so freeing the block frees
+// them too.
+static block_t *allocate_block(const medical_transaction_t *tx) {
+    const char *patient = tx->patient_id ? tx->patient_id : "";
+    const char *prescription = tx->prescription ? tx->prescription : "";
+    const char *note = tx->visit_note ? tx->visit_note : "";
+    size_t length = strnlen(patient, MAX_PATIENT_ID_SIZE - 1) +
+                    strnlen(prescription, MAX_PRESCRIPTION_SIZE - 1) +
+                    strnlen(note, MAX_NOTES_SIZE - 1) + 3;
+    block_t *block = malloc(sizeof(block_t) + length);
+    if (!block) return NULL;
+
+    block->transaction = *tx;
+    char *out = (char *)(block + 1);
+    out = copy_field(out, patient, MAX_PATIENT_ID_SIZE, &block->transaction.patient_id);
+    out = copy_field(out, prescription, MAX_PRESCRIPTION_SIZE, &block->transaction.prescription);
+    copy_field(out, note, MAX_NOTES_SIZE, &block->transaction.visit_note);
+    block->next = NULL;
+    return block;
+}
+
+// Copy a block (read from a record, say) into a block of its own, with
+// its doctor and diagnosis interned
+block_t *copy_block(const block_t *block) {
+    medical_transaction_t tx = block->transaction;
+    if (!intern_transaction(&tx)) return NULL;
+
+    block_t *copy = allocate_block(&tx);
+    if (!copy) return NULL;
+    copy->index = block->index;
+    memcpy(copy->timestamp, block->timestamp, sizeof(copy->timestamp));
+    copy->nonce = block->nonce;
+    memcpy(copy->previous_hash, block->previous_hash, HASH_SIZE);
+    memcpy(copy->current_hash, block->current_hash, HASH_SIZE);
+    return copy;
+}
+
 // Create the genesis block with initial transaction
 block_t* create_genesis_block(void) {
-    block_t *genesis = malloc(sizeof(block_t));
+    printf(DIM "   📝 Setting up genesis transaction...\n" RESET_COLOR);
+
+    // Create a dummy transaction for the genesis block
+    medical_transaction_t tx;
+    block_t *genesis = NULL;
+    if (create_transaction(&tx, "GENESIS", "system@alueducation.com",
+                           "Genesis Block", "No Prescription", "Initial Block in the chain")) {
+        genesis = allocate_block(&tx);
+    }
     if (!genesis) {
         printf(RED "❌ Memory allocation failed for genesis block!\n" RESET_COLOR);
         return NULL;
@@ -100,12 +195,6 @@ block_t* create_genesis_block(void) {
     genesis->index = 0;
     get_timestamp(genesis->timestamp);
 
-    printf(DIM "   📝 Setting up genesis transaction...\n" RESET_COLOR);
-    
-    // Create a dummy transaction for the genesis block
-    create_transaction(&genesis->transaction, "GENESIS", "system@alueducation.com",
-                       "Genesis Block", "No Prescription", "Initial Block in the chain");
-
     // Set nonce and previous hash for the genesis block
     genesis->nonce = 0;
     strcpy(genesis->previous_hash, "0000000000000000000000000000000000000000000000000000000000000000");
@@ -128,10 +217,12 @@ block_t* create_block(int index, const medical_transaction_t *tx, const char *pr
         return NULL;
     }
 
-    printf(BRIGHT_BLUE "🔨 Creating new block #%d...\n" RESET_COLOR, index);
+    if (!is_quiet_mode()) {
+        printf(BRIGHT_BLUE "🔨 Creating new block #%d...\n" RESET_COLOR, index);
+    }
 
     // Allocate memory for the new block
-    block_t *block = malloc(sizeof(block_t));
+    block_t *block = allocate_block(tx);
     if (!block) {
         printf(RED "❌ Memory allocation failed for block #%d!\n" RESET_COLOR, index);
         return NULL;
@@ -140,7 +231,6 @@ block_t* create_block(int index, const medical_transaction_t *tx, const char *pr
     // Initialize the block fields
     block->index = index;
     get_timestamp(block->timestamp);
-    block->transaction = *tx;
     block->nonce = 0;
     
     // Copy the previous hash and initialize the current hash
@@ -148,9 +238,11 @@ block_t* create_block(int index, const medical_transaction_t *tx, const char *pr
     block->previous_hash[HASH_SIZE - 1] = '\0';
     block->next = NULL;
 
-    printf(BRIGHT_GREEN "✅ Block #%d structure created successfully!\n" RESET_COLOR, index);
-    printf(DIM "   📝 Patient ID: %s\n" RESET_COLOR, tx->patient_id);
-    printf(DIM "   👨‍⚕️ Doctor: %s\n" RESET_COLOR, tx->doctor_email);
+    if (!is_quiet_mode()) {
+        printf(BRIGHT_GREEN "✅ Block #%d structure created successfully!\n" RESET_COLOR, index);
+        printf(DIM "   📝 Patient ID: %s\n" RESET_COLOR, tx->patient_id);
+        printf(DIM "   👨‍⚕️ Doctor: %s\n" RESET_COLOR, tx->doctor_email);
+    }
 
     return block;
 }
@@ -162,6 +254,26 @@ void calculate_block_hash(block_t *block) {
         return;
     }
 
+    // time a sample of hashes only, the clock reads would cost more than
+    // the counter on this path
+    static __thread unsigned int hash_calls = 0;
+    int sampled = ++hash_calls % METRICS_HASH_SAMPLE == 0;
+    uint64_t start = sampled ? metrics_now_ns() : 0;
+
+    compute_block_hash(block, block->current_hash);
+
+    metrics_counter_add(METRIC_BLOCK_HASHES, 1);
+    if (sampled) {
+        metrics_observe(METRIC_HASH_LATENCY, metrics_now_ns() - start);
+    }
+
+    if (block->index > 0 && !is_quiet_mode()) {  // Don't show for genesis block to avoid spam
+        printf(DIM "   🔐 Hash calculated: %s%.16s...\n" RESET_COLOR, CYAN, block->current_hash);
+    }
+}
+
+// Compute the hash of a block into `hash` without modifying the block
+void compute_block_hash(const block_t *block, char *hash) {
     // Prepare the string representation of the block
     char tx_string[2048];
     transaction_to_string(&block->transaction, tx_string);
@@ -172,14 +284,146 @@ void calculate_block_hash(block_t *block) {
              block->index, block->timestamp, tx_string, block->nonce, block->previous_hash);
 
     // Calculate the SHA-256 hash of the block data
-    sha256_hash(block_data, block->current_hash);
-    
-    if (block->index > 0) {  // Don't show for genesis block to avoid spam
-        printf(DIM "   🔐 Hash calculated: %s%.16s...\n" RESET_COLOR, CYAN, block->current_hash);
+    sha256_hash(block_data, hash);
+}
+
+// Check that `block` correctly extends `previous` (NULL for a genesis
+// block): consecutive index, matching previous hash and an intact hash
+int block_follows(const block_t *previous, const block_t *block) {
+    if (previous && (block->index != previous->index + 1 ||
+                     strcmp(block->previous_hash, previous->current_hash) != 0)) {
+        return 0;
     }
+    if (!previous && block->index != 0) return 0;
+
+    char hash[HASH_SIZE];
+    compute_block_hash(block, hash);
+    metrics_counter_add(METRIC_BLOCK_HASHES, 1);
+    return strcmp(hash, block->current_hash) == 0;
 }
 
-// Add a block to the blockchain with enhanced feedback
+// function to free a list of blocks (the first `count`, or all of them if
+// `count` is negative), unmapping the snapshot image the first blocks may
+// live in. Returns the number of blocks released.
+static int release_blocks(block_t *head, const block_image_t *image, int count) {
+    int released = 0;
+    block_t *current = head;
+    while (current && (count < 0 || released < count)) {
+        block_t *next = current->next;
+        if (!image->blocks || current < image->blocks || current >= image->blocks + image->count) {
+            free(current);
+        }
+        released++;
+        current = next;
+    }
+    if (image->map) {
+        munmap(image->map, image->map_size);
+    }
+    return released;
+}
+
+// blocks unlinked from a chain by chain_replace or archived by
+// evict_blocks, with whatever else must outlive their readers
+typedef struct block_list {
+    block_t *head;
+    int count;                  // -1: the whole list
+    block_image_t image;
+    mmr_t *mmr;
+    patient_table_t *patients;
+    seal_table_t *seals;
+    dedup_filter_t *dedup;
+    archive_t *archive;
+} block_list_t;
+
+// function to free an unlinked block list (epoch release callback)
+static void free_block_list(void *ptr) {
+    block_list_t *list = ptr;
+    // the accumulator may live in the image too
+    mmr_free(list->mmr);
+    patients_free(list->patients);
+    seals_free(list->seals);
+    dedup_free(list->dedup);
+    archive_free(list->archive);
+    release_blocks(list->head, &list->image, list->count);
+    free(list);
+}
+
+// function to move the oldest blocks in memory to the archive while more
+// than the resident horizon are loaded. Returns the unlinked blocks, to be
+// retired once readers can no longer reach them, or NULL.
+static block_list_t *evict_blocks(blockchain_t *chain) {
+    int resident = archive_resident_blocks();
+    if (!chain->archive || chain->length - chain->archived < resident + ARCHIVE_SEGMENT_BLOCKS) {
+        return NULL;
+    }
+
+    block_list_t *list = calloc(1, sizeof(block_list_t));
+    if (!list) return NULL;
+    list->head = chain->head;
+    // image blocks are not freed one by one and the rest of the image
+    // stays with the chain
+    list->image = chain->image;
+    list->image.map = NULL;
+
+    while (chain->length - chain->archived >= resident + ARCHIVE_SEGMENT_BLOCKS &&
+           archive_seal(chain->archive, chain->head)) {
+        for (int i = 0; i < ARCHIVE_SEGMENT_BLOCKS; i++) {
+            chain->head = chain->head->next;
+        }
+        chain->archived += ARCHIVE_SEGMENT_BLOCKS;
+        list->count += ARCHIVE_SEGMENT_BLOCKS;
+    }
+
+    if (list->count == 0) {
+        free(list);
+        return NULL;
+    }
+    return list;
+}
+
+// function to hold what the writer unlinked until a publish succeeds: the
+// last snapshot readers got may still reach it. Blocks evicted by later
+// appends follow the ones already held, so the lists are joined.
+static void defer_retirement(blockchain_t *chain, block_list_t *evicted,
+                             mmr_t *dropped, patient_table_t *stale) {
+    if (evicted) {
+        block_list_t *held = chain->retiring.blocks;
+        if (!held) {
+            chain->retiring.blocks = evicted;
+        } else {
+            held->count += evicted->count;
+            free(evicted);
+        }
+    }
+    if (dropped) chain->retiring.mmr = dropped;
+    if (stale) chain->retiring.patients = stale;
+}
+
+// function to retire what failed publishes left behind, once a snapshot
+// without it is published
+static void retire_deferred(blockchain_t *chain) {
+    epoch_retire(chain->retiring.mmr, mmr_release);
+    epoch_retire(chain->retiring.patients, patients_release);
+    epoch_retire(chain->retiring.blocks, free_block_list);
+    chain->retiring.mmr = NULL;
+    chain->retiring.patients = NULL;
+    chain->retiring.blocks = NULL;
+}
+
+// Archive the oldest blocks beyond the resident horizon and publish the
+// result (after loading a chain other than block by block). Only the
+// writer thread calls this. Returns the number of blocks archived, or -1
+// if the result could not be published (the next publish retires them).
+int chain_archive_old_blocks(blockchain_t *chain) {
+    block_list_t *evicted = evict_blocks(chain);
+    int count = evicted ? evicted->count : 0;
+    defer_retirement(chain, evicted, NULL, NULL);
+    return chain_publish(chain) ? count : -1;
+}
+
+// Add a block to the blockchain with enhanced feedback. Returns 0 if the
+// block could not be published to readers yet; it stays on the chain and
+// the next successful publish shows it.
 int add_block_to_chain(blockchain_t *chain, block_t *block) {
     if (!chain || !block) {
         printf(RED "❌ Cannot add block - invalid chain or block!\n" RESET_COLOR);
@@ -191,17 +435,50 @@ int add_block_to_chain(blockchain_t *chain, block_t *block) {
         // Adding the first block (genesis block)
         chain->head = block;
         chain->tail = block;
-        printf(BRIGHT_YELLOW "🌟 Genesis block added to chain!\n" RESET_COLOR);
+        if (!is_quiet_mode()) {
+            printf(BRIGHT_YELLOW "🌟 Genesis block added to chain!\n" RESET_COLOR);
+        }
     } else {
         // Adding subsequent blocks
         chain->tail->next = block;
         chain->tail = block;
-        printf(BRIGHT_GREEN "🔗 Block #%d linked to blockchain!\n" RESET_COLOR, block->index);
-        printf(BRIGHT_CYAN "📊 Chain length: %d → %d\n" RESET_COLOR, chain->length, chain->length + 1);
+        if (!is_quiet_mode()) {
+            printf(BRIGHT_GREEN "🔗 Block #%d linked to blockchain!\n" RESET_COLOR, block->index);
+            printf(BRIGHT_CYAN "📊 Chain length: %d → %d\n" RESET_COLOR, chain->length, chain->length + 1);
+        }
     }
     
     chain->length++;
-    return 1;
+
+    // chains loaded without their earlier blocks have no accumulator; one
+    // that cannot grow is dropped rather than left behind the chain
+    mmr_t *dropped = NULL;
+    if (chain->mmr && (chain->mmr->leaves != chain->length - 1 ||
+                       !mmr_append(chain->mmr, block->current_hash))) {
+        printf(YELLOW "⚠️  Block accumulator disabled - inclusion proofs are unavailable\n" RESET_COLOR);
+        dropped = chain->mmr;
+        chain->mmr = NULL;
+    }
+    patient_table_t *stale = NULL;
+    if (chain->patients && !patients_apply(chain->patients, block)) {
+        printf(YELLOW "⚠️  Patient summaries disabled - reload the chain to rebuild them\n" RESET_COLOR);
+        stale = chain->patients;
+        chain->patients = NULL;
+    }
+    // unlike the two above, a filter that cannot take the block stays
+    // attached: it is updated in place under its lock and the import
+    // pipeline holds it outside any epoch. Marked incomplete, it finds no
+    // duplicates and is not saved, so nothing is rejected against it.
+    if (chain->dedup && !dedup_apply(chain->dedup, block)) {
+        printf(YELLOW "⚠️  Duplicate checks disabled - reload the chain to rebuild them\n" RESET_COLOR);
+    }
+
+    block_list_t *evicted = evict_blocks(chain);
+    defer_retirement(chain, evicted, dropped, stale);
+
+    // readers stop at the tail of their snapshot, so the block becomes
+    // visible to them only here
+    return chain_publish(chain);
 }
 
 // Print the entire blockchain with beautiful formatting
@@ -211,19 +488,24 @@ void print_blockchain(const blockchain_t *chain) {
         return;
     }
 
-    if (chain->length == 0) {
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    if (view.length == 0) {
+        chain_read_end();
         printf(YELLOW "⚠️  Blockchain is empty!\n" RESET_COLOR);
         return;
     }
 
+    uint64_t span = trace_begin();
+
     // Header
     printf("\n");
     printf(BRIGHT_CYAN "╔════════════════════════════════════════════════════════════════╗\n" RESET_COLOR);
-    printf(BRIGHT_CYAN "║" BOLD BRIGHT_WHITE " 🏥 BLOCKMED BLOCKCHAIN EXPLORER - %d BLOCKS" RESET_COLOR "%-15s" BRIGHT_CYAN "║\n" RESET_COLOR, chain->length, "");
+    printf(BRIGHT_CYAN "║" BOLD BRIGHT_WHITE " 🏥 BLOCKMED BLOCKCHAIN EXPLORER - %d BLOCKS" RESET_COLOR "%-15s" BRIGHT_CYAN "║\n" RESET_COLOR, view.length, "");
     printf(BRIGHT_CYAN "╚════════════════════════════════════════════════════════════════╝\n" RESET_COLOR);
     printf("\n");
 
-    block_t *current = chain->head;
+    const block_t *current = chain_view_first(&view);
     int block_count = 0;
 
     while (current) {
@@ -262,43 +544,95 @@ void print_blockchain(const blockchain_t *chain) {
         print_block_footer();
         
         // Show chain link if not the last block
-        if (current->next) {
+        if (current != view.tail) {
             print_chain_link();
         }
 
-        current = current->next;
+        current = chain_view_next(&view, current);
     }
+    chain_read_end();
     
     // Footer summary
     printf("\n");
     printf(BRIGHT_CYAN "╔════════════════════════════════════════════════════════════════╗\n" RESET_COLOR);
     printf(BRIGHT_CYAN "║" BRIGHT_WHITE " 📊 BLOCKCHAIN SUMMARY" RESET_COLOR "%-40s" BRIGHT_CYAN "║\n" RESET_COLOR, "");
-    printf(BRIGHT_CYAN "║" BRIGHT_WHITE " Total Blocks: " BOLD "%d" RESET_COLOR "%-45s" BRIGHT_CYAN "║\n" RESET_COLOR, chain->length, "");
-    printf(BRIGHT_CYAN "║" BRIGHT_WHITE " Medical Records: " BOLD "%d" RESET_COLOR "%-40s" BRIGHT_CYAN "║\n" RESET_COLOR, chain->length - 1, "");
+    printf(BRIGHT_CYAN "║" BRIGHT_WHITE " Total Blocks: " BOLD "%d" RESET_COLOR "%-45s" BRIGHT_CYAN "║\n" RESET_COLOR, view.length, "");
+    printf(BRIGHT_CYAN "║" BRIGHT_WHITE " Medical Records: " BOLD "%d" RESET_COLOR "%-40s" BRIGHT_CYAN "║\n" RESET_COLOR, view.length - 1, "");
     printf(BRIGHT_CYAN "║" BRIGHT_WHITE " Chain Status: " BRIGHT_GREEN "🔒 SECURE & IMMUTABLE" RESET_COLOR "%-23s" BRIGHT_CYAN "║\n" RESET_COLOR, "");
     printf(BRIGHT_CYAN "╚════════════════════════════════════════════════════════════════╝\n" RESET_COLOR);
+    trace_end("print_blockchain", span);
 }
 
-// Validate the blockchain with enhanced visual feedback
-int validate_blockchain(const blockchain_t *chain) {
-    if (!chain || !chain->head) {
+// seals of a proof-of-authority chain waiting to be checked
+typedef struct {
+    const seal_table_t *seals;
+    seal_check_t *checks;
+    long count;
+} seal_batch_t;
+
+// function to check the queued seals (on several threads) and empty the
+// batch
+static int flush_seals(seal_batch_t *batch) {
+    long bad = batch->count > 0 ? seals_verify(batch->seals, batch->checks, batch->count) : -1;
+    if (bad >= 0) {
+        printf(RED " ❌ FAILED!\n" RESET_COLOR);
+        printf(RED "🚨 Block %ld is not signed by an authority of the chain!\n" RESET_COLOR,
+               batch->checks[bad].index);
+    }
+    batch->count = 0;
+    return bad < 0;
+}
+
+// function to queue the seal of a block for checking, checking the batch
+// once it is full
+static int queue_seal(seal_batch_t *batch, const block_t *block) {
+    if (!batch || block->index == 0) return 1;
+
+    const unsigned char *seal = seals_get(batch->seals, block->index);
+    if (!seal) {
+        printf(RED " ❌ FAILED!\n" RESET_COLOR);
+        printf(RED "🚨 Block %d has no seal!\n" RESET_COLOR, block->index);
+        return 0;
+    }
+    seal_check_t *check = &batch->checks[batch->count++];
+    check->index = block->index;
+    check->signer = block->nonce;
+    memcpy(check->hash, block->current_hash, HASH_SIZE);
+    memcpy(check->seal, seal, AUTHORITY_SEAL_SIZE);
+    return batch->count < AUTHORITY_VERIFY_BATCH || flush_seals(batch);
+}
+
+// Validate the blockchain with enhanced visual feedback. On a
+// proof-of-authority chain (`batch` not NULL) the seals are checked too.
+static int validate_chain_blocks(const chain_view_t *view, seal_batch_t *batch) {
+    const block_t *current = chain_view_first(view);
+    if (!current) {
         printf(RED "❌ Cannot validate - blockchain is NULL or empty!\n" RESET_COLOR);
         return 0;
     }
 
-    printf(BRIGHT_BLUE "🔍 Starting comprehensive blockchain validation...\n" RESET_COLOR);
-    printf(YELLOW "📊 Validating %d blocks in the chain...\n\n" RESET_COLOR, chain->length);
+    int quiet = is_quiet_mode();
+    if (!quiet) {
+        printf(BRIGHT_BLUE "🔍 Starting comprehensive blockchain validation...\n" RESET_COLOR);
+        printf(YELLOW "📊 Validating %d blocks in the chain...\n\n" RESET_COLOR, view->length);
+    }
 
-    block_t *current = chain->head;
     int blocks_validated = 0;
-    int total_blocks = chain->length;
+    int total_blocks = view->length;
 
-    while (current->next) {
-        block_t *next_block = current->next;
+    while (current != view->tail) {
+        const block_t *next_block = chain_view_next(view, current);
+        if (!next_block) {
+            printf(RED "❌ Block #%d could not be read from the archive!\n" RESET_COLOR,
+                   current->index + 1);
+            return 0;
+        }
         blocks_validated++;
         
         // Progress indicator
-        printf(BRIGHT_WHITE "🔍 Validating Block #%d" RESET_COLOR, current->index);
+        if (!quiet) {
+            printf(BRIGHT_WHITE "🔍 Validating Block #%d" RESET_COLOR, current->index);
+        }
         
         // Check if the current block's hash matches the next block's previous hash
         if (strcmp(current->current_hash, next_block->previous_hash) != 0) {
@@ -309,53 +643,248 @@ int validate_blockchain(const blockchain_t *chain) {
             return 0;
         }
 
-        // Verify the current block's hash
+        // Verify the current block's hash without overwriting the stored one
         char temp_hash[HASH_SIZE];
-        strcpy(temp_hash, current->current_hash);
-        calculate_block_hash(current);
+        uint64_t hash_span = trace_begin();
+        compute_block_hash(current, temp_hash);
+        metrics_counter_add(METRIC_BLOCK_HASHES, 1);
+        trace_end("validate.block_hash", hash_span);
 
         // Check if the calculated hash matches the stored hash
         if (strcmp(temp_hash, current->current_hash) != 0) {
             printf(RED " ❌ FAILED!\n" RESET_COLOR);
             printf(RED "🚨 Block %d has been tampered with!\n" RESET_COLOR, current->index);
-            printf(RED "   Original:   %s\n" RESET_COLOR, temp_hash);
-            printf(RED "   Calculated: %s\n" RESET_COLOR, current->current_hash);
+            printf(RED "   Original:   %s\n" RESET_COLOR, current->current_hash);
+            printf(RED "   Calculated: %s\n" RESET_COLOR, temp_hash);
             return 0;
         }
+        if (!queue_seal(batch, current)) return 0;
 
-        printf(BRIGHT_GREEN " ✅ VALID\n" RESET_COLOR);
-        
-        // Show progress
-        float progress = (float)blocks_validated / (total_blocks - 1) * 100;
-        printf(DIM "   Progress: %.1f%% (%d/%d blocks validated)\n\n" RESET_COLOR, 
-               progress, blocks_validated, total_blocks - 1);
+        if (!quiet) {
+            printf(BRIGHT_GREEN " ✅ VALID\n" RESET_COLOR);
+
+            // Show progress
+            float progress = (float)blocks_validated / (total_blocks - 1) * 100;
+            printf(DIM "   Progress: %.1f%% (%d/%d blocks validated)\n\n" RESET_COLOR,
+                   progress, blocks_validated, total_blocks - 1);
+        }
 
-        current = current->next;
+        current = next_block;
     }
     
     // Final validation of the last block
-    printf(BRIGHT_WHITE "🔍 Validating Block #%d" RESET_COLOR, current->index);
+    if (!quiet) {
+        printf(BRIGHT_WHITE "🔍 Validating Block #%d" RESET_COLOR, current->index);
+    }
     char temp_hash[HASH_SIZE];
-    strcpy(temp_hash, current->current_hash);
-    calculate_block_hash(current);
+    uint64_t hash_span = trace_begin();
+    compute_block_hash(current, temp_hash);
+    metrics_counter_add(METRIC_BLOCK_HASHES, 1);
+    trace_end("validate.block_hash", hash_span);
     
     if (strcmp(temp_hash, current->current_hash) != 0) {
         printf(RED " ❌ FAILED!\n" RESET_COLOR);
         printf(RED "🚨 Final block %d has been tampered with!\n" RESET_COLOR, current->index);
         return 0;
     }
+    if (!queue_seal(batch, current) || (batch && !flush_seals(batch))) return 0;
     
-    printf(BRIGHT_GREEN " ✅ VALID\n\n" RESET_COLOR);
-    
-    // Success message
-    printf(BRIGHT_GREEN "🎉 BLOCKCHAIN VALIDATION COMPLETE!\n" RESET_COLOR);
-    printf(BRIGHT_GREEN "✅ All %d blocks are valid and secure\n" RESET_COLOR, chain->length);
-    printf(BRIGHT_GREEN "🔒 Chain integrity: " BOLD "VERIFIED\n" RESET_COLOR);
-    printf(BRIGHT_GREEN "🛡️  Security status: " BOLD "SECURE\n" RESET_COLOR);
+    if (!quiet) {
+        printf(BRIGHT_GREEN " ✅ VALID\n\n" RESET_COLOR);
+
+        // Success message
+        printf(BRIGHT_GREEN "🎉 BLOCKCHAIN VALIDATION COMPLETE!\n" RESET_COLOR);
+        printf(BRIGHT_GREEN "✅ All %d blocks are valid and secure\n" RESET_COLOR, view->length);
+        printf(BRIGHT_GREEN "🔒 Chain integrity: " BOLD "VERIFIED\n" RESET_COLOR);
+        printf(BRIGHT_GREEN "🛡️  Security status: " BOLD "SECURE\n" RESET_COLOR);
+    }
     
     return 1;
 }
 
+// Validate a snapshot of the blockchain, recording how long it took. Safe
+// to call while another thread appends.
+int validate_blockchain(const blockchain_t *chain) {
+    if (!chain) {
+        printf(RED "❌ Cannot validate - blockchain is NULL or empty!\n" RESET_COLOR);
+        return 0;
+    }
+
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+
+    // a proof-of-authority chain is only valid with the seals of its blocks
+    seal_batch_t seals = {view.seals, NULL, 0};
+    int valid = 1;
+    if (view.seals || authority_genesis(chain_view_first(&view))) {
+        seals.checks = view.seals ? malloc(AUTHORITY_VERIFY_BATCH * sizeof(seal_check_t)) : NULL;
+        if (!seals.checks) {
+            printf(RED "❌ Cannot check the block seals of the chain!\n" RESET_COLOR);
+            valid = 0;
+        }
+    }
+    valid = valid && validate_chain_blocks(&view, seals.checks ? &seals : NULL);
+    free(seals.checks);
+    chain_read_end();
+    trace_end("validate_blockchain", span);
+
+    // move the checkpoint forward (never back: an append may have raced)
+    if (valid) {
+        _Atomic int *validated = &((blockchain_t *)chain)->validated;
+        int seen = atomic_load(validated);
+        while (seen < view.length && !atomic_compare_exchange_weak(validated, &seen, view.length)) {
+        }
+    }
+
+    metrics_counter_add(METRIC_VALIDATIONS, 1);
+    if (!valid) {
+        metrics_counter_add(METRIC_VALIDATION_FAILURES, 1);
+    }
+    metrics_observe(METRIC_VALIDATE_LATENCY, metrics_now_ns() - start);
+    return valid;
+}
+
+// Make the writer's head, tail and length visible to readers as one
+// snapshot. Only the writer thread calls this.
+int chain_publish(blockchain_t *chain) {
+    chain_view_t *view = malloc(sizeof(chain_view_t));
+    if (!view) {
+        printf(RED "❌ Out of memory - readers keep the previous snapshot\n" RESET_COLOR);
+        return 0;
+    }
+    view->head = chain->head;
+    view->tail = chain->tail;
+    view->length = chain->length;
+    view->mmr = chain->mmr;
+    view->patients = chain->patients;
+    view->seals = chain->seals;
+    view->archive = chain->archive;
+    view->archived = chain->archived;
+
+    chain_view_t *old = atomic_exchange(&chain->published, view);
+    epoch_retire(old, free);
+    retire_deferred(chain);
+    return 1;
+}
+
+// Number of blocks from the start of the chain known to be valid
+int chain_validated_height(const blockchain_t *chain) {
+    return atomic_load(&((blockchain_t *)chain)->validated);
+}
+
+// Replace the contents of `chain` with `source` (e.g. a freshly loaded
+// chain) and free `source`. Readers still walking the old blocks keep them
+// until they finish. Only the writer thread calls this.
+int chain_replace(blockchain_t *chain, blockchain_t *source) {
+    if (!chain || !source) return 0;
+
+    block_list_t *old = malloc(sizeof(block_list_t));
+    if (!old) {
+        printf(RED "❌ Out of memory - keeping the current chain\n" RESET_COLOR);
+        return 0;
+    }
+    old->head = chain->head;
+    old->count = -1;
+    old->image = chain->image;
+    old->mmr = chain->mmr;
+    old->patients = chain->patients;
+    old->seals = chain->seals;
+    old->dedup = chain->dedup;
+    old->archive = chain->archive;
+
+    block_t *old_head = chain->head;
+    block_t *old_tail = chain->tail;
+    int old_length = chain->length;
+    int old_archived = chain->archived;
+    chain->head = source->head;
+    chain->tail = source->tail;
+    chain->length = source->length;
+    chain->mmr = source->mmr;
+    chain->patients = source->patients;
+    chain->seals = source->seals;
+    chain->dedup = source->dedup;
+    chain->archive = source->archive;
+    chain->archived = source->archived;
+    if (!chain_publish(chain)) {
+        chain->head = old_head;
+        chain->tail = old_tail;
+        chain->length = old_length;
+        chain->mmr = old->mmr;
+        chain->patients = old->patients;
+        chain->seals = old->seals;
+        chain->dedup = old->dedup;
+        chain->archive = old->archive;
+        chain->archived = old_archived;
+        free(old);
+        return 0;
+    }
+    chain->image = source->image;
+    atomic_store(&chain->validated, atomic_load(&source->validated));
+    epoch_retire(old, free_block_list);
+
+    // nothing else can see `source`
+    mmr_free(source->retiring.mmr);
+    patients_free(source->retiring.patients);
+    if (source->retiring.blocks) free_block_list(source->retiring.blocks);
+    free(atomic_load(&source->published));
+    free(source);
+    return 1;
+}
+
+// Begin reading a snapshot of a chain that another thread may append to.
+// The blocks of the view stay valid until chain_read_end.
+void chain_read_begin(const blockchain_t *chain, chain_view_t *view) {
+    epoch_enter();
+    const chain_view_t *published = atomic_load(&((blockchain_t *)chain)->published);
+    if (published) {
+        *view = *published;
+    } else {
+        view->head = view->tail = NULL;
+        view->length = 0;
+        view->mmr = NULL;
+        view->patients = NULL;
+        view->seals = NULL;
+        view->archive = NULL;
+        view->archived = 0;
+    }
+}
+
+void chain_read_end(void) {
+    epoch_exit();
+}
+
+// First block of a view, faulted in if it was archived
+const block_t *chain_view_first(const chain_view_t *view) {
+    return view->archived > 0 ? archive_block(view->archive, 0) : view->head;
+}
+
+// Next block of a view, NULL after its tail. Archived blocks are faulted
+// in and stay valid until the thread has walked two segments further; NULL
+// before the tail means an archived block could not be read.
+const block_t *chain_view_next(const chain_view_t *view, const block_t *block) {
+    if (block == view->tail) return NULL;
+
+    long index = view->archived > 0 ? archive_cached_index(block) : -1;
+    if (index >= 0) {
+        return index + 1 < view->archived ? archive_block(view->archive, index + 1) : view->head;
+    }
+    return block->next;
+}
+
+// Block `index` of a view (faulted in if archived, otherwise found by
+// walking the blocks in memory), NULL if it has none
+const block_t *chain_view_block(const chain_view_t *view, int index) {
+    if (index >= 0 && index < view->archived) return archive_block(view->archive, index);
+    if (view->tail && view->tail->index == index) return view->tail;
+
+    for (const block_t *block = view->head; block; block = chain_view_next(view, block)) {
+        if (block->index == index) return block;
+    }
+    return NULL;
+}
+
 // Free the entire blockchain with confirmation
 void free_blockchain(blockchain_t *chain) {
     if (!chain) {
@@ -363,20 +892,28 @@ void free_blockchain(blockchain_t *chain) {
         return;
     }
 
-    printf(YELLOW "🧹 Cleaning up blockchain memory...\n" RESET_COLOR);
-    
-    int blocks_freed = 0;
-    block_t *current = chain->head;
-    
-    while (current) {
-        block_t *next = current->next;
-        free(current);
-        blocks_freed++;
-        current = next;
+    int quiet = is_quiet_mode();
+    if (!quiet) {
+        printf(YELLOW "🧹 Cleaning up blockchain memory...\n" RESET_COLOR);
     }
     
+    // no reader may still be inside this chain
+    epoch_synchronize();
+
+    mmr_free(chain->retiring.mmr);
+    patients_free(chain->retiring.patients);
+    if (chain->retiring.blocks) free_block_list(chain->retiring.blocks);
+    mmr_free(chain->mmr);
+    patients_free(chain->patients);
+    seals_free(chain->seals);
+    dedup_free(chain->dedup);
+    archive_free(chain->archive);
+    int blocks_freed = release_blocks(chain->head, &chain->image, -1);
+    free(atomic_load(&chain->published));
     free(chain);
     
-    printf(BRIGHT_GREEN "✅ Blockchain cleanup complete!\n" RESET_COLOR);
-    printf(DIM "   Freed %d blocks and chain structure\n" RESET_COLOR, blocks_freed);
+    if (!quiet) {
+        printf(BRIGHT_GREEN "✅ Blockchain cleanup complete!\n" RESET_COLOR);
+        printf(DIM "   Freed %d blocks and chain structure\n" RESET_COLOR, blocks_freed);
+    }
 }
\ No newline at end of file
@@ -3,8 +3,13 @@
 
 #include "utils.h"
 #include "transaction.h"
+#include "mmr.h"
+#include <stdatomic.h>
 
-// Define block structure
+// Define block structure. A block allocated by create_block or copy_block
+// carries its patient, prescription and visit note behind it; blocks read
+// straight from a record (decode_block_record) point into the record
+// instead.
 typedef struct block {
     int index;
     char timestamp[20];
@@ -15,22 +20,100 @@ typedef struct block {
     struct block *next;
 } block_t;
 
-// blockchain structure
+// cold tier holding the oldest blocks of a chain (see archive.h)
+typedef struct archive archive_t;
+
+// per-patient summaries of a chain (see patients.h)
+typedef struct patient_table patient_table_t;
+
+// signers and block seals of a proof-of-authority chain (see authority.h)
+typedef struct seal_table seal_table_t;
+
+// digests of the records of a chain, for duplicate checks (see dedup.h)
+typedef struct dedup_filter dedup_filter_t;
+
+// a consistent snapshot of a chain: `length` blocks, of which the first
+// `archived` are in `archive` and the rest run from head to tail. Walk it
+// with chain_view_first and chain_view_next; tail->next may be changing
+// under a reader. `mmr` (NULL when the chain has none) holds at least
+// `length` leaves; `patients` (NULL likewise) covers at least `length`
+// blocks. `seals` is NULL unless the chain uses proof of authority.
+typedef struct {
+    const block_t *head;
+    const block_t *tail;
+    int length;
+    const mmr_t *mmr;
+    const patient_table_t *patients;
+    const seal_table_t *seals;
+    const archive_t *archive;
+    int archived;
+} chain_view_t;
+
+// blocks restored from a state snapshot (see snapshot.c) live in one file
+// mapping and are released with it instead of one free() each
+typedef struct {
+    void *map;
+    size_t map_size;
+    block_t *blocks;
+    int count;
+} block_image_t;
+
+// blockchain structure. head, tail and length belong to the single writer
+// thread; every append publishes a new snapshot that any number of reader
+// threads pick up with chain_read_begin, without locks. Replaced snapshots
+// and block lists are freed through epoch-based reclamation (epoch.h).
+// `validated` is the validation checkpoint: the first `validated` blocks
+// are known to be valid. `mmr` accumulates the block hashes (see mmr.h) and
+// `patients` summarizes the records per patient; a chain loaded without its
+// earlier blocks has neither. `seals` holds the block signatures of a
+// proof-of-authority chain (NULL for proof of work). `dedup` finds records
+// already on the chain; the writer and the import pipeline use it, readers
+// of a view do not. With tiering on, the first `archived` blocks have moved
+// to `archive` and head is the oldest block still in memory. `retiring`
+// holds what the writer unlinked while publishing failed, until the next
+// snapshot is published.
 typedef struct {
     block_t *head;
     block_t *tail;
     int length;
+    _Atomic(chain_view_t *) published;
+    block_image_t image;
+    _Atomic int validated;
+    mmr_t *mmr;
+    patient_table_t *patients;
+    seal_table_t *seals;
+    dedup_filter_t *dedup;
+    archive_t *archive;
+    int archived;
+    struct {
+        struct block_list *blocks;
+        mmr_t *mmr;
+        patient_table_t *patients;
+    } retiring;
 } blockchain_t;
 
 // Function prototypes
 blockchain_t* create_blockchain(void);
+blockchain_t *allocate_blockchain(void);
 block_t* create_genesis_block(void);
 block_t* create_block(int index, const medical_transaction_t *tx,
                       const char *prev_hash);
+block_t *copy_block(const block_t *block);
 void calculate_block_hash(block_t *block);
+void compute_block_hash(const block_t *block, char *hash);
 int add_block_to_chain(blockchain_t *chain, block_t *block);
+int block_follows(const block_t *previous, const block_t *block);
 void print_blockchain(const blockchain_t *chain);
 int validate_blockchain(const blockchain_t *chain);
+int chain_validated_height(const blockchain_t *chain);
 void free_blockchain(blockchain_t *chain);
+int chain_publish(blockchain_t *chain);
+int chain_replace(blockchain_t *chain, blockchain_t *source);
+int chain_archive_old_blocks(blockchain_t *chain);
+void chain_read_begin(const blockchain_t *chain, chain_view_t *view);
+void chain_read_end(void);
+const block_t *chain_view_first(const chain_view_t *view);
+const block_t *chain_view_next(const chain_view_t *view, const block_t *block);
+const block_t *chain_view_block(const chain_view_t *view, int index);
 
 #endif
@@ -0,0 +1,479 @@
+#define _GNU_SOURCE
+#include "cipher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK_STRIDE (CIPHER_NONCE_SIZE + CIPHER_CHUNK_SIZE + CIPHER_TAG_SIZE)
+#define AAD_SIZE (16 + 8 + 1)           // file id, chunk number, last-chunk flag
+
+// the header is written and read as one block
+typedef char cipher_header_fits[sizeof(cipher_header_t) == CIPHER_HEADER_SIZE ? 1 : -1];
+
+// an open encrypted file; the chunk in `plain` is written back as soon as
+// a write to it returns, so fflush reaches the file
+typedef struct {
+    int fd;
+    int writable;
+    char path[4096];
+    cipher_header_t header;
+    EVP_CIPHER_CTX *encrypt;
+    EVP_CIPHER_CTX *decrypt;
+    long position;                      // plaintext offset
+    long size;                          // plaintext size
+    long growing_to;                    // size once the write under way is done
+    long chunk;                         // chunk held in `plain`, -1 if none
+    size_t chunk_length;
+    int dirty;
+    unsigned char plain[CIPHER_CHUNK_SIZE];
+    unsigned char sealed[CHUNK_STRIDE];
+} cipher_stream_t;
+
+static char key_path[4096] = CIPHER_KEY_FILE;
+static unsigned char key[CIPHER_KEY_SIZE];
+static unsigned char key_id[16];
+static int key_loaded = 0;
+
+// Path of the key file in use (BLOCKMED_KEY_FILE or data/blockmed.key)
+const char *cipher_key_path(void) {
+    return key_path;
+}
+
+static void derive_key_id(const unsigned char *material, unsigned char *id) {
+    unsigned char data[7 + CIPHER_KEY_SIZE];
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    memcpy(data, "BMKEYID", 7);
+    memcpy(data + 7, material, CIPHER_KEY_SIZE);
+    SHA256(data, sizeof(data), digest);
+    memcpy(id, digest, 16);
+    OPENSSL_cleanse(data, sizeof(data));
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Load the key from `key_file` (NULL: BLOCKMED_KEY_FILE or the default).
+// Without a key file encryption stays off and 1 is returned; a key file
+// that is malformed or readable by others returns 0.
+int cipher_configure(const char *key_file) {
+    const char *path = key_file ? key_file : getenv("BLOCKMED_KEY_FILE");
+    snprintf(key_path, sizeof(key_path), "%s", path && path[0] ? path : CIPHER_KEY_FILE);
+    key_loaded = 0;
+
+    struct stat st;
+    if (stat(key_path, &st) != 0) {
+        if (errno == ENOENT) return 1;
+        printf("Error: Could not read key file '%s': %s\n", key_path, strerror(errno));
+        return 0;
+    }
+    if (st.st_mode & (S_IRWXG | S_IRWXO)) {
+        printf("Error: Key file '%s' must not be accessible by others (chmod 600)\n", key_path);
+        return 0;
+    }
+
+    FILE *file = fopen(key_path, "r");
+    char text[2 * CIPHER_KEY_SIZE + 2];
+    size_t length = file ? fread(text, 1, sizeof(text), file) : 0;
+    if (file) fclose(file);
+
+    int ok = length >= 2 * CIPHER_KEY_SIZE &&
+             (length == 2 * CIPHER_KEY_SIZE || text[2 * CIPHER_KEY_SIZE] == '\n');
+    for (int i = 0; ok && i < CIPHER_KEY_SIZE; i++) {
+        int high = hex_value(text[2 * i]), low = hex_value(text[2 * i + 1]);
+        ok = high >= 0 && low >= 0;
+        key[i] = (unsigned char)(high << 4 | low);
+    }
+    OPENSSL_cleanse(text, sizeof(text));
+    if (!ok) {
+        OPENSSL_cleanse(key, sizeof(key));
+        printf("Error: Key file '%s' must hold %d hex characters\n", key_path, 2 * CIPHER_KEY_SIZE);
+        return 0;
+    }
+
+    derive_key_id(key, key_id);
+    key_loaded = 1;
+    return 1;
+}
+
+// Whether new files are written encrypted
+int cipher_enabled(void) {
+    return key_loaded;
+}
+
+// Write a new random key to `key_file`, which must not exist yet
+int cipher_generate_key(const char *key_file) {
+    unsigned char material[CIPHER_KEY_SIZE];
+    char text[2 * CIPHER_KEY_SIZE + 1];
+    if (RAND_bytes(material, sizeof(material)) != 1) {
+        printf("Error: Could not generate a key\n");
+        return 0;
+    }
+    for (int i = 0; i < CIPHER_KEY_SIZE; i++) {
+        snprintf(text + 2 * i, 3, "%02x", material[i]);
+    }
+    text[2 * CIPHER_KEY_SIZE] = '\n';
+
+    int fd = open(key_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    int ok = fd >= 0 && write(fd, text, sizeof(text)) == (ssize_t)sizeof(text) && fsync(fd) == 0;
+    if (fd < 0) {
+        printf("Error: Could not create key file '%s': %s\n", key_file, strerror(errno));
+    } else if (!ok) {
+        printf("Error: Could not write key file '%s'\n", key_file);
+        unlink(key_file);
+    }
+    if (fd >= 0) close(fd);
+    OPENSSL_cleanse(material, sizeof(material));
+    OPENSSL_cleanse(text, sizeof(text));
+    return ok;
+}
+
+// Check whether a file starts with the encrypted stream header: 1 if it
+// does, 0 if not, -1 if it cannot be read
+int cipher_file_encrypted(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    char magic[8];
+    ssize_t got = pread(fd, magic, sizeof(magic), 0);
+    close(fd);
+    if (got < 0) return -1;
+    return got == (ssize_t)sizeof(magic) && memcmp(magic, CIPHER_MAGIC, sizeof(magic)) == 0;
+}
+
+// function to find the chunk holding the end of a stream of `size` bytes;
+// an empty stream still has an (empty) chunk 0
+static long last_chunk(long size) {
+    return size > 0 ? (size - 1) / CIPHER_CHUNK_SIZE : 0;
+}
+
+// function to build the authenticated data of a chunk: file id, number and
+// whether it ends the stream, so a file cut at a chunk boundary is caught
+static void chunk_aad(const cipher_stream_t *stream, long chunk, int final,
+                      unsigned char *aad) {
+    memcpy(aad, stream->header.file_id, 16);
+    for (int i = 0; i < 8; i++) {
+        aad[16 + i] = (unsigned char)((uint64_t)chunk >> (56 - 8 * i));
+    }
+    aad[24] = (unsigned char)(final != 0);
+}
+
+// function to encrypt the chunk in `plain` and write it at its slot
+static int flush_chunk(cipher_stream_t *stream) {
+    if (!stream->dirty) return 1;
+
+    unsigned char aad[AAD_SIZE];
+    unsigned char *nonce = stream->sealed;
+    unsigned char *out = stream->sealed + CIPHER_NONCE_SIZE;
+    unsigned char *tag = out + stream->chunk_length;
+    int length = 0, final = 0;
+    long end = stream->growing_to > stream->size ? stream->growing_to : stream->size;
+    chunk_aad(stream, stream->chunk, stream->chunk == last_chunk(end), aad);
+
+    // a fresh nonce every time the chunk is written, never one reused
+    int ok = RAND_bytes(nonce, CIPHER_NONCE_SIZE) == 1 &&
+             EVP_EncryptInit_ex(stream->encrypt, NULL, NULL, NULL, nonce) == 1 &&
+             EVP_EncryptUpdate(stream->encrypt, NULL, &length, aad, sizeof(aad)) == 1 &&
+             EVP_EncryptUpdate(stream->encrypt, out, &length, stream->plain,
+                               (int)stream->chunk_length) == 1 &&
+             EVP_EncryptFinal_ex(stream->encrypt, out + length, &final) == 1 &&
+             EVP_CIPHER_CTX_ctrl(stream->encrypt, EVP_CTRL_GCM_GET_TAG, CIPHER_TAG_SIZE, tag) == 1;
+
+    size_t sealed = CIPHER_NONCE_SIZE + stream->chunk_length + CIPHER_TAG_SIZE;
+    off_t offset = CIPHER_HEADER_SIZE + (off_t)stream->chunk * CHUNK_STRIDE;
+    if (!ok || pwrite(stream->fd, stream->sealed, sealed, offset) != (ssize_t)sealed) {
+        errno = EIO;
+        return 0;
+    }
+    stream->dirty = 0;
+    return 1;
+}
+
+// function to decrypt and check chunk `chunk` of `length` bytes into
+// `plain`, sealed as the last chunk of the stream or not (`final`)
+static int unseal_chunk(cipher_stream_t *stream, long chunk, size_t length, int final) {
+    size_t sealed = CIPHER_NONCE_SIZE + length + CIPHER_TAG_SIZE;
+    off_t offset = CIPHER_HEADER_SIZE + (off_t)chunk * CHUNK_STRIDE;
+    unsigned char aad[AAD_SIZE];
+    int out = 0, last = 0;
+    chunk_aad(stream, chunk, final, aad);
+
+    int ok = pread(stream->fd, stream->sealed, sealed, offset) == (ssize_t)sealed &&
+             EVP_DecryptInit_ex(stream->decrypt, NULL, NULL, NULL, stream->sealed) == 1 &&
+             EVP_DecryptUpdate(stream->decrypt, NULL, &out, aad, sizeof(aad)) == 1 &&
+             EVP_DecryptUpdate(stream->decrypt, stream->plain, &out,
+                               stream->sealed + CIPHER_NONCE_SIZE, (int)length) == 1 &&
+             EVP_CIPHER_CTX_ctrl(stream->decrypt, EVP_CTRL_GCM_SET_TAG, CIPHER_TAG_SIZE,
+                                 stream->sealed + CIPHER_NONCE_SIZE + length) == 1 &&
+             EVP_DecryptFinal_ex(stream->decrypt, stream->plain + out, &last) == 1;
+    if (!ok) {
+        printf("Error: Chunk %ld of '%s' failed authentication\n", chunk, stream->path);
+        errno = EIO;
+        return 0;
+    }
+
+    stream->chunk = chunk;
+    stream->chunk_length = length;
+    return 1;
+}
+
+// function to bring chunk `chunk` into `plain`, decrypting and checking it;
+// a chunk at the end of the file starts out empty
+static int load_chunk(cipher_stream_t *stream, long chunk) {
+    if (stream->chunk == chunk) return 1;
+    if (!flush_chunk(stream)) return 0;
+
+    stream->chunk = -1;
+    long start = chunk * (long)CIPHER_CHUNK_SIZE;
+    if (start >= stream->size) {
+        stream->chunk = chunk;
+        stream->chunk_length = 0;
+        return 1;
+    }
+
+    size_t length = stream->size - start < CIPHER_CHUNK_SIZE ? (size_t)(stream->size - start)
+                                                             : CIPHER_CHUNK_SIZE;
+    return unseal_chunk(stream, chunk, length, chunk == last_chunk(stream->size));
+}
+
+static ssize_t stream_read(void *cookie, char *buffer, size_t size) {
+    cipher_stream_t *stream = cookie;
+    size_t done = 0;
+
+    while (done < size && stream->position < stream->size) {
+        long chunk = stream->position / CIPHER_CHUNK_SIZE;
+        size_t offset = (size_t)(stream->position % CIPHER_CHUNK_SIZE);
+        if (!load_chunk(stream, chunk)) return done > 0 ? (ssize_t)done : -1;
+
+        size_t count = stream->chunk_length - offset;
+        if (count > size - done) count = size - done;
+        memcpy(buffer + done, stream->plain + offset, count);
+        done += count;
+        stream->position += (long)count;
+    }
+    return (ssize_t)done;
+}
+
+static ssize_t stream_write(void *cookie, const char *buffer, size_t size) {
+    cipher_stream_t *stream = cookie;
+    // no holes: writes start inside the file or at its end
+    if (!stream->writable || stream->position > stream->size) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // chunks are sealed as the last one or not for the size the stream has
+    // once this write is done
+    long last = last_chunk(stream->size);
+    long first = stream->position / CIPHER_CHUNK_SIZE;
+    if (stream->position + (long)size > stream->size) {
+        stream->growing_to = stream->position + (long)size;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        long chunk = stream->position / CIPHER_CHUNK_SIZE;
+        size_t offset = (size_t)(stream->position % CIPHER_CHUNK_SIZE);
+        if (!load_chunk(stream, chunk)) {
+            stream->growing_to = 0;
+            return -1;
+        }
+
+        size_t count = CIPHER_CHUNK_SIZE - offset;
+        if (count > size - done) count = size - done;
+        memcpy(stream->plain + offset, buffer + done, count);
+        if (offset + count > stream->chunk_length) stream->chunk_length = offset + count;
+        stream->dirty = 1;
+        done += count;
+        stream->position += (long)count;
+        if (stream->position > stream->size) stream->size = stream->position;
+    }
+    stream->growing_to = 0;
+    if (!flush_chunk(stream)) return -1;
+
+    // a full last chunk this write went past without touching is sealed
+    // again as an inner one
+    if (first > last && last_chunk(stream->size) != last) {
+        if (!unseal_chunk(stream, last, CIPHER_CHUNK_SIZE, 1)) return -1;
+        stream->dirty = 1;
+        if (!flush_chunk(stream)) return -1;
+    }
+    return (ssize_t)done;
+}
+
+static int stream_seek(void *cookie, off64_t *offset, int whence) {
+    cipher_stream_t *stream = cookie;
+    long base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? stream->position : stream->size;
+    if (base + *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    stream->position = (long)(base + *offset);
+    *offset = stream->position;
+    return 0;
+}
+
+static void free_stream(cipher_stream_t *stream) {
+    EVP_CIPHER_CTX_free(stream->encrypt);
+    EVP_CIPHER_CTX_free(stream->decrypt);
+    OPENSSL_cleanse(stream->plain, sizeof(stream->plain));
+    close(stream->fd);
+    free(stream);
+}
+
+static int stream_close(void *cookie) {
+    cipher_stream_t *stream = cookie;
+    int ok = flush_chunk(stream);
+    free_stream(stream);
+    return ok ? 0 : -1;
+}
+
+// function to work out the plaintext size from the size on disk; every
+// stream has at least its sealed chunk 0, empty in an empty one
+static int plaintext_size(off_t file_size, long *size) {
+    if (file_size <= CIPHER_HEADER_SIZE) return 0;
+
+    off_t body = file_size - CIPHER_HEADER_SIZE;
+    off_t rest = body % CHUNK_STRIDE;
+    if (rest != 0 && rest < CIPHER_NONCE_SIZE + CIPHER_TAG_SIZE) return 0;
+    if (rest == CIPHER_NONCE_SIZE + CIPHER_TAG_SIZE && body != rest) return 0;
+
+    *size = (long)(body / CHUNK_STRIDE) * CIPHER_CHUNK_SIZE +
+            (rest ? (long)(rest - CIPHER_NONCE_SIZE - CIPHER_TAG_SIZE) : 0);
+    return 1;
+}
+
+// Open a file like fopen ("rb", "r+b" or "wb"). Encrypted files are
+// decrypted and checked as they are read; new files are encrypted while a
+// key is loaded. Returns NULL (after printing why, for a key problem) on
+// failure.
+FILE *cipher_fopen(const char *path, const char *mode) {
+    int create = mode[0] == 'w';
+    int writable = create || strchr(mode, '+') != NULL;
+    if (create && !key_loaded) return fopen(path, mode);
+
+    int fd = create ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)
+                    : open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) return NULL;
+
+    cipher_stream_t *stream = calloc(1, sizeof(cipher_stream_t));
+    if (!stream) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->writable = writable;
+    snprintf(stream->path, sizeof(stream->path), "%s", path);
+    stream->chunk = -1;
+
+    if (create) {
+        memcpy(stream->header.magic, CIPHER_MAGIC, sizeof(stream->header.magic));
+        stream->header.chunk_size = CIPHER_CHUNK_SIZE;
+        memcpy(stream->header.key_id, key_id, sizeof(key_id));
+        if (RAND_bytes(stream->header.file_id, sizeof(stream->header.file_id)) != 1 ||
+            pwrite(fd, &stream->header, sizeof(cipher_header_t), 0) != CIPHER_HEADER_SIZE) {
+            free(stream);
+            close(fd);
+            errno = EIO;
+            return NULL;
+        }
+    } else {
+        struct stat st;
+        ssize_t got = pread(fd, &stream->header, sizeof(cipher_header_t), 0);
+        if (got < (ssize_t)sizeof(stream->header.magic) ||
+            memcmp(stream->header.magic, CIPHER_MAGIC, sizeof(stream->header.magic)) != 0) {
+            // not encrypted: an ordinary file
+            free(stream);
+            FILE *file = fdopen(fd, mode);
+            if (!file) close(fd);
+            return file;
+        }
+        if (!key_loaded) {
+            printf("Error: '%s' is encrypted and there is no key file '%s'\n", path, key_path);
+            free(stream);
+            close(fd);
+            errno = EACCES;
+            return NULL;
+        }
+        if (got != CIPHER_HEADER_SIZE || stream->header.chunk_size != CIPHER_CHUNK_SIZE ||
+            memcmp(stream->header.key_id, key_id, sizeof(key_id)) != 0 ||
+            fstat(fd, &st) != 0 || !plaintext_size(st.st_size, &stream->size)) {
+            printf("Error: '%s' was encrypted with another key or is damaged\n", path);
+            free(stream);
+            close(fd);
+            errno = EACCES;
+            return NULL;
+        }
+    }
+
+    stream->encrypt = EVP_CIPHER_CTX_new();
+    stream->decrypt = EVP_CIPHER_CTX_new();
+    if (!stream->encrypt || !stream->decrypt ||
+        EVP_EncryptInit_ex(stream->encrypt, EVP_aes_256_gcm(), NULL, key, NULL) != 1 ||
+        EVP_DecryptInit_ex(stream->decrypt, EVP_aes_256_gcm(), NULL, key, NULL) != 1) {
+        free_stream(stream);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // a new stream starts as an empty sealed chunk 0; an existing one must
+    // end in a chunk sealed as the last, so a file cut short is caught here
+    int sealed;
+    if (create) {
+        stream->chunk = 0;
+        stream->dirty = 1;
+        sealed = flush_chunk(stream);
+    } else {
+        long last = last_chunk(stream->size);
+        sealed = unseal_chunk(stream, last, (size_t)(stream->size - last * CIPHER_CHUNK_SIZE), 1);
+    }
+    if (!sealed) {
+        free_stream(stream);
+        errno = EIO;
+        return NULL;
+    }
+
+    cookie_io_functions_t functions = {stream_read, stream_write, stream_seek, stream_close};
+    FILE *file = fopencookie(stream, writable ? "r+" : "r", functions);
+    if (!file) {
+        free_stream(stream);
+        return NULL;
+    }
+    // whole chunks per call rather than stdio's small default buffer
+    setvbuf(file, NULL, _IOFBF, CIPHER_CHUNK_SIZE);
+    return file;
+}
+
+// Flush `file` (opened on `path`) and make it durable
+int cipher_sync(FILE *file, const char *path) {
+    if (fflush(file) != 0) return 0;
+
+    int fd = fileno(file);
+    if (fd >= 0) return fsync(fd) == 0;
+
+    // an encrypted stream has no descriptor of its own; its writes are
+    // already in the file, and fsync covers every descriptor of it
+    fd = open(path, O_RDONLY);
+    int ok = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    return ok;
+}
+
+// Plaintext size of an open file, leaving its position unchanged
+int cipher_file_size(FILE *file, long *size) {
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0) return 0;
+
+    *size = ftell(file);
+    return fseek(file, position, SEEK_SET) == 0 && *size >= 0;
+}
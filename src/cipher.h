@@ -0,0 +1,48 @@
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Encryption at rest. While a key file is present, the chain file, its
+// snapshot, archive segments and queued records are written as AES-256-GCM
+// encrypted streams; OpenSSL uses AES-NI where the CPU has it. A stream is split into
+// chunks of CIPHER_CHUNK_SIZE plaintext bytes, each stored at a fixed
+// stride with its own random nonce and tag, so any chunk can be read or
+// rewritten on its own:
+//
+//   header (CIPHER_HEADER_SIZE) | nonce | ciphertext | tag | nonce | ...
+//
+// The tag covers the file id, the chunk number and whether the chunk is the
+// last one, so chunks cannot be moved within or between files and a file
+// cut short at a chunk boundary (or down to its header) fails to open; an
+// empty stream is one empty chunk. cipher_fopen hides all of this behind a
+// FILE, and opens files without the header as plain files.
+#define CIPHER_KEY_FILE "data/blockmed.key"
+#define CIPHER_MAGIC "BMENC01"
+#define CIPHER_KEY_SIZE 32
+#define CIPHER_NONCE_SIZE 12
+#define CIPHER_TAG_SIZE 16
+#define CIPHER_CHUNK_SIZE 65536
+#define CIPHER_HEADER_SIZE 64
+
+typedef struct {
+    char magic[8];
+    uint32_t chunk_size;
+    uint32_t reserved;
+    unsigned char key_id[16];           // tells a wrong key from tampering
+    unsigned char file_id[16];          // random per file, bound into every tag
+    char padding[16];
+} cipher_header_t;
+
+// Function prototypes
+const char *cipher_key_path(void);
+int cipher_configure(const char *key_file);
+int cipher_enabled(void);
+int cipher_generate_key(const char *key_file);
+int cipher_file_encrypted(const char *path);
+FILE *cipher_fopen(const char *path, const char *mode);
+int cipher_sync(FILE *file, const char *path);
+int cipher_file_size(FILE *file, long *size);
+
+#endif
@@ -1,5 +1,9 @@
 #include "cli.h"
 #include "auth.h"
+#include "patients.h"
+#include "authority.h"
+#include "dedup.h"
+#include <unistd.h>
 
 // ANSI Color codes for beautiful terminal output
 #define RESET_COLOR     "\033[0m"
@@ -27,6 +31,10 @@
 
 // Include necessary constants
 static medical_transaction_t pending_transaction;
+// the pending transaction's fields that are not interned
+static char pending_patient[MAX_PATIENT_ID_SIZE];
+static char pending_prescription[MAX_PRESCRIPTION_SIZE];
+static char pending_note[MAX_NOTES_SIZE];
 static int has_pending_transaction = 0;
 
 // Utility functions for beautiful UI
@@ -39,7 +47,7 @@ void print_header(const char* title) {
 }
 
 void print_section_header(const char* title) {
-    printf("\n" BRIGHT_CYAN "▓▓▓ " BOLD "%s" RESET_COLOR BRIGHT_CYAN " ▓▓▓" RESET_COLOR "\n\n");
+    printf("\n" BRIGHT_CYAN "▓▓▓ " BOLD "%s" RESET_COLOR BRIGHT_CYAN " ▓▓▓" RESET_COLOR "\n\n", title);
 }
 
 void print_success(const char* message) {
@@ -99,7 +107,12 @@ void show_menu(user_role_t role) {
     print_menu_option(5, "💾 Save Blockchain", "Export blockchain to file");
     print_menu_option(6, "📂 Load Blockchain", "Import blockchain from file");
     print_menu_option(7, "⚙️  Mining Difficulty", "Adjust blockchain mining parameters");
-    print_menu_option(8, "🚪 Exit System", "Logout and close application");
+    print_menu_option(8, "📥 Bulk Import", "Import and mine medical records from a CSV file");
+    print_menu_option(9, "📤 Export Blockchain", "Write blocks as CSV, JSON Lines or columnar files");
+    print_menu_option(10, "🗂️  Audit Log Query", "Search the audit log by user and time range");
+    print_menu_option(11, "📈 Statistics", "Show counters and latency percentiles");
+    print_menu_option(12, "🩺 Patient Summary", "Latest diagnosis, active prescriptions and visits");
+    print_menu_option(13, "🚪 Exit System", "Logout and close application");
     
     print_separator();
     printf(BRIGHT_WHITE "Enter your choice: " CYAN);
@@ -135,7 +148,35 @@ void handle_add_record(blockchain_t *chain, const user_t *user) {
     printf(RESET_COLOR);
 
     // Create a new transaction
-    create_transaction(&pending_transaction, patient_id, user->email, diagnosis, prescription, visit_note);
+    snprintf(pending_patient, sizeof(pending_patient), "%s", patient_id);
+    snprintf(pending_prescription, sizeof(pending_prescription), "%s", prescription);
+    strcpy(pending_note, visit_note);
+    if (!create_transaction(&pending_transaction, pending_patient, user->email, diagnosis,
+                            pending_prescription, pending_note)) {
+        print_error("Failed to create the medical record.");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    // the blocks of this session may not be saved yet, so possible
+    // duplicates are confirmed in memory
+    unsigned char digest[DEDUP_DIGEST_SIZE];
+    chain_view_t view;
+    dedup_digest(&pending_transaction, digest);
+    chain_read_begin(chain, &view);
+    dedup_source_t source = {NULL, NULL, &view};
+    long duplicate = dedup_find(chain->dedup, digest, &source);
+    chain_read_end();
+    if (duplicate >= 0) {
+        char message[96];
+        snprintf(message, sizeof(message), "This visit is already recorded in block #%ld.", duplicate);
+        print_error(message);
+        log_operation(LOG_WARNING, user->email, "Rejected a duplicate medical record");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
     has_pending_transaction = 1;
 
     print_separator();
@@ -186,7 +227,7 @@ void handle_mine_block(blockchain_t *chain, const user_t *user) {
     }
     printf("\n");
 
-    if (mine_block(new_block, get_mining_difficulty())) {
+    if (seal_block(chain->seals, new_block, get_mining_difficulty())) {
         add_block_to_chain(chain, new_block);
         has_pending_transaction = 0;
         print_success("Block successfully mined and added to blockchain!");
@@ -245,6 +286,280 @@ void handle_validate_chain(const blockchain_t *chain, const user_t *user) {
     getchar();
 }
 
+// Function to handle importing medical records from a CSV file
+void handle_bulk_import(blockchain_t *chain, const user_t *user) {
+    print_header("📥 BULK IMPORT MEDICAL RECORDS");
+
+    if (!has_write_permission(user->role)) {
+        print_error("Access Denied: You do not have permission to import records.");
+        log_security_event(user->email, "Attempted bulk import without permission");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    char path[MAX_INPUT_SIZE];
+
+    print_info("Columns: patient_id,doctor_email,diagnosis,prescription,visit_note[,timestamp]");
+    print_info("An empty doctor_email is recorded as your account. Ctrl+C stops after the current block.");
+    printf(BRIGHT_WHITE "CSV file path: " CYAN);
+    read_path_input(path, sizeof(path));
+    printf(RESET_COLOR);
+
+    if (path[0] == '\0') {
+        print_warning("No file given - import cancelled.");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    printf(YELLOW "🔄 Importing with mining difficulty %d...\n" RESET_COLOR, get_mining_difficulty());
+
+    import_options_t opts;
+    import_stats_t stats;
+    init_import_options(&opts);
+    memset(&stats, 0, sizeof(stats));
+
+    // the import rewrites and appends to the chain file (see batch.c)
+    int lock = lock_chain_file(opts.chain_file, LOCK_EX, 1);
+    int ok = lock >= 0 && import_records_csv(chain, path, user, &opts, &stats);
+    if (lock >= 0) unlock_chain_file(lock);
+
+    print_separator();
+    printf(BRIGHT_WHITE "Rows read: " BRIGHT_CYAN "%ld" RESET_COLOR "\n", stats.rows_read);
+    printf(BRIGHT_WHITE "Already imported (skipped): " BRIGHT_CYAN "%ld" RESET_COLOR "\n", stats.rows_skipped);
+    printf(BRIGHT_WHITE "Rejected: " BRIGHT_CYAN "%ld" RESET_COLOR "\n", stats.rows_rejected);
+    printf(BRIGHT_WHITE "Already on the chain (duplicates): " BRIGHT_CYAN "%ld" RESET_COLOR "\n",
+           stats.rows_duplicate);
+    printf(BRIGHT_WHITE "Imported: " BRIGHT_CYAN "%ld" RESET_COLOR " in %.1fs (" BRIGHT_CYAN "%.1f" RESET_COLOR " records/sec)\n",
+           stats.records_imported, stats.elapsed_seconds, stats.records_per_second);
+
+    if (!ok) {
+        print_error("Import stopped with an error - rerun to resume after the last committed row.");
+    } else if (stats.interrupted) {
+        print_warning("Import interrupted - rerun with the same file to resume.");
+    } else {
+        print_success("Bulk import completed and saved to data/blockchain.dat");
+    }
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+// Function to handle exporting the blockchain for analytics
+void handle_export_blockchain(const blockchain_t *chain, const user_t *user) {
+    print_header("📤 EXPORT BLOCKCHAIN");
+
+    if (!has_write_permission(user->role)) {
+        print_error("Access Denied: You do not have permission to export records.");
+        log_security_event(user->email, "Attempted to export blockchain without permission");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    export_options_t opts;
+    init_export_options(&opts);
+
+    char format[16], path[MAX_INPUT_SIZE], range[64], fields[MAX_INPUT_SIZE];
+
+    printf(BRIGHT_WHITE "Format (csv, jsonl, columnar) [csv]: " CYAN);
+    secure_input(format, sizeof(format));
+    printf(BRIGHT_WHITE "Output file (directory for columnar): " CYAN);
+    read_path_input(path, sizeof(path));
+    printf(BRIGHT_WHITE "Height range as FROM-TO (empty for all): " CYAN);
+    secure_input(range, sizeof(range));
+    printf(BRIGHT_WHITE "Fields, comma-separated (empty for all): " CYAN);
+    secure_input(fields, sizeof(fields));
+    printf(RESET_COLOR);
+
+    int valid = path[0] != '\0' &&
+                (format[0] == '\0' || parse_export_format(format, &opts.format)) &&
+                parse_export_fields(fields, &opts.fields);
+
+    if (valid && range[0] != '\0') {
+        int from, to;
+        if (sscanf(range, "%d-%d", &from, &to) == 2) {
+            opts.from_height = from;
+            opts.to_height = to;
+        } else if (sscanf(range, "%d-", &from) == 1) {
+            opts.from_height = from;
+        } else {
+            valid = 0;
+        }
+    }
+
+    if (!valid) {
+        print_error("Invalid export settings.");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    long rows = export_blockchain(chain, path, &opts);
+    if (rows >= 0) {
+        printf(BRIGHT_GREEN "✓ " BOLD "Exported %ld blocks to %s" RESET_COLOR "\n", rows, path);
+        log_operation(LOG_INFO, user->email, "Exported blockchain");
+    } else {
+        print_error("Export failed.");
+    }
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+// function to print one audit record of a query
+static int print_audit_entry(const audit_entry_t *entry, void *ctx) {
+    (void)ctx;
+    char timestamp[20];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&entry->time));
+
+    const char *color = entry->level == LOG_SECURITY ? RED :
+                        entry->level == LOG_INFO ? WHITE : YELLOW;
+    printf(DIM "[%s] " RESET_COLOR "%s%-8s" RESET_COLOR " " CYAN "%s" RESET_COLOR " %s\n",
+           timestamp, color, log_level_name(entry->level), entry->user, entry->operation);
+    return 1;
+}
+
+// Function to handle querying the audit log
+void handle_audit_query(const user_t *user) {
+    print_header("🗂️ AUDIT LOG QUERY");
+
+    if (!has_full_permission(user->role)) {
+        print_error("Access Denied: You do not have permission to read the audit log.");
+        log_security_event(user->email, "Attempted to query audit log without permission");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    char email[MAX_EMAIL_SIZE], from[32], to[32];
+
+    printf(BRIGHT_WHITE "User email (empty for all): " CYAN);
+    secure_input(email, sizeof(email));
+    printf(BRIGHT_WHITE "From (YYYY-MM-DD [HH:MM:SS], empty for start): " CYAN);
+    if (fgets(from, sizeof(from), stdin)) from[strcspn(from, "\n")] = '\0';
+    printf(BRIGHT_WHITE "To (YYYY-MM-DD [HH:MM:SS], empty for now): " CYAN);
+    if (fgets(to, sizeof(to), stdin)) to[strcspn(to, "\n")] = '\0';
+    printf(RESET_COLOR);
+
+    audit_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.user = email;
+
+    if ((from[0] != '\0' && !audit_parse_time(from, 0, &query.from)) ||
+        (to[0] != '\0' && !audit_parse_time(to, 1, &query.to))) {
+        print_error("Invalid date. Use YYYY-MM-DD or YYYY-MM-DD HH:MM:SS.");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    printf("\n");
+    audit_query_stats_t stats;
+    if (audit_query(&query, print_audit_entry, NULL, &stats) < 0) {
+        print_error("Audit query failed.");
+    } else {
+        printf("\n" BRIGHT_GREEN "✓ " BOLD "%ld records" RESET_COLOR
+               " (scanned %d of %d audit files)\n",
+               stats.records_matched, stats.segments_opened, stats.segments_total);
+        log_operation(LOG_INFO, user->email, "Queried audit log");
+    }
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+// function to format a duration in nanoseconds with a readable unit
+static void format_duration(uint64_t nanoseconds, char *out, size_t size) {
+    if (nanoseconds < 1000ULL) {
+        snprintf(out, size, "%llu ns", (unsigned long long)nanoseconds);
+    } else if (nanoseconds < 1000000ULL) {
+        snprintf(out, size, "%.1f us", nanoseconds / 1e3);
+    } else if (nanoseconds < 1000000000ULL) {
+        snprintf(out, size, "%.1f ms", nanoseconds / 1e6);
+    } else {
+        snprintf(out, size, "%.2f s", nanoseconds / 1e9);
+    }
+}
+
+// Function to show the metrics collected since startup
+void handle_statistics(const blockchain_t *chain) {
+    print_header("📈 SYSTEM STATISTICS");
+
+    printf(BRIGHT_WHITE "Chain length: " BRIGHT_CYAN "%d blocks\n" RESET_COLOR,
+           chain ? chain->length : 0);
+    printf(BRIGHT_WHITE "Active sessions: " BRIGHT_CYAN "%d\n" RESET_COLOR, session_count());
+    printf(BRIGHT_WHITE "Dropped log events: " BRIGHT_CYAN "%lu\n\n" RESET_COLOR, log_dropped_events());
+
+    print_section_header("🔢 COUNTERS");
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        printf("  %-28s " BRIGHT_CYAN "%llu\n" RESET_COLOR, metrics_counter_name((metric_counter_t)i),
+               (unsigned long long)metrics_counter_value((metric_counter_t)i));
+    }
+
+    printf("\n");
+    print_section_header("⏱️  LATENCY");
+    printf(BOLD "  %-20s %8s %10s %10s %10s %10s\n" RESET_COLOR,
+           "operation", "count", "p50", "p99", "p99.9", "max");
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        metrics_summary_t summary;
+        metrics_histogram_summary((metric_histogram_t)i, &summary);
+
+        char p50[16], p99[16], p999[16], max[16];
+        format_duration(summary.p50, p50, sizeof(p50));
+        format_duration(summary.p99, p99, sizeof(p99));
+        format_duration(summary.p999, p999, sizeof(p999));
+        format_duration(summary.max, max, sizeof(max));
+
+        printf("  %-20s %8llu %10s %10s %10s %10s\n", metrics_histogram_name((metric_histogram_t)i),
+               (unsigned long long)summary.count, p50, p99, p999, max);
+    }
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+// Function to show one patient's summary, kept up to date as blocks are
+// added (see patients.h)
+void handle_patient_summary(const blockchain_t *chain, const user_t *user) {
+    print_header("🩺 PATIENT SUMMARY");
+
+    char patient_id[50];
+    printf(BRIGHT_WHITE "Patient ID: " CYAN);
+    secure_input(patient_id, sizeof(patient_id));
+    printf(RESET_COLOR "\n");
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    const patient_summary_t *summary = patients_find(view.patients, patient_id);
+    if (!view.patients) {
+        print_error("Patient summaries are unavailable - reload the blockchain to rebuild them");
+    } else if (!summary) {
+        print_warning("No records found for this patient.");
+    } else {
+        printf(BRIGHT_WHITE "Patient:        " BOLD "%s\n" RESET_COLOR, summary->patient_id);
+        printf(BRIGHT_WHITE "Visits:         " BRIGHT_CYAN "%d" RESET_COLOR DIM
+               " (blocks #%d to #%d)\n" RESET_COLOR,
+               summary->visits, summary->first_index, summary->last_index);
+        printf(BRIGHT_WHITE "Last visit:     " CYAN "%s" RESET_COLOR " by " CYAN "%s\n" RESET_COLOR,
+               summary->last_visit, summary->last_doctor);
+        printf(BRIGHT_WHITE "Diagnosis:      " YELLOW "%s\n" RESET_COLOR, summary->diagnosis);
+        printf(BRIGHT_WHITE "Prescriptions:\n" RESET_COLOR);
+        if (summary->prescription_count == 0) {
+            printf(DIM "  none recorded\n" RESET_COLOR);
+        }
+        for (int i = 0; i < summary->prescription_count; i++) {
+            printf(BRIGHT_GREEN "  💊 " RESET_COLOR "%s\n", summary->prescriptions[i]);
+        }
+    }
+    chain_read_end();
+    log_operation(LOG_INFO, user->email, "Viewed patient summary");
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
 // Function to handle user login
 void handle_user_login(user_t *user) {
     print_header("🔐 BLOCKMED AUTHENTICATION");
@@ -358,6 +673,15 @@ int run_cli(blockchain_t *chain) {
             }
         }
 
+        // Issue a session so each action is authorised by the token, not by
+        // the copied-in user record
+        char session_token[SESSION_TOKEN_SIZE];
+        if (!session_create(&current_user, SESSION_DEFAULT_TTL, session_token)) {
+            print_error("Could not start a session. Please log in again.");
+            memset(&current_user, 0, sizeof(user_t));
+            continue;
+        }
+
         // Main menu loop - inner loop handles main application functionality
         char choice[10];
         int logout_requested = 0;
@@ -367,23 +691,34 @@ int run_cli(blockchain_t *chain) {
             secure_input(choice, sizeof(choice));
             printf(RESET_COLOR);
 
-            switch (choice[0]) {
-                case '1':
+            if (!session_verify(session_token, &current_user)) {
+                print_warning("Your session has expired. Please log in again.");
+                log_operation(LOG_INFO, current_user.email, "Session expired");
+                printf("\nPress Enter to continue...");
+                getchar();
+                break;
+            }
+
+            switch (atoi(choice)) {
+                case 1:
                     handle_add_record(chain, &current_user);
                     break;
-                case '2':
+                case 2:
                     handle_mine_block(chain, &current_user);
                     break;
-                case '3':
+                case 3:
                     handle_view_blockchain(chain, &current_user);
                     break;
-                case '4':
+                case 4:
                     handle_validate_chain(chain, &current_user);
                     break;
-                case '5':
+                case 5:
                     print_header("💾 SAVE BLOCKCHAIN");
                     printf(YELLOW "🔄 Saving blockchain to file...\n" RESET_COLOR);
-                    if (save_blockchain(chain, "data/blockchain.dat")) {
+                    int lock = lock_chain_file("data/blockchain.dat", LOCK_EX, 1);
+                    int saved = lock >= 0 && save_blockchain(chain, "data/blockchain.dat");
+                    if (lock >= 0) unlock_chain_file(lock);
+                    if (saved) {
                         print_success("Blockchain saved successfully to data/blockchain.dat");
                         log_operation(LOG_INFO, current_user.email, "Saved blockchain to file");
                     } else {
@@ -392,18 +727,16 @@ int run_cli(blockchain_t *chain) {
                     printf("\nPress Enter to continue...");
                     getchar();
                     break;
-                case '6':
+                case 6:
                     if (has_write_permission(current_user.role)) {
                         print_header("📂 LOAD BLOCKCHAIN");
                         printf(YELLOW "🔄 Loading blockchain from file...\n" RESET_COLOR);
                         blockchain_t *loaded_chain = load_blockchain("data/blockchain.dat");
-                        if (loaded_chain) {
+                        if (loaded_chain && chain_replace(chain, loaded_chain)) {
                             print_success("Blockchain loaded successfully from data/blockchain.dat");
-                            print_info("Note: Changes will take effect on next application restart");
                             log_operation(LOG_INFO, current_user.email, "Loaded blockchain from file");
-                            // Free the loaded chain since we can't replace the main one
-                            // free_blockchain(&loaded_chain);
                         } else {
+                            if (loaded_chain) free_blockchain(loaded_chain);
                             print_error("Failed to load blockchain from file");
                         }
                     } else {
@@ -413,7 +746,7 @@ int run_cli(blockchain_t *chain) {
                     printf("\nPress Enter to continue...");
                     getchar();
                     break;
-                case '7':
+                case 7:
                     if (has_full_permission(current_user.role)) {
                         print_header("⚙️ MINING DIFFICULTY SETTINGS");
                         printf(BRIGHT_WHITE "Current Mining Difficulty: " BRIGHT_CYAN "%d\n\n" RESET_COLOR, get_mining_difficulty());
@@ -436,8 +769,24 @@ int run_cli(blockchain_t *chain) {
                     printf("\nPress Enter to continue...");
                     getchar();
                     break;
-                case '8':
+                case 8:
+                    handle_bulk_import(chain, &current_user);
+                    break;
+                case 9:
+                    handle_export_blockchain(chain, &current_user);
+                    break;
+                case 10:
+                    handle_audit_query(&current_user);
+                    break;
+                case 11:
+                    handle_statistics(chain);
+                    break;
+                case 12:
+                    handle_patient_summary(chain, &current_user);
+                    break;
+                case 13:
                     // just log the logout and set the flag
+                    session_revoke(session_token);
                     log_operation(LOG_INFO, current_user.email, "User logged out");
                     print_success("Successfully logged out. Returning to login screen...");
                     printf("\nPress Enter to continue...");
@@ -445,7 +794,7 @@ int run_cli(blockchain_t *chain) {
                     logout_requested = 1;  // This will exit the inner loop and return to auth menu
                     break;
                 default:
-                    print_error("Invalid selection. Please choose a number between 1-8.");
+                    print_error("Invalid selection. Please choose a number between 1-13.");
                     printf("\nPress Enter to continue...");
                     getchar();
                     break;
@@ -454,7 +803,557 @@ int run_cli(blockchain_t *chain) {
         
         // Clear user data after logout
         memset(&current_user, 0, sizeof(user_t));
+        memset(session_token, 0, sizeof(session_token));
     }
     
     return 0;
-}
\ No newline at end of file
+}
+// ---- thin client: the same workflows, served by a running daemon ----
+
+static int daemon_fd = -1;
+static char daemon_token[128];
+static int session_lost = 0;
+static int daemon_lost = 0;
+
+// function to point at the last line of a response (its result object)
+static const char *result_line(const char *response) {
+    const char *line = response;
+    for (const char *p = response; *p; p++) {
+        if (*p == '\n' && p[1] != '\0') line = p + 1;
+    }
+    return line;
+}
+
+// function to send one request with the session token. Returns the exit
+// code, or -1 if the daemon could not be reached.
+static int daemon_call(const char *command, const char *const options[], int count,
+                       char **response) {
+    const char *argv[24];
+    int argc = 0;
+    argv[argc++] = daemon_token;
+    argv[argc++] = command;
+    for (int i = 0; i < count && argc < 24; i++) argv[argc++] = options[i];
+
+    int code;
+    *response = NULL;
+    if (!client_request(daemon_fd, argc, argv, &code, response, NULL)) {
+        print_error("Lost connection to the BlockMed daemon.");
+        daemon_lost = 1;
+        return -1;
+    }
+
+    if (code != 0) {
+        char message[256] = "request failed";
+        client_json_field(result_line(*response), "error", message, sizeof(message));
+        print_error(message);
+        if (strstr(message, "session")) session_lost = 1;
+    }
+    return code;
+}
+
+static void show_client_menu(const char *email, const char *role) {
+    system("clear");
+
+    print_header("🏥 BLOCKMED - MEDICAL RECORD BLOCKCHAIN SYSTEM 🏥");
+    printf(BRIGHT_WHITE "Signed in as " BOLD "%s" RESET_COLOR DIM " (%s) - connected to the shared ledger\n\n"
+           RESET_COLOR, email, role);
+
+    print_section_header("📋 MAIN MENU OPTIONS");
+
+    print_menu_option(1, "📝 Add Medical Record", "Create a record; the daemon mines it into the chain");
+    print_menu_option(2, "🔗 View Records", "List blocks, optionally for one patient");
+    print_menu_option(3, "🔍 Validate Chain", "Check blockchain integrity and security");
+    print_menu_option(4, "📥 Bulk Import", "Import and mine medical records from a CSV file");
+    print_menu_option(5, "📤 Export Blockchain", "Write blocks as CSV, JSON Lines or columnar files");
+    print_menu_option(6, "🗂️  Audit Log Query", "Search the audit log by user and time range");
+    print_menu_option(7, "📡 Daemon Status", "Chain height, connected clients and sessions");
+    print_menu_option(8, "🩺 Patient Summary", "Latest diagnosis, active prescriptions and visits");
+    print_menu_option(9, "🚪 Exit System", "Logout and return to the login screen");
+
+    print_separator();
+    printf(BRIGHT_WHITE "Enter your choice: " CYAN);
+}
+
+static void client_add_record(void) {
+    print_header("📝 ADD NEW MEDICAL RECORD");
+
+    char patient_id[50], diagnosis[MAX_DIAGNOSIS_SIZE];
+    char prescription[MAX_PRESCRIPTION_SIZE], visit_note[MAX_NOTES_SIZE];
+
+    printf(BRIGHT_WHITE "Patient ID: " CYAN);
+    secure_input(patient_id, sizeof(patient_id));
+    printf(BRIGHT_WHITE "Diagnosis: " CYAN);
+    secure_input(diagnosis, sizeof(diagnosis));
+    printf(BRIGHT_WHITE "Prescription: " CYAN);
+    secure_input(prescription, sizeof(prescription));
+    printf(BRIGHT_WHITE "Visit Notes: " CYAN);
+    secure_input(visit_note, sizeof(visit_note));
+    printf(RESET_COLOR);
+
+    printf(YELLOW "⚡ Mining on the daemon...\n" RESET_COLOR);
+    const char *options[] = {"--patient", patient_id, "--diagnosis", diagnosis,
+                             "--prescription", prescription, "--note", visit_note};
+    char *response;
+    if (daemon_call("add", options, 8, &response) == 0) {
+        char height[32] = "?", hash[HASH_SIZE] = "";
+        client_json_field(response, "height", height, sizeof(height));
+        client_json_field(response, "hash", hash, sizeof(hash));
+        print_success("Block successfully mined and added to blockchain!");
+        printf(BRIGHT_WHITE "Chain height: " BRIGHT_CYAN "%s\n" RESET_COLOR, height);
+        printf(BRIGHT_GREEN "🎉 New block hash: " CYAN "%s\n" RESET_COLOR, hash);
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_view_records(void) {
+    print_header("🔗 BLOCKCHAIN EXPLORER");
+
+    char patient_id[50], limit[16];
+    printf(BRIGHT_WHITE "Patient ID (empty for all): " CYAN);
+    secure_input(patient_id, sizeof(patient_id));
+    printf(BRIGHT_WHITE "Maximum records [100]: " CYAN);
+    secure_input(limit, sizeof(limit));
+    printf(RESET_COLOR "\n");
+
+    const char *options[4] = {"--limit", limit[0] ? limit : "100"};
+    int count = 2;
+    if (patient_id[0] != '\0') {
+        options[count++] = "--patient";
+        options[count++] = patient_id;
+    }
+
+    char *response;
+    if (daemon_call("query", options, count, &response) == 0) {
+        const char *summary = result_line(response);
+        for (const char *line = response; line < summary; line = strchr(line, '\n') + 1) {
+            char index[16], timestamp[20], patient[50], doctor[MAX_EMAIL_SIZE];
+            char diagnosis[MAX_DIAGNOSIS_SIZE], hash[HASH_SIZE];
+            client_json_field(line, "index", index, sizeof(index));
+            client_json_field(line, "timestamp", timestamp, sizeof(timestamp));
+            client_json_field(line, "patient_id", patient, sizeof(patient));
+            client_json_field(line, "doctor_email", doctor, sizeof(doctor));
+            client_json_field(line, "diagnosis", diagnosis, sizeof(diagnosis));
+            client_json_field(line, "hash", hash, sizeof(hash));
+
+            printf(BRIGHT_CYAN "#%-6s" RESET_COLOR DIM " %s " RESET_COLOR BOLD "%s" RESET_COLOR
+                   " by " CYAN "%s" RESET_COLOR " - %s " DIM "(%.16s...)\n" RESET_COLOR,
+                   index, timestamp, patient, doctor, diagnosis, hash);
+        }
+
+        char matches[32] = "0", scanned[32] = "0";
+        client_json_field(summary, "matches", matches, sizeof(matches));
+        client_json_field(summary, "scanned", scanned, sizeof(scanned));
+        print_separator();
+        printf(BRIGHT_GREEN "✓ " BOLD "%s records" RESET_COLOR " (%s blocks scanned)\n", matches, scanned);
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_validate_chain(void) {
+    print_header("🔍 BLOCKCHAIN INTEGRITY VALIDATOR");
+    printf(YELLOW "🔄 Performing comprehensive blockchain validation...\n" RESET_COLOR);
+
+    char *response;
+    int code = daemon_call("validate", NULL, 0, &response);
+    if (code == 0) {
+        print_success("Blockchain integrity verified - All blocks are valid!");
+        printf(BRIGHT_GREEN "🛡️  Security Status: " BOLD "SECURE\n" RESET_COLOR);
+    } else if (code > 0 && response && strstr(response, "\"valid\":false")) {
+        printf(RED "⚠️  Security Status: " BOLD "COMPROMISED\n" RESET_COLOR);
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_bulk_import(void) {
+    print_header("📥 BULK IMPORT MEDICAL RECORDS");
+
+    char path[MAX_INPUT_SIZE], absolute[4096];
+    print_info("Columns: patient_id,doctor_email,diagnosis,prescription,visit_note[,timestamp]");
+    printf(BRIGHT_WHITE "CSV file path: " CYAN);
+    read_path_input(path, sizeof(path));
+    printf(RESET_COLOR);
+
+    if (path[0] == '\0' || !client_absolute_path(path, absolute, sizeof(absolute))) {
+        print_warning("No file given - import cancelled.");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    printf(YELLOW "🔄 Importing on the daemon...\n" RESET_COLOR);
+    const char *options[] = {"--file", absolute};
+    char *response;
+    if (daemon_call("import", options, 2, &response) == 0) {
+        char mined[32] = "0", rejected[32] = "0", skipped[32] = "0", rate[32] = "0";
+        client_json_field(response, "mined", mined, sizeof(mined));
+        client_json_field(response, "rejected", rejected, sizeof(rejected));
+        client_json_field(response, "skipped", skipped, sizeof(skipped));
+        client_json_field(response, "records_per_second", rate, sizeof(rate));
+
+        print_separator();
+        printf(BRIGHT_WHITE "Already imported (skipped): " BRIGHT_CYAN "%s" RESET_COLOR "\n", skipped);
+        printf(BRIGHT_WHITE "Rejected: " BRIGHT_CYAN "%s" RESET_COLOR "\n", rejected);
+        printf(BRIGHT_WHITE "Imported: " BRIGHT_CYAN "%s" RESET_COLOR " (" BRIGHT_CYAN "%s" RESET_COLOR
+               " records/sec)\n", mined, rate);
+        print_success("Bulk import completed");
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_export_blockchain(void) {
+    print_header("📤 EXPORT BLOCKCHAIN");
+
+    char format[16], path[MAX_INPUT_SIZE], range[64], fields[MAX_INPUT_SIZE];
+    char absolute[4096], from[16], to[16];
+
+    printf(BRIGHT_WHITE "Format (csv, jsonl, columnar) [csv]: " CYAN);
+    secure_input(format, sizeof(format));
+    printf(BRIGHT_WHITE "Output file (directory for columnar): " CYAN);
+    read_path_input(path, sizeof(path));
+    printf(BRIGHT_WHITE "Height range as FROM-TO (empty for all): " CYAN);
+    secure_input(range, sizeof(range));
+    printf(BRIGHT_WHITE "Fields, comma-separated (empty for all): " CYAN);
+    secure_input(fields, sizeof(fields));
+    printf(RESET_COLOR);
+
+    if (path[0] == '\0' || !client_absolute_path(path, absolute, sizeof(absolute))) {
+        print_error("Invalid export settings.");
+        printf("\nPress Enter to continue...");
+        getchar();
+        return;
+    }
+
+    const char *options[10] = {"--output", absolute};
+    int count = 2;
+    if (format[0] != '\0') {
+        options[count++] = "--format";
+        options[count++] = format;
+    }
+    if (fields[0] != '\0') {
+        options[count++] = "--fields";
+        options[count++] = fields;
+    }
+    int first, last;
+    if (sscanf(range, "%d-%d", &first, &last) == 2) {
+        snprintf(from, sizeof(from), "%d", first);
+        snprintf(to, sizeof(to), "%d", last);
+        options[count++] = "--from";
+        options[count++] = from;
+        options[count++] = "--to";
+        options[count++] = to;
+    } else if (sscanf(range, "%d-", &first) == 1) {
+        snprintf(from, sizeof(from), "%d", first);
+        options[count++] = "--from";
+        options[count++] = from;
+    }
+
+    char *response;
+    if (daemon_call("export", options, count, &response) == 0) {
+        char rows[32] = "0";
+        client_json_field(response, "rows", rows, sizeof(rows));
+        printf(BRIGHT_GREEN "✓ " BOLD "Exported %s blocks to %s" RESET_COLOR "\n", rows, absolute);
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_audit_query(void) {
+    print_header("🗂️ AUDIT LOG QUERY");
+
+    char email[MAX_EMAIL_SIZE], from[32], to[32];
+    printf(BRIGHT_WHITE "User email (empty for all): " CYAN);
+    secure_input(email, sizeof(email));
+    printf(BRIGHT_WHITE "From (YYYY-MM-DD [HH:MM:SS], empty for start): " CYAN);
+    if (fgets(from, sizeof(from), stdin)) from[strcspn(from, "\n")] = '\0';
+    printf(BRIGHT_WHITE "To (YYYY-MM-DD [HH:MM:SS], empty for now): " CYAN);
+    if (fgets(to, sizeof(to), stdin)) to[strcspn(to, "\n")] = '\0';
+    printf(RESET_COLOR "\n");
+
+    const char *options[6];
+    int count = 0;
+    if (email[0] != '\0') {
+        options[count++] = "--user";
+        options[count++] = email;
+    }
+    if (from[0] != '\0') {
+        options[count++] = "--from";
+        options[count++] = from;
+    }
+    if (to[0] != '\0') {
+        options[count++] = "--to";
+        options[count++] = to;
+    }
+
+    char *response;
+    if (daemon_call("audit", options, count, &response) == 0) {
+        const char *summary = result_line(response);
+        for (const char *line = response; line < summary; line = strchr(line, '\n') + 1) {
+            audit_entry_t entry;
+            char when[32], level[16];
+            client_json_field(line, "time", when, sizeof(when));
+            client_json_field(line, "level", level, sizeof(level));
+            client_json_field(line, "user", entry.user, sizeof(entry.user));
+            client_json_field(line, "operation", entry.operation, sizeof(entry.operation));
+            entry.time = (time_t)atol(when);
+            entry.level = strcmp(level, "SECURITY") == 0 ? LOG_SECURITY :
+                          strcmp(level, "INFO") == 0 ? LOG_INFO : LOG_WARNING;
+            print_audit_entry(&entry, NULL);
+        }
+
+        char matches[32] = "0";
+        client_json_field(summary, "matches", matches, sizeof(matches));
+        printf("\n" BRIGHT_GREEN "✓ " BOLD "%s records" RESET_COLOR "\n", matches);
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_patient_summary(void) {
+    print_header("🩺 PATIENT SUMMARY");
+
+    char patient_id[50];
+    printf(BRIGHT_WHITE "Patient ID: " CYAN);
+    secure_input(patient_id, sizeof(patient_id));
+    printf(RESET_COLOR "\n");
+
+    const char *options[] = {"--patient", patient_id};
+    char *response;
+    if (daemon_call("patient", options, 2, &response) == 0) {
+        const char *summary = result_line(response);
+        char patient[50], visits[16], first[16], last[16], visit[20], doctor[MAX_EMAIL_SIZE];
+        char diagnosis[MAX_DIAGNOSIS_SIZE];
+        client_json_field(summary, "patient_id", patient, sizeof(patient));
+        client_json_field(summary, "visits", visits, sizeof(visits));
+        client_json_field(summary, "first_index", first, sizeof(first));
+        client_json_field(summary, "last_index", last, sizeof(last));
+        client_json_field(summary, "last_visit", visit, sizeof(visit));
+        client_json_field(summary, "last_doctor", doctor, sizeof(doctor));
+        client_json_field(summary, "diagnosis", diagnosis, sizeof(diagnosis));
+
+        printf(BRIGHT_WHITE "Patient:        " BOLD "%s\n" RESET_COLOR, patient);
+        printf(BRIGHT_WHITE "Visits:         " BRIGHT_CYAN "%s" RESET_COLOR DIM
+               " (blocks #%s to #%s)\n" RESET_COLOR, visits, first, last);
+        printf(BRIGHT_WHITE "Last visit:     " CYAN "%s" RESET_COLOR " by " CYAN "%s\n" RESET_COLOR,
+               visit, doctor);
+        printf(BRIGHT_WHITE "Diagnosis:      " YELLOW "%s\n" RESET_COLOR, diagnosis);
+        printf(BRIGHT_WHITE "Prescriptions:\n" RESET_COLOR);
+        if (summary == response) {
+            printf(DIM "  none recorded\n" RESET_COLOR);
+        }
+        for (const char *line = response; line < summary; line = strchr(line, '\n') + 1) {
+            char prescription[MAX_PRESCRIPTION_SIZE];
+            client_json_field(line, "prescription", prescription, sizeof(prescription));
+            printf(BRIGHT_GREEN "  💊 " RESET_COLOR "%s\n", prescription);
+        }
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+static void client_status(void) {
+    print_header("📡 DAEMON STATUS");
+
+    char *response;
+    if (daemon_call("status", NULL, 0, &response) == 0) {
+        static const char *const fields[][2] = {
+            {"height", "Chain height"}, {"tip", "Tip hash"}, {"clients", "Connected clients"},
+            {"sessions", "Active sessions"}, {"workers", "Worker threads"},
+            {"difficulty", "Mining difficulty"}, {"requests", "Requests served"},
+            {"uptime_seconds", "Uptime (seconds)"}
+        };
+        for (int i = 0; i < 8; i++) {
+            char value[HASH_SIZE] = "";
+            client_json_field(response, fields[i][0], value, sizeof(value));
+            printf(BRIGHT_WHITE "%-20s " BRIGHT_CYAN "%s\n" RESET_COLOR, fields[i][1], value);
+        }
+    }
+    free(response);
+
+    printf("\nPress Enter to continue...");
+    getchar();
+}
+
+// function to log in through the daemon; fills email and role on success
+static int client_login(char *email, char *role) {
+    print_header("🔐 BLOCKMED AUTHENTICATION");
+
+    char password[MAX_PASSWORD_SIZE];
+    printf(BRIGHT_WHITE "📧 Email Address: " CYAN);
+    secure_input(email, MAX_EMAIL_SIZE);
+    printf(BRIGHT_WHITE "🔑 Password: " CYAN);
+    secure_input(password, sizeof(password));
+    printf(RESET_COLOR);
+
+    printf(YELLOW "\n🔄 Authenticating user...\n" RESET_COLOR);
+
+    const char *argv[] = {"", "login", "--email", email, "--password", password};
+    char *response = NULL;
+    int code = -1;
+    int reached = client_request(daemon_fd, 6, argv, &code, &response, NULL);
+    memset(password, 0, sizeof(password));
+
+    int ok = reached && code == 0 &&
+             client_json_field(response, "token", daemon_token, sizeof(daemon_token)) &&
+             client_json_field(response, "role", role, 32);
+    free(response);
+
+    if (!reached) {
+        print_error("Lost connection to the BlockMed daemon.");
+        return -1;
+    }
+    if (ok) {
+        print_success("Authentication successful!");
+        printf(BRIGHT_GREEN "Welcome back, " BOLD "%s" RESET_COLOR BRIGHT_GREEN " (%s)\n" RESET_COLOR,
+               email, role);
+        printf("\nPress Enter to continue to main menu...");
+    } else {
+        print_error("Authentication failed - Invalid credentials");
+        printf("\nPress Enter to try again...");
+    }
+    getchar();
+    return ok;
+}
+
+static int client_register(void) {
+    print_header("📋 USER REGISTRATION");
+
+    char email[MAX_EMAIL_SIZE], password[MAX_PASSWORD_SIZE];
+    printf(BRIGHT_WHITE "📧 Email (ALU domain required): " CYAN);
+    secure_input(email, sizeof(email));
+    printf(BRIGHT_WHITE "🔑 Create Password: " CYAN);
+    secure_input(password, sizeof(password));
+    printf(RESET_COLOR);
+
+    printf(YELLOW "\n🔄 Processing registration...\n" RESET_COLOR);
+
+    const char *argv[] = {"", "register", "--email", email, "--password", password};
+    char *response = NULL;
+    int code = -1;
+    int reached = client_request(daemon_fd, 6, argv, &code, &response, NULL);
+    memset(password, 0, sizeof(password));
+    free(response);
+
+    if (!reached) {
+        print_error("Lost connection to the BlockMed daemon.");
+        return 0;
+    }
+    if (code == 0) {
+        print_success("Registration completed successfully!");
+        print_info("You can now login with your credentials.");
+    } else {
+        print_error("Registration failed - Please check your details and try again.");
+    }
+    printf("\nPress Enter to continue...");
+    getchar();
+    return 1;
+}
+
+// Run the menus against a daemon connected on `fd` (see daemon.c). The
+// daemon does the work and enforces permissions; this only prompts and
+// prints. Closes fd.
+int run_client_cli(int fd) {
+    daemon_fd = fd;
+    char email[MAX_EMAIL_SIZE], role[32];
+    int connected = 1;
+
+    while (connected) {
+        // Authentication loop
+        int logged_in = 0;
+        while (!logged_in && connected) {
+            show_auth_menu();
+
+            char choice[10];
+            secure_input(choice, sizeof(choice));
+            printf(RESET_COLOR);
+
+            switch (choice[0]) {
+                case '1': {
+                    int result = client_login(email, role);
+                    logged_in = result == 1;
+                    connected = result >= 0;
+                    break;
+                }
+                case '2':
+                    connected = client_register();
+                    break;
+                case '3':
+                    printf(BRIGHT_CYAN "\n👋 Thank you for using BlockMed. Goodbye!\n" RESET_COLOR);
+                    close(daemon_fd);
+                    return 0;
+                default:
+                    print_error("Invalid selection. Please choose 1, 2, or 3.");
+                    printf("\nPress Enter to continue...");
+                    getchar();
+                    break;
+            }
+        }
+
+        // Main menu loop
+        session_lost = 0;
+        int logout_requested = 0;
+        while (logged_in && !logout_requested && !session_lost) {
+            show_client_menu(email, role);
+
+            char choice[10];
+            secure_input(choice, sizeof(choice));
+            printf(RESET_COLOR);
+
+            switch (atoi(choice)) {
+                case 1: client_add_record(); break;
+                case 2: client_view_records(); break;
+                case 3: client_validate_chain(); break;
+                case 4: client_bulk_import(); break;
+                case 5: client_export_blockchain(); break;
+                case 6: client_audit_query(); break;
+                case 7: client_status(); break;
+                case 8: client_patient_summary(); break;
+                case 9: {
+                    char *response;
+                    if (daemon_call("logout", NULL, 0, &response) >= 0) {
+                        print_success("Successfully logged out. Returning to login screen...");
+                    }
+                    free(response);
+                    printf("\nPress Enter to continue...");
+                    getchar();
+                    logout_requested = 1;
+                    break;
+                }
+                default:
+                    print_error("Invalid selection. Please choose a number between 1-9.");
+                    printf("\nPress Enter to continue...");
+                    getchar();
+                    break;
+            }
+
+            // a request that could not reach the daemon ends the program
+            if (daemon_lost) {
+                connected = 0;
+                logged_in = 0;
+            }
+        }
+
+        memset(daemon_token, 0, sizeof(daemon_token));
+    }
+
+    print_error("The BlockMed daemon is no longer reachable.");
+    close(daemon_fd);
+    return 1;
+}
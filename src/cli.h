@@ -3,9 +3,15 @@
 
 #include "blockchain.h"
 #include "auth.h"
+#include "session.h"
 #include "storage.h"
 #include "pow.h"
 #include "log.h"
+#include "import.h"
+#include "export.h"
+#include "audit_store.h"
+#include "metrics.h"
+#include "client.h"
 
 // function prototypes
 void show_menu(user_role_t role);
@@ -13,9 +19,15 @@ void handle_add_record(blockchain_t *chain, const user_t *user);
 void handle_mine_block(blockchain_t *chain, const user_t *user);
 void handle_view_blockchain(const blockchain_t *chain, const user_t *user);
 void handle_validate_chain(const blockchain_t *chain, const user_t *user);
+void handle_bulk_import(blockchain_t *chain, const user_t *user);
+void handle_export_blockchain(const blockchain_t *chain, const user_t *user);
+void handle_audit_query(const user_t *user);
+void handle_statistics(const blockchain_t *chain);
+void handle_patient_summary(const blockchain_t *chain, const user_t *user);
 void handle_user_login(user_t *user);
 void handle_user_registration(void);
 int run_cli(blockchain_t *chain);
+int run_client_cli(int fd);
 
 
 #endif
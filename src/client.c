@@ -0,0 +1,319 @@
+#define _POSIX_C_SOURCE 200809L
+#include "client.h"
+#include "daemon.h"
+#include "batch.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Connect to the daemon. Returns the socket, or -1 if no daemon listens.
+int client_connect(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Split a `host:port` address (or a bare port, meaning 127.0.0.1)
+int client_split_address(const char *address, char *host, size_t host_size,
+                         char *port, size_t port_size) {
+    const char *colon = address ? strrchr(address, ':') : NULL;
+    const char *port_text = colon ? colon + 1 : address;
+    size_t host_length = colon ? (size_t)(colon - address) : 0;
+    if (!address || port_text[0] == '\0' || strspn(port_text, "0123456789") != strlen(port_text) ||
+        strlen(port_text) >= port_size || host_length >= host_size) {
+        return 0;
+    }
+
+    if (host_length > 0) {
+        memcpy(host, address, host_length);
+        host[host_length] = '\0';
+    } else {
+        snprintf(host, host_size, "127.0.0.1");
+    }
+    strcpy(port, port_text);
+    return 1;
+}
+
+// Connect to a daemon serving replication peers at `host:port`. Returns
+// the socket, or -1 if nothing listens there.
+int client_connect_tcp(const char *address) {
+    char host[256], port[16];
+    if (!client_split_address(address, host, sizeof(host), port, sizeof(port))) return -1;
+
+    struct addrinfo hints, *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &found) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo *ai = found; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+
+    // requests are small and answered one at a time
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return 0;
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 1;
+}
+
+static int recv_all(int fd, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(fd, data, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return 0;
+        data += received;
+        length -= (size_t)received;
+    }
+    return 1;
+}
+
+// Send one request (argv[0] is the session token, argv[1] the command)
+// without waiting for its response; the daemon answers requests of a
+// connection in order. Returns 0 if the connection failed.
+int client_send(int fd, int argc, const char *const argv[]) {
+    size_t payload = 0;
+    for (int i = 0; i < argc; i++) payload += strlen(argv[i]) + 1;
+    if (payload > DAEMON_MAX_REQUEST) return 0;
+
+    char *frame = malloc(4 + payload);
+    if (!frame) return 0;
+
+    uint32_t header = htonl((uint32_t)payload);
+    memcpy(frame, &header, 4);
+    size_t offset = 4;
+    for (int i = 0; i < argc; i++) {
+        size_t size = strlen(argv[i]) + 1;
+        memcpy(frame + offset, argv[i], size);
+        offset += size;
+    }
+
+    int ok = send_all(fd, frame, offset);
+    free(frame);
+    return ok;
+}
+
+// Wait for the response to the oldest request sent. *response is
+// NUL-terminated and must be freed. Returns 0 if the connection failed.
+int client_receive(int fd, int *exit_code, char **response, size_t *length) {
+    uint32_t head[2];
+    if (!recv_all(fd, (char *)head, sizeof(head))) return 0;
+
+    uint32_t size = ntohl(head[0]);
+    if (size < 4 || size - 4 > DAEMON_MAX_RESPONSE) return 0;
+    size -= 4;
+
+    char *body = malloc((size_t)size + 1);
+    if (!body || !recv_all(fd, body, size)) {
+        free(body);
+        return 0;
+    }
+    body[size] = '\0';
+
+    *exit_code = (int)(int32_t)ntohl(head[1]);
+    *response = body;
+    if (length) *length = size;
+    return 1;
+}
+
+// Send one request and wait for its response (see client_send and
+// client_receive)
+int client_request(int fd, int argc, const char *const argv[], int *exit_code,
+                   char **response, size_t *length) {
+    return client_send(fd, argc, argv) && client_receive(fd, exit_code, response, length);
+}
+
+// Copy the value of "key" from a single-line JSON object into `value`.
+// Strings are unescaped; numbers and booleans are copied as text.
+int client_json_field(const char *json, const char *key, char *value, size_t size) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+    const char *found = json;
+    while ((found = strstr(found, pattern)) != NULL) {
+        if (found > json && (found[-1] == '{' || found[-1] == ',')) break;
+        found++;
+    }
+    if (!found || size == 0) return 0;
+
+    const char *p = found + strlen(pattern);
+    size_t used = 0;
+    if (*p != '"') {
+        while (*p && *p != ',' && *p != '}' && *p != '\n' && used + 1 < size) {
+            value[used++] = *p++;
+        }
+        value[used] = '\0';
+        return 1;
+    }
+
+    for (p++; *p && *p != '"'; p++) {
+        char c = *p;
+        if (c == '\\' && p[1]) {
+            p++;
+            switch (*p) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'u': c = '?'; p += strlen(p) >= 5 ? 4 : 0; break;
+                default: c = *p; break;
+            }
+        }
+        if (used + 1 < size) value[used++] = c;
+    }
+    value[used] = '\0';
+    return 1;
+}
+
+// Resolve a path against the current directory, since the daemon runs in
+// its own working directory
+int client_absolute_path(const char *path, char *out, size_t size) {
+    if (path[0] == '/') {
+        return snprintf(out, size, "%s", path) < (int)size;
+    }
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) return 0;
+    return snprintf(out, size, "%s/%s", cwd, path) < (int)size;
+}
+
+// function to read all of stdin (for `add --stdin`)
+static char *read_stdin(void) {
+    size_t capacity = 65536, length = 0;
+    char *data = malloc(capacity);
+    if (!data) return NULL;
+
+    size_t got;
+    while ((got = fread(data + length, 1, capacity - length - 1, stdin)) > 0) {
+        length += got;
+        if (capacity - length == 1) {
+            if (capacity >= DAEMON_MAX_REQUEST) {
+                free(data);
+                return NULL;
+            }
+            char *grown = realloc(data, capacity * 2);
+            if (!grown) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+    }
+    data[length] = '\0';
+    return data;
+}
+
+// Forward a batch command to a running daemon, which owns the chain while
+// it runs. Returns the command's exit code, or -1 if there is no daemon (or
+// the command names its own --chain file or always runs locally) and it
+// should run locally.
+int client_run_batch(int argc, char *argv[]) {
+    if (argc < 2 || !is_batch_command(argv[1]) || is_local_batch_command(argv[1]) ||
+        argc >= DAEMON_MAX_ARGS) {
+        return -1;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--chain") == 0) return -1;
+    }
+
+    int fd = client_connect(daemon_socket_path());
+    if (fd < 0) return -1;
+
+    const char *command = argv[1];
+    const char *email = getenv("BLOCKMED_EMAIL");
+    const char *password = getenv("BLOCKMED_PASSWORD");
+    char *response = NULL;
+    char token[128] = "";
+    int code;
+
+    const char *login[] = {"", "login", "--email", email ? email : "",
+                           "--password", password ? password : ""};
+    if (!email || !password ||
+        !client_request(fd, 6, login, &code, &response, NULL) || code != BATCH_EXIT_OK ||
+        !client_json_field(response, "token", token, sizeof(token))) {
+        free(response);
+        close(fd);
+        return batch_fail(stdout, command, BATCH_EXIT_DENIED,
+                          "set BLOCKMED_EMAIL and BLOCKMED_PASSWORD to valid credentials");
+    }
+    free(response);
+    response = NULL;
+
+    // same arguments, with paths made absolute and stdin sent as --rows
+    const char *request[DAEMON_MAX_ARGS + 1];
+    char paths[2][4096];
+    int used_paths = 0, count = 0;
+    char *rows = NULL;
+
+    request[count++] = token;
+    request[count++] = command;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--stdin") == 0 && !rows) {
+            rows = read_stdin();
+            if (!rows) {
+                close(fd);
+                return batch_fail(stdout, command, BATCH_EXIT_FAILURE,
+                                  "could not read records from stdin");
+            }
+            request[count++] = "--rows";
+            request[count++] = rows;
+        } else if ((strcmp(argv[i], "--file") == 0 || strcmp(argv[i], "--output") == 0) &&
+                   i + 1 < argc && used_paths < 2 &&
+                   client_absolute_path(argv[i + 1], paths[used_paths], sizeof(paths[0]))) {
+            request[count++] = argv[i++];
+            request[count++] = paths[used_paths++];
+        } else {
+            request[count++] = argv[i];
+        }
+    }
+
+    size_t length = 0;
+    int ok = client_request(fd, count, request, &code, &response, &length);
+    free(rows);
+    if (ok) {
+        fwrite(response, 1, length, stdout);
+        free(response);
+        response = NULL;
+
+        int logout_code;
+        const char *logout[] = {token, "logout"};
+        if (client_request(fd, 2, logout, &logout_code, &response, NULL)) free(response);
+    } else {
+        code = batch_fail(stdout, command, BATCH_EXIT_FAILURE, "lost connection to the daemon");
+    }
+
+    close(fd);
+    return code;
+}
@@ -0,0 +1,19 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stddef.h>
+
+// Function prototypes
+int client_connect(const char *socket_path);
+int client_split_address(const char *address, char *host, size_t host_size,
+                         char *port, size_t port_size);
+int client_connect_tcp(const char *address);
+int client_send(int fd, int argc, const char *const argv[]);
+int client_receive(int fd, int *exit_code, char **response, size_t *length);
+int client_request(int fd, int argc, const char *const argv[], int *exit_code,
+                   char **response, size_t *length);
+int client_json_field(const char *json, const char *key, char *value, size_t size);
+int client_absolute_path(const char *path, char *out, size_t size);
+int client_run_batch(int argc, char *argv[]);
+
+#endif
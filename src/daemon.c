@@ -0,0 +1,1330 @@
+#define _POSIX_C_SOURCE 200809L
+#include "daemon.h"
+#include "epoch.h"
+#include "intern.h"
+#include "batch.h"
+#include "storage.h"
+#include "snapshot.h"
+#include "archive.h"
+#include "session.h"
+#include "pow.h"
+#include "authority.h"
+#include "dedup.h"
+#include "cipher.h"
+#include "log.h"
+#include "import.h"
+#include "export.h"
+#include "metrics.h"
+#include "queue.h"
+#include "trace.h"
+#include "replica.h"
+#include "client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// epoll ids of the non-client descriptors (client ids are slot numbers)
+#define LISTEN_ID DAEMON_MAX_CLIENTS
+#define WAKE_ID (DAEMON_MAX_CLIENTS + 1)
+#define SIGNAL_ID (DAEMON_MAX_CLIENTS + 2)
+#define PEER_LISTEN_ID (DAEMON_MAX_CLIENTS + 3)
+#define READ_CHUNK 65536
+
+// one connected client. Owned by the event loop thread; a client has at
+// most one request being served, further frames wait in its input buffer.
+typedef struct {
+    int fd;                     // -1 when the slot is free
+    uint32_t generation;        // bumped on close so stale replies are dropped
+    char *in;
+    size_t in_length;
+    size_t in_capacity;
+    char *out;
+    size_t out_length;
+    size_t out_sent;
+    int busy;
+    int remote;                 // a replication peer connected over TCP
+} daemon_client_t;
+
+// one parsed request travelling from the event loop to a worker and back
+typedef struct daemon_job {
+    struct daemon_job *next;
+    const struct daemon_command *command;
+    int slot;
+    uint32_t generation;
+    int argc;
+    char *argv[DAEMON_MAX_ARGS];
+    char *payload;
+    char *response;
+    size_t response_size;
+    int exit_code;
+} daemon_job_t;
+
+// state a command handler works with
+typedef struct {
+    FILE *out;
+    const char *command;
+    const char *token;
+    const batch_args_t *args;
+    user_t user;
+} daemon_request_t;
+
+typedef int (*daemon_handler_t)(daemon_request_t *request);
+
+typedef struct daemon_command {
+    const char *name;
+    daemon_handler_t run;
+    int writer;                 // modifies the chain: served by the miner thread
+    int public;                 // allowed without a session token
+    int remote;                 // also served to replication peers (--listen)
+    const char *options[8];     // accepted option names, NULL-terminated
+} daemon_command_t;
+
+static blockchain_t *chain = NULL;
+static int default_difficulty = DEFAULT_DIFFICULTY;
+static int worker_count = DAEMON_DEFAULT_WORKERS;
+static time_t started_at;
+
+static daemon_client_t clients[DAEMON_MAX_CLIENTS];
+static atomic_int connected_clients;
+static atomic_long requests_served;
+static int epoll_fd = -1;
+static int wake_fd = -1;
+
+static bounded_queue_t read_queue;     // served in parallel by the workers
+static bounded_queue_t write_queue;    // served in order by the miner
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static daemon_job_t *done_jobs = NULL;
+
+static int daemon_login(daemon_request_t *request);
+static int daemon_register(daemon_request_t *request);
+static int daemon_logout(daemon_request_t *request);
+static int daemon_status(daemon_request_t *request);
+static int daemon_add(daemon_request_t *request);
+static int daemon_mine(daemon_request_t *request);
+static int daemon_import(daemon_request_t *request);
+static int daemon_validate(daemon_request_t *request);
+static int daemon_query(daemon_request_t *request);
+static int daemon_export(daemon_request_t *request);
+static int daemon_audit(daemon_request_t *request);
+static int daemon_root(daemon_request_t *request);
+static int daemon_proof(daemon_request_t *request);
+static int daemon_patient(daemon_request_t *request);
+static int daemon_verify_patients(daemon_request_t *request);
+static int daemon_blocks(daemon_request_t *request);
+static int daemon_sync(daemon_request_t *request);
+
+static const daemon_command_t commands[] = {
+    {"login", daemon_login, 0, 1, 1, {"email", "password", NULL}},
+    {"register", daemon_register, 0, 1, 0, {"email", "password", NULL}},
+    {"logout", daemon_logout, 0, 0, 1, {NULL}},
+    {"status", daemon_status, 0, 0, 1, {NULL}},
+    {"add", daemon_add, 1, 0, 0, {"patient", "diagnosis", "prescription", "note", "rows",
+                                  "difficulty", NULL}},
+    {"mine", daemon_mine, 1, 0, 0, {"difficulty", "batch-size", NULL}},
+    {"import", daemon_import, 1, 0, 0, {"file", "difficulty", "batch-size", NULL}},
+    {"validate", daemon_validate, 0, 0, 0, {NULL}},
+    {"query", daemon_query, 0, 0, 0, {"patient", "doctor", "from", "to", "limit", NULL}},
+    {"export", daemon_export, 0, 0, 0, {"format", "output", "from", "to", "fields", NULL}},
+    {"audit", daemon_audit, 0, 0, 0, {"user", "from", "to", NULL}},
+    {"root", daemon_root, 0, 0, 1, {"height", NULL}},
+    {"proof", daemon_proof, 0, 0, 0, {"height", NULL}},
+    {"patient", daemon_patient, 0, 0, 0, {"patient", NULL}},
+    {"verify-patients", daemon_verify_patients, 0, 0, 0, {NULL}},
+    {"blocks", daemon_blocks, 0, 0, 1, {"from", "count", NULL}},
+    {"sync", daemon_sync, 1, 0, 0, {"peer", "batch-size", NULL}}
+};
+
+#define COMMAND_COUNT ((int)(sizeof(commands) / sizeof(commands[0])))
+
+// Socket path of the daemon: BLOCKMED_SOCKET or data/blockmed.sock
+const char *daemon_socket_path(void) {
+    const char *path = getenv("BLOCKMED_SOCKET");
+    return path && path[0] ? path : DAEMON_SOCKET_PATH;
+}
+
+// ---- command handlers (run on worker or miner threads) ----
+
+static int daemon_login(daemon_request_t *request) {
+    const char *email = batch_get_option(request->args, "email");
+    const char *password = batch_get_option(request->args, "password");
+    user_t user;
+
+    if (!email || !password || !authenticate_user(email, password, &user)) {
+        log_security_event(email ? email : "Unknown", "Failed login attempt (daemon)");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED,
+                          "invalid credentials");
+    }
+
+    char token[SESSION_TOKEN_SIZE];
+    if (!session_create(&user, SESSION_DEFAULT_TTL, token)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "could not start a session");
+    }
+
+    log_operation(LOG_INFO, user.email, "Successful login (daemon)");
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_string(request->out, "token", token);
+    batch_json_string(request->out, "email", user.email);
+    batch_json_string(request->out, "role", role_to_string(user.role));
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+static int daemon_register(daemon_request_t *request) {
+    const char *email = batch_get_option(request->args, "email");
+    const char *password = batch_get_option(request->args, "password");
+
+    if (!email || !password || !register_user(email, password)) {
+        log_security_event(email ? email : "Unknown", "Failed registration attempt");
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "registration failed");
+    }
+
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_string(request->out, "email", email);
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+static int daemon_logout(daemon_request_t *request) {
+    session_revoke(request->token);
+    log_operation(LOG_INFO, request->user.email, "User logged out");
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+static int daemon_status(daemon_request_t *request) {
+    FILE *out = request->out;
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    long height = view.length;
+    long archived = view.archived;
+    char tip[HASH_SIZE];
+    strcpy(tip, view.tail ? view.tail->current_hash : "");
+    mmr_hash_t root;
+    char root_hex[HASH_SIZE] = "";
+    if (view.mmr && mmr_root(view.mmr, view.length, root)) {
+        mmr_hash_to_hex(root, root_hex);
+    }
+    long local_signer = view.seals ? view.seals->local_signer : -1;
+    int authority = view.seals != NULL;
+    chain_read_end();
+    long interned;
+    size_t interned_bytes;
+    intern_stats(&interned, &interned_bytes);
+
+    batch_json_begin(out, request->command, 1);
+    fprintf(out, ",\"daemon\":true");
+    batch_json_long(out, "height", height);
+    batch_json_string(out, "tip", tip);
+    batch_json_string(out, "root", root_hex);
+    batch_json_long(out, "clients", atomic_load(&connected_clients));
+    batch_json_long(out, "sessions", session_count());
+    batch_json_long(out, "workers", worker_count);
+    batch_json_long(out, "difficulty", default_difficulty);
+    batch_json_string(out, "consensus", authority ? "authority" : "work");
+    if (authority) batch_json_long(out, "local_signer", local_signer);
+    batch_json_long(out, "validated", chain_validated_height(chain));
+    batch_json_long(out, "archived", archived);
+    batch_json_long(out, "retired", epoch_pending());
+    batch_json_long(out, "interned_strings", interned);
+    batch_json_long(out, "interned_bytes", (long)interned_bytes);
+    batch_json_long(out, "requests", atomic_load(&requests_served));
+    batch_json_long(out, "uptime_seconds", (long)(time(NULL) - started_at));
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// function to read the per-request --difficulty (default: the daemon's)
+static int request_difficulty(const daemon_request_t *request, int *difficulty) {
+    long value;
+    if (!batch_int_option(request->args, "difficulty", default_difficulty, &value) ||
+        value < 1 || value > 8) {
+        return 0;
+    }
+    *difficulty = (int)value;
+    return 1;
+}
+
+// function to mine a CSV into the chain and report the result. Only the
+// miner thread calls this, so it is the chain's single writer.
+static int mine_csv(daemon_request_t *request, const char *csv_path, int *interrupted) {
+    int difficulty;
+    long batch_size;
+    if (!request_difficulty(request, &difficulty) ||
+        !batch_int_option(request->args, "batch-size", IMPORT_DEFAULT_BATCH_SIZE, &batch_size)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "invalid --difficulty or --batch-size");
+    }
+
+    import_options_t opts;
+    init_import_options(&opts);
+    opts.chain_file = DAEMON_CHAIN_FILE;
+    opts.batch_size = (int)batch_size;
+    opts.show_progress = 0;
+    opts.chain_file_synced = 1;
+
+    set_mining_difficulty(difficulty);
+    import_stats_t stats;
+    int ok = import_records_csv(chain, csv_path, &request->user, &opts, &stats);
+    set_mining_difficulty(default_difficulty);
+
+    *interrupted = stats.interrupted;
+    if (!ok) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE, "mining failed");
+    }
+
+    FILE *out = request->out;
+    batch_json_begin(out, request->command, 1);
+    batch_json_long(out, "mined", stats.records_imported);
+    batch_json_long(out, "rejected", stats.rows_rejected);
+    batch_json_long(out, "duplicates", stats.rows_duplicate);
+    batch_json_long(out, "skipped", stats.rows_skipped);
+    batch_json_long(out, "height", chain->length);
+    fprintf(out, ",\"records_per_second\":%.1f", stats.records_per_second);
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// function to mine rows in the bulk import format sent with --rows
+static int add_rows(daemon_request_t *request, const char *rows) {
+    // mode 0600, and encrypted like the chain while a key is loaded
+    char path[] = "data/daemon-rows-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    FILE *file = fd >= 0 ? cipher_fopen(path, "wb") : NULL;
+    if (!file) {
+        if (fd >= 0) remove(path);
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "could not stage the rows");
+    }
+
+    int ok = fputs(rows, file) >= 0;
+    if (fclose(file) != 0) ok = 0;
+
+    int interrupted = 0;
+    int result = ok ? mine_csv(request, path, &interrupted)
+                    : batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                                 "could not stage the rows");
+    remove(path);
+    return result;
+}
+
+// add: mine the record(s) straight into the chain
+static int daemon_add(daemon_request_t *request) {
+    const batch_args_t *args = request->args;
+    const user_t *user = &request->user;
+
+    if (!has_write_permission(user->role)) {
+        log_security_event(user->email, "Attempted to add record without permission");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    const char *patient = batch_get_option(args, "patient");
+    const char *rows = batch_get_option(args, "rows");
+    if ((rows != NULL) == (patient != NULL)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "give either --patient ... or --stdin");
+    }
+    if (rows) {
+        log_operation(LOG_INFO, user->email, "Created new medical records (daemon)");
+        return add_rows(request, rows);
+    }
+
+    const char *diagnosis = batch_get_option(args, "diagnosis");
+    const char *prescription = batch_get_option(args, "prescription");
+    const char *note = batch_get_option(args, "note");
+    int difficulty;
+    if (patient[0] == '\0' ||
+        strlen(patient) >= MAX_PATIENT_ID_SIZE ||
+        (diagnosis && strlen(diagnosis) >= MAX_DIAGNOSIS_SIZE) ||
+        (prescription && strlen(prescription) >= MAX_PRESCRIPTION_SIZE) ||
+        (note && strlen(note) >= MAX_NOTES_SIZE) || !request_difficulty(request, &difficulty)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "invalid or oversized record fields");
+    }
+
+    medical_transaction_t tx;
+    int created = create_transaction(&tx, patient, user->email, diagnosis ? diagnosis : "",
+                                     prescription ? prescription : "", note ? note : "");
+
+    // a visit already on the chain (a form sent twice, say) is refused
+    long duplicate = -1;
+    if (created) {
+        unsigned char digest[DEDUP_DIGEST_SIZE];
+        dedup_source_t source = {DAEMON_CHAIN_FILE, NULL, NULL};
+        dedup_digest(&tx, digest);
+        duplicate = dedup_find(chain->dedup, digest, &source);
+        dedup_source_close(&source);
+    }
+    if (duplicate >= 0) {
+        char message[64];
+        snprintf(message, sizeof(message), "the record duplicates block %ld", duplicate);
+        metrics_counter_add(METRIC_DUPLICATES_REJECTED, 1);
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE, message);
+    }
+
+    // the chain only changes on this thread, so the tail can be read
+    // without the lock
+    block_t *block = created ? create_block(chain->length, &tx, chain->tail->current_hash) : NULL;
+    if (!block || !seal_block(chain->seals, block, difficulty)) {
+        free(block);
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "could not mine or sign the block");
+    }
+
+    // the block is on disk before readers can see it
+    if (!append_blocks(DAEMON_CHAIN_FILE, block, chain->seals)) {
+        free(block);
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "could not write " DAEMON_CHAIN_FILE);
+    }
+    add_block_to_chain(chain, block);
+    log_operation(LOG_INFO, user->email, "Successfully mined a block (daemon)");
+
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_long(request->out, "added", 1);
+    batch_json_long(request->out, "height", block->index + 1);
+    batch_json_string(request->out, "hash", block->current_hash);
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+// mine: mine records left in the pending file by batch `add` runs
+static int daemon_mine(daemon_request_t *request) {
+    if (!has_write_permission(request->user.role)) {
+        log_security_event(request->user.email, "Attempted to mine block without permission");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    int claim;
+    int claimed = batch_claim_pending(&claim);
+    if (claimed < 0) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "could not claim pending records");
+    }
+    if (claimed == 0) {
+        batch_json_begin(request->out, request->command, 1);
+        batch_json_long(request->out, "mined", 0);
+        batch_json_end(request->out);
+        return BATCH_EXIT_OK;
+    }
+
+    int interrupted = 0;
+    int result = mine_csv(request, BATCH_MINING_FILE, &interrupted);
+    batch_release_claim(claim, result == BATCH_EXIT_OK && !interrupted);
+    return result;
+}
+
+static int daemon_import(daemon_request_t *request) {
+    if (!has_write_permission(request->user.role)) {
+        log_security_event(request->user.email, "Attempted to bulk import without permission");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    const char *file = batch_get_option(request->args, "file");
+    if (!file) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE, "--file is required");
+    }
+
+    int interrupted = 0;
+    return mine_csv(request, file, &interrupted);
+}
+
+static int daemon_validate(daemon_request_t *request) {
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    long height = view.length;
+    chain_read_end();
+    int valid = validate_blockchain(chain);
+
+    if (!valid) {
+        log_security_event(request->user.email, "Blockchain integrity check failed");
+    }
+    log_operation(LOG_INFO, request->user.email, valid ? "Validated blockchain - VALID" :
+                                                         "Validated blockchain - INVALID");
+    batch_json_begin(request->out, request->command, 1);
+    fprintf(request->out, ",\"valid\":%s", valid ? "true" : "false");
+    batch_json_long(request->out, "height", height);
+    batch_json_end(request->out);
+    return valid ? BATCH_EXIT_OK : BATCH_EXIT_INVALID;
+}
+
+// query: records matching a patient and/or doctor, read from memory
+static int daemon_query(daemon_request_t *request) {
+    const batch_args_t *args = request->args;
+    const char *patient = batch_get_option(args, "patient");
+    const char *doctor = batch_get_option(args, "doctor");
+    long from, to, limit;
+
+    if (!batch_int_option(args, "from", 0, &from) || !batch_int_option(args, "to", -1, &to) ||
+        !batch_int_option(args, "limit", 0, &limit)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "invalid --from, --to or --limit");
+    }
+    if (!batch_get_option(args, "to")) to = -1;
+
+    long matches = 0, scanned = 0;
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    // start at --from directly, so archived blocks before it stay on disk
+    const block_t *block = from == 0 ? chain_view_first(&view) :
+                           from < view.length ? chain_view_block(&view, (int)from) : NULL;
+    int ok = block || from >= view.length;
+    while (block) {
+        if ((to >= 0 && block->index > to) || (limit > 0 && matches >= limit)) break;
+        scanned++;
+
+        if ((!patient || strcmp(block->transaction.patient_id, patient) == 0) &&
+            (!doctor || strcasecmp(block->transaction.doctor_email, doctor) == 0)) {
+            batch_write_block_json(request->out, block);
+            matches++;
+        }
+
+        const block_t *next = chain_view_next(&view, block);
+        // NULL before the tail: an archived block could not be read
+        if (!next && block != view.tail) ok = 0;
+        block = next;
+    }
+    chain_read_end();
+
+    if (!ok) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "could not read archived blocks");
+    }
+
+    log_operation(LOG_INFO, request->user.email, "Queried blockchain (daemon)");
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_long(request->out, "matches", matches);
+    batch_json_long(request->out, "scanned", scanned);
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+static int daemon_export(daemon_request_t *request) {
+    const batch_args_t *args = request->args;
+    if (!has_write_permission(request->user.role)) {
+        log_security_event(request->user.email, "Attempted to export blockchain without permission");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    export_options_t opts;
+    init_export_options(&opts);
+
+    const char *output = batch_get_option(args, "output");
+    const char *format = batch_get_option(args, "format");
+    const char *fields = batch_get_option(args, "fields");
+    long from, to;
+
+    if (!output || strcmp(output, "-") == 0 ||
+        (format && !parse_export_format(format, &opts.format)) ||
+        (fields && !parse_export_fields(fields, &opts.fields)) ||
+        !batch_int_option(args, "from", 0, &from) || !batch_int_option(args, "to", -1, &to)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "invalid export options (--output is required)");
+    }
+    opts.from_height = (int)from;
+    opts.to_height = batch_get_option(args, "to") ? (int)to : -1;
+
+    long rows = export_blockchain(chain, output, &opts);
+    if (rows < 0) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE, "export failed");
+    }
+
+    log_operation(LOG_INFO, request->user.email, "Exported blockchain");
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_long(request->out, "rows", rows);
+    batch_json_string(request->out, "output", output);
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+static int daemon_audit(daemon_request_t *request) {
+    const batch_args_t *args = request->args;
+    if (!has_full_permission(request->user.role)) {
+        log_security_event(request->user.email, "Attempted to query audit log without permission");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED, "permission denied");
+    }
+
+    audit_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.user = batch_get_option(args, "user");
+
+    const char *from = batch_get_option(args, "from");
+    const char *to = batch_get_option(args, "to");
+    if ((from && !audit_parse_time(from, 0, &query.from)) ||
+        (to && !audit_parse_time(to, 1, &query.to))) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "dates must be YYYY-MM-DD[ HH:MM:SS]");
+    }
+
+    audit_query_stats_t stats;
+    if (audit_query(&query, batch_write_audit_json, request->out, &stats) < 0) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_FAILURE,
+                          "audit query failed");
+    }
+
+    log_operation(LOG_INFO, request->user.email, "Queried audit log");
+    batch_json_begin(request->out, request->command, 1);
+    batch_json_long(request->out, "matches", stats.records_matched);
+    batch_json_long(request->out, "segments_scanned", stats.segments_opened);
+    batch_json_long(request->out, "segments_total", stats.segments_total);
+    batch_json_end(request->out);
+    return BATCH_EXIT_OK;
+}
+
+// root: accumulator root of the chain in memory (or of its first --height
+// blocks, which is how a syncing peer finds where the chains part)
+static int daemon_root(daemon_request_t *request) {
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_root(request->out, request->command, &view, request->args);
+    chain_read_end();
+
+    log_operation(LOG_INFO, request->user.email, "Read blockchain root");
+    return result;
+}
+
+// proof: inclusion proof of the block at --height
+static int daemon_proof(daemon_request_t *request) {
+    long height;
+    if (!batch_get_option(request->args, "height") ||
+        !batch_int_option(request->args, "height", 0, &height)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "--height is required");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_proof(request->out, request->command, &view, height);
+    chain_read_end();
+
+    log_operation(LOG_INFO, request->user.email, "Generated inclusion proof");
+    return result;
+}
+
+// patient: one patient's summary, a single lookup
+static int daemon_patient(daemon_request_t *request) {
+    const char *patient = batch_get_option(request->args, "patient");
+    if (!patient || patient[0] == '\0') {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "--patient is required");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_patient(request->out, request->command, &view, patient);
+    chain_read_end();
+
+    log_operation(LOG_INFO, request->user.email, "Viewed patient summary");
+    return result;
+}
+
+// verify-patients: rebuild the summaries from the snapshot and compare;
+// patients whose summary already holds a newer block are only checked for
+// presence
+static int daemon_verify_patients(daemon_request_t *request) {
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = batch_write_patients_check(request->out, request->command, &view);
+    chain_read_end();
+
+    log_operation(LOG_INFO, request->user.email, result == BATCH_EXIT_OK ?
+                  "Verified patient summaries - CONSISTENT" : "Verified patient summaries - FAILED");
+    return result;
+}
+
+// blocks: chain file records of --count blocks from --from, for a peer
+static int daemon_blocks(daemon_request_t *request) {
+    long from, count;
+    if (!batch_get_option(request->args, "from") ||
+        !batch_int_option(request->args, "from", 0, &from) ||
+        !batch_int_option(request->args, "count", REPLICA_DEFAULT_BATCH, &count)) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "--from is required");
+    }
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    int result = replica_write_blocks(request->out, request->command, &view, from, count);
+    chain_read_end();
+    return result;
+}
+
+// sync: fetch the blocks a peer has and this chain lacks
+static int daemon_sync(daemon_request_t *request) {
+    if (!has_write_permission(request->user.role)) {
+        log_security_event(request->user.email, "Attempted to sync the blockchain without permission");
+        return batch_fail(request->out, request->command, BATCH_EXIT_DENIED, "permission denied");
+    }
+    if (!batch_get_option(request->args, "peer")) {
+        return batch_fail(request->out, request->command, BATCH_EXIT_USAGE,
+                          "--peer HOST:PORT is required");
+    }
+
+    int result = batch_write_sync(request->out, request->command, chain, DAEMON_CHAIN_FILE,
+                                  request->args);
+    log_operation(LOG_INFO, request->user.email, result == BATCH_EXIT_OK ?
+                  "Synced blockchain from peer (daemon)" : "Blockchain sync failed (daemon)");
+    return result;
+}
+
+// ---- worker side ----
+
+// function to run one request and leave its JSON in job->response
+static void execute_job(daemon_job_t *job) {
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    const char *name = job->argv[1];
+
+    FILE *out = open_memstream(&job->response, &job->response_size);
+    if (!out) {
+        job->exit_code = BATCH_EXIT_FAILURE;
+        return;
+    }
+
+    daemon_request_t request;
+    memset(&request, 0, sizeof(request));
+    request.out = out;
+    request.command = name;
+    request.token = job->argv[0];
+
+    batch_args_t args;
+    const char *unknown;
+    if (!batch_parse_options(job->argc, job->argv, &args)) {
+        job->exit_code = batch_fail(out, name, BATCH_EXIT_USAGE,
+                                    "options must be given as --name value");
+    } else if ((unknown = batch_unknown_option(&args, job->command->options))) {
+        char message[128];
+        snprintf(message, sizeof(message), "unknown option --%s", unknown);
+        job->exit_code = batch_fail(out, name, BATCH_EXIT_USAGE, message);
+    } else if (!job->command->public && !session_verify(request.token, &request.user)) {
+        job->exit_code = batch_fail(out, name, BATCH_EXIT_DENIED,
+                                    "session expired or invalid - log in again");
+    } else {
+        request.args = &args;
+        job->exit_code = job->command->run(&request);
+    }
+
+    if (fclose(out) != 0 || job->response_size > DAEMON_MAX_RESPONSE) {
+        free(job->response);
+        job->response = NULL;
+        job->response_size = 0;
+        job->exit_code = BATCH_EXIT_FAILURE;
+    }
+
+    atomic_fetch_add(&requests_served, 1);
+    metrics_counter_add(METRIC_DAEMON_REQUESTS, 1);
+    metrics_observe(METRIC_REQUEST_LATENCY, metrics_now_ns() - start);
+    trace_end("daemon.request", span);
+}
+
+// function to hand a finished job back to the event loop
+static void complete_job(daemon_job_t *job) {
+    pthread_mutex_lock(&done_lock);
+    job->next = done_jobs;
+    done_jobs = job;
+    pthread_mutex_unlock(&done_lock);
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // the counter only saturates if the loop is far behind; it will
+        // still find the job on its next wake-up
+    }
+}
+
+static void *worker_main(void *arg) {
+    bounded_queue_t *queue = arg;
+    daemon_job_t *job;
+    while ((job = queue_pop(queue)) != NULL) {
+        execute_job(job);
+        complete_job(job);
+    }
+    return NULL;
+}
+
+static void free_job(daemon_job_t *job) {
+    free(job->payload);
+    free(job->response);
+    free(job);
+}
+
+// ---- event loop side ----
+
+// Block SIGINT and SIGTERM in the calling thread and every thread it starts
+// afterwards; the event loop reads them from a signalfd instead. Call before
+// any other thread (logging, metrics) is started.
+void daemon_block_signals(sigset_t *signals) {
+    sigset_t set;
+    if (!signals) signals = &set;
+    sigemptyset(signals);
+    sigaddset(signals, SIGINT);
+    sigaddset(signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, signals, NULL);
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static uint64_t client_id(int slot) {
+    return ((uint64_t)clients[slot].generation << 32) | (uint32_t)slot;
+}
+
+static void watch_client(int slot, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = client_id(slot);
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, clients[slot].fd, &event);
+}
+
+static void close_client(int slot) {
+    daemon_client_t *client = &clients[slot];
+    if (client->fd < 0) return;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+
+    uint32_t generation = client->generation + 1;
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+    client->generation = generation;
+    atomic_fetch_sub(&connected_clients, 1);
+}
+
+static void accept_clients(int listen_fd, int remote) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        int slot = -1;
+        for (int i = 0; i < DAEMON_MAX_CLIENTS && slot < 0; i++) {
+            if (clients[i].fd < 0) slot = i;
+        }
+        if (slot < 0 || !set_nonblocking(fd)) {
+            close(fd);
+            continue;
+        }
+
+        // peers send small requests and wait for each answer
+        int one = 1;
+        if (remote) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        clients[slot].fd = fd;
+        clients[slot].remote = remote;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u64 = client_id(slot);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            clients[slot].fd = -1;
+            continue;
+        }
+        atomic_fetch_add(&connected_clients, 1);
+    }
+}
+
+// function to write as much of the pending response as the socket takes.
+// Returns 0 if the client had to be closed.
+static int flush_client(int slot) {
+    daemon_client_t *client = &clients[slot];
+    if (!client->out) return 1;
+
+    while (client->out_sent < client->out_length) {
+        ssize_t sent = send(client->fd, client->out + client->out_sent,
+                            client->out_length - client->out_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watch_client(slot, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+            return 1;
+        }
+        if (sent <= 0) {
+            close_client(slot);
+            return 0;
+        }
+        client->out_sent += (size_t)sent;
+    }
+
+    free(client->out);
+    client->out = NULL;
+    client->out_length = client->out_sent = 0;
+    client->busy = 0;
+    watch_client(slot, EPOLLIN | EPOLLRDHUP);
+    return 1;
+}
+
+// function to frame a response and start sending it
+static int send_response(int slot, int exit_code, const char *json, size_t length) {
+    daemon_client_t *client = &clients[slot];
+    client->out = malloc(8 + length);
+    if (!client->out) {
+        close_client(slot);
+        return 0;
+    }
+
+    uint32_t header[2] = {htonl((uint32_t)(4 + length)), htonl((uint32_t)exit_code)};
+    memcpy(client->out, header, sizeof(header));
+    if (length > 0) memcpy(client->out + 8, json, length);
+    client->out_length = 8 + length;
+    client->out_sent = 0;
+    return flush_client(slot);
+}
+
+// function to answer a request the event loop rejects itself
+static int send_error(int slot, const char *command, int code, const char *message) {
+    char *json = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&json, &length);
+    if (!out) {
+        close_client(slot);
+        return 0;
+    }
+    batch_fail(out, command, code, message);
+    fclose(out);
+
+    clients[slot].busy = 1;
+    int ok = send_response(slot, code, json, length);
+    free(json);
+    return ok;
+}
+
+// function to split a request payload into its NUL-terminated strings
+static int parse_request(daemon_job_t *job, size_t length) {
+    if (length == 0 || job->payload[length - 1] != '\0') return 0;
+
+    job->argc = 0;
+    for (size_t i = 0; i < length; i += strlen(job->payload + i) + 1) {
+        if (job->argc == DAEMON_MAX_ARGS) return 0;
+        job->argv[job->argc++] = job->payload + i;
+    }
+    return job->argc >= 2;
+}
+
+// function to start serving the next complete frame of a client, if it
+// is not already waiting for a response. Returns 0 if the client was closed.
+static int dispatch_request(int slot) {
+    daemon_client_t *client = &clients[slot];
+    if (client->busy || client->in_length < 4) return 1;
+
+    uint32_t length;
+    memcpy(&length, client->in, 4);
+    length = ntohl(length);
+    if (length > DAEMON_MAX_REQUEST) {
+        close_client(slot);
+        return 0;
+    }
+    if (client->in_length < 4 + (size_t)length) return 1;
+
+    daemon_job_t *job = calloc(1, sizeof(daemon_job_t));
+    char *payload = malloc(length > 0 ? length : 1);
+    if (!job || !payload) {
+        free(job);
+        free(payload);
+        close_client(slot);
+        return 0;
+    }
+    memcpy(payload, client->in + 4, length);
+    client->in_length -= 4 + (size_t)length;
+    memmove(client->in, client->in + 4 + length, client->in_length);
+
+    job->payload = payload;
+    job->slot = slot;
+    job->generation = client->generation;
+    if (!parse_request(job, length)) {
+        free_job(job);
+        return send_error(slot, "", BATCH_EXIT_USAGE, "malformed request");
+    }
+
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        if (strcmp(commands[i].name, job->argv[1]) == 0) job->command = &commands[i];
+    }
+    if (!job->command) {
+        int ok = send_error(slot, job->argv[1], BATCH_EXIT_USAGE, "unknown command");
+        free_job(job);
+        return ok;
+    }
+    if (client->remote && !job->command->remote) {
+        int ok = send_error(slot, job->argv[1], BATCH_EXIT_DENIED,
+                            "not available to replication peers");
+        free_job(job);
+        return ok;
+    }
+
+    // the queues hold one job per client at most, so this never blocks
+    client->busy = 1;
+    queue_push(job->command->writer ? &write_queue : &read_queue, job);
+    return 1;
+}
+
+static int read_client(int slot) {
+    daemon_client_t *client = &clients[slot];
+
+    for (;;) {
+        if (client->in_capacity - client->in_length < READ_CHUNK) {
+            size_t capacity = client->in_capacity ? client->in_capacity * 2 : READ_CHUNK * 2;
+            char *grown = capacity <= 2 * (size_t)DAEMON_MAX_REQUEST ?
+                          realloc(client->in, capacity) : NULL;
+            if (!grown) {
+                close_client(slot);
+                return 0;
+            }
+            client->in = grown;
+            client->in_capacity = capacity;
+        }
+
+        ssize_t received = recv(client->fd, client->in + client->in_length,
+                                client->in_capacity - client->in_length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (received <= 0) {
+            close_client(slot);
+            return 0;
+        }
+        client->in_length += (size_t)received;
+    }
+    return dispatch_request(slot);
+}
+
+// function to send the responses of every job the workers finished
+static void deliver_responses(void) {
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) < 0) {
+        // nothing to read; the list is checked anyway
+    }
+
+    pthread_mutex_lock(&done_lock);
+    daemon_job_t *job = done_jobs;
+    done_jobs = NULL;
+    pthread_mutex_unlock(&done_lock);
+
+    while (job) {
+        daemon_job_t *next = job->next;
+        daemon_client_t *client = &clients[job->slot];
+
+        // the client may have gone away (and its slot been reused) meanwhile
+        if (client->fd >= 0 && client->generation == job->generation) {
+            const char *json = job->response ? job->response :
+                "{\"ok\":false,\"error\":\"response too large\"}\n";
+            size_t length = job->response ? job->response_size : strlen(json);
+            if (send_response(job->slot, job->exit_code, json, length) &&
+                !clients[job->slot].busy) {
+                dispatch_request(job->slot);
+            }
+        }
+        free_job(job);
+        job = next;
+    }
+}
+
+static int open_listener(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Error: Could not create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // the daemon lock is held, so a socket file left behind is stale
+    unlink(path);
+    mode_t old_mask = umask(0077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if (bound != 0 || listen(fd, 128) != 0 || !set_nonblocking(fd)) {
+        printf("Error: Could not listen on '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// function to check that a listen address only reaches this machine
+static int is_loopback(const struct sockaddr *address) {
+    if (address->sa_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)address;
+        return (ntohl(in->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (address->sa_family == AF_INET6) {
+        const struct in6_addr *in6 = &((const struct sockaddr_in6 *)address)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(in6) ||
+               (IN6_IS_ADDR_V4MAPPED(in6) && in6->s6_addr[12] == 127);
+    }
+    return 0;
+}
+
+// function to listen for replication peers on `host:port`. Peers log in
+// and receive whole records over plain TCP, so only loopback addresses are
+// taken unless `allow_remote` is set.
+static int open_peer_listener(const char *address, int allow_remote) {
+    char host[256], port[16];
+    struct addrinfo hints, *found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (!client_split_address(address, host, sizeof(host), port, sizeof(port)) ||
+        getaddrinfo(host, port, &hints, &found) != 0) {
+        printf("Error: Invalid listen address '%s' (use HOST:PORT)\n", address);
+        return -1;
+    }
+
+    int fd = -1, refused = 0;
+    for (struct addrinfo *ai = found; ai && fd < 0; ai = ai->ai_next) {
+        if (!allow_remote && !is_loopback(ai->ai_addr)) {
+            refused = 1;
+            continue;
+        }
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        int one = 1;
+        if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+                        bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 128) != 0 ||
+                        !set_nonblocking(fd))) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+
+    if (fd < 0 && refused) {
+        printf("Error: '%s' is not a loopback address and replication is not encrypted; "
+               "add --allow-remote to serve peers on it\n", address);
+    } else if (fd < 0) {
+        printf("Error: Could not listen on '%s': %s\n", address, strerror(errno));
+    }
+    return fd;
+}
+
+// function to make sure only one daemon serves this data directory
+static int acquire_daemon_lock(void) {
+    int fd = open(DAEMON_LOCK_FILE, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        printf("Error: Could not open '%s': %s\n", DAEMON_LOCK_FILE, strerror(errno));
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        printf("Error: Another BlockMed daemon is already running\n");
+        close(fd);
+        return -1;
+    }
+
+    char pid[32];
+    int length = snprintf(pid, sizeof(pid), "%ld\n", (long)getpid());
+    if (ftruncate(fd, 0) != 0 || write(fd, pid, (size_t)length) != length) {
+        printf("Warning: Could not write '%s'\n", DAEMON_LOCK_FILE);
+    }
+    return fd;
+}
+
+// function to load the chain the daemon serves, creating it if missing
+static blockchain_t *open_chain(void) {
+    if (access(DAEMON_CHAIN_FILE, F_OK) == 0) {
+        return open_blockchain(DAEMON_CHAIN_FILE);
+    }
+
+    blockchain_t *created = create_blockchain();
+    if (created && !save_blockchain(created, DAEMON_CHAIN_FILE)) {
+        free_blockchain(created);
+        return NULL;
+    }
+    return created;
+}
+
+// function to add a descriptor to the epoll set under a fixed id
+static int watch_fd(int fd, uint64_t id) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = id;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+// function to run the event loop until SIGINT or SIGTERM
+static void serve(int listen_fd, int peer_fd) {
+    struct epoll_event events[64];
+    int running = 1;
+
+    while (running) {
+        int ready = epoll_wait(epoll_fd, events, 64, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            printf("Error: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            uint64_t id = events[i].data.u64;
+            int slot = (int)(uint32_t)id;
+
+            if (slot == LISTEN_ID) {
+                accept_clients(listen_fd, 0);
+            } else if (slot == PEER_LISTEN_ID) {
+                accept_clients(peer_fd, 1);
+            } else if (slot == WAKE_ID) {
+                deliver_responses();
+            } else if (slot == SIGNAL_ID) {
+                running = 0;
+            } else if (clients[slot].fd >= 0 && client_id(slot) == id) {
+                uint32_t flags = events[i].events;
+                if ((flags & EPOLLOUT) && !flush_client(slot)) continue;
+                if ((flags & EPOLLOUT) && !clients[slot].busy && !dispatch_request(slot)) continue;
+                if ((flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !read_client(slot)) {
+                    continue;
+                }
+            }
+        }
+    }
+}
+
+// Run `blockmed daemon [--socket PATH] [--workers N] [--difficulty N]
+// [--listen HOST:PORT [--allow-remote]]`: own the chain and serve clients
+// (and replication peers) until SIGINT or SIGTERM
+int run_daemon(int argc, char *argv[]) {
+    static const char *const options[] = {"socket", "workers", "difficulty", "resident-blocks",
+                                          "listen", "allow-remote", NULL};
+    batch_args_t args;
+    long workers, difficulty, resident;
+
+    if (!batch_parse_options(argc, argv, &args) || batch_unknown_option(&args, options) ||
+        !batch_int_option(&args, "workers", DAEMON_DEFAULT_WORKERS, &workers) ||
+        workers < 1 || workers > DAEMON_MAX_WORKERS ||
+        !batch_int_option(&args, "difficulty", DEFAULT_DIFFICULTY, &difficulty) ||
+        difficulty < 1 || difficulty > 8 ||
+        !batch_int_option(&args, "resident-blocks", DAEMON_DEFAULT_RESIDENT_BLOCKS, &resident) ||
+        resident > INT_MAX) {
+        printf("Usage: blockmed daemon [--socket PATH] [--workers 1-%d] [--difficulty 1-8] "
+               "[--resident-blocks N] [--listen HOST:PORT [--allow-remote]]\n"
+               "  --listen serves replication peers over unencrypted TCP on loopback\n"
+               "  addresses only (a bare PORT means 127.0.0.1); --allow-remote also\n"
+               "  accepts other addresses, for a trusted network or a TLS tunnel\n",
+               DAEMON_MAX_WORKERS);
+        return BATCH_EXIT_USAGE;
+    }
+    const char *socket_path = batch_get_option(&args, "socket");
+    if (!socket_path) socket_path = daemon_socket_path();
+    const char *listen_address = batch_get_option(&args, "listen");
+    worker_count = (int)workers;
+    default_difficulty = (int)difficulty;
+    set_mining_difficulty(default_difficulty);
+
+    int lock_fd = acquire_daemon_lock();
+    if (lock_fd < 0) return BATCH_EXIT_FAILURE;
+
+    set_quiet_mode(1);
+    // blocks beyond the newest `resident` go to data/archive (0: keep all)
+    archive_configure(ARCHIVE_DIR, (int)resident);
+    chain = open_chain();
+    if (!chain) {
+        printf("Error: Could not open %s\n", DAEMON_CHAIN_FILE);
+        close(lock_fd);
+        return BATCH_EXIT_FAILURE;
+    }
+
+    sigset_t signals;
+    daemon_block_signals(&signals);
+
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) clients[i].fd = -1;
+    started_at = time(NULL);
+
+    int listen_fd = open_listener(socket_path);
+    int peer_fd = listen_address
+                      ? open_peer_listener(listen_address,
+                                           batch_get_option(&args, "allow-remote") != NULL)
+                      : -1;
+    int signal_fd = signalfd(-1, &signals, 0);
+    epoll_fd = epoll_create1(0);
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+
+    int queues = queue_init(&read_queue, DAEMON_MAX_CLIENTS);
+    if (queues && !queue_init(&write_queue, DAEMON_MAX_CLIENTS)) {
+        queue_destroy(&read_queue);
+        queues = 0;
+    }
+    int ok = queues && listen_fd >= 0 && signal_fd >= 0 && epoll_fd >= 0 && wake_fd >= 0 &&
+             watch_fd(listen_fd, LISTEN_ID) && watch_fd(wake_fd, WAKE_ID) &&
+             watch_fd(signal_fd, SIGNAL_ID) &&
+             (!listen_address || (peer_fd >= 0 && watch_fd(peer_fd, PEER_LISTEN_ID)));
+
+    pthread_t threads[DAEMON_MAX_WORKERS + 1];
+    int started = 0;
+    if (ok) {
+        ok = pthread_create(&threads[started], NULL, worker_main, &write_queue) == 0;
+        if (ok) started++;
+        for (int i = 0; ok && i < worker_count; i++) {
+            ok = pthread_create(&threads[started], NULL, worker_main, &read_queue) == 0;
+            if (ok) started++;
+        }
+    }
+
+    if (ok) {
+        printf("BlockMed daemon serving %d blocks on %s (%d workers, difficulty %d, "
+               "%d archived)\n", chain->length, socket_path, worker_count, default_difficulty,
+               chain->archived);
+        if (listen_address) printf("Serving replication peers on %s\n", listen_address);
+        fflush(stdout);
+        log_operation(LOG_INFO, "daemon", "Daemon started");
+        serve(listen_fd, peer_fd);
+        printf("BlockMed daemon shutting down...\n");
+    } else {
+        printf("Error: Could not start the daemon\n");
+    }
+
+    // stop taking requests, let the threads finish what was queued and
+    // close every connection
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    if (peer_fd >= 0) close(peer_fd);
+    if (started > 0) {
+        queue_close(&read_queue);
+        queue_close(&write_queue);
+        for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    }
+    if (wake_fd >= 0) deliver_responses();
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) close_client(i);
+    if (queues) {
+        queue_destroy(&read_queue);
+        queue_destroy(&write_queue);
+    }
+
+    if (signal_fd >= 0) close(signal_fd);
+    if (wake_fd >= 0) close(wake_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+    log_operation(LOG_INFO, "daemon", "Daemon stopped");
+
+    // every block is already in the chain file; the snapshot makes the next
+    // start independent of its length
+    save_snapshot(chain, DAEMON_CHAIN_FILE);
+    free_blockchain(chain);
+    chain = NULL;
+    unlink(DAEMON_LOCK_FILE);
+    close(lock_fd);
+    return ok ? BATCH_EXIT_OK : BATCH_EXIT_FAILURE;
+}
@@ -0,0 +1,31 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <signal.h>
+#include <stdint.h>
+
+// The daemon owns data/blockchain.dat and serves local clients over a UNIX
+// socket. Every message is a frame: a 4-byte length in network byte order
+// followed by the payload.
+//
+//   request:  NUL-terminated strings "token\0command\0--name\0value\0..."
+//             (the token is empty for `login` and `register`)
+//   response: a 4-byte exit code in network byte order (the BATCH_EXIT_*
+//             codes) followed by the same JSON text batch mode prints
+#define DAEMON_SOCKET_PATH "data/blockmed.sock"
+#define DAEMON_LOCK_FILE "data/blockmed.pid"
+#define DAEMON_CHAIN_FILE "data/blockchain.dat"
+#define DAEMON_MAX_REQUEST (4 << 20)
+#define DAEMON_MAX_RESPONSE (256 << 20)
+#define DAEMON_MAX_CLIENTS 1024
+#define DAEMON_MAX_ARGS 40
+#define DAEMON_DEFAULT_WORKERS 4
+#define DAEMON_MAX_WORKERS 64
+#define DAEMON_DEFAULT_RESIDENT_BLOCKS 65536     // newest blocks kept in memory
+
+// Function prototypes
+const char *daemon_socket_path(void);
+void daemon_block_signals(sigset_t *signals);
+int run_daemon(int argc, char *argv[]);
+
+#endif
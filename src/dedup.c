@@ -0,0 +1,388 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dedup.h"
+#include "storage.h"
+#include "cipher.h"
+#include <errno.h>
+#include <openssl/sha.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the visit day of a record timestamp, "YYYY-MM-DD"
+#define DEDUP_DAY_SIZE 10
+
+// function to append one field to the canonical form of a record, length
+// first so that no two records share it
+static size_t put_field(unsigned char *out, const char *value, size_t max) {
+    uint32_t length = value ? (uint32_t)strnlen(value, max) : 0;
+    memcpy(out, &length, sizeof(length));
+    if (length > 0) memcpy(out + sizeof(length), value, length);
+    return sizeof(length) + length;
+}
+
+// Digest of the fields that identify a visit. The timestamp counts only
+// by its day, so a form submitted twice a few minutes apart still matches.
+void dedup_digest(const medical_transaction_t *tx, unsigned char *digest) {
+    unsigned char canonical[sizeof(transaction_record_t) + 6 * sizeof(uint32_t)];
+    size_t size = 0;
+    size += put_field(canonical + size, tx->patient_id, MAX_PATIENT_ID_SIZE);
+    size += put_field(canonical + size, tx->doctor_email, MAX_EMAIL_SIZE);
+    size += put_field(canonical + size, tx->timestamp, DEDUP_DAY_SIZE);
+    size += put_field(canonical + size, tx->diagnosis, MAX_DIAGNOSIS_SIZE);
+    size += put_field(canonical + size, tx->prescription, MAX_PRESCRIPTION_SIZE);
+    size += put_field(canonical + size, tx->visit_note, MAX_NOTES_SIZE);
+    SHA256(canonical, size, digest);
+}
+
+// function to take the fingerprint of a digest; 0 is kept for empty slots
+static uint32_t fingerprint_of(const unsigned char *digest) {
+    uint32_t fingerprint;
+    memcpy(&fingerprint, digest, sizeof(fingerprint));
+    return fingerprint ? fingerprint : 1;
+}
+
+// function to find the two buckets a fingerprint may live in; each is the
+// other's alternate
+static long first_bucket(uint32_t fingerprint, long buckets) {
+    uint64_t mixed = (uint64_t)fingerprint * 0x9e3779b97f4a7c15ull;
+    return (long)((mixed >> 32) & (uint64_t)(buckets - 1));
+}
+
+static long alternate_bucket(long bucket, uint32_t fingerprint, long buckets) {
+    uint32_t mixed = fingerprint * 0x5bd1e995u;
+    return (bucket ^ (long)(mixed | 1)) & (buckets - 1);
+}
+
+// function to step the generator that picks which entry to evict
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// function to put an entry into a free slot of a bucket
+static int place(dedup_entry_t *entries, long bucket, dedup_entry_t entry) {
+    dedup_entry_t *slots = &entries[bucket * DEDUP_BUCKET_SLOTS];
+    for (int i = 0; i < DEDUP_BUCKET_SLOTS; i++) {
+        if (slots[i].fingerprint == 0) {
+            slots[i] = entry;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// function to insert an entry, evicting entries to their alternate bucket
+// while both of its buckets are full. On failure `entry` holds the entry
+// left without a slot.
+static int insert_entry(dedup_entry_t *entries, long buckets, dedup_entry_t *entry,
+                        uint64_t *random) {
+    long bucket = first_bucket(entry->fingerprint, buckets);
+    if (place(entries, bucket, *entry)) return 1;
+    bucket = alternate_bucket(bucket, entry->fingerprint, buckets);
+    if (place(entries, bucket, *entry)) return 1;
+
+    for (int kick = 0; kick < DEDUP_MAX_KICKS; kick++) {
+        dedup_entry_t *victim = &entries[bucket * DEDUP_BUCKET_SLOTS +
+                                         (long)(next_random(random) % DEDUP_BUCKET_SLOTS)];
+        dedup_entry_t evicted = *victim;
+        *victim = *entry;
+        *entry = evicted;
+        bucket = alternate_bucket(bucket, entry->fingerprint, buckets);
+        if (place(entries, bucket, *entry)) return 1;
+    }
+    return 0;
+}
+
+// function to move the entries into a table of at least `buckets` buckets,
+// doubling further until every entry fits, plus `pending` if given
+static int grow(dedup_filter_t *filter, long buckets, dedup_entry_t *pending) {
+    for (;; buckets *= 2) {
+        dedup_entry_t *entries = calloc((size_t)buckets * DEDUP_BUCKET_SLOTS,
+                                        sizeof(dedup_entry_t));
+        if (!entries) return 0;
+
+        int fits = 1;
+        for (long i = 0; fits && i < filter->buckets * DEDUP_BUCKET_SLOTS; i++) {
+            dedup_entry_t entry = filter->entries[i];
+            fits = entry.fingerprint == 0 || insert_entry(entries, buckets, &entry, &filter->random);
+        }
+        if (fits && pending) {
+            dedup_entry_t entry = *pending;
+            fits = insert_entry(entries, buckets, &entry, &filter->random);
+        }
+        if (fits) {
+            free(filter->entries);
+            filter->entries = entries;
+            filter->buckets = buckets;
+            return 1;
+        }
+        free(entries);
+    }
+}
+
+// function to allocate a filter with room for `buckets` buckets
+static dedup_filter_t *allocate_filter(long buckets) {
+    dedup_filter_t *filter = calloc(1, sizeof(dedup_filter_t));
+    if (!filter) return NULL;
+
+    filter->entries = calloc((size_t)buckets * DEDUP_BUCKET_SLOTS, sizeof(dedup_entry_t));
+    if (!filter->entries) {
+        free(filter);
+        return NULL;
+    }
+    filter->buckets = buckets;
+    filter->complete = 1;
+    filter->random = 0x2545f4914f6cdd1dull;
+    pthread_mutex_init(&filter->lock, NULL);
+    return filter;
+}
+
+// Create an empty filter
+dedup_filter_t *dedup_create(void) {
+    return allocate_filter(DEDUP_INITIAL_BUCKETS);
+}
+
+void dedup_free(dedup_filter_t *filter) {
+    if (!filter) return;
+    pthread_mutex_destroy(&filter->lock);
+    free(filter->entries);
+    free(filter);
+}
+
+// epoch_retire callback
+void dedup_release(void *ptr) {
+    dedup_free(ptr);
+}
+
+// Add the record of the next block of the chain. Returns 0 when the block
+// cannot be added, after which the filter stops reporting duplicates; a
+// filter that already gave up takes further blocks silently.
+int dedup_apply(dedup_filter_t *filter, const block_t *block) {
+    if (!filter || !block) return 0;
+
+    pthread_mutex_lock(&filter->lock);
+    int was_complete = filter->complete;
+    if (filter->complete && block->index != filter->blocks) {
+        filter->complete = 0;
+    }
+
+    // the genesis block records no visit
+    if (filter->complete && block->index > 0) {
+        unsigned char digest[DEDUP_DIGEST_SIZE];
+        dedup_digest(&block->transaction, digest);
+        dedup_entry_t entry = {fingerprint_of(digest), (uint32_t)block->index};
+
+        if ((double)(filter->count + 1) >
+            (double)filter->buckets * DEDUP_BUCKET_SLOTS * DEDUP_MAX_LOAD) {
+            filter->complete = grow(filter, filter->buckets * 2, NULL);
+        }
+        if (filter->complete &&
+            !insert_entry(filter->entries, filter->buckets, &entry, &filter->random)) {
+            filter->complete = grow(filter, filter->buckets * 2, &entry);
+        }
+        if (filter->complete) filter->count++;
+    }
+    if (filter->complete) filter->blocks++;
+    pthread_mutex_unlock(&filter->lock);
+    return filter->complete || !was_complete;
+}
+
+// function to read block `index` of a chain file and digest its record
+static int read_record_digest(dedup_source_t *source, long index, unsigned char *digest) {
+    if (!source->chain_file) return 0;
+    if (!source->file) {
+        source->file = cipher_fopen(source->chain_file, "rb");
+        if (!source->file) return 0;
+    }
+
+    char record[BLOCK_RECORD_SIZE];
+    long offset = (long)sizeof(int) + index * (long)BLOCK_RECORD_SIZE;
+    block_t block;
+    if (fseek(source->file, offset, SEEK_SET) != 0 || !read_block_record(source->file, record)) {
+        clearerr(source->file);
+        return 0;
+    }
+    decode_block_record(record, &block);
+    if (block.index != index) return 0;
+
+    dedup_digest(&block.transaction, digest);
+    return 1;
+}
+
+// function to tell whether block `index` really holds the record of
+// `digest`
+static int confirm(dedup_source_t *source, long index, const unsigned char *digest) {
+    unsigned char found[DEDUP_DIGEST_SIZE];
+    if (!read_record_digest(source, index, found)) {
+        const block_t *block = source->view && index < source->view->length
+                                   ? chain_view_block(source->view, (int)index)
+                                   : NULL;
+        if (!block) return 0;
+        dedup_digest(&block->transaction, found);
+    }
+    return memcmp(found, digest, DEDUP_DIGEST_SIZE) == 0;
+}
+
+// Index of a block already holding the record of `digest`, or -1. Every
+// candidate the filter gives is confirmed against `source`.
+long dedup_find(dedup_filter_t *filter, const unsigned char *digest, dedup_source_t *source) {
+    if (!filter || !digest || !source) return -1;
+
+    uint32_t fingerprint = fingerprint_of(digest);
+    long candidates[2 * DEDUP_BUCKET_SLOTS];
+    int count = 0;
+
+    pthread_mutex_lock(&filter->lock);
+    if (filter->complete) {
+        long bucket = first_bucket(fingerprint, filter->buckets);
+        for (int pass = 0; pass < 2; pass++) {
+            const dedup_entry_t *slots = &filter->entries[bucket * DEDUP_BUCKET_SLOTS];
+            for (int i = 0; i < DEDUP_BUCKET_SLOTS; i++) {
+                if (slots[i].fingerprint == fingerprint) candidates[count++] = slots[i].index;
+            }
+            bucket = alternate_bucket(bucket, fingerprint, filter->buckets);
+        }
+    }
+    pthread_mutex_unlock(&filter->lock);
+
+    // the blocks are read without the lock; a candidate seen twice (both
+    // buckets the same) is simply confirmed again
+    for (int i = 0; i < count; i++) {
+        if (confirm(source, candidates[i], digest)) return candidates[i];
+    }
+    return -1;
+}
+
+// Close the chain file a source opened
+void dedup_source_close(dedup_source_t *source) {
+    if (source && source->file) {
+        fclose(source->file);
+        source->file = NULL;
+    }
+}
+
+// Path of the filter kept for a chain file
+int dedup_path(const char *chain_file, char *path, size_t size) {
+    return snprintf(path, size, "%s%s", chain_file, DEDUP_SUFFIX) < (int)size;
+}
+
+// Write the filter of a chain next to its chain file, through a temporary
+// file renamed over the old one. Only a filter covering every block of the
+// chain is written. Returns 1 on success.
+int dedup_save(const blockchain_t *chain, const char *chain_file) {
+    dedup_filter_t *filter = chain ? chain->dedup : NULL;
+    if (!filter || !chain_file || !chain->tail) return 0;
+
+    char path[4096], temp[4100];
+    if (!dedup_path(chain_file, path, sizeof(path)) ||
+        snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&filter->lock);
+    if (!filter->complete || filter->blocks != chain->length) {
+        pthread_mutex_unlock(&filter->lock);
+        return 0;
+    }
+
+    dedup_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DEDUP_MAGIC, sizeof(header.magic));
+    header.blocks = filter->blocks;
+    header.buckets = (uint64_t)filter->buckets;
+    header.count = (uint64_t)filter->count;
+    memcpy(header.last_hash, chain->tail->current_hash, HASH_SIZE);
+
+    FILE *file = cipher_fopen(temp, "wb");
+    int ok = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(filter->entries, sizeof(dedup_entry_t),
+                    (size_t)filter->buckets * DEDUP_BUCKET_SLOTS, file) ==
+                 (size_t)filter->buckets * DEDUP_BUCKET_SLOTS &&
+             cipher_sync(file, temp);
+    pthread_mutex_unlock(&filter->lock);
+    if (file && fclose(file) != 0) ok = 0;
+
+    if (!ok || rename(temp, path) != 0) {
+        printf("Error: Failed to write duplicate filter '%s'\n", path);
+        unlink(temp);
+        return 0;
+    }
+    return 1;
+}
+
+// function to read the saved filter of a chain file, provided it covers
+// no more than `length` blocks and the chain file still holds the block it
+// ends with
+static dedup_filter_t *read_filter(const char *chain_file, FILE *chain, int length) {
+    char path[4096];
+    FILE *file = dedup_path(chain_file, path, sizeof(path)) ? cipher_fopen(path, "rb") : NULL;
+    if (!file) return NULL;
+
+    dedup_header_t header;
+    dedup_filter_t *filter = NULL;
+    char record[BLOCK_RECORD_SIZE];
+    block_t last;
+    long offset = 0;
+    int usable = fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, DEDUP_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.blocks > 0 && header.blocks <= length &&
+                 header.buckets >= DEDUP_INITIAL_BUCKETS &&
+                 (header.buckets & (header.buckets - 1)) == 0 &&
+                 header.count <= header.buckets * DEDUP_BUCKET_SLOTS;
+    if (usable) {
+        offset = (long)sizeof(int) + (long)(header.blocks - 1) * (long)BLOCK_RECORD_SIZE;
+        usable = fseek(chain, offset, SEEK_SET) == 0 && read_block_record(chain, record);
+    }
+    if (usable) {
+        decode_block_record(record, &last);
+        usable = memcmp(last.current_hash, header.last_hash, HASH_SIZE) == 0;
+    }
+    if (usable) filter = allocate_filter((long)header.buckets);
+    if (filter) {
+        size_t slots = (size_t)header.buckets * DEDUP_BUCKET_SLOTS;
+        if (fread(filter->entries, sizeof(dedup_entry_t), slots, file) == slots) {
+            filter->count = (long)header.count;
+            filter->blocks = header.blocks;
+        } else {
+            dedup_free(filter);
+            filter = NULL;
+        }
+    }
+    fclose(file);
+    return filter;
+}
+
+// Give a chain loaded from `chain_file` without going through
+// add_block_to_chain for each block (load_blockchain_tail, load_snapshot)
+// a filter covering its chain->length blocks: the saved one when it still
+// matches the chain file, brought up to date from the records after it,
+// otherwise one built from every record. Only the writer calls this, while
+// loading; without a filter the chain is loaded all the same.
+void dedup_load(blockchain_t *chain, const char *chain_file) {
+    FILE *file = cipher_fopen(chain_file, "rb");
+    dedup_filter_t *filter = file ? read_filter(chain_file, file, chain->length) : NULL;
+    if (file && !filter) filter = dedup_create();
+
+    char record[BLOCK_RECORD_SIZE];
+    block_t block;
+    int ok = filter && fseek(file, (long)sizeof(int) + (long)filter->blocks * (long)BLOCK_RECORD_SIZE,
+                             SEEK_SET) == 0;
+    while (ok && filter->blocks < chain->length) {
+        ok = read_block_record(file, record);
+        if (ok) {
+            decode_block_record(record, &block);
+            ok = dedup_apply(filter, &block) && filter->complete;
+        }
+    }
+    if (file) fclose(file);
+
+    if (!ok) {
+        printf("Warning: Duplicate checks are off - '%s' could not be indexed\n", chain_file);
+        dedup_free(filter);
+        filter = NULL;
+    }
+    dedup_free(chain->dedup);
+    chain->dedup = filter;
+}
@@ -0,0 +1,81 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "blockchain.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Duplicate record detection. Every record on a chain is reduced to a
+// digest of its canonical fields (patient, doctor, visit day, diagnosis,
+// prescription and note), and a cuckoo filter maps the digests to the
+// blocks holding them: each entry is a 32-bit fingerprint of the digest and
+// the index of its block. Checking a new record is one lookup in two
+// buckets; a matching fingerprint is only a possible duplicate until the
+// block it points to is read back (from the chain file, or from memory)
+// and found to have the same digest.
+//
+// Both buckets of an entry follow from its fingerprint alone, so the table
+// grows by rehashing its entries into one twice the size. The filter is
+// kept beside the chain file in <chain file>.dedup, tagged with the hash of
+// the last block it covers, and a chain loaded without its earlier blocks
+// (or from a snapshot) picks it up there and reads only the blocks since.
+#define DEDUP_SUFFIX ".dedup"
+#define DEDUP_MAGIC "BMDUP01"
+#define DEDUP_DIGEST_SIZE 32
+#define DEDUP_BUCKET_SLOTS 4
+#define DEDUP_INITIAL_BUCKETS 1024
+#define DEDUP_MAX_LOAD 0.9              // fraction of slots used before growing
+#define DEDUP_MAX_KICKS 256
+
+// one slot: fingerprint 0 marks it empty
+typedef struct {
+    uint32_t fingerprint;
+    uint32_t index;                     // block holding the record
+} dedup_entry_t;
+
+// The writer applies blocks in chain order; the import pipeline looks
+// records up from its own threads, so both take the lock.
+struct dedup_filter {
+    pthread_mutex_t lock;
+    dedup_entry_t *entries;             // buckets * DEDUP_BUCKET_SLOTS
+    long buckets;                       // a power of two
+    long count;
+    int blocks;                         // blocks applied
+    int complete;                       // 0 once a block could not be added
+    uint64_t random;                    // picks the entries to evict
+};
+
+// on-disk header of a persisted filter, followed by its entries
+typedef struct {
+    char magic[8];
+    int32_t blocks;
+    uint32_t reserved;
+    uint64_t buckets;
+    uint64_t count;
+    char last_hash[HASH_SIZE];          // hash of block blocks - 1
+    char padding[7];
+} dedup_header_t;
+
+// where possible duplicates are confirmed: the records of a chain file,
+// then the blocks of a chain view for records not saved yet. Either may be
+// NULL.
+typedef struct {
+    const char *chain_file;
+    FILE *file;                         // opened on the first confirmation
+    const chain_view_t *view;
+} dedup_source_t;
+
+// Function prototypes
+void dedup_digest(const medical_transaction_t *tx, unsigned char *digest);
+dedup_filter_t *dedup_create(void);
+void dedup_free(dedup_filter_t *filter);
+void dedup_release(void *ptr);
+int dedup_apply(dedup_filter_t *filter, const block_t *block);
+long dedup_find(dedup_filter_t *filter, const unsigned char *digest, dedup_source_t *source);
+void dedup_source_close(dedup_source_t *source);
+int dedup_path(const char *chain_file, char *path, size_t size);
+int dedup_save(const blockchain_t *chain, const char *chain_file);
+void dedup_load(blockchain_t *chain, const char *chain_file);
+
+#endif
@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+#include "epoch.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// an object waiting until no reader can hold it
+typedef struct retired {
+    struct retired *next;
+    void *ptr;
+    epoch_release_fn release;
+    unsigned long epoch;        // global epoch when it was unlinked
+} retired_t;
+
+static atomic_ulong global_epoch = 1;
+
+// epoch each reading thread announced on entry, 0 while it is not reading
+static atomic_ulong reader_epochs[EPOCH_MAX_READERS];
+static atomic_int slot_taken[EPOCH_MAX_READERS];
+static __thread int thread_slot = -1;
+static __thread int nesting = 0;
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static retired_t *retired_list = NULL;
+static atomic_long retired_count;
+
+// function to give a thread's reader slot back when the thread exits
+static void release_slot(void *value) {
+    int slot = (int)(intptr_t)value - 1;
+    atomic_store(&reader_epochs[slot], 0);
+    atomic_store(&slot_taken[slot], 0);
+}
+
+static void create_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+// function to claim a reader slot for the calling thread, waiting for one
+// to be released if all are in use
+static int claim_slot(void) {
+    pthread_once(&slot_key_once, create_slot_key);
+
+    for (;;) {
+        for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+            int expected = 0;
+            if (atomic_compare_exchange_strong(&slot_taken[i], &expected, 1)) {
+                pthread_setspecific(slot_key, (void *)(intptr_t)(i + 1));
+                return i;
+            }
+        }
+        sched_yield();
+    }
+}
+
+// Start a read-side critical section. Sections nest; objects retired while
+// the outermost one is open stay valid until it ends.
+void epoch_enter(void) {
+    if (nesting++ > 0) return;
+    if (thread_slot < 0) thread_slot = claim_slot();
+
+    atomic_store(&reader_epochs[thread_slot], atomic_load(&global_epoch));
+    // the announcement must be visible before any shared pointer is read
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit(void) {
+    if (--nesting > 0) return;
+    atomic_store_explicit(&reader_epochs[thread_slot], 0, memory_order_release);
+}
+
+// function to find the oldest epoch a reader is still in
+static unsigned long oldest_reader_epoch(void) {
+    unsigned long oldest = ULONG_MAX;
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        unsigned long epoch = atomic_load(&reader_epochs[i]);
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+    return oldest;
+}
+
+// function to release every retired object no reader can hold; called with
+// retire_lock held
+static void reclaim(void) {
+    unsigned long oldest = oldest_reader_epoch();
+    retired_t **link = &retired_list;
+
+    while (*link) {
+        retired_t *item = *link;
+        // readers that entered after the unlink cannot have seen the object
+        if (item->epoch < oldest) {
+            *link = item->next;
+            item->release(item->ptr);
+            free(item);
+            atomic_fetch_sub(&retired_count, 1);
+        } else {
+            link = &item->next;
+        }
+    }
+}
+
+// Release `ptr` with `release` once no reader can still hold it. Call after
+// the object has been unlinked from every shared pointer.
+void epoch_retire(void *ptr, epoch_release_fn release) {
+    if (!ptr) return;
+
+    retired_t *item = malloc(sizeof(retired_t));
+    if (!item) {
+        // no memory to defer it: wait for the readers instead
+        epoch_synchronize();
+        release(ptr);
+        return;
+    }
+    item->ptr = ptr;
+    item->release = release;
+
+    pthread_mutex_lock(&retire_lock);
+    item->epoch = atomic_fetch_add(&global_epoch, 1);
+    item->next = retired_list;
+    retired_list = item;
+    atomic_fetch_add(&retired_count, 1);
+    reclaim();
+    pthread_mutex_unlock(&retire_lock);
+}
+
+// Wait until every reader that entered before this call has left, then
+// release everything retired so far. Must not be called inside a read-side
+// section.
+void epoch_synchronize(void) {
+    unsigned long target = atomic_fetch_add(&global_epoch, 1);
+
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        for (;;) {
+            unsigned long epoch = atomic_load(&reader_epochs[i]);
+            if (epoch == 0 || epoch > target) break;
+            sched_yield();
+        }
+    }
+
+    pthread_mutex_lock(&retire_lock);
+    reclaim();
+    pthread_mutex_unlock(&retire_lock);
+}
+
+// Number of retired objects not yet released
+long epoch_pending(void) {
+    return atomic_load(&retired_count);
+}
@@ -0,0 +1,19 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch-based reclamation. Readers bracket lock-free access to shared data
+// with epoch_enter/epoch_exit; a writer that unlinks an object hands it to
+// epoch_retire, which releases it only once every reader that could still
+// see it has left.
+#define EPOCH_MAX_READERS 256
+
+typedef void (*epoch_release_fn)(void *ptr);
+
+// Function prototypes
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, epoch_release_fn release);
+void epoch_synchronize(void);
+long epoch_pending(void);
+
+#endif
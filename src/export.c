@@ -0,0 +1,481 @@
+#define _POSIX_C_SOURCE 200809L
+#include "export.h"
+#include "storage.h"
+#include "cipher.h"
+#include "strdict.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define EXPORT_BUFFER_SIZE (1 << 20)
+#define EXPORT_COLUMN_BUFFER_SIZE (256 * 1024)
+
+// how a field is laid out in the columnar format
+typedef enum {
+    COLUMN_INT32,       // little-endian int32 per row
+    COLUMN_UINT64,      // little-endian uint64 per row
+    COLUMN_FIXED,       // fixed-width bytes per row
+    COLUMN_VARLEN,      // bytes in .col, uint64 end offsets in .off
+    COLUMN_DICT         // uint32 ids in .col, (uint32 length, bytes) in .dict
+} column_encoding_t;
+
+typedef struct {
+    const char *name;
+    column_encoding_t encoding;
+    int width;          // for COLUMN_FIXED
+} export_field_t;
+
+static const export_field_t export_fields[EXPORT_FIELD_COUNT] = {
+    { "index",            COLUMN_INT32,  0 },
+    { "timestamp",        COLUMN_FIXED,  19 },
+    { "patient_id",       COLUMN_VARLEN, 0 },
+    { "doctor_email",     COLUMN_DICT,   0 },
+    { "diagnosis",        COLUMN_DICT,   0 },
+    { "prescription",     COLUMN_DICT,   0 },
+    { "visit_note",       COLUMN_VARLEN, 0 },
+    { "record_timestamp", COLUMN_FIXED,  19 },
+    { "nonce",            COLUMN_UINT64, 0 },
+    { "previous_hash",    COLUMN_FIXED,  64 },
+    { "current_hash",     COLUMN_FIXED,  64 }
+};
+
+static const char *encoding_names[] = { "int32", "uint64", "fixed", "varlen", "dict" };
+
+// per-field output of the columnar format
+typedef struct {
+    FILE *data;
+    FILE *aux;
+    char *data_buffer;
+    char *aux_buffer;
+    uint64_t offset;
+    strdict_t dict;
+} column_writer_t;
+
+// state of one export run
+typedef struct {
+    const export_options_t *opts;
+    const char *path;
+    FILE *out;
+    char *out_buffer;
+    column_writer_t columns[EXPORT_FIELD_COUNT];
+    int first_height;
+    int last_height;
+    long rows;
+} exporter_t;
+
+// Fill in default export options (CSV, whole chain, all fields)
+void init_export_options(export_options_t *opts) {
+    if (!opts) return;
+
+    opts->format = EXPORT_CSV;
+    opts->from_height = 0;
+    opts->to_height = -1;
+    opts->fields = EXPORT_ALL_FIELDS;
+}
+
+// Parse "csv", "jsonl" or "columnar"
+int parse_export_format(const char *name, export_format_t *format) {
+    if (!name || !format) return 0;
+
+    if (strcmp(name, "csv") == 0) {
+        *format = EXPORT_CSV;
+    } else if (strcmp(name, "jsonl") == 0 || strcmp(name, "json") == 0) {
+        *format = EXPORT_JSONL;
+    } else if (strcmp(name, "columnar") == 0) {
+        *format = EXPORT_COLUMNAR;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Parse a comma-separated field list into an EXPORT_FIELD_* mask.
+// An empty list selects all fields.
+int parse_export_fields(const char *list, unsigned int *fields) {
+    if (!list || !fields) return 0;
+
+    if (list[0] == '\0') {
+        *fields = EXPORT_ALL_FIELDS;
+        return 1;
+    }
+
+    unsigned int mask = 0;
+    const char *start = list;
+    while (*start) {
+        size_t length = strcspn(start, ",");
+        int found = 0;
+
+        for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+            if (strlen(export_fields[i].name) == length &&
+                strncmp(export_fields[i].name, start, length) == 0) {
+                mask |= 1u << i;
+                found = 1;
+                break;
+            }
+        }
+        if (!found) {
+            printf("Error: Unknown export field '%.*s'\n", (int)length, start);
+            return 0;
+        }
+
+        start += length;
+        if (*start == ',') start++;
+    }
+
+    *fields = mask;
+    return mask != 0;
+}
+
+// Get the text of a string field of a block
+static const char *block_string_field(const block_t *block, int field) {
+    switch (field) {
+        case 1: return block->timestamp;
+        case 2: return block->transaction.patient_id;
+        case 3: return block->transaction.doctor_email;
+        case 4: return block->transaction.diagnosis;
+        case 5: return block->transaction.prescription;
+        case 6: return block->transaction.visit_note;
+        case 7: return block->transaction.timestamp;
+        case 9: return block->previous_hash;
+        case 10: return block->current_hash;
+        default: return "";
+    }
+}
+
+// Open a column file inside the export directory
+static FILE *open_column_file(const char *dir, const char *name, const char *ext,
+                              char **buffer, size_t buffer_size) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.%s", dir, name, ext);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("Error: Could not create '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    *buffer = malloc(buffer_size);
+    if (*buffer) {
+        setvbuf(file, *buffer, _IOFBF, buffer_size);
+    }
+    return file;
+}
+
+// function to open the outputs for the requested format
+static int exporter_open(exporter_t *exporter) {
+    const export_options_t *opts = exporter->opts;
+
+    if (opts->format != EXPORT_COLUMNAR) {
+        if (strcmp(exporter->path, "-") == 0) {
+            exporter->out = stdout;
+        } else {
+            exporter->out = fopen(exporter->path, "wb");
+            if (!exporter->out) {
+                printf("Error: Could not open '%s' for export: %s\n", exporter->path, strerror(errno));
+                return 0;
+            }
+        }
+
+        exporter->out_buffer = malloc(EXPORT_BUFFER_SIZE);
+        if (exporter->out_buffer) {
+            setvbuf(exporter->out, exporter->out_buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+        }
+
+        if (opts->format == EXPORT_CSV) {
+            int first = 1;
+            for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+                if (!(opts->fields & (1u << i))) continue;
+                if (!first) fputc(',', exporter->out);
+                fputs(export_fields[i].name, exporter->out);
+                first = 0;
+            }
+            fputc('\n', exporter->out);
+        }
+        return 1;
+    }
+
+    if (mkdir(exporter->path, 0700) != 0 && errno != EEXIST) {
+        printf("Error: Could not create export directory '%s': %s\n", exporter->path, strerror(errno));
+        return 0;
+    }
+
+    for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+        if (!(opts->fields & (1u << i))) continue;
+
+        column_writer_t *column = &exporter->columns[i];
+        const export_field_t *field = &export_fields[i];
+
+        column->data = open_column_file(exporter->path, field->name, "col",
+                                        &column->data_buffer, EXPORT_COLUMN_BUFFER_SIZE);
+        if (!column->data) return 0;
+
+        if (field->encoding == COLUMN_VARLEN) {
+            column->aux = open_column_file(exporter->path, field->name, "off",
+                                           &column->aux_buffer, EXPORT_COLUMN_BUFFER_SIZE);
+            if (!column->aux) return 0;
+            uint64_t zero = 0;
+            fwrite(&zero, sizeof(zero), 1, column->aux);
+        } else if (field->encoding == COLUMN_DICT) {
+            column->aux = open_column_file(exporter->path, field->name, "dict",
+                                           &column->aux_buffer, EXPORT_COLUMN_BUFFER_SIZE);
+            if (!column->aux || !strdict_init(&column->dict)) return 0;
+        }
+    }
+    return 1;
+}
+
+// function to append one column value for a block
+static int write_column_value(column_writer_t *column, const export_field_t *field,
+                              const block_t *block, int index) {
+    switch (field->encoding) {
+        case COLUMN_INT32: {
+            int32_t value = block->index;
+            return fwrite(&value, sizeof(value), 1, column->data) == 1;
+        }
+        case COLUMN_UINT64: {
+            uint64_t value = block->nonce;
+            return fwrite(&value, sizeof(value), 1, column->data) == 1;
+        }
+        case COLUMN_FIXED: {
+            char fixed[HASH_SIZE] = {0};
+            strncpy(fixed, block_string_field(block, index), field->width);
+            return fwrite(fixed, 1, field->width, column->data) == (size_t)field->width;
+        }
+        case COLUMN_VARLEN: {
+            const char *value = block_string_field(block, index);
+            size_t length = strlen(value);
+            column->offset += length;
+            return fwrite(value, 1, length, column->data) == length &&
+                   fwrite(&column->offset, sizeof(uint64_t), 1, column->aux) == 1;
+        }
+        case COLUMN_DICT: {
+            const char *value = block_string_field(block, index);
+            size_t length = strlen(value);
+            uint32_t id;
+            int added = strdict_intern(&column->dict, value, length, &id);
+            if (added < 0) return 0;
+            if (added) {
+                uint32_t stored_length = (uint32_t)length;
+                if (fwrite(&stored_length, sizeof(stored_length), 1, column->aux) != 1 ||
+                    fwrite(value, 1, length, column->aux) != length) {
+                    return 0;
+                }
+            }
+            return fwrite(&id, sizeof(id), 1, column->data) == 1;
+        }
+    }
+    return 0;
+}
+
+// function to export a single block
+static int exporter_write(exporter_t *exporter, const block_t *block) {
+    const export_options_t *opts = exporter->opts;
+    FILE *out = exporter->out;
+
+    if (exporter->rows == 0) exporter->first_height = block->index;
+    exporter->last_height = block->index;
+    exporter->rows++;
+
+    if (opts->format == EXPORT_COLUMNAR) {
+        for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+            if (!(opts->fields & (1u << i))) continue;
+            if (!write_column_value(&exporter->columns[i], &export_fields[i], block, i)) {
+                printf("Error: Failed to write column '%s'\n", export_fields[i].name);
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    int first = 1;
+    if (opts->format == EXPORT_JSONL) fputc('{', out);
+
+    for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+        if (!(opts->fields & (1u << i))) continue;
+
+        if (!first) fputc(',', out);
+        first = 0;
+
+        if (opts->format == EXPORT_JSONL) {
+            fprintf(out, "\"%s\":", export_fields[i].name);
+        }
+
+        if (export_fields[i].encoding == COLUMN_INT32) {
+            fprintf(out, "%d", block->index);
+        } else if (export_fields[i].encoding == COLUMN_UINT64) {
+            fprintf(out, "%lu", block->nonce);
+        } else if (opts->format == EXPORT_JSONL) {
+            write_json_string(out, block_string_field(block, i));
+        } else {
+            write_csv_string(out, block_string_field(block, i));
+        }
+    }
+
+    if (opts->format == EXPORT_JSONL) fputc('}', out);
+    fputc('\n', out);
+    return !ferror(out);
+}
+
+// function to write the columnar manifest describing the column files
+static int write_manifest(const exporter_t *exporter) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/manifest.json", exporter->path);
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("Error: Could not create '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    fprintf(file, "{\"format\":\"blockmed-columnar\",\"version\":1,\"byte_order\":\"little\",");
+    fprintf(file, "\"rows\":%ld,\"from_height\":%d,\"to_height\":%d,\"columns\":[",
+            exporter->rows, exporter->rows ? exporter->first_height : -1,
+            exporter->rows ? exporter->last_height : -1);
+
+    int first = 1;
+    for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+        if (!(exporter->opts->fields & (1u << i))) continue;
+
+        const export_field_t *field = &export_fields[i];
+        fprintf(file, "%s{\"name\":\"%s\",\"encoding\":\"%s\"", first ? "" : ",",
+                field->name, encoding_names[field->encoding]);
+        if (field->encoding == COLUMN_FIXED) {
+            fprintf(file, ",\"width\":%d", field->width);
+        } else if (field->encoding == COLUMN_DICT) {
+            fprintf(file, ",\"dictionary_size\":%u", exporter->columns[i].dict.count);
+        }
+        fprintf(file, "}");
+        first = 0;
+    }
+    fprintf(file, "]}\n");
+
+    return fclose(file) == 0;
+}
+
+// function to flush and close all outputs
+static int exporter_close(exporter_t *exporter, int ok) {
+    if (exporter->out) {
+        if (fflush(exporter->out) != 0) ok = 0;
+        if (exporter->out != stdout && fclose(exporter->out) != 0) ok = 0;
+    }
+    free(exporter->out_buffer);
+
+    for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+        column_writer_t *column = &exporter->columns[i];
+        if (column->data && fclose(column->data) != 0) ok = 0;
+        if (column->aux && fclose(column->aux) != 0) ok = 0;
+        free(column->data_buffer);
+        free(column->aux_buffer);
+    }
+
+    if (ok && exporter->opts->format == EXPORT_COLUMNAR) {
+        ok = write_manifest(exporter);
+    }
+
+    for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+        if (exporter->columns[i].dict.slots) {
+            strdict_free(&exporter->columns[i].dict);
+        }
+    }
+    return ok;
+}
+
+static int check_export_options(const export_options_t *opts) {
+    if (opts->from_height < 0 || (opts->to_height >= 0 && opts->to_height < opts->from_height)) {
+        printf("Error: Invalid export height range %d..%d\n", opts->from_height, opts->to_height);
+        return 0;
+    }
+    if ((opts->fields & EXPORT_ALL_FIELDS) == 0) {
+        printf("Error: No fields selected for export\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Export the blocks of an in-memory chain within the height range.
+// Returns the number of exported blocks, or -1 on error.
+long export_blockchain(const blockchain_t *chain, const char *path,
+                       const export_options_t *opts) {
+    if (!chain || !path || !opts || !check_export_options(opts)) return -1;
+
+    exporter_t exporter;
+    memset(&exporter, 0, sizeof(exporter));
+    exporter.opts = opts;
+    exporter.path = path;
+
+    int ok = exporter_open(&exporter);
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    // start at the first height directly, so archived blocks before it
+    // stay on disk
+    int from = opts->from_height;
+    const block_t *current = from == 0 ? chain_view_first(&view) :
+                             from < view.length ? chain_view_block(&view, from) : NULL;
+    ok = ok && (current || from >= view.length);
+    while (ok && current) {
+        if (opts->to_height >= 0 && current->index > opts->to_height) break;
+        ok = exporter_write(&exporter, current);
+
+        const block_t *next = chain_view_next(&view, current);
+        // NULL before the tail: an archived block could not be read
+        if (!next && current != view.tail) ok = 0;
+        current = next;
+    }
+    chain_read_end();
+
+    ok = exporter_close(&exporter, ok);
+    return ok ? exporter.rows : -1;
+}
+
+// Export straight from a blockchain file, one record in memory at a time,
+// so chains larger than RAM can be exported. Fixed-size records let the
+// range start be reached with a single seek.
+long export_blockchain_file(const char *chain_file, const char *path,
+                            const export_options_t *opts) {
+    if (!chain_file || !path || !opts || !check_export_options(opts)) return -1;
+
+    FILE *file = cipher_fopen(chain_file, "rb");
+    if (!file) {
+        printf("Error: Could not open file '%s' for reading: %s\n", chain_file, strerror(errno));
+        return -1;
+    }
+
+    int length;
+    if (fread(&length, sizeof(int), 1, file) != 1 || length < 0) {
+        printf("Error: Failed to read blockchain length from file\n");
+        fclose(file);
+        return -1;
+    }
+
+    int last = opts->to_height >= 0 && opts->to_height < length ? opts->to_height : length - 1;
+    if (opts->from_height < length &&
+        fseek(file, (long)sizeof(int) + (long)opts->from_height * (long)BLOCK_RECORD_SIZE, SEEK_SET) != 0) {
+        printf("Error: Failed to seek in '%s': %s\n", chain_file, strerror(errno));
+        fclose(file);
+        return -1;
+    }
+
+    exporter_t exporter;
+    memset(&exporter, 0, sizeof(exporter));
+    exporter.opts = opts;
+    exporter.path = path;
+
+    char *record = malloc(BLOCK_RECORD_SIZE);
+    block_t block;
+    int ok = record != NULL && exporter_open(&exporter);
+
+    for (int height = opts->from_height; ok && height <= last; height++) {
+        if (!read_block_record(file, record)) {
+            printf("Error: Failed to read block %d from file\n", height);
+            ok = 0;
+            break;
+        }
+        decode_block_record(record, &block);
+        ok = exporter_write(&exporter, &block);
+    }
+
+    free(record);
+    fclose(file);
+    ok = exporter_close(&exporter, ok);
+    return ok ? exporter.rows : -1;
+}
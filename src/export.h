@@ -0,0 +1,45 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "blockchain.h"
+
+// output formats
+typedef enum {
+    EXPORT_CSV,
+    EXPORT_JSONL,
+    EXPORT_COLUMNAR
+} export_format_t;
+
+// exportable fields, combined as a bit mask for projection
+#define EXPORT_FIELD_INDEX            (1u << 0)
+#define EXPORT_FIELD_TIMESTAMP        (1u << 1)
+#define EXPORT_FIELD_PATIENT_ID       (1u << 2)
+#define EXPORT_FIELD_DOCTOR_EMAIL     (1u << 3)
+#define EXPORT_FIELD_DIAGNOSIS        (1u << 4)
+#define EXPORT_FIELD_PRESCRIPTION     (1u << 5)
+#define EXPORT_FIELD_VISIT_NOTE       (1u << 6)
+#define EXPORT_FIELD_RECORD_TIMESTAMP (1u << 7)
+#define EXPORT_FIELD_NONCE            (1u << 8)
+#define EXPORT_FIELD_PREVIOUS_HASH    (1u << 9)
+#define EXPORT_FIELD_CURRENT_HASH     (1u << 10)
+#define EXPORT_FIELD_COUNT            11
+#define EXPORT_ALL_FIELDS             ((1u << EXPORT_FIELD_COUNT) - 1)
+
+// options for an export run
+typedef struct {
+    export_format_t format;
+    int from_height;            // first block to export
+    int to_height;              // last block to export, -1 for the tip
+    unsigned int fields;        // EXPORT_FIELD_* mask
+} export_options_t;
+
+// Function prototypes
+void init_export_options(export_options_t *opts);
+int parse_export_format(const char *name, export_format_t *format);
+int parse_export_fields(const char *list, unsigned int *fields);
+long export_blockchain(const blockchain_t *chain, const char *path,
+                       const export_options_t *opts);
+long export_blockchain_file(const char *chain_file, const char *path,
+                            const export_options_t *opts);
+
+#endif
@@ -0,0 +1,673 @@
+#define _POSIX_C_SOURCE 200809L
+#include "import.h"
+#include "storage.h"
+#include "pow.h"
+#include "authority.h"
+#include "dedup.h"
+#include "cipher.h"
+#include "strdict.h"
+#include "log.h"
+#include "metrics.h"
+#include "queue.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <strings.h>
+
+#define IMPORT_LINE_SIZE 4096
+#define IMPORT_MAX_FIELDS 6
+#define IMPORT_STAGES 4
+
+// a CSV line as read by the parse stage
+typedef struct {
+    long row;
+    char *line;
+} raw_row_t;
+
+// a validated record ready to be mined; the mine stage adds its block
+typedef struct {
+    long row;
+    medical_transaction_t tx;
+    char patient_id[MAX_PATIENT_ID_SIZE];   // tx.patient_id points here
+    char prescription[MAX_PRESCRIPTION_SIZE];   // tx.prescription here
+    char visit_note[MAX_NOTES_SIZE];    // tx.visit_note here
+    block_t *block;
+} parsed_row_t;
+
+// consecutive blocks the persist stage wrote to the chain file, linked
+// from `first`
+typedef struct {
+    block_t *first;
+    int count;
+    long last_row;                      // CSV line of the last block
+} committed_batch_t;
+
+// state shared by the pipeline stages
+typedef struct {
+    FILE *file;
+    const char *csv_path;
+    const char *chain_file;
+    long resume_after;
+    int resumable;
+    const char *default_doctor;
+    int batch_size;
+    int difficulty;
+    seal_table_t *seals;                // signs blocks instead of mining
+    dedup_filter_t *dedup;              // records already on the chain
+    dedup_source_t dedup_source;        // mine stage: confirms possible duplicates
+    strdict_t seen;                     // mine stage: digests of the rows mined
+    bounded_queue_t raw_rows;
+    bounded_queue_t parsed_rows;
+    bounded_queue_t mined_rows;
+    bounded_queue_t committed;
+    long rows_read;
+    long rows_skipped;
+    long rows_rejected;
+    long rows_duplicate;                // mine stage
+    int next_index;                     // mine stage: where the next block goes
+    char previous_hash[HASH_SIZE];
+    atomic_int failed;                  // a stage gave up
+} import_ctx_t;
+
+static volatile sig_atomic_t import_interrupted = 0;
+
+static void handle_import_signal(int signum) {
+    (void)signum;
+    import_interrupted = 1;
+}
+
+// imports running at the same time (one per shard, say) share the SIGINT
+// handler: the first installs it and the last restores the old one
+static pthread_mutex_t signal_lock = PTHREAD_MUTEX_INITIALIZER;
+static int signal_users = 0;
+static struct sigaction saved_action;
+
+// function to route SIGINT to the running imports
+static void claim_interrupt(void) {
+    pthread_mutex_lock(&signal_lock);
+    if (signal_users++ == 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handle_import_signal;
+        sigemptyset(&action.sa_mask);
+        import_interrupted = 0;
+        sigaction(SIGINT, &action, &saved_action);
+    }
+    pthread_mutex_unlock(&signal_lock);
+}
+
+// function to give SIGINT back once no import is running
+static void release_interrupt(void) {
+    pthread_mutex_lock(&signal_lock);
+    if (--signal_users == 0) {
+        sigaction(SIGINT, &saved_action, NULL);
+    }
+    pthread_mutex_unlock(&signal_lock);
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fill in default import options
+void init_import_options(import_options_t *opts) {
+    if (!opts) return;
+
+    opts->chain_file = "data/blockchain.dat";
+    opts->batch_size = IMPORT_DEFAULT_BATCH_SIZE;
+    opts->show_progress = 1;
+    opts->chain_file_synced = 0;
+    opts->resumable = 1;
+}
+
+// Split one CSV line in place. Double-quoted fields may contain commas and
+// "" escapes. Returns the number of fields, or -1 for a malformed line.
+int split_csv_line(char *line, char **fields, int max_fields) {
+    int count = 0;
+    char *read = line;
+    char *write = line;
+
+    for (;;) {
+        if (count == max_fields) return -1;
+        fields[count++] = write;
+
+        if (*read == '"') {
+            read++;
+            for (;;) {
+                if (*read == '\0') return -1; // unterminated quote
+                if (*read == '"') {
+                    if (read[1] == '"') {
+                        *write++ = '"';
+                        read += 2;
+                        continue;
+                    }
+                    read++;
+                    break;
+                }
+                *write++ = *read++;
+            }
+            if (*read != ',' && *read != '\0') return -1;
+        } else {
+            while (*read != ',' && *read != '\0') {
+                *write++ = *read++;
+            }
+        }
+
+        if (*read == '\0') {
+            *write = '\0';
+            return count;
+        }
+        read++; // skip the comma
+        *write++ = '\0';
+    }
+}
+
+// Check a "YYYY-MM-DD HH:MM:SS" timestamp
+static int is_valid_timestamp(const char *timestamp) {
+    if (strlen(timestamp) != 19) return 0;
+
+    for (int i = 0; i < 19; i++) {
+        char c = timestamp[i];
+        if (i == 4 || i == 7) {
+            if (c != '-') return 0;
+        } else if (i == 10) {
+            if (c != ' ') return 0;
+        } else if (i == 13 || i == 16) {
+            if (c != ':') return 0;
+        } else if (c < '0' || c > '9') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Parse stage: stream lines from the CSV file into the raw queue
+static void *parse_stage(void *arg) {
+    import_ctx_t *ctx = arg;
+    char buffer[IMPORT_LINE_SIZE];
+    long row = 0;
+
+    while (fgets(buffer, sizeof(buffer), ctx->file)) {
+        row++;
+
+        // lines longer than the buffer cannot hold a valid record; they are
+        // passed on empty so the validate stage counts the rejection
+        if (!strchr(buffer, '\n') && !feof(ctx->file)) {
+            int c;
+            while ((c = fgetc(ctx->file)) != EOF && c != '\n');
+            buffer[0] = '\0';
+        } else {
+            buffer[strcspn(buffer, "\r\n")] = '\0';
+            if (buffer[0] == '\0') continue;
+        }
+
+        // optional header row
+        if (row == 1 && strncasecmp(buffer, "patient_id", 10) == 0) continue;
+
+        ctx->rows_read++;
+        if (row <= ctx->resume_after) {
+            ctx->rows_skipped++;
+            continue;
+        }
+
+        raw_row_t *raw = malloc(sizeof(raw_row_t));
+        char *line = strdup(buffer);
+        if (!raw || !line) {
+            free(raw);
+            free(line);
+            break;
+        }
+        raw->row = row;
+        raw->line = line;
+
+        if (!queue_push(&ctx->raw_rows, raw)) {
+            free(raw->line);
+            free(raw);
+            break;
+        }
+    }
+
+    queue_close(&ctx->raw_rows);
+    return NULL;
+}
+
+// Validate stage: split, sanitize and validate rows into transactions
+static void *validate_stage(void *arg) {
+    import_ctx_t *ctx = arg;
+    raw_row_t *raw;
+
+    while ((raw = queue_pop(&ctx->raw_rows))) {
+        char *fields[IMPORT_MAX_FIELDS];
+        int count = split_csv_line(raw->line, fields, IMPORT_MAX_FIELDS);
+        parsed_row_t *parsed = NULL;
+
+        if (count == 5 || count == 6) {
+            for (int i = 0; i < count; i++) {
+                sanitize_input(fields[i]);
+            }
+
+            const char *doctor = fields[1][0] ? fields[1] : ctx->default_doctor;
+            int valid = fields[0][0] != '\0' &&
+                        strlen(fields[0]) < MAX_PATIENT_ID_SIZE &&
+                        is_valid_email(doctor) &&
+                        (count == 5 || is_valid_timestamp(fields[5]));
+
+            if (valid) {
+                parsed = malloc(sizeof(parsed_row_t));
+            }
+            if (parsed) {
+                parsed->row = raw->row;
+                // the line is freed below; the fields that are not
+                // interned are kept with the row
+                snprintf(parsed->patient_id, sizeof(parsed->patient_id), "%s", fields[0]);
+                snprintf(parsed->prescription, sizeof(parsed->prescription), "%s", fields[3]);
+                snprintf(parsed->visit_note, sizeof(parsed->visit_note), "%s", fields[4]);
+                if (!create_transaction(&parsed->tx, parsed->patient_id, doctor, fields[2],
+                                        parsed->prescription, parsed->visit_note)) {
+                    free(parsed);
+                    parsed = NULL;
+                } else if (count == 6) {
+                    strcpy(parsed->tx.timestamp, fields[5]);
+                }
+            }
+        }
+
+        free(raw->line);
+        free(raw);
+
+        if (!parsed) {
+            ctx->rows_rejected++;
+            continue;
+        }
+
+        if (!queue_push(&ctx->parsed_rows, parsed)) {
+            free(parsed);
+            break;
+        }
+    }
+
+    queue_close(&ctx->parsed_rows);
+    return NULL;
+}
+
+// Read the resume point left by an interrupted import of `csv_path`
+static long read_import_progress(const char *csv_path, int chain_length) {
+    FILE *file = fopen(IMPORT_PROGRESS_FILE, "r");
+    if (!file) return 0;
+
+    char source[1024] = "";
+    long row = 0;
+    int height = 0;
+    char line[1100];
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "source=", 7) == 0) {
+            strncpy(source, line + 7, sizeof(source) - 1);
+        } else if (strncmp(line, "row=", 4) == 0) {
+            row = atol(line + 4);
+        } else if (strncmp(line, "height=", 7) == 0) {
+            height = atoi(line + 7);
+        }
+    }
+    fclose(file);
+
+    if (strcmp(source, csv_path) != 0) {
+        printf("Warning: discarding unfinished import of '%s'\n", source);
+        return 0;
+    }
+
+    if (chain_length < height) {
+        printf("Warning: chain is shorter than the recorded import height (%d < %d), restarting import\n",
+               chain_length, height);
+        return 0;
+    }
+
+    return row;
+}
+
+// Atomically record the last committed row of the current import
+static int write_import_progress(const char *csv_path, long row, int height) {
+    char tmp_path[] = IMPORT_PROGRESS_FILE ".tmp";
+
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        printf("Error: Could not write import progress: %s\n", strerror(errno));
+        return 0;
+    }
+
+    fprintf(file, "source=%s\nrow=%ld\nheight=%d\n", csv_path, row, height);
+    if (fclose(file) != 0 || rename(tmp_path, IMPORT_PROGRESS_FILE) != 0) {
+        printf("Error: Could not write import progress: %s\n", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+// function to tell whether a row records a visit already on the chain or
+// in an earlier row of this import, remembering it otherwise. Rows of this
+// import may not be on the chain yet, so they are tracked apart.
+static int is_duplicate(import_ctx_t *ctx, const medical_transaction_t *tx) {
+    unsigned char digest[DEDUP_DIGEST_SIZE];
+    dedup_digest(tx, digest);
+    if (strdict_find(&ctx->seen, (const char *)digest, sizeof(digest), NULL)) return 1;
+    if (dedup_find(ctx->dedup, digest, &ctx->dedup_source) >= 0) return 1;
+
+    strdict_intern(&ctx->seen, (const char *)digest, sizeof(digest), NULL);
+    return 0;
+}
+
+// Mine stage: build each record's block on the hash of the block mined
+// before it, which is known as soon as that block is mined, so mining never
+// waits for earlier blocks to be written or indexed. Rows recording a visit
+// that is already there are dropped first.
+static void *mine_stage(void *arg) {
+    import_ctx_t *ctx = arg;
+    parsed_row_t *parsed;
+
+    while ((parsed = queue_pop(&ctx->parsed_rows))) {
+        if (import_interrupted || atomic_load(&ctx->failed)) {
+            free(parsed);
+            break;
+        }
+
+        if (is_duplicate(ctx, &parsed->tx)) {
+            ctx->rows_duplicate++;
+            metrics_counter_add(METRIC_DUPLICATES_REJECTED, 1);
+            free(parsed);
+            continue;
+        }
+
+        block_t *block = create_block(ctx->next_index, &parsed->tx, ctx->previous_hash);
+        if (!block || !seal_block(ctx->seals, block, ctx->difficulty)) {
+            printf("Error: Failed to mine record from row %ld\n", parsed->row);
+            free(block);
+            free(parsed);
+            atomic_store(&ctx->failed, 1);
+            break;
+        }
+
+        ctx->next_index++;
+        strcpy(ctx->previous_hash, block->current_hash);
+        parsed->block = block;
+        if (!queue_push(&ctx->mined_rows, parsed)) {
+            free(block);
+            free(parsed);
+            break;
+        }
+    }
+
+    queue_close(&ctx->mined_rows);
+    return NULL;
+}
+
+// function to free the blocks of a batch that never reached the chain
+static void free_batch(committed_batch_t *batch) {
+    block_t *block = batch->first;
+    for (int i = 0; block && i < batch->count; i++) {
+        block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(batch);
+}
+
+// function to append a batch to the chain file, record the resume point
+// and hand the batch on to be indexed. Once appended the batch goes on to
+// the chain even if the resume point cannot be written, so the chain
+// matches the file.
+static int commit_batch(import_ctx_t *ctx, committed_batch_t *batch) {
+    if (!append_blocks(ctx->chain_file, batch->first, ctx->seals)) {
+        free_batch(batch);
+        return 0;
+    }
+
+    int recorded = !ctx->resumable ||
+                   write_import_progress(ctx->csv_path, batch->last_row,
+                                         batch->first->index + batch->count);
+    if (!queue_push(&ctx->committed, batch)) {
+        free_batch(batch);
+        return 0;
+    }
+    return recorded;
+}
+
+// Persist stage: append the mined blocks to the chain file batch_size at a
+// time (and whatever is left at the end), each batch durable before it is
+// passed on
+static void *persist_stage(void *arg) {
+    import_ctx_t *ctx = arg;
+    committed_batch_t *batch = NULL;
+    block_t *last = NULL;
+    parsed_row_t *mined;
+    int ok = 1;
+
+    while (ok && (mined = queue_pop(&ctx->mined_rows))) {
+        if (!batch && !(batch = calloc(1, sizeof(committed_batch_t)))) {
+            free(mined->block);
+            free(mined);
+            ok = 0;
+            break;
+        }
+
+        if (last) {
+            last->next = mined->block;
+        } else {
+            batch->first = mined->block;
+        }
+        last = mined->block;
+        batch->count++;
+        batch->last_row = mined->row;
+        free(mined);
+
+        if (batch->count >= ctx->batch_size) {
+            ok = commit_batch(ctx, batch);
+            batch = NULL;
+            last = NULL;
+        }
+    }
+
+    if (ok && batch) {
+        ok = commit_batch(ctx, batch);
+    } else if (batch) {
+        free_batch(batch);
+    }
+
+    // after a failure nothing more can be written: stop the miner and drop
+    // what it has already queued
+    if (!ok) {
+        atomic_store(&ctx->failed, 1);
+        queue_close(&ctx->mined_rows);
+        while ((mined = queue_pop(&ctx->mined_rows))) {
+            free(mined->block);
+            free(mined);
+        }
+    }
+    queue_close(&ctx->committed);
+    return NULL;
+}
+
+// Stream a CSV of medical records into the chain through a pipeline of
+// stages on their own threads, joined by bounded queues: parse, validate,
+// mine, persist (every batch_size blocks are appended to the chain file and
+// the resume point recorded) and index, which stays on the calling thread
+// as the chain's writer and adds each persisted batch to the chain. The
+// miner starts on the next block as soon as the last hash is known, so the
+// import runs at the pace of the slowest stage; blocks are on disk before
+// readers of the chain can see them, and an interrupted import continues
+// after the last committed row.
+int import_records_csv(blockchain_t *chain, const char *csv_path, const user_t *user,
+                       const import_options_t *opts, import_stats_t *stats) {
+    if (!chain || !chain->tail || !csv_path || !user || !stats) {
+        printf("Error: Invalid parameters for import_records_csv\n");
+        return 0;
+    }
+
+    import_options_t defaults;
+    if (!opts) {
+        init_import_options(&defaults);
+        opts = &defaults;
+    }
+
+    memset(stats, 0, sizeof(import_stats_t));
+
+    import_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.csv_path = csv_path;
+    ctx.chain_file = opts->chain_file;
+    ctx.default_doctor = user->email;
+    ctx.batch_size = opts->batch_size > 0 ? opts->batch_size : IMPORT_DEFAULT_BATCH_SIZE;
+    ctx.difficulty = get_mining_difficulty();
+    ctx.seals = chain->seals;
+    ctx.dedup = chain->dedup;
+    ctx.dedup_source.chain_file = opts->chain_file;
+    ctx.next_index = chain->length;
+    strcpy(ctx.previous_hash, chain->tail->current_hash);
+    atomic_init(&ctx.failed, 0);
+    // queued records are encrypted like the chain (see batch.c)
+    ctx.file = cipher_fopen(csv_path, "rb");
+    if (!ctx.file) {
+        printf("Error: Could not open '%s' for import: %s\n", csv_path, strerror(errno));
+        return 0;
+    }
+
+    ctx.resumable = opts->resumable;
+    ctx.resume_after = opts->resumable ? read_import_progress(csv_path, chain->length) : 0;
+    if (ctx.resume_after > 0) {
+        printf("Resuming import of '%s' after row %ld\n", csv_path, ctx.resume_after);
+    }
+
+    // appends below require the file to hold exactly the in-memory chain
+    int was_quiet = is_quiet_mode();
+    set_quiet_mode(1);
+    if (!opts->chain_file_synced && !save_blockchain(chain, opts->chain_file)) {
+        set_quiet_mode(was_quiet);
+        fclose(ctx.file);
+        return 0;
+    }
+
+    if (!queue_init(&ctx.raw_rows, IMPORT_QUEUE_CAPACITY) ||
+        !queue_init(&ctx.parsed_rows, IMPORT_QUEUE_CAPACITY) ||
+        !queue_init(&ctx.mined_rows, IMPORT_QUEUE_CAPACITY) ||
+        !queue_init(&ctx.committed, IMPORT_COMMIT_QUEUE_CAPACITY) ||
+        !strdict_init(&ctx.seen)) {
+        printf("Error: Memory allocation failed for import queues\n");
+        queue_destroy(&ctx.raw_rows);
+        queue_destroy(&ctx.parsed_rows);
+        queue_destroy(&ctx.mined_rows);
+        queue_destroy(&ctx.committed);
+        strdict_free(&ctx.seen);
+        set_quiet_mode(was_quiet);
+        fclose(ctx.file);
+        return 0;
+    }
+
+    claim_interrupt();
+
+    // parse, validate, mine and persist, in pipeline order
+    void *(*const stage_main[IMPORT_STAGES])(void *) = {parse_stage, validate_stage,
+                                                        mine_stage, persist_stage};
+    pthread_t stages[IMPORT_STAGES];
+    int running = 0;
+    double started = monotonic_seconds();
+    double last_report = started;
+    while (running < IMPORT_STAGES &&
+           pthread_create(&stages[running], NULL, stage_main[running], &ctx) == 0) {
+        running++;
+    }
+
+    // without every stage the pipeline cannot finish: the queues are closed
+    // so the stages that did start run dry, the committed one here since
+    // the persist stage that closes it is not running
+    if (running < IMPORT_STAGES) {
+        printf("Error: Could not start the import threads\n");
+        atomic_store(&ctx.failed, 1);
+        queue_close(&ctx.raw_rows);
+        queue_close(&ctx.parsed_rows);
+        queue_close(&ctx.mined_rows);
+        queue_close(&ctx.committed);
+    }
+
+    // index stage: the blocks of a batch are already linked to each other
+    committed_batch_t *batch;
+    while ((batch = queue_pop(&ctx.committed))) {
+        block_t *block = batch->first;
+        for (int i = 0; i < batch->count; i++) {
+            block_t *next = block->next;
+            add_block_to_chain(chain, block);
+            block = next;
+        }
+        stats->records_imported += batch->count;
+        stats->last_committed_row = batch->last_row;
+        free(batch);
+
+        double now = monotonic_seconds();
+        if (opts->show_progress && now - last_report >= 1.0) {
+            printf("\rImported %ld records (%.0f records/sec)   ", stats->records_imported,
+                   stats->records_imported / (now - started));
+            fflush(stdout);
+            last_report = now;
+        }
+    }
+
+    // stop the upstream stages if mining ended early
+    queue_close(&ctx.parsed_rows);
+    queue_close(&ctx.raw_rows);
+    for (int i = 0; i < running; i++) {
+        pthread_join(stages[i], NULL);
+    }
+
+    // drop rows that were queued but never mined
+    raw_row_t *raw;
+    while ((raw = queue_pop(&ctx.raw_rows))) {
+        free(raw->line);
+        free(raw);
+    }
+    parsed_row_t *parsed;
+    while ((parsed = queue_pop(&ctx.parsed_rows))) {
+        free(parsed);
+    }
+    while ((parsed = queue_pop(&ctx.mined_rows))) {
+        free(parsed->block);
+        free(parsed);
+    }
+    int ok = !atomic_load(&ctx.failed);
+
+    release_interrupt();
+    queue_destroy(&ctx.raw_rows);
+    queue_destroy(&ctx.parsed_rows);
+    queue_destroy(&ctx.mined_rows);
+    queue_destroy(&ctx.committed);
+    strdict_free(&ctx.seen);
+    dedup_source_close(&ctx.dedup_source);
+    fclose(ctx.file);
+    set_quiet_mode(was_quiet);
+
+    stats->rows_read = ctx.rows_read;
+    stats->rows_skipped = ctx.rows_skipped;
+    stats->rows_rejected = ctx.rows_rejected;
+    stats->rows_duplicate = ctx.rows_duplicate;
+    stats->interrupted = import_interrupted ? 1 : 0;
+    stats->elapsed_seconds = monotonic_seconds() - started;
+    if (stats->elapsed_seconds > 0) {
+        stats->records_per_second = stats->records_imported / stats->elapsed_seconds;
+    }
+    if (opts->show_progress) {
+        printf("\n");
+    }
+
+    // a completed import leaves nothing to resume
+    if (ok && !stats->interrupted && opts->resumable) {
+        remove(IMPORT_PROGRESS_FILE);
+    }
+
+    char message[256];
+    snprintf(message, sizeof(message), "Bulk imported %ld records (%ld rejected, %ld duplicates)%s",
+             stats->records_imported, stats->rows_rejected, stats->rows_duplicate,
+             stats->interrupted ? ", interrupted" : "");
+    log_operation(ok ? LOG_INFO : LOG_ERROR, user->email, message);
+
+    return ok;
+}
@@ -0,0 +1,40 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include "blockchain.h"
+#include "auth.h"
+
+#define IMPORT_PROGRESS_FILE "data/import.progress"
+#define IMPORT_DEFAULT_BATCH_SIZE 256
+#define IMPORT_QUEUE_CAPACITY 1024
+#define IMPORT_COMMIT_QUEUE_CAPACITY 8  // persisted batches waiting to be indexed
+
+// options for a bulk import run
+typedef struct {
+    const char *chain_file;     // blockchain file the committed blocks go to
+    int batch_size;             // blocks mined between two commits
+    int show_progress;          // print a throughput line about once a second
+    int chain_file_synced;      // chain_file already holds exactly the chain
+    int resumable;              // keep the resume point in IMPORT_PROGRESS_FILE
+} import_options_t;
+
+// statistics reported at the end of an import run
+typedef struct {
+    long rows_read;             // data rows seen in the CSV (excluding header)
+    long rows_skipped;          // rows already committed by a previous run
+    long rows_rejected;         // rows failing validation
+    long rows_duplicate;        // rows recording a visit already on the chain
+    long records_imported;      // records mined and committed in this run
+    long last_committed_row;    // CSV line number of the last committed record
+    double elapsed_seconds;
+    double records_per_second;
+    int interrupted;            // stopped early by SIGINT, resumable
+} import_stats_t;
+
+// Function prototypes
+void init_import_options(import_options_t *opts);
+int split_csv_line(char *line, char **fields, int max_fields);
+int import_records_csv(blockchain_t *chain, const char *csv_path, const user_t *user,
+                       const import_options_t *opts, import_stats_t *stats);
+
+#endif
@@ -0,0 +1,36 @@
+#include "intern.h"
+#include "strdict.h"
+#include <pthread.h>
+#include <string.h>
+
+static strdict_t table;
+static int table_ready = 0;
+static size_t table_bytes = 0;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Intern the first `length` bytes of `str`. Returns the shared copy, or
+// NULL if memory runs out.
+const char *intern_string(const char *str, size_t length) {
+    if (!str) return NULL;
+
+    pthread_mutex_lock(&table_lock);
+    const char *interned = NULL;
+    uint32_t id;
+    if (table_ready || (table_ready = strdict_init(&table))) {
+        int added = strdict_intern(&table, str, length, &id);
+        if (added >= 0) {
+            interned = strdict_get(&table, id);
+            if (added) table_bytes += length + 1;
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+    return interned;
+}
+
+// Number of distinct strings interned and the bytes they take
+void intern_stats(long *count, size_t *bytes) {
+    pthread_mutex_lock(&table_lock);
+    if (count) *count = table_ready ? (long)table.count : 0;
+    if (bytes) *bytes = table_bytes;
+    pthread_mutex_unlock(&table_lock);
+}
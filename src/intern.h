@@ -0,0 +1,16 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+// Process-wide table of interned strings. Transactions hold their doctor
+// and diagnosis as pointers into it, so a value shared by thousands of
+// blocks is stored once. Interned strings never move and are never freed,
+// so any thread may keep and read them; interning itself takes a lock.
+// Since the table only grows, it is kept to fields with few distinct values.
+
+// Function prototypes
+const char *intern_string(const char *str, size_t length);
+void intern_stats(long *count, size_t *bytes);
+
+#endif
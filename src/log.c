@@ -1,37 +1,245 @@
+#define _POSIX_C_SOURCE 200809L
 #include "log.h"
+#include "audit_store.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
-static FILE *log_file = NULL;
+// One fixed-size log record. Callers only copy into a slot; formatting,
+// writing and flushing happen on the writer thread.
+typedef struct {
+    atomic_size_t sequence;     // ring slot state (see log_operation)
+    time_t time;
+    log_level_t level;
+    int security;
+    char user[MAX_EMAIL_SIZE];
+    char operation[LOG_MAX_OPERATION];
+} log_record_t;
+
+static audit_writer_t audit_writer;
+static int log_enabled = 0;
+static log_record_t ring[LOG_RING_CAPACITY];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;                  // owned by the writer thread
+static atomic_ulong dropped_events;
+static atomic_int security_pending;
+static atomic_int writer_running;
+
+static pthread_t writer_thread;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+
+static const char *level_str[] = {
+    "INFO",
+    "WARNING",
+    "ERROR",
+    "DEBUG",
+    "SECURITY"
+};
+
+// function to append one record to the binary audit log
+static void write_record(const log_record_t *record) {
+    audit_entry_t entry;
+    entry.time = record->time;
+    entry.level = record->level;
+    memcpy(entry.user, record->user, sizeof(entry.user));
+    memcpy(entry.operation, record->operation, sizeof(entry.operation));
+    audit_writer_append(&audit_writer, &entry);
+}
+
+// function to move every published record from the ring to the file.
+// Returns the number written; *security is set if any needs an fsync.
+static int drain_ring(int *security) {
+    int written = 0;
+
+    for (;;) {
+        log_record_t *record = &ring[dequeue_pos & (LOG_RING_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        if (sequence != dequeue_pos + 1) break;
+
+        write_record(record);
+        if (record->security) *security = 1;
+
+        // hand the slot back to producers for the next lap
+        atomic_store_explicit(&record->sequence, dequeue_pos + LOG_RING_CAPACITY,
+                              memory_order_release);
+        dequeue_pos++;
+        written++;
+    }
+    return written;
+}
+
+// function to report events lost to a full ring, so drops are never silent
+static void report_dropped(unsigned long *reported) {
+    unsigned long dropped = atomic_load(&dropped_events);
+    if (dropped == *reported) return;
+
+    log_record_t notice;
+    memset(&notice, 0, sizeof(notice));
+    notice.time = time(NULL);
+    notice.level = LOG_WARNING;
+    strcpy(notice.user, "system");
+    snprintf(notice.operation, sizeof(notice.operation),
+             "%lu log events dropped (ring buffer full), %lu in total",
+             dropped - *reported, dropped);
+    write_record(&notice);
+    *reported = dropped;
+}
+
+// Writer thread: drains the ring in batches and flushes when LOG_FLUSH_BATCH
+// records are pending or LOG_FLUSH_INTERVAL_MS has passed. Security events
+// are flushed and fsync'ed as soon as they are drained.
+static void *log_writer(void *arg) {
+    (void)arg;
+    int unflushed = 0;
+    unsigned long reported_drops = 0;
+    struct timespec last_flush;
+    clock_gettime(CLOCK_MONOTONIC, &last_flush);
+
+    for (;;) {
+        int running = atomic_load(&writer_running);
+        int security = 0;
+
+        atomic_store(&security_pending, 0);
+        unflushed += drain_ring(&security);
+        report_dropped(&reported_drops);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - last_flush.tv_sec) * 1000 +
+                          (now.tv_nsec - last_flush.tv_nsec) / 1000000;
+
+        if (security || unflushed >= LOG_FLUSH_BATCH ||
+            (unflushed > 0 && elapsed_ms >= LOG_FLUSH_INTERVAL_MS) || !running) {
+            audit_writer_flush(&audit_writer, security);
+            unflushed = 0;
+            last_flush = now;
+        }
+
+        if (!running) break;
+
+        // sleep until woken by a security event or the next flush deadline
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS / 4 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&wake_lock);
+        if (!atomic_load(&security_pending) && atomic_load(&writer_running)) {
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &deadline);
+        }
+        pthread_mutex_unlock(&wake_lock);
+    }
+
+    // final drain after producers have stopped
+    int security = 0;
+    drain_ring(&security);
+    report_dropped(&reported_drops);
+    audit_writer_close(&audit_writer);
+    return NULL;
+}
 
 // function to initialize logging
 void init_logging(void) {
-    log_file = fopen("data/access.log", "a");
-    if (!log_file) {
-        fprintf(stderr, "Error opening log file\n");
+    if (!audit_writer_open(&audit_writer)) {
+        fprintf(stderr, "Error opening audit log\n");
+        return;
+    }
+
+    for (size_t i = 0; i < LOG_RING_CAPACITY; i++) {
+        atomic_init(&ring[i].sequence, i);
+    }
+    atomic_init(&enqueue_pos, 0);
+    atomic_init(&dropped_events, 0);
+    dequeue_pos = 0;
+
+    atomic_store(&writer_running, 1);
+    if (pthread_create(&writer_thread, NULL, log_writer, NULL) != 0) {
+        fprintf(stderr, "Error starting log writer thread\n");
+        atomic_store(&writer_running, 0);
+        audit_writer_close(&audit_writer);
+        return;
     }
+    log_enabled = 1;
+}
+
+// function to drain pending records, stop the writer and seal the segment
+void shutdown_logging(void) {
+    if (!log_enabled) return;
+
+    pthread_mutex_lock(&wake_lock);
+    atomic_store(&writer_running, 0);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+
+    pthread_join(writer_thread, NULL);
+    log_enabled = 0;
 }
 
-// function to log operational events
+// function to log operational events. Never blocks: the record is copied
+// into a lock-free ring slot, or counted as dropped if the ring is full.
 void log_operation(log_level_t level, const char *user, const char *operation) {
-    if (!log_file) return;
+    if (!log_enabled) return;
+
+    // claim a slot (bounded MPMC ring with per-slot sequence numbers)
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    log_record_t *record;
+    for (;;) {
+        record = &ring[pos & (LOG_RING_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        long diff = (long)sequence - (long)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&dropped_events, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
 
-    char timestamp[20];
-    // Get the current timestamp
-    get_timestamp(timestamp);
+    int security = level == LOG_SECURITY;
+    record->time = time(NULL);
+    record->level = level;
+    record->security = security;
+    strncpy(record->user, user ? user : "Unknown", sizeof(record->user) - 1);
+    record->user[sizeof(record->user) - 1] = '\0';
+    strncpy(record->operation, operation ? operation : "", sizeof(record->operation) - 1);
+    record->operation[sizeof(record->operation) - 1] = '\0';
 
-    const char *level_str[] = {
-        "INFO",
-        "WARNING",
-        "ERROR",
-        "SECURITY"
-    };
+    // publish the record to the writer
+    atomic_store_explicit(&record->sequence, pos + 1, memory_order_release);
 
-    // Log the operation with timestamp, level, user, and operation details
-    fprintf(log_file, "[%s] [%s] User: %s, Operation: %s\n", 
-            timestamp, level_str[level], user ? user : "Unknown", operation);
-    fflush(log_file);
+    // wake the writer for an immediate flush of security events and once per
+    // full batch; a missed signal only delays it until the next timed wake-up
+    if (security) {
+        atomic_store(&security_pending, 1);
+        pthread_cond_signal(&wake_cond);
+    } else if ((pos + 1) % LOG_FLUSH_BATCH == 0) {
+        pthread_cond_signal(&wake_cond);
+    }
 }
 
 // function to log security events
 void log_security_event(const char *user, const char *event) {
-    log_operation(LOG_DEBUG, user, event);
+    log_operation(LOG_SECURITY, user, event);
+}
+
+// Number of events dropped because the ring buffer was full
+unsigned long log_dropped_events(void) {
+    return atomic_load(&dropped_events);
+}
+
+// Display name of a log level
+const char *log_level_name(log_level_t level) {
+    if ((unsigned)level > LOG_SECURITY) return "UNKNOWN";
+    return level_str[level];
 }
@@ -9,14 +9,24 @@ typedef enum {
     LOG_INFO,
     LOG_WARNING,
     LOG_ERROR,
-    LOG_DEBUG
+    LOG_DEBUG,
+    LOG_SECURITY
 } log_level_t;
 
 
+// ring buffer and flush policy of the background log writer
+#define LOG_RING_CAPACITY 4096          // records, must be a power of two
+#define LOG_MAX_OPERATION 256
+#define LOG_FLUSH_BATCH 64              // flush after this many records
+#define LOG_FLUSH_INTERVAL_MS 200       // or after this long
+
 // functions for logging operations and security events
 void init_logging(void);
+void shutdown_logging(void);
 void log_operation(log_level_t level, const char *user,
                    const char *operation);
 void log_security_event(const char *user, const char *event);
+unsigned long log_dropped_events(void);
+const char *log_level_name(log_level_t level);
 
 #endif
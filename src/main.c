@@ -1,6 +1,13 @@
 #include "cli.h"
 #include "storage.h"
+#include "snapshot.h"
 #include "log.h"
+#include "trace.h"
+#include "batch.h"
+#include "daemon.h"
+#include "client.h"
+#include "cipher.h"
+#include "authority.h"
 #include <sys/stat.h>
 
 
@@ -17,17 +24,76 @@ void create_data_directory(void) {
     }
 }
 
-int main(void) {
+// function to run one scripted command (see batch.c) and exit
+static int run_batch_mode(int argc, char *argv[]) {
+    // while a daemon runs it owns the chain, so the command goes to it
+    int forwarded = client_run_batch(argc, argv);
+    if (forwarded >= 0) {
+        return forwarded;
+    }
+
+    create_data_directory();
+    trace_init();
+    init_logging();
+
+    int result = run_batch(argc, argv);
+
+    shutdown_logging();
+    trace_shutdown();
+    return result;
+}
+
+// function to serve the chain to local clients until stopped (see daemon.c)
+static int run_daemon_mode(int argc, char *argv[]) {
+    daemon_block_signals(NULL);
+    create_data_directory();
+    if (!cipher_configure(NULL) || !authority_configure(NULL)) {
+        return 1;
+    }
+    trace_init();
+    init_logging();
+    metrics_start_exporter(NULL, METRICS_DUMP_INTERVAL);
+
+    int result = run_daemon(argc, argv);
+
+    metrics_stop_exporter();
+    shutdown_logging();
+    trace_shutdown();
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    // `blockmed daemon` shares one chain between many clients
+    if (argc > 1 && strcmp(argv[1], "daemon") == 0) {
+        return run_daemon_mode(argc, argv);
+    }
+
+    // `blockmed <command> [--option value ...]` runs without the menus
+    if (argc > 1) {
+        return run_batch_mode(argc, argv);
+    }
+
+    // with a daemon running, the menus become a thin client of it
+    int daemon_fd = client_connect(daemon_socket_path());
+    if (daemon_fd >= 0) {
+        return run_client_cli(daemon_fd);
+    }
+
     printf("\n=== BlockMed - Medical Records Blockchain ===\n");
     printf("African Leadership University (ALU) Project\n");
     printf("Secure Medical Records Management System\n");
 
-    //initialize the data directory
+    //initialize the data directory and the encryption and signer keys, if there are any
     create_data_directory();
+    if (!cipher_configure(NULL) || !authority_configure(NULL)) {
+        return 1;
+    }
+    trace_init();
     init_logging();
+    metrics_start_exporter(NULL, METRICS_DUMP_INTERVAL);
 
-    // try to load the blockchain from storage
-    blockchain_t *chain = load_blockchain("data/blockchain.dat");
+    // try to load the blockchain from storage (its snapshot, when usable)
+    blockchain_t *chain = open_blockchain("data/blockchain.dat");
     if (!chain) {
         printf("Creating a new blockchain...\n");
         chain = create_blockchain();
@@ -43,11 +109,22 @@ int main(void) {
     // Run the CLI interface for interacting with the blockchain
     int result = run_cli(chain);
 
-    // save the blockchain before exiting
-    save_blockchain(chain, "data/blockchain.dat");
+    // save the blockchain before exiting, then snapshot it for a fast start;
+    // batch commands mining into the file meanwhile are waited for
+    int lock = lock_chain_file("data/blockchain.dat", LOCK_EX, 1);
+    if (lock >= 0 && save_blockchain(chain, "data/blockchain.dat")) {
+        save_snapshot(chain, "data/blockchain.dat");
+    }
+    if (lock >= 0) unlock_chain_file(lock);
+
+    // write the final metrics and seal the audit log before tearing
+    // anything else down
+    metrics_stop_exporter();
+    shutdown_logging();
+    trace_shutdown();
 
     // Free the blockchain resources
-    free_blockchain(&chain);
+    free_blockchain(chain);
     printf("System shutting down. Goodbye!\n");
     return result;
 }
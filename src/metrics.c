@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+#include "metrics.h"
+#include "log.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// counters are padded to a cache line so threads bumping different
+// counters do not contend
+typedef struct {
+    atomic_ullong value;
+    char padding[64 - sizeof(atomic_ullong)];
+} counter_slot_t;
+
+typedef struct {
+    atomic_ullong buckets[METRICS_HISTOGRAM_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+} histogram_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+} metric_info_t;
+
+static counter_slot_t counters[METRIC_COUNTER_COUNT];
+static histogram_t histograms[METRIC_HISTOGRAM_COUNT];
+
+static const metric_info_t counter_info[METRIC_COUNTER_COUNT] = {
+    {"blocks_mined_total", "Blocks mined"},
+    {"hash_attempts_total", "Nonces tried while mining"},
+    {"block_hashes_total", "Block hashes calculated"},
+    {"saves_total", "Blockchain saves"},
+    {"loads_total", "Blockchain loads"},
+    {"validations_total", "Chain validations"},
+    {"validation_failures_total", "Chain validations that found an invalid block"},
+    {"logins_total", "Login attempts"},
+    {"login_failures_total", "Failed login attempts"},
+    {"daemon_requests_total", "Requests served by the daemon"},
+    {"blocks_signed_total", "Blocks signed by this node (proof of authority)"},
+    {"seals_verified_total", "Block seals checked"},
+    {"duplicates_rejected_total", "Records rejected as already on the chain"}
+};
+
+static const metric_info_t histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    {"mine_block_seconds", "Time to mine one block"},
+    {"block_hash_seconds", "Time to hash one block (sampled)"},
+    {"save_seconds", "Time to save the blockchain"},
+    {"load_seconds", "Time to load the blockchain"},
+    {"validate_seconds", "Time to validate the chain"},
+    {"login_seconds", "Time to authenticate a user"},
+    {"daemon_request_seconds", "Time to serve one daemon request"},
+    {"sign_block_seconds", "Time to sign one block"}
+};
+
+// exporter thread state
+static pthread_t exporter_thread;
+static pthread_mutex_t exporter_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exporter_cond = PTHREAD_COND_INITIALIZER;
+static int exporter_running = 0;
+static int exporter_interval = METRICS_DUMP_INTERVAL;
+static char exporter_path[512];
+
+// Monotonic time in nanoseconds, for measuring durations
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_counter_add(metric_counter_t counter, uint64_t amount) {
+    if ((unsigned)counter >= METRIC_COUNTER_COUNT) return;
+    atomic_fetch_add_explicit(&counters[counter].value, amount, memory_order_relaxed);
+}
+
+uint64_t metrics_counter_value(metric_counter_t counter) {
+    if ((unsigned)counter >= METRIC_COUNTER_COUNT) return 0;
+    return atomic_load_explicit(&counters[counter].value, memory_order_relaxed);
+}
+
+// function to map a value to its bucket: values below METRICS_SUB_BUCKETS
+// get their own bucket, larger ones are split by their top bits
+static int bucket_index(uint64_t value) {
+    if (value < METRICS_SUB_BUCKETS) return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - METRICS_SUB_BUCKET_BITS;
+    int sub_bucket = (int)(value >> shift) - METRICS_SUB_BUCKETS;
+    return (exponent - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + sub_bucket;
+}
+
+// function to get the largest value that maps to a bucket
+static uint64_t bucket_upper_bound(int index) {
+    if (index < METRICS_SUB_BUCKETS) return (uint64_t)index;
+
+    int shift = index / METRICS_SUB_BUCKETS - 1;
+    uint64_t mantissa = (uint64_t)(index % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+// Record one duration. Lock-free: a few relaxed atomic adds.
+void metrics_observe(metric_histogram_t histogram, uint64_t nanoseconds) {
+    if ((unsigned)histogram >= METRIC_HISTOGRAM_COUNT) return;
+    histogram_t *h = &histograms[histogram];
+
+    atomic_fetch_add_explicit(&h->buckets[bucket_index(nanoseconds)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, nanoseconds, memory_order_relaxed);
+
+    unsigned long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (nanoseconds > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, nanoseconds,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// Summarise a histogram. Percentiles are bucket upper bounds, capped at the
+// largest recorded value.
+void metrics_histogram_summary(metric_histogram_t histogram, metrics_summary_t *summary) {
+    if (!summary) return;
+    memset(summary, 0, sizeof(metrics_summary_t));
+    if ((unsigned)histogram >= METRIC_HISTOGRAM_COUNT) return;
+
+    histogram_t *h = &histograms[histogram];
+    static uint64_t snapshot[METRICS_HISTOGRAM_BUCKETS];
+    static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&snapshot_lock);
+
+    // count from the buckets themselves so percentiles stay consistent with
+    // concurrent writers
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+        snapshot[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        total += snapshot[i];
+    }
+
+    summary->count = total;
+    summary->sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+    summary->max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t *targets[] = {&summary->p50, &summary->p90, &summary->p99, &summary->p999};
+    uint64_t seen = 0;
+    int q = 0;
+
+    for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS && q < 4 && total > 0; i++) {
+        seen += snapshot[i];
+        while (q < 4 && (double)seen >= quantiles[q] * (double)total) {
+            uint64_t bound = bucket_upper_bound(i);
+            *targets[q++] = bound < summary->max ? bound : summary->max;
+        }
+    }
+
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+const char *metrics_counter_name(metric_counter_t counter) {
+    if ((unsigned)counter >= METRIC_COUNTER_COUNT) return "unknown";
+    return counter_info[counter].name;
+}
+
+const char *metrics_histogram_name(metric_histogram_t histogram) {
+    if ((unsigned)histogram >= METRIC_HISTOGRAM_COUNT) return "unknown";
+    return histogram_info[histogram].name;
+}
+
+// Write all metrics in the Prometheus text format. The file is written to a
+// temporary name and renamed so node_exporter never reads a partial file.
+int metrics_write_prometheus(const char *path) {
+    if (!path) return 0;
+
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) return 0;
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        fprintf(file, "# HELP blockmed_%s %s\n", counter_info[i].name, counter_info[i].help);
+        fprintf(file, "# TYPE blockmed_%s counter\n", counter_info[i].name);
+        fprintf(file, "blockmed_%s %llu\n", counter_info[i].name,
+                (unsigned long long)metrics_counter_value((metric_counter_t)i));
+    }
+
+    fprintf(file, "# HELP blockmed_log_dropped_events_total Log events dropped by a full ring buffer\n");
+    fprintf(file, "# TYPE blockmed_log_dropped_events_total counter\n");
+    fprintf(file, "blockmed_log_dropped_events_total %lu\n", log_dropped_events());
+
+    // latency histograms are exported as summaries; their buckets are far too
+    // fine-grained for Prometheus histogram series
+    const char *quantile_labels[] = {"0.5", "0.9", "0.99", "0.999"};
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        metrics_summary_t summary;
+        metrics_histogram_summary((metric_histogram_t)i, &summary);
+        uint64_t values[] = {summary.p50, summary.p90, summary.p99, summary.p999};
+
+        fprintf(file, "# HELP blockmed_%s %s\n", histogram_info[i].name, histogram_info[i].help);
+        fprintf(file, "# TYPE blockmed_%s summary\n", histogram_info[i].name);
+        for (int q = 0; q < 4; q++) {
+            fprintf(file, "blockmed_%s{quantile=\"%s\"} %.9f\n", histogram_info[i].name,
+                    quantile_labels[q], values[q] / 1e9);
+        }
+        fprintf(file, "blockmed_%s_sum %.9f\n", histogram_info[i].name, summary.sum / 1e9);
+        fprintf(file, "blockmed_%s_count %llu\n", histogram_info[i].name,
+                (unsigned long long)summary.count);
+    }
+
+    int ok = !ferror(file);
+    if (fclose(file) != 0) ok = 0;
+    if (ok && rename(tmp_path, path) != 0) ok = 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+// Exporter thread: dumps the metrics every interval and once more on stop
+static void *metrics_exporter(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&exporter_lock);
+    while (exporter_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += exporter_interval;
+
+        while (exporter_running &&
+               pthread_cond_timedwait(&exporter_cond, &exporter_lock, &deadline) == 0) {
+        }
+
+        pthread_mutex_unlock(&exporter_lock);
+        metrics_write_prometheus(exporter_path);
+        pthread_mutex_lock(&exporter_lock);
+    }
+    pthread_mutex_unlock(&exporter_lock);
+    return NULL;
+}
+
+// Start dumping metrics to `path` (NULL for BLOCKMED_METRICS_FILE or the
+// default) every interval_seconds. Returns 1 if the exporter is running.
+int metrics_start_exporter(const char *path, int interval_seconds) {
+    if (!path) path = getenv("BLOCKMED_METRICS_FILE");
+    if (!path || !path[0]) path = METRICS_DEFAULT_FILE;
+
+    pthread_mutex_lock(&exporter_lock);
+    if (exporter_running) {
+        pthread_mutex_unlock(&exporter_lock);
+        return 1;
+    }
+
+    strncpy(exporter_path, path, sizeof(exporter_path) - 1);
+    exporter_path[sizeof(exporter_path) - 1] = '\0';
+    exporter_interval = interval_seconds > 0 ? interval_seconds : METRICS_DUMP_INTERVAL;
+    exporter_running = 1;
+
+    if (pthread_create(&exporter_thread, NULL, metrics_exporter, NULL) != 0) {
+        fprintf(stderr, "Error starting metrics exporter thread\n");
+        exporter_running = 0;
+    }
+
+    int running = exporter_running;
+    pthread_mutex_unlock(&exporter_lock);
+    return running;
+}
+
+// Stop the exporter after a final dump
+void metrics_stop_exporter(void) {
+    pthread_mutex_lock(&exporter_lock);
+    if (!exporter_running) {
+        pthread_mutex_unlock(&exporter_lock);
+        return;
+    }
+    exporter_running = 0;
+    pthread_cond_signal(&exporter_cond);
+    pthread_mutex_unlock(&exporter_lock);
+
+    pthread_join(exporter_thread, NULL);
+}
@@ -0,0 +1,70 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+// Prometheus textfile written for node_exporter's textfile collector;
+// BLOCKMED_METRICS_FILE overrides the path
+#define METRICS_DEFAULT_FILE "data/blockmed.prom"
+#define METRICS_DUMP_INTERVAL 15        // seconds between dumps
+#define METRICS_HASH_SAMPLE 64          // time one in this many block hashes
+
+// histograms are log-linear: 2^METRICS_SUB_BUCKET_BITS buckets per power of
+// two, so any recorded value is within ~6% of its bucket's bounds
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_HISTOGRAM_BUCKETS ((64 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+typedef enum {
+    METRIC_BLOCKS_MINED,
+    METRIC_HASH_ATTEMPTS,       // nonces tried while mining
+    METRIC_BLOCK_HASHES,        // calls to calculate_block_hash
+    METRIC_SAVES,
+    METRIC_LOADS,
+    METRIC_VALIDATIONS,
+    METRIC_VALIDATION_FAILURES,
+    METRIC_LOGINS,
+    METRIC_LOGIN_FAILURES,
+    METRIC_DAEMON_REQUESTS,     // requests served by the daemon
+    METRIC_BLOCKS_SIGNED,       // blocks sealed by proof of authority
+    METRIC_SEALS_VERIFIED,
+    METRIC_DUPLICATES_REJECTED, // records already on the chain, not added again
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum {
+    METRIC_MINE_LATENCY,
+    METRIC_HASH_LATENCY,
+    METRIC_SAVE_LATENCY,
+    METRIC_LOAD_LATENCY,
+    METRIC_VALIDATE_LATENCY,
+    METRIC_LOGIN_LATENCY,
+    METRIC_REQUEST_LATENCY,
+    METRIC_SIGN_LATENCY,
+    METRIC_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+// point-in-time view of a histogram, all values in nanoseconds
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+} metrics_summary_t;
+
+// Function prototypes
+uint64_t metrics_now_ns(void);
+void metrics_counter_add(metric_counter_t counter, uint64_t amount);
+uint64_t metrics_counter_value(metric_counter_t counter);
+void metrics_observe(metric_histogram_t histogram, uint64_t nanoseconds);
+void metrics_histogram_summary(metric_histogram_t histogram, metrics_summary_t *summary);
+const char *metrics_counter_name(metric_counter_t counter);
+const char *metrics_histogram_name(metric_histogram_t histogram);
+int metrics_write_prometheus(const char *path);
+int metrics_start_exporter(const char *path, int interval_seconds);
+void metrics_stop_exporter(void);
+
+#endif
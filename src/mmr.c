@@ -0,0 +1,401 @@
+#include "mmr.h"
+#include "epoch.h"
+#include <errno.h>
+#include <openssl/sha.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEX_HASH_LENGTH (MMR_HASH_SIZE * 2)
+
+// function to hash a block hash into a leaf
+static void hash_leaf(const char *block_hash, mmr_hash_t out) {
+    unsigned char data[1 + HEX_HASH_LENGTH];
+    data[0] = 0x00;
+    memcpy(data + 1, block_hash, HEX_HASH_LENGTH);
+    SHA256(data, sizeof(data), out);
+}
+
+// function to hash two children into their parent (out may alias either)
+static void hash_node(const unsigned char *left, const unsigned char *right, mmr_hash_t out) {
+    unsigned char data[1 + 2 * MMR_HASH_SIZE];
+    data[0] = 0x01;
+    memcpy(data + 1, left, MMR_HASH_SIZE);
+    memcpy(data + 1 + MMR_HASH_SIZE, right, MMR_HASH_SIZE);
+    SHA256(data, sizeof(data), out);
+}
+
+// function to bag the peaks (highest first) and the leaf count into the root
+static void hash_peaks(long leaves, const mmr_hash_t *peaks, int count, mmr_hash_t out) {
+    unsigned char data[1 + 8 + (MMR_MAX_HEIGHT + 1) * MMR_HASH_SIZE];
+    data[0] = 0x02;
+    for (int i = 0; i < 8; i++) {
+        data[1 + i] = (unsigned char)((uint64_t)leaves >> (56 - 8 * i));
+    }
+    memcpy(data + 9, peaks, (size_t)count * MMR_HASH_SIZE);
+    SHA256(data, 9 + (size_t)count * MMR_HASH_SIZE, out);
+}
+
+static const mmr_directory_t *level_directory(const mmr_t *mmr, int level) {
+    return atomic_load(&((mmr_t *)mmr)->levels[level].directory);
+}
+
+// function to find a written node: `position` counts from the left at `level`
+static const unsigned char *node_at(const mmr_t *mmr, int level, long position) {
+    const mmr_directory_t *directory = level_directory(mmr, level);
+    return directory->chunks[position >> MMR_CHUNK_SHIFT][position & (MMR_CHUNK_NODES - 1)];
+}
+
+// function to write a node, growing the level's directory if needed
+static int store_node(mmr_t *mmr, int level, long position, const mmr_hash_t hash) {
+    mmr_level_t *slot = &mmr->levels[level];
+    mmr_directory_t *directory = atomic_load(&slot->directory);
+    long chunk = position >> MMR_CHUNK_SHIFT;
+
+    if (!directory || chunk >= directory->capacity) {
+        long capacity = directory ? directory->capacity * 2 : 4;
+        while (capacity <= chunk) capacity *= 2;
+
+        mmr_directory_t *grown = calloc(1, sizeof(mmr_directory_t) +
+                                           (size_t)capacity * sizeof(mmr_hash_t *));
+        if (!grown) return 0;
+        grown->capacity = capacity;
+        if (directory) {
+            memcpy(grown->chunks, directory->chunks,
+                   (size_t)directory->capacity * sizeof(mmr_hash_t *));
+        }
+        // readers may still be looking chunks up in the old directory
+        atomic_store(&slot->directory, grown);
+        epoch_retire(directory, free);
+        directory = grown;
+    }
+
+    if (!directory->chunks[chunk]) {
+        directory->chunks[chunk] = malloc(MMR_CHUNK_NODES * sizeof(mmr_hash_t));
+        if (!directory->chunks[chunk]) return 0;
+    }
+    memcpy(directory->chunks[chunk][position & (MMR_CHUNK_NODES - 1)], hash, MMR_HASH_SIZE);
+    return 1;
+}
+
+// Create an empty accumulator
+mmr_t *mmr_create(void) {
+    mmr_t *mmr = malloc(sizeof(mmr_t));
+    if (!mmr) return NULL;
+
+    for (int level = 0; level <= MMR_MAX_HEIGHT; level++) {
+        atomic_init(&mmr->levels[level].directory, NULL);
+        mmr->levels[level].mapped_chunks = 0;
+    }
+    mmr->leaves = 0;
+    return mmr;
+}
+
+// Free an accumulator; chunks mapped from a snapshot image are left to the
+// image, which must be unmapped after this
+void mmr_free(mmr_t *mmr) {
+    if (!mmr) return;
+
+    for (int level = 0; level <= MMR_MAX_HEIGHT; level++) {
+        mmr_directory_t *directory = atomic_load(&mmr->levels[level].directory);
+        if (!directory) continue;
+        for (long chunk = mmr->levels[level].mapped_chunks; chunk < directory->capacity; chunk++) {
+            free(directory->chunks[chunk]);
+        }
+        free(directory);
+    }
+    free(mmr);
+}
+
+// mmr_free as an epoch release callback
+void mmr_release(void *ptr) {
+    mmr_free(ptr);
+}
+
+// Append the leaf of the next block (its 64-character hex hash). Only the
+// writer thread calls this, before publishing the block to readers.
+int mmr_append(mmr_t *mmr, const char *block_hash) {
+    if (!mmr || !block_hash || strlen(block_hash) != HEX_HASH_LENGTH ||
+        mmr->leaves >= (1L << MMR_MAX_HEIGHT) - 1) {
+        return 0;
+    }
+
+    mmr_hash_t hash;
+    hash_leaf(block_hash, hash);
+    long position = mmr->leaves;
+    int level = 0;
+    if (!store_node(mmr, level, position, hash)) return 0;
+
+    // a right child completes its parent
+    while (position & 1) {
+        hash_node(node_at(mmr, level, position - 1), hash, hash);
+        level++;
+        position >>= 1;
+        if (!store_node(mmr, level, position, hash)) return 0;
+    }
+
+    mmr->leaves++;
+    return 1;
+}
+
+// function to copy the peaks of the first `leaves` leaves, highest first
+static int collect_peaks(const mmr_t *mmr, long leaves, mmr_hash_t *peaks) {
+    int count = 0;
+    for (int level = MMR_MAX_HEIGHT; level >= 0; level--) {
+        if ((leaves >> level) & 1) {
+            memcpy(peaks[count++], node_at(mmr, level, (leaves >> level) - 1), MMR_HASH_SIZE);
+        }
+    }
+    return count;
+}
+
+// Root committing to the first `leaves` blocks
+int mmr_root(const mmr_t *mmr, long leaves, mmr_hash_t root) {
+    if (!mmr || leaves < 0 || leaves >= 1L << MMR_MAX_HEIGHT) return 0;
+
+    mmr_hash_t peaks[MMR_MAX_HEIGHT + 1];
+    int count = collect_peaks(mmr, leaves, peaks);
+    hash_peaks(leaves, peaks, count, root);
+    return 1;
+}
+
+// function to find the height of the mountain holding leaf `index` and
+// the position of its peak among the peaks (-1 if out of range)
+static int find_mountain(long leaves, long index, int *peak) {
+    long start = 0;
+    int count = 0;
+    for (int level = MMR_MAX_HEIGHT; level >= 0; level--) {
+        if (!((leaves >> level) & 1)) continue;
+        if (index < start + (1L << level)) {
+            *peak = count;
+            return level;
+        }
+        start += 1L << level;
+        count++;
+    }
+    return -1;
+}
+
+// Build the inclusion proof of block `index` against the root of the first
+// `leaves` blocks
+int mmr_prove(const mmr_t *mmr, long leaves, long index, mmr_proof_t *proof) {
+    int peak;
+    if (!mmr || !proof || index < 0 || index >= leaves || leaves >= 1L << MMR_MAX_HEIGHT) {
+        return 0;
+    }
+
+    memset(proof, 0, sizeof(*proof));
+    proof->index = index;
+    proof->leaves = leaves;
+    proof->path_length = find_mountain(leaves, index, &peak);
+
+    // mountains are aligned perfect trees, so the sibling at each level is
+    // the neighbour of the block's ancestor
+    for (int level = 0; level < proof->path_length; level++) {
+        memcpy(proof->path[level], node_at(mmr, level, (index >> level) ^ 1), MMR_HASH_SIZE);
+    }
+    proof->peak_count = collect_peaks(mmr, leaves, proof->peaks);
+    return 1;
+}
+
+// Check that `block_hash` is block proof->index of the chain `root`
+// commits to. Needs nothing but the proof and a trusted root.
+int mmr_verify(const mmr_proof_t *proof, const char *block_hash, const mmr_hash_t root) {
+    if (!proof || !block_hash || strlen(block_hash) != HEX_HASH_LENGTH || proof->index < 0 ||
+        proof->index >= proof->leaves || proof->leaves >= 1L << MMR_MAX_HEIGHT) {
+        return 0;
+    }
+
+    int peak, peaks = 0;
+    int height = find_mountain(proof->leaves, proof->index, &peak);
+    for (long bits = proof->leaves; bits; bits >>= 1) peaks += (int)(bits & 1);
+    if (height != proof->path_length || peaks != proof->peak_count) return 0;
+
+    mmr_hash_t hash;
+    hash_leaf(block_hash, hash);
+    for (int level = 0; level < height; level++) {
+        if ((proof->index >> level) & 1) {
+            hash_node(proof->path[level], hash, hash);
+        } else {
+            hash_node(hash, proof->path[level], hash);
+        }
+    }
+    if (memcmp(hash, proof->peaks[peak], MMR_HASH_SIZE) != 0) return 0;
+
+    mmr_hash_t computed;
+    hash_peaks(proof->leaves, proof->peaks, proof->peak_count, computed);
+    return memcmp(computed, root, MMR_HASH_SIZE) == 0;
+}
+
+// Bytes needed to store the nodes of the first `leaves` blocks: every
+// level's nodes in order, level 0 first
+size_t mmr_image_size(long leaves) {
+    size_t nodes = 0;
+    for (long count = leaves; count > 0; count >>= 1) nodes += (size_t)count;
+    return nodes * MMR_HASH_SIZE;
+}
+
+// Write the nodes of the first `leaves` blocks in the mmr_image_size layout
+int mmr_write_image(const mmr_t *mmr, long leaves, unsigned char *image) {
+    if (!mmr || leaves < 0 || leaves > mmr->leaves) return 0;
+
+    for (int level = 0; (leaves >> level) > 0; level++) {
+        long count = leaves >> level;
+        const mmr_directory_t *directory = level_directory(mmr, level);
+        for (long position = 0; position < count; position += MMR_CHUNK_NODES) {
+            long nodes = count - position < MMR_CHUNK_NODES ? count - position : MMR_CHUNK_NODES;
+            memcpy(image, directory->chunks[position >> MMR_CHUNK_SHIFT],
+                   (size_t)nodes * MMR_HASH_SIZE);
+            image += (size_t)nodes * MMR_HASH_SIZE;
+        }
+    }
+    return 1;
+}
+
+// Rebuild an accumulator over an image written by mmr_write_image. Full
+// chunks are used in place (the image must outlive the accumulator); the
+// last, partly filled chunk of each level is copied so appends can go on.
+mmr_t *mmr_from_image(unsigned char *image, long leaves) {
+    if (!image || leaves < 0 || leaves >= 1L << MMR_MAX_HEIGHT) return NULL;
+
+    mmr_t *mmr = mmr_create();
+    if (!mmr) return NULL;
+
+    for (int level = 0; (leaves >> level) > 0; level++) {
+        long count = leaves >> level;
+        long chunks = (count + MMR_CHUNK_NODES - 1) >> MMR_CHUNK_SHIFT;
+        mmr_directory_t *directory = calloc(1, sizeof(mmr_directory_t) +
+                                               (size_t)chunks * sizeof(mmr_hash_t *));
+        if (!directory) {
+            mmr_free(mmr);
+            return NULL;
+        }
+        directory->capacity = chunks;
+        atomic_store(&mmr->levels[level].directory, directory);
+
+        for (long chunk = 0; chunk < chunks; chunk++) {
+            long nodes = count - chunk * MMR_CHUNK_NODES;
+            if (nodes >= MMR_CHUNK_NODES) {
+                directory->chunks[chunk] = (mmr_hash_t *)image;
+                mmr->levels[level].mapped_chunks++;
+                nodes = MMR_CHUNK_NODES;
+            } else {
+                directory->chunks[chunk] = malloc(MMR_CHUNK_NODES * sizeof(mmr_hash_t));
+                if (!directory->chunks[chunk]) {
+                    mmr_free(mmr);
+                    return NULL;
+                }
+                memcpy(directory->chunks[chunk], image, (size_t)nodes * MMR_HASH_SIZE);
+            }
+            image += (size_t)nodes * MMR_HASH_SIZE;
+        }
+    }
+
+    mmr->leaves = leaves;
+    return mmr;
+}
+
+void mmr_hash_to_hex(const mmr_hash_t hash, char *hex) {
+    for (int i = 0; i < MMR_HASH_SIZE; i++) {
+        sprintf(hex + i * 2, "%02x", hash[i]);
+    }
+    hex[HEX_HASH_LENGTH] = '\0';
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parse a 64-character hex hash
+int mmr_hash_from_hex(const char *hex, mmr_hash_t hash) {
+    if (!hex || strlen(hex) != HEX_HASH_LENGTH) return 0;
+
+    for (int i = 0; i < MMR_HASH_SIZE; i++) {
+        int high = hex_digit(hex[i * 2]);
+        int low = hex_digit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) return 0;
+        hash[i] = (unsigned char)(high << 4 | low);
+    }
+    return 1;
+}
+
+// function to write a JSON array of hashes
+static void write_hashes(FILE *out, const char *key, const mmr_hash_t *hashes, int count) {
+    char hex[HEX_HASH_LENGTH + 1];
+    fprintf(out, ",\"%s\":[", key);
+    for (int i = 0; i < count; i++) {
+        mmr_hash_to_hex(hashes[i], hex);
+        fprintf(out, "%s\"%s\"", i > 0 ? "," : "", hex);
+    }
+    fputc(']', out);
+}
+
+// Write the fields of a proof into an open JSON object
+void mmr_write_proof_json(FILE *out, const mmr_proof_t *proof) {
+    fprintf(out, ",\"index\":%ld,\"leaves\":%ld", proof->index, proof->leaves);
+    write_hashes(out, "path", proof->path, proof->path_length);
+    write_hashes(out, "peaks", proof->peaks, proof->peak_count);
+}
+
+// function to find the value of "key" in a one-line JSON object
+static const char *find_value(const char *json, const char *key) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *found = strstr(json, pattern);
+    return found ? found + strlen(pattern) : NULL;
+}
+
+static int read_long(const char *json, const char *key, long *value) {
+    const char *text = find_value(json, key);
+    if (!text) return 0;
+
+    char *end;
+    errno = 0;
+    *value = strtol(text, &end, 10);
+    return errno == 0 && end != text;
+}
+
+// function to read a quoted 64-character hex hash, returning what follows
+static const char *read_hash(const char *text, mmr_hash_t hash, char *hex) {
+    const char *close = text[0] == '"' ? strchr(text + 1, '"') : NULL;
+    if (!close || close - text - 1 != HEX_HASH_LENGTH) return NULL;
+
+    memcpy(hex, text + 1, HEX_HASH_LENGTH);
+    hex[HEX_HASH_LENGTH] = '\0';
+    return mmr_hash_from_hex(hex, hash) ? close + 1 : NULL;
+}
+
+static int read_hashes(const char *json, const char *key, mmr_hash_t *hashes, int max, int *count) {
+    const char *text = find_value(json, key);
+    char hex[HEX_HASH_LENGTH + 1];
+    if (!text || *text++ != '[') return 0;
+
+    *count = 0;
+    while (*text != ']') {
+        if (*count == max || !(text = read_hash(text, hashes[*count], hex))) return 0;
+        (*count)++;
+        if (*text == ',') {
+            text++;
+        } else if (*text != ']') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Read a proof written by `blockmed proof` (its JSON result object);
+// block_hash receives the proven block's hash
+int mmr_read_proof_json(const char *json, mmr_proof_t *proof, char *block_hash, size_t size) {
+    const char *text = find_value(json, "block_hash");
+    mmr_hash_t ignored;
+
+    memset(proof, 0, sizeof(*proof));
+    return text && size > HEX_HASH_LENGTH && read_hash(text, ignored, block_hash) &&
+           read_long(json, "index", &proof->index) &&
+           read_long(json, "leaves", &proof->leaves) &&
+           read_hashes(json, "path", proof->path, MMR_MAX_HEIGHT, &proof->path_length) &&
+           read_hashes(json, "peaks", proof->peaks, MMR_MAX_HEIGHT + 1, &proof->peak_count);
+}
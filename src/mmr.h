@@ -0,0 +1,70 @@
+#ifndef MMR_H
+#define MMR_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Merkle Mountain Range over the block hashes of a chain. Leaf i commits to
+// block i; the leaves form perfect binary trees ("mountains") whose sizes
+// are the set bits of the leaf count, and the root bags the mountain peaks
+// together with the leaf count. Appending costs one leaf hash plus, on
+// average, one node hash; an inclusion proof holds the sibling path inside
+// the block's mountain and the peaks, O(log n) hashes in all.
+//
+//   leaf = SHA256(0x00 || block hash as 64 hex characters)
+//   node = SHA256(0x01 || left || right)
+//   root = SHA256(0x02 || leaf count as 8 bytes big-endian || peaks, highest first)
+#define MMR_HASH_SIZE 32
+#define MMR_MAX_HEIGHT 48
+#define MMR_CHUNK_SHIFT 10
+#define MMR_CHUNK_NODES (1L << MMR_CHUNK_SHIFT)
+
+typedef unsigned char mmr_hash_t[MMR_HASH_SIZE];
+
+// chunks of one level. The writer replaces a full directory with a bigger
+// copy and retires the old one (epoch.h); chunks never move.
+typedef struct {
+    long capacity;
+    mmr_hash_t *chunks[];
+} mmr_directory_t;
+
+// level k holds the leaf_count >> k complete nodes at that height
+typedef struct {
+    _Atomic(mmr_directory_t *) directory;
+    long mapped_chunks;         // leading chunks that live in a snapshot image
+} mmr_level_t;
+
+// The writer appends; readers use the leaf count of their chain view and
+// read only nodes below it, which never change once written.
+typedef struct {
+    mmr_level_t levels[MMR_MAX_HEIGHT + 1];
+    long leaves;                // writer only
+} mmr_t;
+
+typedef struct {
+    long index;                 // height of the proven block
+    long leaves;                // leaf count the root commits to
+    int path_length;            // height of the block's mountain
+    mmr_hash_t path[MMR_MAX_HEIGHT];
+    int peak_count;
+    mmr_hash_t peaks[MMR_MAX_HEIGHT + 1];
+} mmr_proof_t;
+
+// Function prototypes
+mmr_t *mmr_create(void);
+void mmr_free(mmr_t *mmr);
+void mmr_release(void *ptr);
+int mmr_append(mmr_t *mmr, const char *block_hash);
+int mmr_root(const mmr_t *mmr, long leaves, mmr_hash_t root);
+int mmr_prove(const mmr_t *mmr, long leaves, long index, mmr_proof_t *proof);
+int mmr_verify(const mmr_proof_t *proof, const char *block_hash, const mmr_hash_t root);
+size_t mmr_image_size(long leaves);
+int mmr_write_image(const mmr_t *mmr, long leaves, unsigned char *image);
+mmr_t *mmr_from_image(unsigned char *image, long leaves);
+void mmr_hash_to_hex(const mmr_hash_t hash, char *hex);
+int mmr_hash_from_hex(const char *hex, mmr_hash_t hash);
+void mmr_write_proof_json(FILE *out, const mmr_proof_t *proof);
+int mmr_read_proof_json(const char *json, mmr_proof_t *proof, char *block_hash, size_t size);
+
+#endif
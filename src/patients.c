@@ -0,0 +1,315 @@
+#include "patients.h"
+#include "epoch.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 64
+
+// function to hash a patient id (FNV-1a)
+static uint32_t hash_id(const char *patient_id) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)patient_id; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static patient_slots_t *load_slots(const patient_table_t *table) {
+    return atomic_load(&((patient_table_t *)table)->slots);
+}
+
+// function to find the slot holding a patient, or the empty slot that
+// ends its probe sequence
+static long find_slot(const patient_slots_t *slots, const char *patient_id) {
+    long mask = slots->capacity - 1;
+    long slot = (long)(hash_id(patient_id) & (uint32_t)mask);
+    for (;;) {
+        const patient_summary_t *summary = atomic_load(&((patient_slots_t *)slots)->slots[slot]);
+        if (!summary || strcmp(summary->patient_id, patient_id) == 0) return slot;
+        slot = (slot + 1) & mask;
+    }
+}
+
+// function to allocate an empty slot array
+static patient_slots_t *allocate_slots(long capacity) {
+    patient_slots_t *slots = calloc(1, sizeof(patient_slots_t) +
+                                       (size_t)capacity * sizeof(patient_summary_t *));
+    if (slots) slots->capacity = capacity;
+    return slots;
+}
+
+// function to make room for one more patient, keeping the table at most
+// half full. The old slot array is retired, or freed when `shared` is 0
+// (a table no reader can see).
+static int reserve(patient_table_t *table, int shared) {
+    patient_slots_t *slots = load_slots(table);
+    if (slots && (table->count + 1) * 2 <= slots->capacity) return 1;
+
+    patient_slots_t *grown = allocate_slots(slots ? slots->capacity * 2 : INITIAL_CAPACITY);
+    if (!grown) return 0;
+    for (long i = 0; slots && i < slots->capacity; i++) {
+        patient_summary_t *summary = atomic_load(&slots->slots[i]);
+        if (summary) atomic_init(&grown->slots[find_slot(grown, summary->patient_id)], summary);
+    }
+
+    atomic_store(&table->slots, grown);
+    if (shared) {
+        epoch_retire(slots, free);
+    } else {
+        free(slots);
+    }
+    return 1;
+}
+
+// function to add a summary for a patient not in the table yet
+static int insert(patient_table_t *table, patient_summary_t *summary, int shared) {
+    if (!reserve(table, shared)) return 0;
+
+    patient_slots_t *slots = load_slots(table);
+    atomic_store(&slots->slots[find_slot(slots, summary->patient_id)], summary);
+    table->count++;
+    return 1;
+}
+
+// function to fold one record into a patient's summary
+static void update_summary(patient_summary_t *summary, const block_t *block) {
+    const medical_transaction_t *tx = &block->transaction;
+
+    if (summary->visits == 0) summary->first_index = block->index;
+    summary->visits++;
+    summary->last_index = block->index;
+    strncpy(summary->last_visit, tx->timestamp, sizeof(summary->last_visit) - 1);
+    strncpy(summary->last_doctor, tx->doctor_email, sizeof(summary->last_doctor) - 1);
+    strncpy(summary->diagnosis, tx->diagnosis, sizeof(summary->diagnosis) - 1);
+
+    if (tx->prescription[0] == '\0') return;
+
+    // the latest distinct prescriptions, newest first
+    int count = summary->prescription_count;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(summary->prescriptions[i], tx->prescription) == 0) {
+            count = i;
+            break;
+        }
+    }
+    if (count == PATIENT_ACTIVE_PRESCRIPTIONS) count--;
+    memmove(summary->prescriptions[1], summary->prescriptions[0],
+            (size_t)count * MAX_PRESCRIPTION_SIZE);
+    memset(summary->prescriptions[0], 0, MAX_PRESCRIPTION_SIZE);
+    strncpy(summary->prescriptions[0], tx->prescription, MAX_PRESCRIPTION_SIZE - 1);
+    if (summary->prescription_count < PATIENT_ACTIVE_PRESCRIPTIONS &&
+        count == summary->prescription_count) {
+        summary->prescription_count++;
+    }
+}
+
+// function to apply the next block of the chain (see patients_apply)
+static int apply_block(patient_table_t *table, const block_t *block, int shared) {
+    if (!table || !block || block->index != table->blocks) return 0;
+
+    // the genesis block records no patient
+    if (block->index == 0) {
+        table->blocks++;
+        return 1;
+    }
+
+    patient_slots_t *slots = load_slots(table);
+    long slot = slots ? find_slot(slots, block->transaction.patient_id) : -1;
+    patient_summary_t *old = slot >= 0 ? atomic_load(&slots->slots[slot]) : NULL;
+
+    patient_summary_t *summary = malloc(sizeof(patient_summary_t));
+    if (!summary) return 0;
+    if (old) {
+        memcpy(summary, old, sizeof(patient_summary_t));
+    } else {
+        memset(summary, 0, sizeof(patient_summary_t));
+        strncpy(summary->patient_id, block->transaction.patient_id,
+                sizeof(summary->patient_id) - 1);
+    }
+    update_summary(summary, block);
+
+    if (old) {
+        atomic_store(&slots->slots[slot], summary);
+        if (shared) {
+            epoch_retire(old, free);
+        } else {
+            free(old);
+        }
+    } else if (!insert(table, summary, shared)) {
+        free(summary);
+        return 0;
+    }
+
+    table->blocks++;
+    return 1;
+}
+
+// Create an empty table
+patient_table_t *patients_create(void) {
+    patient_table_t *table = malloc(sizeof(patient_table_t));
+    if (!table) return NULL;
+
+    atomic_init(&table->slots, NULL);
+    table->count = 0;
+    table->blocks = 0;
+    return table;
+}
+
+// Free a table and every summary in it
+void patients_free(patient_table_t *table) {
+    if (!table) return;
+
+    patient_slots_t *slots = load_slots(table);
+    for (long i = 0; slots && i < slots->capacity; i++) {
+        free(atomic_load(&slots->slots[i]));
+    }
+    free(slots);
+    free(table);
+}
+
+// patients_free as an epoch release callback
+void patients_release(void *ptr) {
+    patients_free(ptr);
+}
+
+// Apply the next block of the chain (index == blocks applied so far). Only
+// the writer thread calls this, before publishing the block. Returns 0 if
+// the block is out of order or memory runs out.
+int patients_apply(patient_table_t *table, const block_t *block) {
+    return apply_block(table, block, 1);
+}
+
+// Summary of a patient, NULL if the patient has no records. Call it
+// between chain_read_begin and chain_read_end.
+const patient_summary_t *patients_find(const patient_table_t *table, const char *patient_id) {
+    const patient_slots_t *slots = table && patient_id ? load_slots(table) : NULL;
+    if (!slots) return NULL;
+
+    return atomic_load(&((patient_slots_t *)slots)->slots[find_slot(slots, patient_id)]);
+}
+
+// Build a table from scratch by walking a chain view. Returns NULL if a
+// block cannot be read or memory runs out.
+patient_table_t *patients_rebuild(const chain_view_t *view) {
+    patient_table_t *table = patients_create();
+    if (!table) return NULL;
+
+    const block_t *block = chain_view_first(view);
+    for (int i = 0; i < view->length; i++) {
+        if (!block || !apply_block(table, block, 0)) {
+            patients_free(table);
+            return NULL;
+        }
+        block = chain_view_next(view, block);
+    }
+    return table;
+}
+
+// Check `table` against a table rebuilt from `view`: every patient with
+// records in the view must be in both and, unless the table already holds
+// a later record of theirs, summarized alike. `checked` gets the number of
+// patients compared. Returns 1 if consistent, 0 if not, -1 if the view
+// could not be rebuilt.
+int patients_verify(const patient_table_t *table, const chain_view_t *view, long *checked) {
+    patient_table_t *rebuilt = patients_rebuild(view);
+    if (!rebuilt) return -1;
+
+    int consistent = table != NULL;
+    long compared = 0;
+    patient_slots_t *slots = load_slots(rebuilt);
+    for (long i = 0; slots && i < slots->capacity; i++) {
+        const patient_summary_t *expected = atomic_load(&slots->slots[i]);
+        if (!expected) continue;
+
+        const patient_summary_t *summary = patients_find(table, expected->patient_id);
+        if (!summary || (summary->last_index < view->length &&
+                         memcmp(summary, expected, sizeof(patient_summary_t)) != 0)) {
+            consistent = 0;
+        }
+        compared++;
+    }
+
+    // and nobody in the table is missing from the view
+    slots = consistent ? load_slots(table) : NULL;
+    for (long i = 0; consistent && slots && i < slots->capacity; i++) {
+        const patient_summary_t *summary = atomic_load(&slots->slots[i]);
+        if (summary && summary->first_index < view->length &&
+            !patients_find(rebuilt, summary->patient_id)) {
+            consistent = 0;
+        }
+    }
+
+    patients_free(rebuilt);
+    if (checked) *checked = compared;
+    return consistent;
+}
+
+// Size of the image patients_write_image writes
+size_t patients_image_size(const patient_table_t *table) {
+    return table ? (size_t)table->count * sizeof(patient_summary_t) : 0;
+}
+
+// Write every summary into `image` (patients_image_size bytes). Only the
+// writer thread calls this.
+int patients_write_image(const patient_table_t *table, unsigned char *image, size_t size) {
+    if (!table || size != patients_image_size(table)) return 0;
+
+    patient_slots_t *slots = load_slots(table);
+    long written = 0;
+    for (long i = 0; slots && i < slots->capacity; i++) {
+        const patient_summary_t *summary = atomic_load(&slots->slots[i]);
+        if (!summary) continue;
+        memcpy(image + (size_t)written * sizeof(patient_summary_t), summary,
+               sizeof(patient_summary_t));
+        written++;
+    }
+    return written == table->count;
+}
+
+// function to check a summary read from an image
+static int summary_usable(const patient_summary_t *summary, int blocks) {
+    if (summary->patient_id[0] == '\0' ||
+        !memchr(summary->patient_id, '\0', sizeof(summary->patient_id)) ||
+        !memchr(summary->last_visit, '\0', sizeof(summary->last_visit)) ||
+        !memchr(summary->last_doctor, '\0', sizeof(summary->last_doctor)) ||
+        !memchr(summary->diagnosis, '\0', sizeof(summary->diagnosis)) ||
+        summary->visits <= 0 || summary->first_index <= 0 ||
+        summary->first_index > summary->last_index || summary->last_index >= blocks ||
+        summary->prescription_count < 0 ||
+        summary->prescription_count > PATIENT_ACTIVE_PRESCRIPTIONS) {
+        return 0;
+    }
+    for (int i = 0; i < summary->prescription_count; i++) {
+        if (!memchr(summary->prescriptions[i], '\0', MAX_PRESCRIPTION_SIZE)) return 0;
+    }
+    return 1;
+}
+
+// Load a table from an image of the first `blocks` blocks (a snapshot
+// section). Returns NULL if the image is damaged.
+patient_table_t *patients_from_image(const unsigned char *image, size_t size, int blocks) {
+    if (!image || size % sizeof(patient_summary_t) != 0) return NULL;
+
+    patient_table_t *table = patients_create();
+    if (!table) return NULL;
+
+    size_t count = size / sizeof(patient_summary_t);
+    for (size_t i = 0; i < count; i++) {
+        patient_summary_t *summary = malloc(sizeof(patient_summary_t));
+        if (!summary) {
+            patients_free(table);
+            return NULL;
+        }
+        memcpy(summary, image + i * sizeof(patient_summary_t), sizeof(patient_summary_t));
+
+        if (!summary_usable(summary, blocks) || patients_find(table, summary->patient_id) ||
+            !insert(table, summary, 0)) {
+            free(summary);
+            patients_free(table);
+            return NULL;
+        }
+    }
+    table->blocks = blocks;
+    return table;
+}
@@ -0,0 +1,56 @@
+#ifndef PATIENTS_H
+#define PATIENTS_H
+
+#include "blockchain.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Per-patient view of a chain, kept up to date as add_block_to_chain
+// appends each block, so a patient's summary is one hash lookup instead of
+// a scan of the chain. Summaries are never changed once readers can see
+// them: the writer replaces a patient's summary with an updated copy and
+// retires the old one (epoch.h), as it does with a full slot array.
+#define PATIENT_ACTIVE_PRESCRIPTIONS 4
+
+// summary of one patient's records. Strings are zero-padded, so equal
+// summaries compare equal with memcmp.
+typedef struct {
+    char patient_id[50];
+    int visits;                         // records on the chain
+    int first_index;                    // first and latest block of the patient
+    int last_index;
+    char last_visit[20];                // timestamp of the latest record
+    char last_doctor[MAX_EMAIL_SIZE];
+    char diagnosis[MAX_DIAGNOSIS_SIZE]; // latest diagnosis
+    int prescription_count;
+    char prescriptions[PATIENT_ACTIVE_PRESCRIPTIONS][MAX_PRESCRIPTION_SIZE]; // newest first
+} patient_summary_t;
+
+// open-addressing table of summaries, capacity a power of two
+typedef struct {
+    long capacity;
+    _Atomic(patient_summary_t *) slots[];
+} patient_slots_t;
+
+// The writer applies blocks in chain order; readers look summaries up in
+// the slots they load after chain_read_begin. A summary may already
+// include a block appended after the reader's view (its last_index tells).
+struct patient_table {
+    _Atomic(patient_slots_t *) slots;
+    long count;                         // writer only: patients
+    int blocks;                         // writer only: blocks applied
+};
+
+// Function prototypes
+patient_table_t *patients_create(void);
+void patients_free(patient_table_t *table);
+void patients_release(void *ptr);
+int patients_apply(patient_table_t *table, const block_t *block);
+const patient_summary_t *patients_find(const patient_table_t *table, const char *patient_id);
+patient_table_t *patients_rebuild(const chain_view_t *view);
+int patients_verify(const patient_table_t *table, const chain_view_t *view, long *checked);
+size_t patients_image_size(const patient_table_t *table);
+int patients_write_image(const patient_table_t *table, unsigned char *image, size_t size);
+patient_table_t *patients_from_image(const unsigned char *image, size_t size, int blocks);
+
+#endif
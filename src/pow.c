@@ -1,4 +1,6 @@
 #include "pow.h"
+#include "metrics.h"
+#include "trace.h"
 
 static int mining_difficulty = DEFAULT_DIFFICULTY;
 
@@ -31,7 +33,12 @@ int mine_block(block_t *block, int difficulty) {
         return 0; // Invalid block
     }
 
-    printf("Mining block %d with difficulty %d...\n", block->index, difficulty);
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    int quiet = is_quiet_mode();
+    if (!quiet) {
+        printf("Mining block %d with difficulty %d...\n", block->index, difficulty);
+    }
 
     block->nonce = 0;
 
@@ -41,11 +48,18 @@ int mine_block(block_t *block, int difficulty) {
         calculate_block_hash(block);
 
         // show progress every 1000 iterations
-        if (block->nonce % 1000 == 0) {
+        if (!quiet && block->nonce % 1000 == 0) {
             printf("Nonce: %lu, Hash: %.16s...\n", block->nonce, block->current_hash);
         }
     } while (!is_valid_proof(block->current_hash, difficulty));
 
-    printf("Block mined! Nonce: %lu, Hash: %s\n", block->nonce, block->current_hash);
+    if (!quiet) {
+        printf("Block mined! Nonce: %lu, Hash: %s\n", block->nonce, block->current_hash);
+    }
+
+    metrics_counter_add(METRIC_BLOCKS_MINED, 1);
+    metrics_counter_add(METRIC_HASH_ATTEMPTS, block->nonce);
+    metrics_observe(METRIC_MINE_LATENCY, metrics_now_ns() - start);
+    trace_end("mine_block", span);
     return 1;
 }
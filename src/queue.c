@@ -0,0 +1,78 @@
+#include "queue.h"
+#include <stdlib.h>
+
+// function to initialize a queue holding at most `capacity` items
+int queue_init(bounded_queue_t *queue, size_t capacity) {
+    if (!queue || capacity == 0) return 0;
+
+    queue->items = malloc(capacity * sizeof(void *));
+    if (!queue->items) return 0;
+
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return 1;
+}
+
+// function to push an item, blocking while the queue is full.
+// Returns 0 if the queue was closed and the item was not accepted.
+int queue_push(bounded_queue_t *queue, void *item) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity && !queue->closed) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+// function to pop an item, blocking while the queue is empty.
+// Returns NULL once the queue is closed and fully drained.
+void *queue_pop(bounded_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    void *item = NULL;
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+// function to close the queue; blocked producers and consumers are woken up
+void queue_close(bounded_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// function to release queue resources (items still queued are not freed)
+void queue_destroy(bounded_queue_t *queue) {
+    if (!queue) return;
+
+    free(queue->items);
+    queue->items = NULL;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
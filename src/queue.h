@@ -0,0 +1,26 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// bounded, blocking hand-off queue used between pipeline stages
+typedef struct {
+    void **items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} bounded_queue_t;
+
+// Function prototypes
+int queue_init(bounded_queue_t *queue, size_t capacity);
+int queue_push(bounded_queue_t *queue, void *item);
+void *queue_pop(bounded_queue_t *queue);
+void queue_close(bounded_queue_t *queue);
+void queue_destroy(bounded_queue_t *queue);
+
+#endif
@@ -0,0 +1,537 @@
+#define _POSIX_C_SOURCE 200809L
+#include "replica.h"
+#include "batch.h"
+#include "client.h"
+#include "storage.h"
+#include "snapshot.h"
+#include "authority.h"
+#include "dedup.h"
+#include "metrics.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_HEX_SIZE (2 * BLOCK_RECORD_SIZE)
+
+// a logged-in connection to the peer
+typedef struct {
+    int fd;
+    char token[128];
+} peer_t;
+
+// one verifier thread: every `step`-th block of a batch from `start`
+typedef struct {
+    block_t **blocks;
+    long count;
+    long start;
+    long step;
+    long failed;                        // first block with a bad hash, or -1
+} verify_job_t;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// function to write bytes in hex
+static int write_hex(FILE *out, const unsigned char *data, size_t length) {
+    char hex[RECORD_HEX_SIZE];
+    for (size_t i = 0; i < length; i++) {
+        hex[2 * i] = hex_digits[data[i] >> 4];
+        hex[2 * i + 1] = hex_digits[data[i] & 15];
+    }
+    return fwrite(hex, 2 * length, 1, out) == 1;
+}
+
+// function to write a block as its chain file record, in hex
+static int write_record_hex(FILE *out, const block_t *block) {
+    unsigned char record[BLOCK_RECORD_SIZE];
+    encode_block_record(block, (char *)record);
+    return write_hex(out, record, sizeof(record));
+}
+
+// function to decode one hex digit, -1 if it is not one
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// function to read the hex field `name` of a line into `length` bytes
+static int read_hex_field(const char *line, const char *name, unsigned char *data, size_t length) {
+    char key[16];
+    snprintf(key, sizeof(key), "\"%s\":\"", name);
+    const char *hex = strstr(line, key);
+    if (!hex) return 0;
+    hex += strlen(key);
+    const char *end = strchr(hex, '"');
+    if (!end || end - hex != (ptrdiff_t)(2 * length)) return 0;
+
+    for (size_t i = 0; i < length; i++) {
+        int high = hex_value(hex[2 * i]), low = hex_value(hex[2 * i + 1]);
+        if (high < 0 || low < 0) return 0;
+        data[i] = (unsigned char)(high << 4 | low);
+    }
+    return 1;
+}
+
+// function to read a block back from a line of replica_write_blocks output
+static block_t *read_record_line(const char *line) {
+    unsigned char record[BLOCK_RECORD_SIZE];
+    if (!read_hex_field(line, "record", record, sizeof(record))) return NULL;
+
+    block_t view;
+    decode_block_record((char *)record, &view);
+    return copy_block(&view);
+}
+
+// Write `count` blocks of a view from height `from` as JSON Lines
+// ({"index":N,"record":"<hex>"}, with "seal":"<hex>" after blocks 1 and
+// up of a proof-of-authority chain), then a result object
+int replica_write_blocks(FILE *out, const char *command, const chain_view_t *view,
+                         long from, long count) {
+    if (from < 0 || from >= view->length || count < 1 || count > REPLICA_MAX_BATCH) {
+        return batch_fail(out, command, BATCH_EXIT_USAGE,
+                          "--from must be below the height and --count between 1 and 4096");
+    }
+
+    long sent = 0;
+    const block_t *block = chain_view_block(view, (int)from);
+    for (; block && sent < count && from + sent < view->length;
+         block = chain_view_next(view, block)) {
+        fprintf(out, "{\"index\":%d,\"record\":\"", block->index);
+        if (!write_record_hex(out, block)) break;
+        const unsigned char *seal = view->seals ? seals_get(view->seals, block->index) : NULL;
+        if (seal) {
+            fprintf(out, "\",\"seal\":\"");
+            if (!write_hex(out, seal, AUTHORITY_SEAL_SIZE)) break;
+        }
+        fprintf(out, "\"}\n");
+        sent++;
+    }
+    if (sent < count && from + sent < view->length) {
+        return batch_fail(out, command, BATCH_EXIT_FAILURE, "could not read the blocks");
+    }
+
+    batch_json_begin(out, command, 1);
+    batch_json_long(out, "from", from);
+    batch_json_long(out, "count", sent);
+    batch_json_long(out, "height", view->length);
+    batch_json_end(out);
+    return BATCH_EXIT_OK;
+}
+
+// function to record why a sync failed and return its exit code
+static int sync_fail(replica_stats_t *stats, int code, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(stats->error, sizeof(stats->error), format, args);
+    va_end(args);
+    return code;
+}
+
+// function to connect to the peer and log in. Credentials come from
+// BLOCKMED_PEER_EMAIL and BLOCKMED_PEER_PASSWORD, or else the usual
+// BLOCKMED_EMAIL and BLOCKMED_PASSWORD.
+static int peer_open(peer_t *peer, const char *address, replica_stats_t *stats) {
+    peer->fd = client_connect_tcp(address);
+    peer->token[0] = '\0';
+    if (peer->fd < 0) {
+        return sync_fail(stats, BATCH_EXIT_FAILURE, "could not connect to %s", address);
+    }
+
+    const char *email = getenv("BLOCKMED_PEER_EMAIL");
+    const char *password = getenv("BLOCKMED_PEER_PASSWORD");
+    if (!email || !password) {
+        email = getenv("BLOCKMED_EMAIL");
+        password = getenv("BLOCKMED_PASSWORD");
+    }
+
+    const char *login[] = {"", "login", "--email", email ? email : "",
+                           "--password", password ? password : ""};
+    char *response = NULL;
+    int code;
+    int ok = email && password && client_request(peer->fd, 6, login, &code, &response, NULL) &&
+             code == BATCH_EXIT_OK &&
+             client_json_field(response, "token", peer->token, sizeof(peer->token));
+    free(response);
+    if (!ok) {
+        close(peer->fd);
+        peer->fd = -1;
+        return sync_fail(stats, BATCH_EXIT_DENIED, "the peer refused the credentials");
+    }
+    return BATCH_EXIT_OK;
+}
+
+static void peer_close(peer_t *peer) {
+    if (peer->fd < 0) return;
+
+    const char *logout[] = {peer->token, "logout"};
+    char *response = NULL;
+    int code;
+    if (client_request(peer->fd, 2, logout, &code, &response, NULL)) free(response);
+    close(peer->fd);
+    peer->fd = -1;
+}
+
+// function to send one command to the peer. Returns the response (to be
+// freed) if the command succeeded, NULL otherwise.
+static char *peer_call(peer_t *peer, int argc, const char *argv[]) {
+    char *response = NULL;
+    int code;
+    argv[0] = peer->token;
+    if (!client_request(peer->fd, argc, argv, &code, &response, NULL)) return NULL;
+    if (code != BATCH_EXIT_OK) {
+        free(response);
+        return NULL;
+    }
+    return response;
+}
+
+// function to fetch the peer's accumulator root over its first `height`
+// blocks
+static int peer_root(peer_t *peer, long height, char *root) {
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", height);
+    const char *argv[] = {NULL, "root", "--height", text};
+    char *response = peer_call(peer, 4, argv);
+    int ok = response && client_json_field(response, "root", root, HASH_SIZE);
+    free(response);
+    return ok;
+}
+
+// function to compare the roots of both chains over their first `height`
+// blocks. Returns 1 if equal, 0 if not, -1 if the peer did not answer.
+static int roots_match(peer_t *peer, const blockchain_t *chain, long height,
+                       replica_stats_t *stats) {
+    mmr_hash_t local;
+    char local_hex[HASH_SIZE], remote_hex[HASH_SIZE];
+    stats->probes++;
+    if (!peer_root(peer, height, remote_hex)) return -1;
+    if (!mmr_root(chain->mmr, height, local)) return 0;
+    mmr_hash_to_hex(local, local_hex);
+    return strcmp(local_hex, remote_hex) == 0;
+}
+
+// function to find the number of leading blocks both chains share: the
+// roots of equal prefixes match, and once two prefixes differ every longer
+// one does too
+static long find_common(peer_t *peer, const blockchain_t *chain, long peer_height,
+                        replica_stats_t *stats) {
+    long low = 0;
+    long high = chain->length < peer_height ? chain->length : peer_height;
+
+    // usually the peer has simply moved ahead
+    int match = high > 0 ? roots_match(peer, chain, high, stats) : 1;
+    if (match < 0) return -1;
+    if (match) return high;
+
+    while (high - low > 1) {
+        long middle = low + (high - low) / 2;
+        match = roots_match(peer, chain, middle, stats);
+        if (match < 0) return -1;
+        if (match) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void *verify_worker(void *arg) {
+    verify_job_t *job = arg;
+    job->failed = -1;
+    for (long i = job->start; i < job->count; i += job->step) {
+        char hash[HASH_SIZE];
+        compute_block_hash(job->blocks[i], hash);
+        if (strcmp(hash, job->blocks[i]->current_hash) != 0) {
+            job->failed = i;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// function to check a batch fetched from the peer: block hashes on
+// REPLICA_VERIFY_THREADS threads, then indexes and links in order.
+// Returns the first bad block, or -1.
+static long verify_batch(block_t **blocks, long count, const block_t *previous) {
+    verify_job_t jobs[REPLICA_VERIFY_THREADS];
+    pthread_t threads[REPLICA_VERIFY_THREADS];
+    int started = 0;
+
+    int workers = count < REPLICA_VERIFY_THREADS ? (int)count : REPLICA_VERIFY_THREADS;
+    for (int i = 0; i < workers; i++) {
+        jobs[i] = (verify_job_t){blocks, count, i, workers, -1};
+        if (i > 0 && pthread_create(&threads[i], NULL, verify_worker, &jobs[i]) == 0) {
+            started |= 1 << i;
+        }
+    }
+    // this thread takes the first share and any a thread could not start for
+    for (int i = 0; i < workers; i++) {
+        if (!(started & (1 << i))) verify_worker(&jobs[i]);
+    }
+
+    long failed = -1;
+    for (int i = 0; i < workers; i++) {
+        if (started & (1 << i)) pthread_join(threads[i], NULL);
+        if (jobs[i].failed >= 0 && (failed < 0 || jobs[i].failed < failed)) failed = jobs[i].failed;
+    }
+    metrics_counter_add(METRIC_BLOCK_HASHES, (uint64_t)count);
+
+    long expected = previous ? previous->index + 1 : 0;
+    for (long i = 0; i < count && (failed < 0 || i < failed); i++) {
+        const block_t *before = i > 0 ? blocks[i - 1] : previous;
+        if (blocks[i]->index != expected + i ||
+            (before && strcmp(blocks[i]->previous_hash, before->current_hash) != 0)) {
+            return i;
+        }
+    }
+    return failed;
+}
+
+// function to check the seals that came with a batch of a
+// proof-of-authority chain (on several threads) and store them in the
+// chain's seal table. Returns the first bad block, or -1.
+static long check_seals(seal_table_t *table, block_t **blocks, authority_seal_t *seals,
+                        long count) {
+    seal_check_t *checks = malloc((size_t)count * sizeof(seal_check_t));
+    if (!checks) return 0;
+
+    long checked = 0;
+    for (long i = 0; i < count; i++) {
+        if (blocks[i]->index == 0) continue;
+        checks[checked].index = i;
+        checks[checked].signer = blocks[i]->nonce;
+        memcpy(checks[checked].hash, blocks[i]->current_hash, HASH_SIZE);
+        memcpy(checks[checked].seal, seals[i], AUTHORITY_SEAL_SIZE);
+        checked++;
+    }
+    long bad = checked > 0 ? seals_verify(table, checks, checked) : -1;
+    if (bad >= 0) bad = checks[bad].index;
+    free(checks);
+
+    for (long i = 0; bad < 0 && i < count; i++) {
+        if (blocks[i]->index > 0 && !seals_put(table, blocks[i]->index, seals[i])) bad = i;
+    }
+    return bad;
+}
+
+// function to ask the peer for `count` blocks from `from`
+static int request_blocks(peer_t *peer, long from, long count) {
+    char from_text[24], count_text[24];
+    snprintf(from_text, sizeof(from_text), "%ld", from);
+    snprintf(count_text, sizeof(count_text), "%ld", count);
+    const char *argv[] = {peer->token, "blocks", "--from", from_text, "--count", count_text};
+    return client_send(peer->fd, 6, argv);
+}
+
+// function to fetch, check and append the peer's blocks [from, to) in
+// batches. The request for the next batch is sent before the current one
+// is checked, so the peer reads blocks while this side verifies them.
+static int fetch_blocks(peer_t *peer, blockchain_t *chain, const char *chain_file, long from,
+                        long to, long batch_size, replica_stats_t *stats) {
+    block_t **blocks = malloc((size_t)batch_size * sizeof(block_t *));
+    authority_seal_t *seals = malloc((size_t)batch_size * sizeof(authority_seal_t));
+    int result = blocks && seals ? BATCH_EXIT_OK
+                                 : sync_fail(stats, BATCH_EXIT_FAILURE, "out of memory");
+
+    long requested = from;
+    int pending = 0;
+    if (result == BATCH_EXIT_OK && from < to) {
+        long count = to - from < batch_size ? to - from : batch_size;
+        pending = request_blocks(peer, requested, count);
+        requested += count;
+        if (!pending) result = sync_fail(stats, BATCH_EXIT_FAILURE, "lost the connection to the peer");
+    }
+
+    while (result == BATCH_EXIT_OK && from < to) {
+        uint64_t span = trace_begin();
+        long wanted = to - from < batch_size ? to - from : batch_size;
+        char *response = NULL;
+        int code;
+        pending = 0;
+        if (!client_receive(peer->fd, &code, &response, NULL) || code != BATCH_EXIT_OK) {
+            free(response);
+            result = sync_fail(stats, BATCH_EXIT_FAILURE, "the peer did not send blocks %ld-%ld",
+                               from, from + wanted - 1);
+            break;
+        }
+        if (requested < to) {
+            long count = to - requested < batch_size ? to - requested : batch_size;
+            pending = request_blocks(peer, requested, count);
+            requested += count;
+        }
+
+        // one record per line, then the result object; a missing seal is
+        // left zero and fails its check
+        long count = 0;
+        char *save = NULL;
+        for (char *line = strtok_r(response, "\n", &save); line && count < wanted;
+             line = strtok_r(NULL, "\n", &save)) {
+            if (strncmp(line, "{\"index\":", 9) != 0) continue;
+            block_t *block = read_record_line(line);
+            if (!block) break;
+            if (!read_hex_field(line, "seal", seals[count], AUTHORITY_SEAL_SIZE)) {
+                memset(seals[count], 0, AUTHORITY_SEAL_SIZE);
+            }
+            blocks[count++] = block;
+        }
+        free(response);
+
+        // a chain fetched from the start learns its consensus from the
+        // genesis block
+        long bad = count == wanted ? verify_batch(blocks, count, chain->tail) : count;
+        if (bad < 0 && chain->length == 0 && authority_genesis(blocks[0]) &&
+            !(chain->seals = seals_create(blocks[0]))) {
+            bad = 0;
+        }
+        if (bad < 0 && chain->seals) bad = check_seals(chain->seals, blocks, seals, count);
+        if (bad >= 0) {
+            result = sync_fail(stats, BATCH_EXIT_INVALID, "block %ld from the peer is invalid",
+                               from + bad);
+        } else {
+            for (long i = 0; i < count; i++) blocks[i]->next = i + 1 < count ? blocks[i + 1] : NULL;
+        }
+
+        // on disk before it is in the chain, as with mined blocks
+        if (result == BATCH_EXIT_OK && !append_blocks(chain_file, blocks[0], chain->seals)) {
+            result = sync_fail(stats, BATCH_EXIT_FAILURE, "could not write %s", chain_file);
+        }
+        if (result != BATCH_EXIT_OK) {
+            for (long i = 0; i < count; i++) free(blocks[i]);
+            break;
+        }
+
+        int validated = atomic_load(&chain->validated) == chain->length;
+        for (long i = 0; i < count; i++) add_block_to_chain(chain, blocks[i]);
+        if (validated) atomic_store(&chain->validated, chain->length);
+
+        from += count;
+        stats->fetched += count;
+        stats->batches++;
+        trace_end("replica.batch", span);
+        if (from < to && !pending) {
+            result = sync_fail(stats, BATCH_EXIT_FAILURE, "lost the connection to the peer");
+        }
+    }
+
+    // leave the connection in step for the logout
+    char *response = NULL;
+    int code;
+    if (pending && client_receive(peer->fd, &code, &response, NULL)) free(response);
+
+    free(blocks);
+    free(seals);
+    return result;
+}
+
+// function to start over with the peer's chain when the local one holds
+// nothing but its own genesis block: fetch into a new chain file and swap
+// it in once complete
+static int adopt_chain(peer_t *peer, blockchain_t *chain, const char *chain_file,
+                       long peer_height, long batch_size, replica_stats_t *stats) {
+    char temp[4100];
+    if (snprintf(temp, sizeof(temp), "%s.sync", chain_file) >= (int)sizeof(temp)) {
+        return sync_fail(stats, BATCH_EXIT_USAGE, "chain path is too long");
+    }
+
+    blockchain_t *fresh = allocate_blockchain();
+    if (!fresh || !save_blockchain(fresh, temp)) {
+        if (fresh) free_blockchain(fresh);
+        return sync_fail(stats, BATCH_EXIT_FAILURE, "could not create %s", temp);
+    }
+
+    int result = fetch_blocks(peer, fresh, temp, 0, peer_height, batch_size, stats);
+    if (result == BATCH_EXIT_OK &&
+        (rename(temp, chain_file) != 0 || !seals_rename(temp, chain_file))) {
+        result = sync_fail(stats, BATCH_EXIT_FAILURE, "could not replace %s", chain_file);
+    }
+    if (result != BATCH_EXIT_OK) {
+        char temp_seals[4200];
+        unlink(temp);
+        if (seals_path(temp, temp_seals, sizeof(temp_seals))) unlink(temp_seals);
+        free_blockchain(fresh);
+        return result;
+    }
+
+    // the old snapshot and duplicate filter describe the genesis block just
+    // replaced
+    char path[4096];
+    if (snapshot_path(chain_file, path, sizeof(path))) unlink(path);
+    if (dedup_path(chain_file, path, sizeof(path))) unlink(path);
+    if (!chain_replace(chain, fresh)) {
+        free_blockchain(fresh);
+        return sync_fail(stats, BATCH_EXIT_FAILURE, "out of memory");
+    }
+    return BATCH_EXIT_OK;
+}
+
+// Bring `chain` (saved in `chain_file`) up to the chain of the daemon at
+// `peer` (host:port). Only the chain's writer calls this. Returns a
+// BATCH_EXIT_* code; on failure stats->error says why, and the blocks
+// appended so far stay.
+int replica_sync(blockchain_t *chain, const char *chain_file, const char *peer_address,
+                 long batch_size, replica_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!chain || !chain_file || !peer_address) {
+        return sync_fail(stats, BATCH_EXIT_USAGE, "--peer is required");
+    }
+    if (batch_size < 1 || batch_size > REPLICA_MAX_BATCH) {
+        return sync_fail(stats, BATCH_EXIT_USAGE, "--batch-size must be between 1 and 4096");
+    }
+    if (!chain->mmr) {
+        return sync_fail(stats, BATCH_EXIT_FAILURE, "the chain has no block accumulator");
+    }
+
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    peer_t peer;
+    int result = peer_open(&peer, peer_address, stats);
+    if (result != BATCH_EXIT_OK) return result;
+
+    const char *status[] = {NULL, "status"};
+    char *response = peer_call(&peer, 2, status);
+    char height_text[24], peer_root_hex[HASH_SIZE];
+    int ok = response && client_json_field(response, "height", height_text, sizeof(height_text)) &&
+             client_json_field(response, "root", peer_root_hex, sizeof(peer_root_hex));
+    free(response);
+    if (!ok) {
+        peer_close(&peer);
+        return sync_fail(stats, BATCH_EXIT_FAILURE, "the peer did not report its status");
+    }
+
+    stats->local_height = chain->length;
+    stats->peer_height = atol(height_text);
+    stats->common = find_common(&peer, chain, stats->peer_height, stats);
+
+    if (stats->common < 0) {
+        result = sync_fail(stats, BATCH_EXIT_FAILURE, "the peer did not send its roots");
+    } else if (stats->common == 0 && chain->length == 1 && stats->peer_height > 0) {
+        result = adopt_chain(&peer, chain, chain_file, stats->peer_height, batch_size, stats);
+    } else if (stats->common < chain->length) {
+        result = sync_fail(stats, BATCH_EXIT_INVALID,
+                           "the chains diverge after block %ld; nothing was changed",
+                           stats->common - 1);
+    } else if (stats->peer_height > chain->length) {
+        result = fetch_blocks(&peer, chain, chain_file, chain->length, stats->peer_height,
+                              batch_size, stats);
+    }
+
+    // the chain now ends where the peer's did when it reported its root
+    if (result == BATCH_EXIT_OK && chain->length == stats->peer_height) {
+        mmr_hash_t root;
+        char hex[HASH_SIZE] = "";
+        if (mmr_root(chain->mmr, chain->length, root)) mmr_hash_to_hex(root, hex);
+        if (strcmp(hex, peer_root_hex) != 0) {
+            result = sync_fail(stats, BATCH_EXIT_INVALID, "the root differs from the peer's");
+        }
+    }
+
+    peer_close(&peer);
+    stats->seconds = (double)(metrics_now_ns() - start) / 1e9;
+    trace_end("replica_sync", span);
+    return result;
+}
@@ -0,0 +1,45 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include "blockchain.h"
+#include <stdio.h>
+
+// Node-to-node replication. A daemon started with `--listen HOST:PORT`
+// (loopback only without `--allow-remote`) also takes replication peers
+// over TCP, using the same frames as local clients (daemon.h) but only the
+// commands a peer needs: login, status, root and blocks. `blockmed sync
+// --peer HOST:PORT` then brings the local chain up to the peer's:
+//
+//   1. status gives the peer's height; the longest common prefix is found
+//      by binary search, comparing accumulator roots (mmr.h) of prefixes
+//      of both chains, one `root --height H` round trip per step
+//   2. the missing blocks come in batches (`blocks --from H --count N`),
+//      each block a record in the chain file format
+//   3. every batch is checked in parallel (block hashes) and in order
+//      (links), appended to the chain file and added to the chain
+//   4. the final root is compared with the one the peer reported
+//
+// A chain holding blocks the peer does not have is never rewritten; the
+// sync stops and reports where the two diverge.
+#define REPLICA_DEFAULT_BATCH 512
+#define REPLICA_MAX_BATCH 4096
+#define REPLICA_VERIFY_THREADS 4
+
+typedef struct {
+    long local_height;                  // before the sync
+    long peer_height;
+    long common;                        // leading blocks both chains share
+    long fetched;
+    long batches;
+    long probes;                        // root round trips of the search
+    double seconds;
+    char error[160];                    // why the sync failed
+} replica_stats_t;
+
+// Function prototypes
+int replica_write_blocks(FILE *out, const char *command, const chain_view_t *view,
+                         long from, long count);
+int replica_sync(blockchain_t *chain, const char *chain_file, const char *peer,
+                 long batch_size, replica_stats_t *stats);
+
+#endif
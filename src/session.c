@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+#include "session.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#define SELECTOR_HEX 16
+#define VERIFIER_BYTES 32
+
+typedef enum {
+    SLOT_EMPTY,
+    SLOT_USED,
+    SLOT_DELETED
+} slot_state_t;
+
+// One issued session. The selector finds the slot; only a hash of the
+// verifier is kept, so a leaked table does not leak usable tokens.
+typedef struct {
+    slot_state_t state;
+    uint64_t selector;
+    unsigned char verifier_hash[SHA256_DIGEST_LENGTH];
+    user_t user;
+    time_t expires_at;
+} session_slot_t;
+
+static session_slot_t sessions[SESSION_TABLE_SIZE];
+static int active_sessions = 0;
+static int deleted_slots = 0;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// expiry uses the monotonic clock so wall-clock changes cannot extend a session
+static time_t now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void to_hex(const unsigned char *bytes, size_t length, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++) {
+        out[i * 2] = digits[bytes[i] >> 4];
+        out[i * 2 + 1] = digits[bytes[i] & 0x0f];
+    }
+    out[length * 2] = '\0';
+}
+
+static int from_hex(const char *hex, unsigned char *bytes, size_t length) {
+    for (size_t i = 0; i < length * 2; i++) {
+        char c = hex[i];
+        int value;
+        if (c >= '0' && c <= '9') value = c - '0';
+        else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+        else return 0;
+
+        if (i % 2 == 0) bytes[i / 2] = (unsigned char)(value << 4);
+        else bytes[i / 2] |= (unsigned char)value;
+    }
+    return 1;
+}
+
+// function to split a token into its selector and verifier hash
+static int parse_token(const char *token, uint64_t *selector,
+                       unsigned char *verifier_hash) {
+    if (!token || strlen(token) != SESSION_TOKEN_SIZE - 1 || token[SELECTOR_HEX] != '.') {
+        return 0;
+    }
+
+    unsigned char selector_bytes[SELECTOR_HEX / 2];
+    unsigned char verifier[VERIFIER_BYTES];
+    if (!from_hex(token, selector_bytes, sizeof(selector_bytes)) ||
+        !from_hex(token + SELECTOR_HEX + 1, verifier, sizeof(verifier))) {
+        return 0;
+    }
+
+    memcpy(selector, selector_bytes, sizeof(*selector));
+    SHA256(verifier, sizeof(verifier), verifier_hash);
+    OPENSSL_cleanse(verifier, sizeof(verifier));
+    return 1;
+}
+
+// function to find the slot of a selector; the selector is random, so it
+// is its own hash
+static session_slot_t *find_slot(uint64_t selector) {
+    size_t slot = selector % SESSION_TABLE_SIZE;
+
+    for (size_t probes = 0; probes < SESSION_TABLE_SIZE; probes++) {
+        session_slot_t *entry = &sessions[slot];
+        if (entry->state == SLOT_EMPTY) return NULL;
+        if (entry->state == SLOT_USED && entry->selector == selector) return entry;
+        slot = (slot + 1) % SESSION_TABLE_SIZE;
+    }
+    return NULL;
+}
+
+static void release_slot(session_slot_t *entry) {
+    OPENSSL_cleanse(entry, sizeof(session_slot_t));
+    entry->state = SLOT_DELETED;
+    active_sessions--;
+    deleted_slots++;
+}
+
+// function to clear tombstones once they make up a quarter of the table;
+// caller holds session_lock. find_slot only stops at an empty slot, so a
+// daemon that always has some session open would otherwise end up probing
+// the whole table. Live sessions are reinserted in place, in table order
+// from an empty slot, so each one moves back along its own probe path and
+// stays reachable from its home slot.
+static void compact_locked(void) {
+    if (deleted_slots <= SESSION_TABLE_SIZE / 4) return;
+
+    size_t start = 0;
+    for (size_t i = 0; i < SESSION_TABLE_SIZE; i++) {
+        if (sessions[i].state != SLOT_USED) {
+            sessions[i].state = SLOT_EMPTY;
+            start = i;
+        }
+    }
+    deleted_slots = 0;
+
+    for (size_t n = 1; n < SESSION_TABLE_SIZE; n++) {
+        size_t i = (start + n) % SESSION_TABLE_SIZE;
+        if (sessions[i].state != SLOT_USED) continue;
+
+        size_t slot = sessions[i].selector % SESSION_TABLE_SIZE;
+        while (slot != i && sessions[slot].state == SLOT_USED) {
+            slot = (slot + 1) % SESSION_TABLE_SIZE;
+        }
+        if (slot != i) {
+            sessions[slot] = sessions[i];
+            OPENSSL_cleanse(&sessions[i], sizeof(session_slot_t));
+            sessions[i].state = SLOT_EMPTY;
+        }
+    }
+}
+
+// function to drop expired sessions; caller holds session_lock
+static int purge_locked(time_t now) {
+    int purged = 0;
+    for (size_t i = 0; i < SESSION_TABLE_SIZE; i++) {
+        if (sessions[i].state == SLOT_USED && sessions[i].expires_at <= now) {
+            release_slot(&sessions[i]);
+            purged++;
+        }
+    }
+
+    // with no live sessions left, clear tombstones to keep probe paths short
+    if (active_sessions == 0) {
+        memset(sessions, 0, sizeof(sessions));
+        deleted_slots = 0;
+    }
+    compact_locked();
+    return purged;
+}
+
+// Issue a session token for an authenticated user. The token is written to
+// `token` (SESSION_TOKEN_SIZE bytes). Returns 1 on success.
+int session_create(const user_t *user, int ttl_seconds, char *token) {
+    if (!user || !token) return 0;
+    if (ttl_seconds <= 0) ttl_seconds = SESSION_DEFAULT_TTL;
+
+    unsigned char selector_bytes[SELECTOR_HEX / 2];
+    unsigned char verifier[VERIFIER_BYTES];
+    if (RAND_bytes(selector_bytes, sizeof(selector_bytes)) != 1 ||
+        RAND_bytes(verifier, sizeof(verifier)) != 1) {
+        return 0;
+    }
+
+    uint64_t selector;
+    memcpy(&selector, selector_bytes, sizeof(selector));
+
+    pthread_mutex_lock(&session_lock);
+
+    time_t now = now_seconds();
+    if (active_sessions >= SESSION_TABLE_SIZE * 3 / 4) {
+        purge_locked(now);
+    }
+
+    // reuse the first free or deleted slot on the probe path
+    session_slot_t *entry = NULL;
+    if (active_sessions < SESSION_TABLE_SIZE * 3 / 4 && !find_slot(selector)) {
+        size_t slot = selector % SESSION_TABLE_SIZE;
+        while (sessions[slot].state == SLOT_USED) {
+            slot = (slot + 1) % SESSION_TABLE_SIZE;
+        }
+        entry = &sessions[slot];
+        if (entry->state == SLOT_DELETED) deleted_slots--;
+    }
+
+    if (!entry) {
+        pthread_mutex_unlock(&session_lock);
+        OPENSSL_cleanse(verifier, sizeof(verifier));
+        return 0;
+    }
+
+    entry->state = SLOT_USED;
+    entry->selector = selector;
+    SHA256(verifier, sizeof(verifier), entry->verifier_hash);
+    entry->user = *user;
+    memset(entry->user.password_hash, 0, sizeof(entry->user.password_hash));
+    entry->expires_at = now + ttl_seconds;
+    active_sessions++;
+
+    pthread_mutex_unlock(&session_lock);
+
+    to_hex(selector_bytes, sizeof(selector_bytes), token);
+    token[SELECTOR_HEX] = '.';
+    to_hex(verifier, sizeof(verifier), token + SELECTOR_HEX + 1);
+    OPENSSL_cleanse(verifier, sizeof(verifier));
+    return 1;
+}
+
+// Verify a token without touching the password store. The verifier is
+// compared in constant time; on success the session's user is copied out.
+int session_verify(const char *token, user_t *user) {
+    uint64_t selector;
+    unsigned char verifier_hash[SHA256_DIGEST_LENGTH];
+    if (!parse_token(token, &selector, verifier_hash)) return 0;
+
+    pthread_mutex_lock(&session_lock);
+
+    int valid = 0;
+    session_slot_t *entry = find_slot(selector);
+    if (entry) {
+        int matches = CRYPTO_memcmp(entry->verifier_hash, verifier_hash,
+                                    sizeof(verifier_hash)) == 0;
+        if (matches && entry->expires_at <= now_seconds()) {
+            release_slot(entry);
+            compact_locked();
+        } else if (matches) {
+            if (user) *user = entry->user;
+            valid = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&session_lock);
+    return valid;
+}
+
+// Revoke a session (logout). Returns 1 if the token was active.
+int session_revoke(const char *token) {
+    uint64_t selector;
+    unsigned char verifier_hash[SHA256_DIGEST_LENGTH];
+    if (!parse_token(token, &selector, verifier_hash)) return 0;
+
+    pthread_mutex_lock(&session_lock);
+
+    int revoked = 0;
+    session_slot_t *entry = find_slot(selector);
+    if (entry && CRYPTO_memcmp(entry->verifier_hash, verifier_hash, sizeof(verifier_hash)) == 0) {
+        release_slot(entry);
+        compact_locked();
+        revoked = 1;
+    }
+
+    pthread_mutex_unlock(&session_lock);
+    return revoked;
+}
+
+// Drop all expired sessions. Returns the number removed.
+int session_purge_expired(void) {
+    pthread_mutex_lock(&session_lock);
+    int purged = purge_locked(now_seconds());
+    pthread_mutex_unlock(&session_lock);
+    return purged;
+}
+
+// Number of active (not yet purged) sessions
+int session_count(void) {
+    pthread_mutex_lock(&session_lock);
+    int count = active_sessions;
+    pthread_mutex_unlock(&session_lock);
+    return count;
+}
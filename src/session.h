@@ -0,0 +1,18 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "auth.h"
+
+// a token is "<selector>.<verifier>": 16 + 1 + 64 hex characters
+#define SESSION_TOKEN_SIZE 82
+#define SESSION_DEFAULT_TTL (30 * 60)
+#define SESSION_TABLE_SIZE 4096
+
+// Function prototypes
+int session_create(const user_t *user, int ttl_seconds, char *token);
+int session_verify(const char *token, user_t *user);
+int session_revoke(const char *token);
+int session_purge_expired(void);
+int session_count(void);
+
+#endif
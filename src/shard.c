@@ -0,0 +1,510 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include "shard.h"
+#include "storage.h"
+#include "pow.h"
+#include "authority.h"
+#include "dedup.h"
+#include "cipher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// function to check a shard name: letters, digits, '-' and '_'
+static int valid_name(const char *name) {
+    size_t length = strlen(name);
+    if (length == 0 || length >= SHARD_NAME_SIZE || strcmp(name, "root") == 0) return 0;
+
+    for (size_t i = 0; i < length; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '-' || c == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// function to add a name to a layout, refusing bad and repeated names
+static int add_name(shard_layout_t *layout, const char *name) {
+    if (!valid_name(name) || layout->count >= SHARD_MAX || shard_find(layout, name) >= 0) {
+        printf("Error: Invalid, repeated or one too many shard names at '%s'\n", name);
+        return 0;
+    }
+    strcpy(layout->names[layout->count++], name);
+    return 1;
+}
+
+// function to create an empty chain file, refusing to replace one
+static int create_chain_file(const char *path) {
+    if (access(path, F_OK) == 0) {
+        printf("Error: Chain file '%s' already exists\n", path);
+        return 0;
+    }
+
+    blockchain_t *chain = create_blockchain();
+    int ok = chain && save_blockchain(chain, path);
+    if (chain) free_blockchain(chain);
+    return ok;
+}
+
+// Create the shards named in `names` (comma separated): their chain files,
+// the root chain and, last, the layout file. Returns 1 on success.
+int shard_layout_create(shard_layout_t *layout, const char *names) {
+    memset(layout, 0, sizeof(shard_layout_t));
+    if (access(SHARD_LAYOUT_FILE, F_OK) == 0) {
+        printf("Error: Shards are already set up in '%s'\n", SHARD_LAYOUT_FILE);
+        return 0;
+    }
+
+    char list[SHARD_MAX * SHARD_NAME_SIZE * 2];
+    if (!names || snprintf(list, sizeof(list), "%s", names) >= (int)sizeof(list)) {
+        printf("Error: Shard list is missing or too long\n");
+        return 0;
+    }
+    char *saveptr = NULL;
+    for (char *name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+        if (!add_name(layout, name)) return 0;
+    }
+    if (layout->count == 0) {
+        printf("Error: No shard names given\n");
+        return 0;
+    }
+
+    if (mkdir(SHARD_DIR, 0755) != 0 && errno != EEXIST) {
+        printf("Error: Could not create '%s': %s\n", SHARD_DIR, strerror(errno));
+        return 0;
+    }
+    char path[256];
+    for (int i = 0; i < layout->count; i++) {
+        if (!shard_chain_file(layout, i, path, sizeof(path)) || !create_chain_file(path)) return 0;
+    }
+    if (!create_chain_file(SHARD_ROOT_FILE)) return 0;
+
+    char temp[] = SHARD_LAYOUT_FILE ".tmp";
+    FILE *file = fopen(temp, "w");
+    int ok = file != NULL;
+    for (int i = 0; ok && i < layout->count; i++) {
+        ok = fprintf(file, "%s\n", layout->names[i]) > 0;
+    }
+    if (file && fclose(file) != 0) ok = 0;
+    if (!ok || rename(temp, SHARD_LAYOUT_FILE) != 0) {
+        printf("Error: Could not write '%s': %s\n", SHARD_LAYOUT_FILE, strerror(errno));
+        unlink(temp);
+        return 0;
+    }
+    return 1;
+}
+
+// Read the shard layout. Returns 0 if there is none or it is damaged.
+int shard_layout_load(shard_layout_t *layout) {
+    memset(layout, 0, sizeof(shard_layout_t));
+    FILE *file = fopen(SHARD_LAYOUT_FILE, "r");
+    if (!file) return 0;
+
+    char line[128];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') ok = add_name(layout, line);
+    }
+    fclose(file);
+    return ok && layout->count > 0;
+}
+
+// Path of the chain file of a shard
+int shard_chain_file(const shard_layout_t *layout, int shard, char *path, size_t size) {
+    if (shard < 0 || shard >= layout->count) return 0;
+    return snprintf(path, size, "%s/%s.dat", SHARD_DIR, layout->names[shard]) < (int)size;
+}
+
+// Position of a shard by name, -1 if there is no such shard
+int shard_find(const shard_layout_t *layout, const char *name) {
+    for (int i = 0; name && i < layout->count; i++) {
+        if (strcmp(layout->names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Shard a patient's records go to when no shard is named (FNV-1a of the ID)
+int shard_for_patient(const shard_layout_t *layout, const char *patient_id) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)patient_id; p && *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return layout->count > 0 ? (int)(hash % (uint32_t)layout->count) : -1;
+}
+
+// one shard's share of shard_fan_out
+typedef struct {
+    int shard;
+    char chain_file[256];
+    shard_task_fn task;
+    void *ctx;
+    int ok;
+} fan_out_job_t;
+
+static void *fan_out_worker(void *arg) {
+    fan_out_job_t *job = arg;
+    job->ok = job->task(job->shard, job->chain_file, job->ctx);
+    return NULL;
+}
+
+// Run `task` on every shard at once, one thread per shard. Returns 1 if it
+// succeeded on all of them.
+int shard_fan_out(const shard_layout_t *layout, shard_task_fn task, void *ctx) {
+    fan_out_job_t jobs[SHARD_MAX];
+    pthread_t threads[SHARD_MAX];
+    int started[SHARD_MAX] = {0};
+
+    for (int i = 0; i < layout->count; i++) {
+        jobs[i].shard = i;
+        jobs[i].task = task;
+        jobs[i].ctx = ctx;
+        jobs[i].ok = shard_chain_file(layout, i, jobs[i].chain_file, sizeof(jobs[i].chain_file));
+        if (jobs[i].ok) {
+            started[i] = pthread_create(&threads[i], NULL, fan_out_worker, &jobs[i]) == 0;
+            // without a thread the shard is done on this one
+            if (!started[i]) fan_out_worker(&jobs[i]);
+        }
+    }
+
+    int ok = 1;
+    for (int i = 0; i < layout->count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        ok = ok && jobs[i].ok;
+    }
+    return ok;
+}
+
+// the rows of a shard import bound for each shard, and what became of them
+typedef struct {
+    char rows_file[SHARD_MAX][256];
+    long rows[SHARD_MAX];
+    const user_t *user;
+    int batch_size;
+    import_stats_t *stats;
+} shard_import_t;
+
+// function to mine one shard's rows into its chain (shard_fan_out task)
+static int import_shard(int shard, const char *chain_file, void *ctx) {
+    shard_import_t *import = ctx;
+    if (import->rows[shard] == 0) return 1;
+
+    int fd = lock_chain_file(chain_file, LOCK_EX, 0);
+    if (fd < 0) return 0;
+    blockchain_t *chain = load_blockchain_tail(chain_file);
+    if (!chain) {
+        unlock_chain_file(fd);
+        return 0;
+    }
+
+    // a rerun after an interruption finds the rows already mined as
+    // duplicates, so shard imports keep no resume point
+    import_options_t opts;
+    init_import_options(&opts);
+    opts.chain_file = chain_file;
+    opts.batch_size = import->batch_size;
+    opts.show_progress = 0;
+    opts.chain_file_synced = 1;
+    opts.resumable = 0;
+
+    int ok = import_records_csv(chain, import->rows_file[shard], import->user, &opts,
+                                &import->stats[shard]);
+    dedup_save(chain, chain_file);
+    free_blockchain(chain);
+    unlock_chain_file(fd);
+    return ok;
+}
+
+// function to route every row of a CSV to the rows file of its shard
+static int split_rows(const shard_layout_t *layout, const char *csv_path, int shard,
+                      shard_import_t *import) {
+    FILE *csv = fopen(csv_path, "r");
+    if (!csv) {
+        printf("Error: Could not open '%s' for import: %s\n", csv_path, strerror(errno));
+        return 0;
+    }
+
+    FILE *files[SHARD_MAX] = {NULL};
+    int ok = 1;
+    for (int i = 0; ok && i < layout->count; i++) {
+        snprintf(import->rows_file[i], sizeof(import->rows_file[i]), "%s/%s.rows-XXXXXX",
+                 SHARD_DIR, layout->names[i]);
+        // mode 0600, and encrypted like the chain while a key is loaded
+        int fd = mkstemp(import->rows_file[i]);
+        if (fd >= 0) close(fd);
+        files[i] = fd >= 0 ? cipher_fopen(import->rows_file[i], "wb") : NULL;
+        if (!files[i]) {
+            if (fd >= 0) unlink(import->rows_file[i]);
+            import->rows_file[i][0] = '\0';
+            ok = 0;
+        }
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while (ok && (length = getline(&line, &size, csv)) >= 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || strncasecmp(line, "patient_id", 10) == 0) continue;
+
+        // rows that cannot be split go to the first shard, whose import
+        // rejects them
+        int target = shard;
+        if (target < 0) {
+            char *copy = strdup(line);
+            char *fields[6];
+            if (!copy) {
+                ok = 0;
+                break;
+            }
+            if (split_csv_line(copy, fields, 6) >= 1) {
+                sanitize_input(fields[0]);
+                target = shard_for_patient(layout, fields[0]);
+            } else {
+                target = 0;
+            }
+            free(copy);
+        }
+        ok = fprintf(files[target], "%s\n", line) >= 0;
+        import->rows[target]++;
+    }
+    free(line);
+    fclose(csv);
+
+    for (int i = 0; i < layout->count; i++) {
+        if (files[i] && fclose(files[i]) != 0) ok = 0;
+    }
+    if (!ok) printf("Error: Could not split '%s' over the shards\n", csv_path);
+    return ok;
+}
+
+// Import a CSV in the bulk import format into the shards: the rows are
+// split by shard (all of them to `shard` if it is not -1, otherwise by
+// patient ID) and every shard mines its rows on its own threads, at the
+// same time as the others. stats[i] tells what became of shard i's rows.
+// Returns 1 if every shard import succeeded.
+int shard_import(const shard_layout_t *layout, const char *csv_path, int shard,
+                 const user_t *user, int batch_size, import_stats_t *stats) {
+    shard_import_t import;
+    memset(&import, 0, sizeof(import));
+    memset(stats, 0, (size_t)layout->count * sizeof(import_stats_t));
+    import.user = user;
+    import.batch_size = batch_size;
+    import.stats = stats;
+
+    int ok = split_rows(layout, csv_path, shard, &import) &&
+             shard_fan_out(layout, import_shard, &import);
+
+    for (int i = 0; i < layout->count; i++) {
+        if (import.rows_file[i][0]) unlink(import.rows_file[i]);
+    }
+    return ok;
+}
+
+// function to read the height and tip hash of a chain file
+static int read_tip(const char *chain_file, shard_tip_t *tip) {
+    FILE *file = cipher_fopen(chain_file, "rb");
+    int length = 0;
+    char record[BLOCK_RECORD_SIZE];
+    int ok = file && fread(&length, sizeof(int), 1, file) == 1 && length > 0 &&
+             fseek(file, (long)sizeof(int) + (long)(length - 1) * (long)BLOCK_RECORD_SIZE,
+                   SEEK_SET) == 0 &&
+             read_block_record(file, record);
+    if (file) fclose(file);
+    if (!ok) {
+        printf("Error: Could not read the tip of '%s'\n", chain_file);
+        return 0;
+    }
+
+    block_t block;
+    decode_block_record(record, &block);
+    tip->height = length;
+    strcpy(tip->hash, block.current_hash);
+    return 1;
+}
+
+// Commit the tip of every shard to the root chain with a new anchor block,
+// unless the last anchor already holds the same tips. Shards are read under
+// a shared lock and the root chain is written under an exclusive one, so
+// imports running in other processes are anchored as of a block boundary.
+// Returns 1 on success.
+int shard_anchor(const shard_layout_t *layout, const user_t *user, shard_anchor_t *result) {
+    memset(result, 0, sizeof(shard_anchor_t));
+    int root_fd = lock_chain_file(SHARD_ROOT_FILE, LOCK_EX, 0);
+    if (root_fd < 0) return 0;
+
+    char note[MAX_NOTES_SIZE] = "";
+    size_t used = 0;
+    int ok = 1;
+    for (int i = 0; ok && i < layout->count; i++) {
+        char path[256];
+        shard_tip_t *tip = &result->tips[i];
+        strcpy(tip->name, layout->names[i]);
+
+        int fd = shard_chain_file(layout, i, path, sizeof(path)) ? lock_chain_file(path, LOCK_SH, 0)
+                                                                  : -1;
+        ok = fd >= 0 && read_tip(path, tip);
+        if (fd >= 0) unlock_chain_file(fd);
+        int written = ok ? snprintf(note + used, sizeof(note) - used, "%s%s:%ld:%s",
+                                    i > 0 ? " " : "", tip->name, tip->height, tip->hash)
+                         : 0;
+        ok = ok && written > 0 && (size_t)written < sizeof(note) - used;
+        used += ok ? (size_t)written : 0;
+    }
+
+    blockchain_t *root = ok ? load_blockchain_tail(SHARD_ROOT_FILE) : NULL;
+    if (root && strcmp(root->tail->transaction.patient_id, SHARD_ANCHOR_PATIENT) == 0 &&
+        strcmp(root->tail->transaction.visit_note, note) == 0) {
+        result->root_height = root->length;
+        free_blockchain(root);
+        unlock_chain_file(root_fd);
+        return 1;
+    }
+
+    medical_transaction_t tx;
+    block_t *block = NULL;
+    if (root && create_transaction(&tx, SHARD_ANCHOR_PATIENT, user->email,
+                                   SHARD_ANCHOR_DIAGNOSIS, "", note)) {
+        block = create_block(root->length, &tx, root->tail->current_hash);
+    }
+    ok = block && seal_block(root->seals, block, get_mining_difficulty()) &&
+         append_blocks(SHARD_ROOT_FILE, block, root->seals);
+    if (ok) {
+        add_block_to_chain(root, block);
+        dedup_save(root, SHARD_ROOT_FILE);
+        result->anchored = 1;
+        result->root_height = root->length;
+    } else {
+        free(block);
+        printf("Error: Could not add an anchor block to '%s'\n", SHARD_ROOT_FILE);
+    }
+    if (root) free_blockchain(root);
+    unlock_chain_file(root_fd);
+    return ok;
+}
+
+// Read the shard tips an anchor block commits into `tips`. Returns their
+// number, 0 if the block is no anchor and -1 if its note is malformed.
+int shard_parse_anchor(const block_t *block, shard_tip_t *tips, int max) {
+    const medical_transaction_t *tx = &block->transaction;
+    if (strcmp(tx->patient_id, SHARD_ANCHOR_PATIENT) != 0 ||
+        strcmp(tx->diagnosis, SHARD_ANCHOR_DIAGNOSIS) != 0) {
+        return 0;
+    }
+
+    char note[MAX_NOTES_SIZE];
+    snprintf(note, sizeof(note), "%s", tx->visit_note);
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *entry = strtok_r(note, " ", &saveptr); entry; entry = strtok_r(NULL, " ", &saveptr)) {
+        char *height = strchr(entry, ':');
+        char *hash = height ? strchr(height + 1, ':') : NULL;
+        if (!hash || count >= max) return -1;
+        *height++ = '\0';
+        *hash++ = '\0';
+
+        char *end;
+        long value = strtol(height, &end, 10);
+        if (!valid_name(entry) || *end != '\0' || value <= 0 || strlen(hash) != HASH_SIZE - 1) {
+            return -1;
+        }
+        strcpy(tips[count].name, entry);
+        tips[count].height = value;
+        strcpy(tips[count].hash, hash);
+        count++;
+    }
+    return count > 0 ? count : -1;
+}
+
+// the anchored tips of every shard, gathered from the root chain
+typedef struct {
+    shard_tip_t *tips[SHARD_MAX];
+    int counts[SHARD_MAX];
+    int capacities[SHARD_MAX];
+    shard_verify_t *result;
+} shard_check_t;
+
+// function to file the tips of one anchor block under their shards
+static int collect_anchor(const shard_layout_t *layout, const block_t *block,
+                          shard_check_t *check) {
+    shard_tip_t tips[SHARD_MAX];
+    int count = shard_parse_anchor(block, tips, SHARD_MAX);
+    if (count <= 0) return count == 0;
+
+    check->result->anchors++;
+    for (int i = 0; i < count; i++) {
+        int shard = shard_find(layout, tips[i].name);
+        if (shard < 0) return 0;
+
+        if (check->counts[shard] == check->capacities[shard]) {
+            int capacity = check->capacities[shard] ? check->capacities[shard] * 2 : 16;
+            shard_tip_t *grown = realloc(check->tips[shard], (size_t)capacity * sizeof(shard_tip_t));
+            if (!grown) return 0;
+            check->tips[shard] = grown;
+            check->capacities[shard] = capacity;
+        }
+        check->tips[shard][check->counts[shard]++] = tips[i];
+    }
+    return 1;
+}
+
+// function to validate one shard and hold it to its anchored tips
+// (shard_fan_out task)
+static int verify_shard(int shard, const char *chain_file, void *ctx) {
+    shard_check_t *check = ctx;
+    shard_report_t *report = &check->result->shards[shard];
+
+    blockchain_t *chain = load_blockchain(chain_file);
+    if (!chain) return 0;
+    report->height = chain->length;
+    report->valid = validate_blockchain(chain);
+    report->anchors_match = 1;
+
+    chain_view_t view;
+    chain_read_begin(chain, &view);
+    for (int i = 0; i < check->counts[shard]; i++) {
+        const shard_tip_t *tip = &check->tips[shard][i];
+        const block_t *block = tip->height <= view.length
+                                   ? chain_view_block(&view, (int)(tip->height - 1))
+                                   : NULL;
+        if (!block || strcmp(block->current_hash, tip->hash) != 0) report->anchors_match = 0;
+        if (tip->height > report->anchored_height) report->anchored_height = tip->height;
+    }
+    chain_read_end();
+    free_blockchain(chain);
+    return report->valid && report->anchors_match;
+}
+
+// Validate the root chain and every shard (one thread per shard), and check
+// that each tip the anchors committed is still on its shard. Returns 1 if
+// everything checked out.
+int shard_verify(const shard_layout_t *layout, shard_verify_t *result) {
+    memset(result, 0, sizeof(shard_verify_t));
+    shard_check_t check;
+    memset(&check, 0, sizeof(check));
+    check.result = result;
+
+    blockchain_t *root = load_blockchain(SHARD_ROOT_FILE);
+    if (!root) return 0;
+    result->root_height = root->length;
+    result->root_valid = validate_blockchain(root);
+
+    chain_view_t view;
+    chain_read_begin(root, &view);
+    for (const block_t *block = chain_view_first(&view); block && result->root_valid;
+         block = chain_view_next(&view, block)) {
+        result->root_valid = collect_anchor(layout, block, &check);
+    }
+    chain_read_end();
+    free_blockchain(root);
+
+    int ok = shard_fan_out(layout, verify_shard, &check) && result->root_valid;
+    for (int i = 0; i < SHARD_MAX; i++) free(check.tips[i]);
+    return ok;
+}
@@ -0,0 +1,80 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "blockchain.h"
+#include "auth.h"
+#include "import.h"
+
+// Sharded chains. One chain takes its writes one at a time, through one
+// tail and one miner; a hospital can instead split its records over
+// independent chains (shards), one per department, each with its own file
+// in SHARD_DIR (and its own duplicate filter beside it) and its own miner,
+// so appends to different shards never wait on each other. A record goes to the shard named for it or else to the shard its
+// patient ID hashes to.
+//
+// The root chain (SHARD_ROOT_FILE) holds anchor blocks. An anchor's note
+// commits the tip of every shard as "name:height:hash" entries, so a shard
+// block changed behind its last anchor no longer matches the root, whose
+// own blocks are mined and linked like any chain's. An anchor is added after
+// every shard import and by `shard-anchor`, which can run periodically; it
+// is skipped when no shard moved since the last one.
+#define SHARD_DIR "data/shards"
+#define SHARD_LAYOUT_FILE SHARD_DIR "/layout"   // one shard name per line
+#define SHARD_ROOT_FILE SHARD_DIR "/root.dat"
+#define SHARD_MAX 8
+#define SHARD_NAME_SIZE 25
+#define SHARD_ANCHOR_PATIENT "shard-anchor"
+#define SHARD_ANCHOR_DIAGNOSIS "Shard anchor"
+
+typedef struct {
+    int count;
+    char names[SHARD_MAX][SHARD_NAME_SIZE];
+} shard_layout_t;
+
+// the tip of one shard, as an anchor records it
+typedef struct {
+    char name[SHARD_NAME_SIZE];
+    long height;
+    char hash[HASH_SIZE];
+} shard_tip_t;
+
+// result of shard_anchor
+typedef struct {
+    int anchored;                       // 0: no shard moved since the last anchor
+    long root_height;
+    shard_tip_t tips[SHARD_MAX];
+} shard_anchor_t;
+
+// state of one shard as shard_verify found it
+typedef struct {
+    long height;
+    int valid;                          // hashes and links check out
+    long anchored_height;               // newest anchored height, 0 if never anchored
+    int anchors_match;                  // every anchored tip is still on the shard
+} shard_report_t;
+
+// result of shard_verify
+typedef struct {
+    long root_height;
+    int root_valid;                     // root chain valid, its anchors well formed
+    long anchors;                       // anchor blocks on the root chain
+    shard_report_t shards[SHARD_MAX];
+} shard_verify_t;
+
+// work run on every shard at once by shard_fan_out; returns 0 on failure
+typedef int (*shard_task_fn)(int shard, const char *chain_file, void *ctx);
+
+// Function prototypes
+int shard_layout_create(shard_layout_t *layout, const char *names);
+int shard_layout_load(shard_layout_t *layout);
+int shard_chain_file(const shard_layout_t *layout, int shard, char *path, size_t size);
+int shard_find(const shard_layout_t *layout, const char *name);
+int shard_for_patient(const shard_layout_t *layout, const char *patient_id);
+int shard_fan_out(const shard_layout_t *layout, shard_task_fn task, void *ctx);
+int shard_import(const shard_layout_t *layout, const char *csv_path, int shard,
+                 const user_t *user, int batch_size, import_stats_t *stats);
+int shard_anchor(const shard_layout_t *layout, const user_t *user, shard_anchor_t *result);
+int shard_parse_anchor(const block_t *block, shard_tip_t *tips, int max);
+int shard_verify(const shard_layout_t *layout, shard_verify_t *result);
+
+#endif
@@ -0,0 +1,498 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include "snapshot.h"
+#include "storage.h"
+#include "patients.h"
+#include "dedup.h"
+#include "authority.h"
+#include "metrics.h"
+#include "trace.h"
+#include "cipher.h"
+#include "strdict.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the header must fit in the page before the blocks section
+typedef char snapshot_header_fits[sizeof(snapshot_header_t) <= SNAPSHOT_HEADER_SIZE ? 1 : -1];
+
+// Path of the snapshot kept for a chain file
+int snapshot_path(const char *chain_file, char *path, size_t size) {
+    return snprintf(path, size, "%s%s", chain_file, SNAPSHOT_SUFFIX) < (int)size;
+}
+
+// function to add the strings of a block's transaction to `dict`, counting
+// the bytes of the ones not seen before
+static int collect_strings(strdict_t *dict, const block_t *block, size_t *size) {
+    const char *fields[] = {block->transaction.patient_id, block->transaction.doctor_email,
+                            block->transaction.diagnosis, block->transaction.prescription,
+                            block->transaction.visit_note};
+    for (int i = 0; i < 5; i++) {
+        size_t length = strlen(fields[i]);
+        int added = strdict_intern(dict, fields[i], length, NULL);
+        if (added < 0) return 0;
+        if (added) *size += length + 1;
+    }
+    return 1;
+}
+
+// function to point a string field of an image block at its copy in the
+// strings section (`offsets` by dictionary id)
+static const char *image_string(const strdict_t *dict, const uint64_t *offsets,
+                                char *strings, const char *value) {
+    uint32_t id = 0;
+    strdict_find(dict, value, strlen(value), &id);
+    return strings + offsets[id];
+}
+
+// Write a snapshot of `chain`, which must match `chain_file` on disk (call it
+// after the chain file is saved, while no other thread appends), along with
+// its duplicate filter (dedup.h). The image is built in a temporary file and
+// renamed over the old snapshot; while a key is loaded it is built in memory
+// and written encrypted instead.
+int save_snapshot(const blockchain_t *chain, const char *chain_file) {
+    if (!chain || !chain_file || chain->length <= 0 || !chain->tail) {
+        printf("Error: Invalid parameters for save_snapshot\n");
+        return 0;
+    }
+    // the duplicate filter is written beside the chain file, snapshot or not
+    dedup_save(chain, chain_file);
+
+    // the image holds blocks in memory only; a tiered chain is reloaded
+    // from the chain file, reusing its sealed archive segments
+    if (chain->archived > 0) {
+        if (!is_quiet_mode()) {
+            printf("Not writing a snapshot: %d blocks are archived\n", chain->archived);
+        }
+        return 0;
+    }
+
+    char path[4096], temp[4100];
+    struct stat chain_stat;
+    if (!snapshot_path(chain_file, path, sizeof(path)) ||
+        snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+        printf("Error: Snapshot path for '%s' is too long\n", chain_file);
+        return 0;
+    }
+    if (stat(chain_file, &chain_stat) != 0) {
+        printf("Error: Could not stat '%s': %s\n", chain_file, strerror(errno));
+        return 0;
+    }
+
+    uint64_t span = trace_begin();
+    strdict_t dict;
+    size_t strings_size = 0;
+    int collected = strdict_init(&dict);
+    int count = 0;
+    for (const block_t *current = chain->head; collected && current && count < chain->length;
+         current = current->next) {
+        collected = collect_strings(&dict, current, &strings_size);
+        count++;
+    }
+    uint64_t *offsets = collected ? malloc((dict.count + 1) * sizeof(uint64_t)) : NULL;
+    if (!offsets) {
+        printf("Error: Memory allocation failed for snapshot strings\n");
+        strdict_free(&dict);
+        return 0;
+    }
+
+    size_t blocks_size = (size_t)chain->length * sizeof(block_t);
+    size_t mmr_size = chain->mmr ? mmr_image_size(chain->length) : 0;
+    size_t patients_size = chain->patients ? patients_image_size(chain->patients) : 0;
+    size_t strings_offset = SNAPSHOT_HEADER_SIZE + blocks_size + mmr_size + patients_size;
+    size_t file_size = strings_offset + strings_size;
+
+    int encrypted = cipher_enabled();
+    int fd = -1;
+    char *map = MAP_FAILED;
+    if (encrypted) {
+        map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        fd = open(temp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            printf("Error: Could not open file '%s' for writing: %s\n", temp, strerror(errno));
+            strdict_free(&dict);
+            free(offsets);
+            return 0;
+        }
+        if (ftruncate(fd, (off_t)file_size) == 0) {
+            map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+    }
+    if (map == MAP_FAILED) {
+        printf("Error: Could not map snapshot '%s': %s\n", temp, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp);
+        }
+        strdict_free(&dict);
+        free(offsets);
+        return 0;
+    }
+
+    // the strings section holds each distinct string once, in dictionary
+    // order
+    char *strings = map + strings_offset;
+    uint64_t offset = 0;
+    for (uint32_t id = 0; id < dict.count; id++) {
+        offsets[id] = offset;
+        memcpy(strings + offset, dict.entries[id].str, dict.entries[id].length + 1);
+        offset += dict.entries[id].length + 1;
+    }
+
+    // lay the blocks out as an array linked for this mapping's address, so
+    // a process that maps the file at the same address can use it as is
+    block_t *image = (block_t *)(map + SNAPSHOT_HEADER_SIZE);
+    count = 0;
+    for (const block_t *current = chain->head; current && count < chain->length;
+         current = current->next) {
+        medical_transaction_t *tx = &image[count].transaction;
+        image[count] = *current;
+        image[count].next = count + 1 < chain->length ? &image[count + 1] : NULL;
+        tx->patient_id = image_string(&dict, offsets, strings, tx->patient_id);
+        tx->doctor_email = image_string(&dict, offsets, strings, tx->doctor_email);
+        tx->diagnosis = image_string(&dict, offsets, strings, tx->diagnosis);
+        tx->prescription = image_string(&dict, offsets, strings, tx->prescription);
+        tx->visit_note = image_string(&dict, offsets, strings, tx->visit_note);
+        count++;
+    }
+    strdict_free(&dict);
+    free(offsets);
+
+    int mmr_ok = !chain->mmr ||
+                 mmr_write_image(chain->mmr, chain->length, (unsigned char *)(image + count));
+    int patients_ok = !chain->patients ||
+                      patients_write_image(chain->patients, (unsigned char *)map +
+                                           SNAPSHOT_HEADER_SIZE + blocks_size + mmr_size,
+                                           patients_size);
+
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.block_size = sizeof(block_t);
+    header.map_address = (uint64_t)(uintptr_t)map;
+    header.file_size = file_size;
+    header.length = chain->length;
+    header.validated = chain_validated_height(chain);
+    if (header.validated > header.length) header.validated = header.length;
+    strcpy(header.tip_hash, chain->tail->current_hash);
+    header.chain_size = (uint64_t)chain_stat.st_size;
+    header.chain_mtime_sec = (int64_t)chain_stat.st_mtim.tv_sec;
+    header.chain_mtime_nsec = (int64_t)chain_stat.st_mtim.tv_nsec;
+    header.section_count = 1;
+    header.sections[0].type = SNAPSHOT_SECTION_BLOCKS;
+    header.sections[0].offset = SNAPSHOT_HEADER_SIZE;
+    header.sections[0].size = blocks_size;
+    if (chain->mmr) {
+        header.section_count = 2;
+        header.sections[1].type = SNAPSHOT_SECTION_MMR;
+        header.sections[1].offset = SNAPSHOT_HEADER_SIZE + blocks_size;
+        header.sections[1].size = mmr_size;
+    }
+    if (chain->patients) {
+        snapshot_section_t *section = &header.sections[header.section_count++];
+        section->type = SNAPSHOT_SECTION_PATIENTS;
+        section->offset = SNAPSHOT_HEADER_SIZE + blocks_size + mmr_size;
+        section->size = patients_size;
+    }
+    snapshot_section_t *section = &header.sections[header.section_count++];
+    section->type = SNAPSHOT_SECTION_STRINGS;
+    section->offset = strings_offset;
+    section->size = strings_size;
+    memcpy(map, &header, sizeof(header));
+
+    int ok = count == chain->length && mmr_ok && patients_ok;
+    if (encrypted) {
+        FILE *file = ok ? cipher_fopen(temp, "wb") : NULL;
+        ok = file && fwrite(map, file_size, 1, file) == 1 && cipher_sync(file, temp);
+        if (file && fclose(file) != 0) ok = 0;
+        munmap(map, file_size);
+    } else {
+        ok = ok && msync(map, file_size, MS_SYNC) == 0;
+        munmap(map, file_size);
+        ok = ok && fsync(fd) == 0;
+        close(fd);
+    }
+
+    if (!ok || rename(temp, path) != 0) {
+        printf("Error: Failed to write snapshot '%s'\n", path);
+        unlink(temp);
+        return 0;
+    }
+
+    if (!is_quiet_mode()) {
+        printf("Saved snapshot of %d blocks to '%s'\n", chain->length, path);
+    }
+    trace_end("save_snapshot", span);
+    return 1;
+}
+
+// function to find a section of a snapshot, checking that it lies in the file
+static const snapshot_section_t *find_section(const snapshot_header_t *header, uint32_t type) {
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        const snapshot_section_t *section = &header->sections[i];
+        if (section->type == type && section->offset <= header->file_size &&
+            section->size <= header->file_size - section->offset) {
+            return section;
+        }
+    }
+    return NULL;
+}
+
+// function to check a snapshot header written by this build
+static int header_usable(const snapshot_header_t *header, off_t file_size) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->block_size != sizeof(block_t) ||
+        header->file_size != (uint64_t)file_size || header->length <= 0 ||
+        header->validated < 0 || header->validated > header->length ||
+        header->section_count > SNAPSHOT_MAX_SECTIONS ||
+        memchr(header->tip_hash, '\0', HASH_SIZE) == NULL) {
+        return 0;
+    }
+
+    const snapshot_section_t *blocks = find_section(header, SNAPSHOT_SECTION_BLOCKS);
+    return blocks && blocks->offset % sizeof(block_t *) == 0 &&
+           blocks->size == (uint64_t)header->length * sizeof(block_t) &&
+           find_section(header, SNAPSHOT_SECTION_STRINGS);
+}
+
+// function to move a string field of an image block to where the image
+// was mapped, checking that it lands on a string of the strings section
+static int relocate_string(const char **field, intptr_t delta, const char *strings,
+                           size_t size) {
+    const char *moved = (const char *)((uintptr_t)*field + (uintptr_t)delta);
+    if (moved < strings || moved >= strings + size) return 0;
+    *field = moved;
+    return 1;
+}
+
+// function to rebuild the links and string fields of image blocks mapped
+// `delta` bytes away from where they were written. Blocks mapped in place
+// go through the same checks, so a damaged image is rejected instead of
+// being followed wherever its stale pointers lead.
+static int relocate_blocks(block_t *blocks, int length, intptr_t delta,
+                           const char *strings, size_t size) {
+    // every string must end inside the section
+    if (size == 0 || strings[size - 1] != '\0') return 0;
+
+    for (int i = 0; i < length; i++) {
+        medical_transaction_t *tx = &blocks[i].transaction;
+        blocks[i].next = i + 1 < length ? &blocks[i + 1] : NULL;
+        if (!relocate_string(&tx->patient_id, delta, strings, size) ||
+            !relocate_string(&tx->doctor_email, delta, strings, size) ||
+            !relocate_string(&tx->diagnosis, delta, strings, size) ||
+            !relocate_string(&tx->prescription, delta, strings, size) ||
+            !relocate_string(&tx->visit_note, delta, strings, size)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// function to check that the snapshot describes a prefix of the chain file:
+// the file holds at least as many blocks and the same block at the tip
+static int chain_file_extends(FILE *file, const snapshot_header_t *header, int *length) {
+    char record[BLOCK_RECORD_SIZE];
+    block_t tip;
+    long offset = (long)sizeof(int) + (long)(header->length - 1) * (long)BLOCK_RECORD_SIZE;
+
+    if (fread(length, sizeof(int), 1, file) != 1 || *length < header->length ||
+        fseek(file, offset, SEEK_SET) != 0 || !read_block_record(file, record)) {
+        return 0;
+    }
+    decode_block_record(record, &tip);
+    return tip.index == header->length - 1 && strcmp(tip.current_hash, header->tip_hash) == 0;
+}
+
+// Restore a chain from the snapshot of `chain_file`, replaying any blocks
+// appended to the file after it was taken. Returns NULL when there is no
+// usable snapshot; the caller then loads the chain file in full.
+blockchain_t *load_snapshot(const char *chain_file) {
+    char path[4096];
+    if (!chain_file || !snapshot_path(chain_file, path, sizeof(path))) return NULL;
+
+    // a snapshot is only used if it is encrypted exactly when the chain
+    // would be written encrypted now
+    int encrypted = cipher_file_encrypted(path);
+    if (encrypted < 0) return NULL;
+    if (encrypted != cipher_enabled()) {
+        printf("Warning: Ignoring %s snapshot '%s'\n", encrypted ? "encrypted" : "unencrypted", path);
+        return NULL;
+    }
+
+    FILE *image = NULL;
+    int fd = -1;
+    if (encrypted) {
+        image = cipher_fopen(path, "rb");
+    } else {
+        fd = open(path, O_RDONLY);
+    }
+    if (!image && fd < 0) return NULL;
+
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    snapshot_header_t header;
+    struct stat st;
+    long image_size = 0;
+    int header_ok = encrypted ? fread(&header, sizeof(header), 1, image) == 1 &&
+                                    cipher_file_size(image, &image_size)
+                              : fstat(fd, &st) == 0 &&
+                                    pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    if (!encrypted && header_ok) image_size = (long)st.st_size;
+    if (!header_ok || !header_usable(&header, (off_t)image_size)) {
+        printf("Warning: Ignoring invalid snapshot '%s'\n", path);
+        if (image) fclose(image);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    FILE *file = cipher_fopen(chain_file, "rb");
+    int file_length = 0;
+    if (!file || !chain_file_extends(file, &header, &file_length)) {
+        printf("Warning: Snapshot '%s' does not match '%s', loading the full chain\n",
+               path, chain_file);
+        if (file) fclose(file);
+        if (image) fclose(image);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    // ask for the address the block links were written for; if it is taken
+    // the links are rebuilt for wherever the mapping landed. An encrypted
+    // image is decrypted into anonymous memory at that address.
+    void *wanted = (void *)(uintptr_t)header.map_address;
+    char *map;
+    if (encrypted) {
+        map = mmap(wanted, header.file_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED && (fseek(image, 0, SEEK_SET) != 0 ||
+                                  fread(map, header.file_size, 1, image) != 1)) {
+            munmap(map, header.file_size);
+            map = MAP_FAILED;
+            errno = EIO;
+        }
+        fclose(image);
+    } else {
+        map = mmap(wanted, header.file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+    }
+    if (map == MAP_FAILED) {
+        printf("Warning: Could not map snapshot '%s': %s\n", path, strerror(errno));
+        fclose(file);
+        return NULL;
+    }
+
+    const snapshot_section_t *section = find_section(&header, SNAPSHOT_SECTION_BLOCKS);
+    const snapshot_section_t *strings = find_section(&header, SNAPSHOT_SECTION_STRINGS);
+    block_t *blocks = (block_t *)(map + section->offset);
+    int relocated = (void *)map != wanted;
+    if (!relocate_blocks(blocks, header.length, (intptr_t)((uintptr_t)map - (uintptr_t)wanted),
+                         map + strings->offset, strings->size)) {
+        printf("Warning: Ignoring invalid snapshot '%s'\n", path);
+        munmap(map, header.file_size);
+        fclose(file);
+        return NULL;
+    }
+
+    blockchain_t *chain = allocate_blockchain();
+    if (!chain) {
+        printf("Error: Memory allocation failed for blockchain\n");
+        munmap(map, header.file_size);
+        fclose(file);
+        return NULL;
+    }
+    chain->image.map = map;
+    chain->image.map_size = header.file_size;
+    chain->image.blocks = blocks;
+    chain->image.count = header.length;
+    chain->head = blocks;
+    chain->tail = &blocks[header.length - 1];
+    chain->length = header.length;
+    atomic_store(&chain->validated, header.validated);
+
+    // the accumulator is used in place as well; a snapshot without it
+    // (or with a damaged one) has it rebuilt from the block hashes
+    const snapshot_section_t *mmr = find_section(&header, SNAPSHOT_SECTION_MMR);
+    mmr_t *mapped = mmr && mmr->size == mmr_image_size(header.length)
+                        ? mmr_from_image((unsigned char *)map + mmr->offset, header.length)
+                        : NULL;
+    if (mapped) {
+        mmr_free(chain->mmr);
+        chain->mmr = mapped;
+    } else {
+        for (int i = 0; chain->mmr && i < header.length; i++) {
+            if (!mmr_append(chain->mmr, blocks[i].current_hash)) {
+                mmr_free(chain->mmr);
+                chain->mmr = NULL;
+            }
+        }
+    }
+
+    // patient summaries are copied out of the image, or rebuilt likewise
+    const snapshot_section_t *patients = find_section(&header, SNAPSHOT_SECTION_PATIENTS);
+    patient_table_t *loaded = patients ? patients_from_image((unsigned char *)map + patients->offset,
+                                                             patients->size, header.length)
+                                       : NULL;
+    if (loaded) {
+        patients_free(chain->patients);
+        chain->patients = loaded;
+    } else {
+        for (int i = 0; chain->patients && i < header.length; i++) {
+            if (!patients_apply(chain->patients, &blocks[i])) {
+                patients_free(chain->patients);
+                chain->patients = NULL;
+            }
+        }
+    }
+
+    // the duplicate filter is saved beside the chain file rather than in
+    // the image
+    dedup_load(chain, chain_file);
+
+    // replay the blocks appended since, extending the validation checkpoint
+    // while every replayed block checks out
+    for (int i = header.length; i < file_length; i++) {
+        block_t *block = read_block(file);
+        if (!block || block->index != i) {
+            printf("Error: Failed to replay block %d from '%s'\n", i, chain_file);
+            free(block);
+            free_blockchain(chain);
+            fclose(file);
+            return NULL;
+        }
+
+        int extends = atomic_load(&chain->validated) == chain->length &&
+                      block_follows(chain->tail, block);
+        add_block_to_chain(chain, block);
+        if (extends) {
+            atomic_store(&chain->validated, chain->length);
+        }
+    }
+    fclose(file);
+    if (!seals_load(chain, chain_file)) {
+        free_blockchain(chain);
+        return NULL;
+    }
+    chain_archive_old_blocks(chain);
+
+    if (!is_quiet_mode()) {
+        printf("Restored blockchain with %d blocks from snapshot '%s' "
+               "(%d replayed, validated through %d%s)\n",
+               chain->length, path, file_length - header.length,
+               chain_validated_height(chain), relocated ? ", relocated" : "");
+    }
+
+    metrics_counter_add(METRIC_LOADS, 1);
+    metrics_observe(METRIC_LOAD_LATENCY, metrics_now_ns() - start);
+    trace_end("load_snapshot", span);
+    return chain;
+}
+
+// Load a chain file, from its snapshot when there is a usable one
+blockchain_t *open_blockchain(const char *chain_file) {
+    blockchain_t *chain = load_snapshot(chain_file);
+    return chain ? chain : load_blockchain(chain_file);
+}
@@ -0,0 +1,57 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "blockchain.h"
+#include <stdint.h>
+
+// A state snapshot is written next to the chain file at clean shutdown
+// ("data/blockchain.dat.snap"). It holds the chain tip, the validation
+// checkpoint and a directory of sections; the blocks section is an image of
+// the in-memory blocks, so startup maps it instead of reading the chain
+// block by block and only replays blocks appended to the chain file since.
+// The strings the blocks point to are stored once each in a strings
+// section, so a field shared by many blocks takes one copy there as well.
+#define SNAPSHOT_MAGIC "BMSNAP01"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 4096
+#define SNAPSHOT_MAX_SECTIONS 8
+#define SNAPSHOT_SUFFIX ".snap"
+
+typedef enum {
+    SNAPSHOT_SECTION_BLOCKS = 1,        // block_t[length], next links resolved
+    SNAPSHOT_SECTION_MMR = 2,           // accumulator nodes, mmr_write_image layout
+    SNAPSHOT_SECTION_PATIENTS = 3,      // patient_summary_t[], patients_write_image layout
+    SNAPSHOT_SECTION_STRINGS = 4        // NUL-terminated strings the blocks point into
+} snapshot_section_type_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+} snapshot_section_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;                // sizeof(block_t) of the writer
+    uint64_t map_address;               // where the block links and strings point into
+    uint64_t file_size;
+    int32_t length;
+    int32_t validated;
+    char tip_hash[HASH_SIZE];
+    uint64_t chain_size;                // chain file size and modification
+    int64_t chain_mtime_sec;            // time when the snapshot was taken
+    int64_t chain_mtime_nsec;
+    uint32_t section_count;
+    uint32_t reserved;
+    snapshot_section_t sections[SNAPSHOT_MAX_SECTIONS];
+} snapshot_header_t;
+
+// Function prototypes
+int snapshot_path(const char *chain_file, char *path, size_t size);
+int save_snapshot(const blockchain_t *chain, const char *chain_file);
+blockchain_t *load_snapshot(const char *chain_file);
+blockchain_t *open_blockchain(const char *chain_file);
+
+#endif
@@ -1,6 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
 #include "storage.h"
+#include "archive.h"
+#include "cipher.h"
+#include "patients.h"
+#include "dedup.h"
+#include "authority.h"
+#include "metrics.h"
+#include "trace.h"
+#include "uring.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// offsets of the fields of a block record
+#define RECORD_TIMESTAMP sizeof(int)
+#define RECORD_TRANSACTION (RECORD_TIMESTAMP + 20)
+#define RECORD_NONCE (RECORD_TRANSACTION + sizeof(transaction_record_t))
+#define RECORD_PREVIOUS_HASH (RECORD_NONCE + sizeof(unsigned long))
+#define RECORD_CURRENT_HASH (RECORD_PREVIOUS_HASH + HASH_SIZE)
+
+// function to copy a string into a NUL-padded record field
+static void encode_field(char *field, size_t size, const char *value) {
+    strncpy(field, value ? value : "", size - 1);
+    field[size - 1] = '\0';
+}
+
+// Encode a block as a record of BLOCK_RECORD_SIZE bytes
+void encode_block_record(const block_t *block, char *record) {
+    transaction_record_t *tx = (transaction_record_t *)(record + RECORD_TRANSACTION);
+
+    memcpy(record, &block->index, sizeof(int));
+    memcpy(record + RECORD_TIMESTAMP, block->timestamp, 20);
+    encode_field(tx->patient_id, sizeof(tx->patient_id), block->transaction.patient_id);
+    encode_field(tx->doctor_email, sizeof(tx->doctor_email), block->transaction.doctor_email);
+    encode_field(tx->diagnosis, sizeof(tx->diagnosis), block->transaction.diagnosis);
+    encode_field(tx->prescription, sizeof(tx->prescription), block->transaction.prescription);
+    memcpy(tx->timestamp, block->transaction.timestamp, sizeof(tx->timestamp));
+    encode_field(tx->visit_note, sizeof(tx->visit_note), block->transaction.visit_note);
+    memcpy(record + RECORD_NONCE, &block->nonce, sizeof(unsigned long));
+    memcpy(record + RECORD_PREVIOUS_HASH, block->previous_hash, HASH_SIZE);
+    memcpy(record + RECORD_CURRENT_HASH, block->current_hash, HASH_SIZE);
+}
+
+// Decode a record into `block`, whose strings then point into the record:
+// the block is only valid while the record is (copy_block makes a block
+// of its own). String fields are cut at their last byte, so a damaged
+// record cannot yield an unterminated string.
+void decode_block_record(char *record, block_t *block) {
+    transaction_record_t *tx = (transaction_record_t *)(record + RECORD_TRANSACTION);
+    tx->patient_id[sizeof(tx->patient_id) - 1] = '\0';
+    tx->doctor_email[sizeof(tx->doctor_email) - 1] = '\0';
+    tx->diagnosis[sizeof(tx->diagnosis) - 1] = '\0';
+    tx->prescription[sizeof(tx->prescription) - 1] = '\0';
+    tx->visit_note[sizeof(tx->visit_note) - 1] = '\0';
+
+    memcpy(&block->index, record, sizeof(int));
+    memcpy(block->timestamp, record + RECORD_TIMESTAMP, 20);
+    block->timestamp[19] = '\0';
+    block->transaction.patient_id = tx->patient_id;
+    block->transaction.doctor_email = tx->doctor_email;
+    block->transaction.diagnosis = tx->diagnosis;
+    block->transaction.prescription = tx->prescription;
+    memcpy(block->transaction.timestamp, tx->timestamp, sizeof(tx->timestamp));
+    block->transaction.timestamp[sizeof(tx->timestamp) - 1] = '\0';
+    block->transaction.visit_note = tx->visit_note;
+    memcpy(&block->nonce, record + RECORD_NONCE, sizeof(unsigned long));
+    memcpy(block->previous_hash, record + RECORD_PREVIOUS_HASH, HASH_SIZE);
+    memcpy(block->current_hash, record + RECORD_CURRENT_HASH, HASH_SIZE);
+    block->previous_hash[HASH_SIZE - 1] = '\0';
+    block->current_hash[HASH_SIZE - 1] = '\0';
+    block->next = NULL;
+}
+
+// read the next record of a chain file into `record` (BLOCK_RECORD_SIZE
+// bytes), to be decoded with decode_block_record
+int read_block_record(FILE *file, char *record) {
+    return fread(record, BLOCK_RECORD_SIZE, 1, file) == 1;
+}
 
+// write one block record in the on-disk field order
+int write_block_record(FILE *file, const block_t *block) {
+    char record[BLOCK_RECORD_SIZE];
+    encode_block_record(block, record);
+    return fwrite(record, BLOCK_RECORD_SIZE, 1, file) == 1;
+}
+
+// function to open a whole chain file to read or write front to back:
+// encrypted files go through the cipher stream, plain ones through io_uring
+static FILE *open_sequential(const char *filename, const char *mode) {
+    int encrypted = mode[0] == 'w' ? cipher_enabled() : cipher_file_encrypted(filename) == 1;
+    return encrypted ? cipher_fopen(filename, mode) : uring_fopen(filename, mode);
+}
+
+// Read the next record of a chain file as a block of its own (copy_block).
+// NULL at the end of the file or if memory runs out.
+block_t *read_block(FILE *file) {
+    char record[BLOCK_RECORD_SIZE];
+    block_t view;
+
+    if (!read_block_record(file, record)) return NULL;
+    decode_block_record(record, &view);
+    return copy_block(&view);
+}
 
 int save_blockchain(const blockchain_t *chain, const char *filename) {
     if (!chain || !filename) {
@@ -8,13 +109,17 @@ int save_blockchain(const blockchain_t *chain, const char *filename) {
         return 0;
     }
 
-    FILE *file = fopen(filename, "wb");
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    FILE *file = open_sequential(filename, "wb");
     if (!file) {
         printf("Error: Could not open file '%s' for writing: %s\n", filename, strerror(errno));
         return 0;
     }
 
-    printf("Saving blockchain with %d blocks to '%s'\n", chain->length, filename);
+    if (!is_quiet_mode()) {
+        printf("Saving blockchain with %d blocks to '%s'\n", chain->length, filename);
+    }
 
     if (fwrite(&chain->length, sizeof(int), 1, file) != 1) {
         printf("Error: Failed to write blockchain length\n");
@@ -22,24 +127,124 @@ int save_blockchain(const blockchain_t *chain, const char *filename) {
         return 0;
     }
 
-    block_t *current = chain->head;
     int blocks_written = 0;
+    uint64_t write_span = trace_begin();
+    chain_view_t view;
+    chain_read_begin(chain, &view);
 
-    while (current) {
+    for (const block_t *current = chain_view_first(&view); blocks_written < view.length;
+         current = chain_view_next(&view, current)) {
         // Write fields individually
-        fwrite(&current->index, sizeof(int), 1, file);
-        fwrite(current->timestamp, sizeof(current->timestamp), 1, file);
-        fwrite(&current->transaction, sizeof(medical_transaction_t), 1, file);
-        fwrite(&current->nonce, sizeof(unsigned long), 1, file);
-        fwrite(current->previous_hash, HASH_SIZE, 1, file);
-        fwrite(current->current_hash, HASH_SIZE, 1, file);
+        if (!current || !write_block_record(file, current)) {
+            printf("Error: Failed to write block %d\n", blocks_written);
+            chain_read_end();
+            fclose(file);
+            return 0;
+        }
 
         blocks_written++;
-        current = current->next;
     }
+    chain_read_end();
+    trace_end("save.write_records", write_span);
 
-    printf("Successfully saved %d blocks\n", blocks_written);
-    fclose(file);
+    if (chain->seals && !seals_write(chain->seals, filename, 0, blocks_written)) {
+        fclose(file);
+        return 0;
+    }
+
+    if (!is_quiet_mode()) {
+        printf("Successfully saved %d blocks\n", blocks_written);
+    }
+
+    uint64_t close_span = trace_begin();
+    if (fclose(file) != 0) {
+        printf("Error: Failed to write '%s': %s\n", filename, strerror(errno));
+        return 0;
+    }
+    trace_end("save.close", close_span);
+
+    metrics_counter_add(METRIC_SAVES, 1);
+    metrics_observe(METRIC_SAVE_LATENCY, metrics_now_ns() - start);
+    trace_end("save_blockchain", span);
+    return 1;
+}
+
+// Append the blocks from `first` to the end of the list to an existing
+// blockchain file. The file must currently hold exactly first->index blocks,
+// so only the new records and the length header are written. On a
+// proof-of-authority chain the seals of the blocks are written first.
+int append_blocks(const char *filename, const block_t *first, const seal_table_t *seals) {
+    if (!filename || !first) {
+        printf("Error: Invalid parameters for append_blocks\n");
+        return 0;
+    }
+
+    uint64_t span = trace_begin();
+    FILE *file = cipher_fopen(filename, "r+b");
+    if (!file) {
+        printf("Error: Could not open file '%s' for appending: %s\n", filename, strerror(errno));
+        return 0;
+    }
+
+    int saved_length;
+    if (fread(&saved_length, sizeof(int), 1, file) != 1 || saved_length != first->index) {
+        printf("Error: '%s' is out of sync with the chain (cannot append block %d)\n",
+               filename, first->index);
+        fclose(file);
+        return 0;
+    }
+
+    int new_length = saved_length;
+    for (const block_t *current = first; current; current = current->next) {
+        new_length++;
+    }
+    if (seals && !seals_write(seals, filename, saved_length, new_length)) {
+        fclose(file);
+        return 0;
+    }
+
+    long offset = (long)sizeof(int) + (long)saved_length * (long)BLOCK_RECORD_SIZE;
+    if (fseek(file, offset, SEEK_SET) != 0) {
+        printf("Error: Failed to seek in '%s': %s\n", filename, strerror(errno));
+        fclose(file);
+        return 0;
+    }
+
+    for (const block_t *current = first; current; current = current->next) {
+        if (!write_block_record(file, current)) {
+            printf("Error: Failed to append block %d\n", current->index);
+            fclose(file);
+            return 0;
+        }
+    }
+
+    // the records must be durable before the header makes them visible
+    uint64_t sync_span = trace_begin();
+    int synced = cipher_sync(file, filename);
+    trace_end("append.fsync", sync_span);
+    if (!synced) {
+        printf("Error: Failed to write blocks to '%s': %s\n", filename, strerror(errno));
+        fclose(file);
+        return 0;
+    }
+
+    rewind(file);
+    if (fwrite(&new_length, sizeof(int), 1, file) != 1) {
+        printf("Error: Failed to update blockchain length\n");
+        fclose(file);
+        return 0;
+    }
+
+    sync_span = trace_begin();
+    synced = cipher_sync(file, filename);
+    if (fclose(file) != 0) synced = 0;
+    trace_end("append.fsync", sync_span);
+    if (!synced) {
+        printf("Error: Failed to update blockchain length: %s\n", strerror(errno));
+        return 0;
+    }
+
+    trace_end("append_blocks", span);
     return 1;
 }
 
@@ -49,80 +254,143 @@ blockchain_t *load_blockchain(const char *filename) {
         return NULL;
     }
 
-    FILE *file = fopen(filename, "rb");
+    uint64_t start = metrics_now_ns();
+    uint64_t span = trace_begin();
+    FILE *file = open_sequential(filename, "rb");
     if (!file) {
         printf("Error: Could not open file '%s' for reading: %s\n", filename, strerror(errno));
         return NULL;
     }
 
-    blockchain_t *chain = malloc(sizeof(blockchain_t));
+    blockchain_t *chain = allocate_blockchain();
     if (!chain) {
         printf("Error: Memory allocation failed for blockchain\n");
         fclose(file);
         return NULL;
     }
 
-    chain->head = NULL;
-    chain->tail = NULL;
-    chain->length = 0;
-
     int saved_length;
     if (fread(&saved_length, sizeof(int), 1, file) != 1) {
         printf("Error: Failed to read blockchain length from file\n");
-        free(chain);
+        free_blockchain(chain);
         fclose(file);
         return NULL;
     }
 
-    printf("Loading blockchain with %d blocks from '%s'\n", saved_length, filename);
+    if (!is_quiet_mode()) {
+        printf("Loading blockchain with %d blocks from '%s'\n", saved_length, filename);
+    }
 
-    if (saved_length < 0 || saved_length > 100000) {
+    // the header may not claim more blocks than the file actually holds
+    long file_size, max_length = 0;
+    if (cipher_file_size(file, &file_size) && file_size > (long)sizeof(int)) {
+        max_length = (file_size - (long)sizeof(int)) / (long)BLOCK_RECORD_SIZE;
+    }
+
+    if (saved_length < 0 || saved_length > max_length) {
         printf("Error: Invalid blockchain length: %d\n", saved_length);
-        free(chain);
+        free_blockchain(chain);
         fclose(file);
         return NULL;
     }
 
     for (int i = 0; i < saved_length; i++) {
-        block_t *block = malloc(sizeof(block_t));
+        uint64_t read_span = trace_begin();
+        block_t *block = read_block(file);
+        trace_end("load.read_block", read_span);
         if (!block) {
-            printf("Error: Memory allocation failed for block %d\n", i);
-            free_blockchain(chain);
-            fclose(file);
-            return NULL;
-        }
-
-        // Read fields individually
-        if (
-            fread(&block->index, sizeof(int), 1, file) != 1 ||
-            fread(block->timestamp, sizeof(block->timestamp), 1, file) != 1 ||
-            fread(&block->transaction, sizeof(medical_transaction_t), 1, file) != 1 ||
-            fread(&block->nonce, sizeof(unsigned long), 1, file) != 1 ||
-            fread(block->previous_hash, HASH_SIZE, 1, file) != 1 ||
-            fread(block->current_hash, HASH_SIZE, 1, file) != 1
-        ) {
             printf("Error: Failed to read block %d from file\n", i);
             free_blockchain(chain);
-            free(block);
             fclose(file);
             return NULL;
         }
 
-        block->next = NULL;
-
+        // a block that could not be published is still on the chain and
+        // is freed with it
         if (add_block_to_chain(chain, block) != 1) {
             printf("Error: Failed to add block %d to chain\n", i);
             free_blockchain(chain);
-            free(block);
             fclose(file);
             return NULL;
         }
 
-        printf("Loaded block %d successfully\n", i + 1);
+        if (!is_quiet_mode()) {
+            printf("Loaded block %d successfully\n", i + 1);
+        }
+    }
+
+    fclose(file);
+    if (!seals_load(chain, filename)) {
+        free_blockchain(chain);
+        return NULL;
+    }
+    if (!is_quiet_mode()) {
+        printf("Successfully loaded blockchain with %d blocks\n", chain->length);
+    }
+
+    metrics_counter_add(METRIC_LOADS, 1);
+    metrics_observe(METRIC_LOAD_LATENCY, metrics_now_ns() - start);
+    trace_end("load_blockchain", span);
+    return chain;
+}
+
+// Load only the newest block of a blockchain file. The returned chain has
+// the file's length but a single block, which is all that is needed to mine
+// and append new blocks (see append_blocks) without reading the whole file;
+// its duplicate filter comes from beside the file (see dedup.h).
+blockchain_t *load_blockchain_tail(const char *filename) {
+    if (!filename) {
+        printf("Error: Filename is NULL\n");
+        return NULL;
+    }
+
+    FILE *file = cipher_fopen(filename, "rb");
+    if (!file) {
+        printf("Error: Could not open file '%s' for reading: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    int saved_length;
+    long file_size;
+    if (fread(&saved_length, sizeof(int), 1, file) != 1 || !cipher_file_size(file, &file_size) ||
+        saved_length <= 0 ||
+        (long)sizeof(int) + (long)saved_length * (long)BLOCK_RECORD_SIZE > file_size) {
+        printf("Error: Invalid blockchain file '%s'\n", filename);
+        fclose(file);
+        return NULL;
     }
 
+    blockchain_t *chain = allocate_blockchain();
+    block_t *block = NULL;
+    long offset = (long)sizeof(int) + (long)(saved_length - 1) * (long)BLOCK_RECORD_SIZE;
+
+    if (!chain || fseek(file, offset, SEEK_SET) != 0 || !(block = read_block(file)) ||
+        block->index != saved_length - 1) {
+        printf("Error: Failed to read the last block of '%s'\n", filename);
+        if (chain) free_blockchain(chain);
+        free(block);
+        fclose(file);
+        return NULL;
+    }
     fclose(file);
-    printf("Successfully loaded blockchain with %d blocks\n", chain->length);
+
+    // without the earlier blocks there is nothing to accumulate over,
+    // summarize or archive
+    mmr_free(chain->mmr);
+    chain->mmr = NULL;
+    patients_free(chain->patients);
+    chain->patients = NULL;
+    archive_free(chain->archive);
+    chain->archive = NULL;
+    chain->head = block;
+    chain->tail = block;
+    chain->length = saved_length;
+    chain_publish(chain);
+    dedup_load(chain, filename);
+    if (!seals_load(chain, filename)) {
+        free_blockchain(chain);
+        return NULL;
+    }
     return chain;
 }
 
@@ -133,7 +401,7 @@ int calculate_file_hash(const char *filename, char *hash) {
     }
 
     // Open the file for reading in binary mode
-    FILE *file = fopen(filename, "rb");
+    FILE *file = uring_fopen(filename, "rb");
     if (!file) {
         printf("Error: Could not open file '%s' for hashing: %s\n", filename, strerror(errno));
         return 0;
@@ -143,22 +411,25 @@ int calculate_file_hash(const char *filename, char *hash) {
     SHA256_CTX sha256;
     SHA256_Init(&sha256);
 
-    unsigned char buffer[1024];
+    // reads this large skip the stdio buffer and take whole ring buffers
+    unsigned char *buffer = malloc(URING_BUFFER_SIZE);
     size_t bytes_read;
     size_t total_bytes = 0;
 
     // Read the file in chunks and update the SHA256 context
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    while (buffer && (bytes_read = fread(buffer, 1, URING_BUFFER_SIZE, file)) > 0) {
         SHA256_Update(&sha256, buffer, bytes_read);
         total_bytes += bytes_read;
     }
 
     // Check for read errors
-    if (ferror(file)) {
+    if (!buffer || ferror(file)) {
         printf("Error: Failed to read file for hashing\n");
+        free(buffer);
         fclose(file);
         return 0;
     }
+    free(buffer);
 
     unsigned char digest[SHA256_DIGEST_LENGTH];
     SHA256_Final(digest, &sha256);
@@ -169,7 +440,10 @@ int calculate_file_hash(const char *filename, char *hash) {
     }
     hash[64] = '\0'; // Null-terminate the hash string
 
-    printf("Calculated hash for file '%s' (%zu bytes): %.16s...\n", filename, total_bytes, hash);
+    if (!is_quiet_mode()) {
+        printf("Calculated hash for file '%s' (%zu bytes): %.16s...\n", filename, total_bytes,
+               hash);
+    }
     fclose(file);
     return 1; // Success
 }
@@ -194,4 +468,23 @@ int verify_file_integrity(const char *filename, const char *expected_hash) {
     }
     
     return result;
-}
\ No newline at end of file
+}
+
+// Lock a chain file against other processes writing it (flock `operation`).
+// With `create`, a missing file is created empty for the caller to write
+// under the lock. Returns the descriptor holding the lock, -1 on failure.
+int lock_chain_file(const char *chain_file, int operation, int create) {
+    int flags = create ? O_RDONLY | O_CREAT : O_RDONLY;
+    int fd = open(chain_file, flags, cipher_enabled() ? 0600 : 0666);
+    if (fd >= 0 && flock(fd, operation) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) printf("Error: Could not lock '%s': %s\n", chain_file, strerror(errno));
+    return fd;
+}
+
+void unlock_chain_file(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
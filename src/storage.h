@@ -2,12 +2,27 @@
 #define STORAGE_H
 
 #include "blockchain.h"
+#include <sys/file.h>
+
+// size of one serialized block record: index, timestamp, the transaction
+// as a transaction_record_t, nonce and both hashes, back to back
+#define BLOCK_RECORD_SIZE (sizeof(int) + 20 + sizeof(transaction_record_t) + \
+                           sizeof(unsigned long) + 2 * HASH_SIZE)
 
 // function prototypes
 
+void encode_block_record(const block_t *block, char *record);
+void decode_block_record(char *record, block_t *block);
+int read_block_record(FILE *file, char *record);
+int write_block_record(FILE *file, const block_t *block);
+block_t *read_block(FILE *file);
 int save_blockchain(const blockchain_t *chain, const char *filename);
+int append_blocks(const char *filename, const block_t *first, const seal_table_t *seals);
 blockchain_t *load_blockchain(const char *filename);
+blockchain_t *load_blockchain_tail(const char *filename);
 int calculate_file_hash(const char *filename, char *hash);
 int verify_file_integrity(const char *filename, const char *expected_hash);
+int lock_chain_file(const char *chain_file, int operation, int create);
+void unlock_chain_file(int fd);
 
 #endif
@@ -0,0 +1,144 @@
+#include "strdict.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STRDICT_INITIAL_SLOTS 1024
+#define STRDICT_CHUNK_SIZE (64 * 1024)
+
+// FNV-1a hash of a byte string
+static uint32_t strdict_hash(const char *str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// function to copy a string into the arena (NUL-terminated)
+static const char *strdict_store(strdict_t *dict, const char *str, size_t length) {
+    strdict_chunk_t *chunk = dict->chunks;
+
+    if (!chunk || chunk->size - chunk->used < length + 1) {
+        size_t size = length + 1 > STRDICT_CHUNK_SIZE ? length + 1 : STRDICT_CHUNK_SIZE;
+        chunk = malloc(sizeof(strdict_chunk_t) + size);
+        if (!chunk) return NULL;
+        chunk->next = dict->chunks;
+        chunk->used = 0;
+        chunk->size = size;
+        dict->chunks = chunk;
+    }
+
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
+}
+
+// function to double the slot table once it is half full
+static int strdict_grow(strdict_t *dict) {
+    uint32_t new_size = (dict->slot_mask + 1) * 2;
+    uint32_t *slots = calloc(new_size, sizeof(uint32_t));
+    if (!slots) return 0;
+
+    for (uint32_t id = 0; id < dict->count; id++) {
+        uint32_t slot = dict->entries[id].hash & (new_size - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (new_size - 1);
+        }
+        slots[slot] = id + 1;
+    }
+
+    free(dict->slots);
+    dict->slots = slots;
+    dict->slot_mask = new_size - 1;
+    return 1;
+}
+
+// Initialize an empty dictionary
+int strdict_init(strdict_t *dict) {
+    if (!dict) return 0;
+
+    memset(dict, 0, sizeof(strdict_t));
+    dict->slots = calloc(STRDICT_INITIAL_SLOTS, sizeof(uint32_t));
+    if (!dict->slots) return 0;
+    dict->slot_mask = STRDICT_INITIAL_SLOTS - 1;
+    return 1;
+}
+
+// Find the id of a string without adding it. Returns 1 if found.
+int strdict_find(const strdict_t *dict, const char *str, size_t length, uint32_t *id) {
+    uint32_t hash = strdict_hash(str, length);
+    uint32_t slot = hash & dict->slot_mask;
+
+    while (dict->slots[slot]) {
+        const strdict_entry_t *entry = &dict->entries[dict->slots[slot] - 1];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->str, str, length) == 0) {
+            if (id) *id = dict->slots[slot] - 1;
+            return 1;
+        }
+        slot = (slot + 1) & dict->slot_mask;
+    }
+    return 0;
+}
+
+// Look up a string, adding it if it is new. Returns 1 if the string was
+// added, 0 if it already existed and -1 on allocation failure.
+int strdict_intern(strdict_t *dict, const char *str, size_t length, uint32_t *id) {
+    if (strdict_find(dict, str, length, id)) return 0;
+
+    if ((dict->count + 1) * 2 > dict->slot_mask + 1 && !strdict_grow(dict)) {
+        return -1;
+    }
+
+    if (dict->count == dict->entries_capacity) {
+        uint32_t capacity = dict->entries_capacity ? dict->entries_capacity * 2 : 256;
+        strdict_entry_t *entries = realloc(dict->entries, capacity * sizeof(strdict_entry_t));
+        if (!entries) return -1;
+        dict->entries = entries;
+        dict->entries_capacity = capacity;
+    }
+
+    const char *copy = strdict_store(dict, str, length);
+    if (!copy) return -1;
+
+    uint32_t hash = strdict_hash(str, length);
+    strdict_entry_t *entry = &dict->entries[dict->count];
+    entry->str = copy;
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+
+    uint32_t slot = hash & dict->slot_mask;
+    while (dict->slots[slot]) {
+        slot = (slot + 1) & dict->slot_mask;
+    }
+    dict->slots[slot] = dict->count + 1;
+
+    if (id) *id = dict->count;
+    dict->count++;
+    return 1;
+}
+
+// Get the string stored under an id
+const char *strdict_get(const strdict_t *dict, uint32_t id) {
+    if (!dict || id >= dict->count) return NULL;
+    return dict->entries[id].str;
+}
+
+// Release all memory held by the dictionary
+void strdict_free(strdict_t *dict) {
+    if (!dict) return;
+
+    strdict_chunk_t *chunk = dict->chunks;
+    while (chunk) {
+        strdict_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(dict->entries);
+    free(dict->slots);
+    memset(dict, 0, sizeof(strdict_t));
+}
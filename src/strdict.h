@@ -0,0 +1,39 @@
+#ifndef STRDICT_H
+#define STRDICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// entry of a string dictionary; ids are assigned in first-seen order
+typedef struct {
+    const char *str;
+    uint32_t length;
+    uint32_t hash;
+} strdict_entry_t;
+
+// one chunk of the arena the dictionary strings are copied into
+typedef struct strdict_chunk {
+    struct strdict_chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} strdict_chunk_t;
+
+// hash table mapping distinct strings to dense ids
+typedef struct {
+    strdict_entry_t *entries;   // indexed by id
+    uint32_t count;
+    uint32_t entries_capacity;
+    uint32_t *slots;            // open addressing, id + 1 (0 = empty)
+    uint32_t slot_mask;
+    strdict_chunk_t *chunks;
+} strdict_t;
+
+// Function prototypes
+int strdict_init(strdict_t *dict);
+int strdict_intern(strdict_t *dict, const char *str, size_t length, uint32_t *id);
+int strdict_find(const strdict_t *dict, const char *str, size_t length, uint32_t *id);
+const char *strdict_get(const strdict_t *dict, uint32_t id);
+void strdict_free(strdict_t *dict);
+
+#endif
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// one completed span
+typedef struct {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+} trace_event_t;
+
+typedef struct trace_chunk {
+    struct trace_chunk *next;
+    int count;
+    trace_event_t events[TRACE_CHUNK_EVENTS];
+} trace_chunk_t;
+
+// Events of one thread. Only the owning thread appends, so recording takes
+// no lock; buffers stay registered after their thread exits.
+typedef struct trace_buffer {
+    struct trace_buffer *next;
+    int tid;
+    int is_main;
+    trace_chunk_t *head;
+    trace_chunk_t *tail;
+    long events;
+    unsigned long dropped;
+} trace_buffer_t;
+
+int trace_active = 0;
+
+static char trace_path[512];
+static uint64_t trace_epoch;
+static pthread_t main_thread;
+static trace_buffer_t *buffers = NULL;
+static int next_tid = 1;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_buffer_t *thread_buffer = NULL;
+
+uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Enable tracing if BLOCKMED_TRACE names an output file. Call before any
+// other thread is started.
+void trace_init(void) {
+    const char *path = getenv("BLOCKMED_TRACE");
+    if (!path || !path[0]) return;
+
+    strncpy(trace_path, path, sizeof(trace_path) - 1);
+    trace_path[sizeof(trace_path) - 1] = '\0';
+    trace_epoch = trace_clock();
+    main_thread = pthread_self();
+    trace_active = 1;
+}
+
+// function to get (and on first use register) the calling thread's buffer
+static trace_buffer_t *get_thread_buffer(void) {
+    if (thread_buffer) return thread_buffer;
+
+    trace_buffer_t *buffer = calloc(1, sizeof(trace_buffer_t));
+    if (!buffer) return NULL;
+
+    pthread_mutex_lock(&buffers_lock);
+    buffer->tid = next_tid++;
+    buffer->is_main = pthread_equal(pthread_self(), main_thread);
+    buffer->next = buffers;
+    buffers = buffer;
+    pthread_mutex_unlock(&buffers_lock);
+
+    thread_buffer = buffer;
+    return buffer;
+}
+
+// Record a span that started at `start` and ends now
+void trace_record(const char *name, uint64_t start) {
+    uint64_t end = trace_clock();
+    trace_buffer_t *buffer = get_thread_buffer();
+    if (!buffer) return;
+
+    if (buffer->events >= TRACE_MAX_EVENTS) {
+        buffer->dropped++;
+        return;
+    }
+
+    if (!buffer->tail || buffer->tail->count == TRACE_CHUNK_EVENTS) {
+        trace_chunk_t *chunk = malloc(sizeof(trace_chunk_t));
+        if (!chunk) {
+            buffer->dropped++;
+            return;
+        }
+        chunk->next = NULL;
+        chunk->count = 0;
+        if (buffer->tail) buffer->tail->next = chunk;
+        else buffer->head = chunk;
+        buffer->tail = chunk;
+    }
+
+    trace_event_t *event = &buffer->tail->events[buffer->tail->count++];
+    event->name = name;
+    event->start = start;
+    event->duration = end - start;
+    buffer->events++;
+}
+
+// function to write every recorded span as Chrome trace-event JSON
+static int write_trace(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open trace file '%s'\n", path);
+        return 0;
+    }
+
+    char *io_buffer = malloc(1 << 20);
+    if (io_buffer) setvbuf(file, io_buffer, _IOFBF, 1 << 20);
+
+    int pid = (int)getpid();
+    int first = 1;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for (trace_buffer_t *buffer = buffers; buffer; buffer = buffer->next) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",\n", pid, buffer->tid, buffer->is_main ? "main" : "worker",
+                buffer->tid);
+        first = 0;
+
+        for (trace_chunk_t *chunk = buffer->head; chunk; chunk = chunk->next) {
+            for (int i = 0; i < chunk->count; i++) {
+                const trace_event_t *event = &chunk->events[i];
+                // timestamps are microseconds since trace_init
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"blockmed\",\"ph\":\"X\","
+                        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                        event->name, (event->start - trace_epoch) / 1e3,
+                        event->duration / 1e3, pid, buffer->tid);
+            }
+        }
+
+        if (buffer->dropped > 0) {
+            fprintf(stderr, "Warning: %lu trace events dropped on thread %d\n",
+                    buffer->dropped, buffer->tid);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    int ok = !ferror(file);
+    if (fclose(file) != 0) ok = 0;
+    free(io_buffer);
+    return ok;
+}
+
+// Write the trace file and release all buffers. Call once other threads
+// that record spans have finished.
+void trace_shutdown(void) {
+    if (!trace_active) return;
+    trace_active = 0;
+
+    pthread_mutex_lock(&buffers_lock);
+    write_trace(trace_path);
+
+    trace_buffer_t *buffer = buffers;
+    while (buffer) {
+        trace_buffer_t *next_buffer = buffer->next;
+        trace_chunk_t *chunk = buffer->head;
+        while (chunk) {
+            trace_chunk_t *next_chunk = chunk->next;
+            free(chunk);
+            chunk = next_chunk;
+        }
+        free(buffer);
+        buffer = next_buffer;
+    }
+    buffers = NULL;
+    thread_buffer = NULL;
+    pthread_mutex_unlock(&buffers_lock);
+}
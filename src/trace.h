@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Spans are recorded into per-thread buffers and written as Chrome
+// trace-event JSON (chrome://tracing, Perfetto) to the path in BLOCKMED_TRACE.
+// When the variable is not set, a span costs one predictable branch.
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_MAX_EVENTS (1 << 20)          // per thread, later spans are dropped
+
+extern int trace_active;
+
+// Function prototypes
+void trace_init(void);
+void trace_shutdown(void);
+uint64_t trace_clock(void);
+void trace_record(const char *name, uint64_t start);
+
+// Start a span; returns 0 when tracing is off
+static inline uint64_t trace_begin(void) {
+    return trace_active ? trace_clock() : 0;
+}
+
+// End a span started with trace_begin. `name` is stored by pointer, so it
+// must be a string literal.
+static inline void trace_end(const char *name, uint64_t start) {
+    if (start) trace_record(name, start);
+}
+
+#endif
@@ -1,26 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
 #include "transaction.h"
+#include "intern.h"
 
-void create_transaction(medical_transaction_t *tx, const char *patient_id,
-                         const char *doctor_email, const char *diagnosis,
-                         const char *prescription, const char *visit_note) {
+// function to intern a field, cut to fit its record field of `size` bytes
+static const char *intern_field(const char *value, size_t size) {
+    const char *str = value ? value : "";
+    return intern_string(str, strnlen(str, size - 1));
+}
 
-    if (!tx) return;
+// Fill in a transaction. The doctor and diagnosis are interned; the
+// patient, prescription and visit note are not copied and must stay valid
+// until the transaction is put in a block (create_block copies them).
+// Returns 0 if memory runs out.
+int create_transaction(medical_transaction_t *tx, const char *patient_id,
+                       const char *doctor_email, const char *diagnosis,
+                       const char *prescription, const char *visit_note) {
 
-    strncpy(tx->patient_id, patient_id ? patient_id : "", sizeof(tx->patient_id) - 1);
-    strncpy(tx->doctor_email, doctor_email ? doctor_email : "", sizeof(tx->doctor_email) - 1);
-    strncpy(tx->diagnosis, diagnosis ? diagnosis : "", sizeof(tx->diagnosis) - 1);
-    strncpy(tx->prescription, prescription ? prescription : "", sizeof(tx->prescription) - 1);
-    strncpy(tx->visit_note, visit_note ? visit_note : "", sizeof(tx->visit_note) - 1);
+    if (!tx) return 0;
 
-    // ensure null termination
-    tx->patient_id[sizeof(tx->patient_id) - 1] = '\0';
-    tx->doctor_email[sizeof(tx->doctor_email) - 1] = '\0';
-    tx->diagnosis[sizeof(tx->diagnosis) - 1] = '\0';
-    tx->prescription[sizeof(tx->prescription) - 1] = '\0';
-    tx->visit_note[sizeof(tx->visit_note) - 1] = '\0';
+    tx->patient_id = patient_id;
+    tx->doctor_email = doctor_email;
+    tx->diagnosis = diagnosis;
+    tx->prescription = prescription;
+    tx->visit_note = visit_note ? visit_note : "";
 
     // Get current timestamp
     get_timestamp(tx->timestamp);
+    return intern_transaction(tx);
+}
+
+// Replace the doctor and diagnosis of a transaction with their interned
+// copies (fields longer than their record field are cut). Only these two
+// are interned: the table is never shrunk, and patients and prescriptions
+// kept there would stay in memory after their blocks went to the archive.
+// Returns 0 if memory runs out.
+int intern_transaction(medical_transaction_t *tx) {
+    if (!tx) return 0;
+
+    tx->doctor_email = intern_field(tx->doctor_email, MAX_EMAIL_SIZE);
+    tx->diagnosis = intern_field(tx->diagnosis, MAX_DIAGNOSIS_SIZE);
+    return tx->doctor_email && tx->diagnosis;
 }
 
 void transaction_to_string(const medical_transaction_t *tx, char *output) {
@@ -3,22 +3,38 @@
 
 #include "utils.h"
 
-// structure to hold transaction details
+// structure to hold transaction details. The doctor and diagnosis, drawn
+// from a small set of values, point into the interned string table
+// (intern.h). The patient, prescription and visit note take far more
+// distinct values; they belong to whoever holds the transaction (a block
+// keeps its own copies, so they are freed with it).
 typedef struct {
-    char patient_id[50]; // Patient ID
+    const char *patient_id;
+    const char *doctor_email;
+    const char *diagnosis;
+    const char *prescription;
+    char timestamp[20]; // Timestamp of the transaction
+    const char *visit_note;
+} medical_transaction_t;
+
+// a transaction as stored in a block record (storage.h): every field a
+// fixed, NUL-padded array, in the field order above
+typedef struct {
+    char patient_id[MAX_PATIENT_ID_SIZE];
     char doctor_email[MAX_EMAIL_SIZE];
     char diagnosis[MAX_DIAGNOSIS_SIZE];
     char prescription[MAX_PRESCRIPTION_SIZE];
-    char timestamp[20]; // Timestamp of the transaction
+    char timestamp[20];
     char visit_note[MAX_NOTES_SIZE];
-} medical_transaction_t;
+} transaction_record_t;
 
 // Function prototypes
-void create_transaction(medical_transaction_t *tx, const char *patient_id,
-                        const char *doctor_email, const char *diagnosis,
-                        const char *prescription, const char *visit_note);
+int create_transaction(medical_transaction_t *tx, const char *patient_id,
+                       const char *doctor_email, const char *diagnosis,
+                       const char *prescription, const char *visit_note);
+int intern_transaction(medical_transaction_t *tx);
 void transaction_to_string(const medical_transaction_t *tx, char *output);
 void print_transaction(const medical_transaction_t *tx);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// one io_uring instance: the submission and completion rings shared with
+// the kernel. A stream never has more than URING_QUEUE_DEPTH requests in
+// flight, so neither ring can fill up.
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;                       // sq_map when the kernel maps both at once
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned unsubmitted;               // queued since the last io_uring_enter
+} ring_t;
+
+// an open file: buffer i holds requested[i] bytes at offsets[i] and is busy
+// while its request is in flight
+typedef struct {
+    int fd;
+    int writable;
+    ring_t ring;
+    char *buffers;                      // URING_QUEUE_DEPTH * URING_BUFFER_SIZE
+    long offsets[URING_QUEUE_DEPTH];
+    size_t requested[URING_QUEUE_DEPTH];
+    size_t lengths[URING_QUEUE_DEPTH];  // bytes a finished read returned
+    int busy[URING_QUEUE_DEPTH];
+    int in_flight;
+    int failed;                         // errno of the first failed request
+    long position;                      // where the caller is in the file
+    long size;                          // reader: file size when opened
+    long next_offset;                   // reader: where the next read starts
+    int head;                           // reader: first buffer in file order
+    int queued;                         // reader: buffers read or in flight from head on
+    int next;                           // writer: buffer the next write goes to
+} uring_stream_t;
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static int available = 0;
+
+static long ring_enter(const ring_t *ring, unsigned submit, unsigned wait) {
+    return syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// function to unmap and close a ring
+static void ring_close(ring_t *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(ring_t));
+    ring->fd = -1;
+}
+
+// function to set up a ring of URING_QUEUE_DEPTH entries; returns 0 if the
+// kernel has no io_uring, or none with IORING_OP_READ/WRITE (Linux 5.6)
+static int ring_setup(ring_t *ring) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(ring_t));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+    if (ring->fd < 0) return 0;
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        ring_close(ring);
+        return 0;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        ring_close(ring);
+        return 0;
+    }
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = ring->cq_map == MAP_FAILED
+                     ? MAP_FAILED
+                     : mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->cq_map == MAP_FAILED) ring->cq_map = NULL;
+        ring->sqes = NULL;
+        ring_close(ring);
+        return 0;
+    }
+
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+// function to queue one read or write of a buffer; it goes to the kernel
+// with the next ring_submit
+static void ring_queue(ring_t *ring, int opcode, int fd, char *buffer, size_t length,
+                       long offset, int slot) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buffer;
+    sqe->len = (unsigned)length;
+    sqe->off = (unsigned long long)offset;
+    sqe->user_data = (unsigned long long)slot;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+}
+
+// function to hand the queued requests to the kernel, waiting for at least
+// one completion if `wait` is set
+static int ring_submit(ring_t *ring, int wait) {
+    for (;;) {
+        long submitted = ring_enter(ring, ring->unsubmitted, wait ? 1 : 0);
+        if (submitted >= 0) {
+            ring->unsubmitted -= (unsigned)submitted;
+            if (ring->unsubmitted == 0 || !wait) return 1;
+        } else if (errno != EINTR) {
+            return 0;
+        }
+    }
+}
+
+// function to finish the part of a request the kernel left undone (a short
+// read or write) with plain system calls
+static void finish_request(uring_stream_t *stream, int slot, long result) {
+    char *buffer = stream->buffers + (size_t)slot * URING_BUFFER_SIZE;
+    size_t done = result > 0 ? (size_t)result : 0;
+
+    while (result >= 0 && done < stream->requested[slot]) {
+        ssize_t more = stream->writable
+                           ? pwrite(stream->fd, buffer + done, stream->requested[slot] - done,
+                                    stream->offsets[slot] + (long)done)
+                           : pread(stream->fd, buffer + done, stream->requested[slot] - done,
+                                   stream->offsets[slot] + (long)done);
+        if (more < 0 && errno == EINTR) continue;
+        if (more <= 0) {
+            result = more < 0 ? -errno : -EIO;
+            break;
+        }
+        done += (size_t)more;
+    }
+    if (result < 0 && !stream->failed) stream->failed = (int)-result;
+
+    stream->lengths[slot] = done;
+    stream->busy[slot] = 0;
+    stream->in_flight--;
+}
+
+// function to collect the finished requests of a stream
+static void reap(uring_stream_t *stream) {
+    ring_t *ring = &stream->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        finish_request(stream, (int)cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// function to wait until a buffer (or, for slot -1, every buffer) is free
+static int wait_for(uring_stream_t *stream, int slot) {
+    while (slot >= 0 ? stream->busy[slot] : stream->in_flight > 0) {
+        if (!ring_submit(&stream->ring, 1)) {
+            if (!stream->failed) stream->failed = errno;
+            return 0;
+        }
+        reap(stream);
+    }
+    return 1;
+}
+
+// function to keep URING_QUEUE_DEPTH reads ahead of the reader in flight
+static int fill_queue(uring_stream_t *stream) {
+    while (stream->queued < URING_QUEUE_DEPTH && stream->next_offset < stream->size) {
+        int slot = (stream->head + stream->queued) % URING_QUEUE_DEPTH;
+        long left = stream->size - stream->next_offset;
+
+        stream->offsets[slot] = stream->next_offset;
+        stream->requested[slot] = left < URING_BUFFER_SIZE ? (size_t)left : URING_BUFFER_SIZE;
+        stream->busy[slot] = 1;
+        stream->in_flight++;
+        ring_queue(&stream->ring, IORING_OP_READ, stream->fd,
+                   stream->buffers + (size_t)slot * URING_BUFFER_SIZE, stream->requested[slot],
+                   stream->offsets[slot], slot);
+        stream->next_offset += (long)stream->requested[slot];
+        stream->queued++;
+    }
+    if (stream->ring.unsubmitted > 0 && !ring_submit(&stream->ring, 0)) {
+        if (!stream->failed) stream->failed = errno;
+        return 0;
+    }
+    return 1;
+}
+
+// function to read on from `position` after a seek away from the buffers
+static int restart_reads(uring_stream_t *stream) {
+    if (!wait_for(stream, -1)) return 0;
+    stream->head = 0;
+    stream->queued = 0;
+    stream->next_offset = stream->position;
+    return fill_queue(stream);
+}
+
+static ssize_t stream_read(void *cookie, char *buffer, size_t size) {
+    uring_stream_t *stream = cookie;
+    size_t done = 0;
+
+    while (done < size && stream->position < stream->size && !stream->failed) {
+        int head = stream->head;
+        if (stream->queued == 0 || stream->position < stream->offsets[head] ||
+            stream->position >= stream->offsets[head] + (long)stream->requested[head]) {
+            if (!restart_reads(stream)) break;
+            head = stream->head;
+        }
+        if (!wait_for(stream, head) || stream->failed) break;
+
+        long end = stream->offsets[head] + (long)stream->lengths[head];
+        size_t count = (size_t)(end - stream->position);
+        if (count > size - done) count = size - done;
+        memcpy(buffer + done,
+               stream->buffers + (size_t)head * URING_BUFFER_SIZE +
+                   (size_t)(stream->position - stream->offsets[head]),
+               count);
+        done += count;
+        stream->position += (long)count;
+
+        if (stream->position >= end) {
+            stream->head = (head + 1) % URING_QUEUE_DEPTH;
+            stream->queued--;
+            fill_queue(stream);
+        }
+    }
+
+    if (done == 0 && stream->failed) {
+        errno = stream->failed;
+        return -1;
+    }
+    return (ssize_t)done;
+}
+
+// writes are queued, not waited for: they are all in the file once fclose
+// returns (which reports any that failed)
+static ssize_t stream_write(void *cookie, const char *buffer, size_t size) {
+    uring_stream_t *stream = cookie;
+    size_t done = 0;
+
+    while (done < size) {
+        int slot = stream->next;
+        if (!wait_for(stream, slot) || stream->failed) {
+            errno = stream->failed ? stream->failed : EIO;
+            return -1;
+        }
+
+        size_t count = size - done < URING_BUFFER_SIZE ? size - done : URING_BUFFER_SIZE;
+        char *data = stream->buffers + (size_t)slot * URING_BUFFER_SIZE;
+        memcpy(data, buffer + done, count);
+        stream->offsets[slot] = stream->position;
+        stream->requested[slot] = count;
+        stream->busy[slot] = 1;
+        stream->in_flight++;
+        ring_queue(&stream->ring, IORING_OP_WRITE, stream->fd, data, count, stream->position,
+                   slot);
+        if (!ring_submit(&stream->ring, 0)) {
+            stream->failed = errno;
+            return -1;
+        }
+
+        done += count;
+        stream->position += (long)count;
+        stream->next = (slot + 1) % URING_QUEUE_DEPTH;
+    }
+    return (ssize_t)done;
+}
+
+// readers seek anywhere; writers only report where they are
+static int stream_seek(void *cookie, off64_t *offset, int whence) {
+    uring_stream_t *stream = cookie;
+    if (stream->writable && !(whence == SEEK_CUR && *offset == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    long base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? stream->position : stream->size;
+    if (base + *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    stream->position = (long)(base + *offset);
+    *offset = stream->position;
+    return 0;
+}
+
+static void free_stream(uring_stream_t *stream) {
+    ring_close(&stream->ring);
+    if (stream->fd >= 0) close(stream->fd);
+    free(stream->buffers);
+    free(stream);
+}
+
+static int stream_close(void *cookie) {
+    uring_stream_t *stream = cookie;
+    int ok = wait_for(stream, -1) && !stream->failed;
+    if (close(stream->fd) != 0) ok = 0;
+    stream->fd = -1;
+    free_stream(stream);
+    return ok ? 0 : -1;
+}
+
+// function to see once whether rings can be set up here
+static void probe(void) {
+    const char *setting = getenv("BLOCKMED_IO_URING");
+    if (setting && strcmp(setting, "off") == 0) return;
+
+    ring_t ring;
+    available = ring_setup(&ring);
+    if (available) ring_close(&ring);
+}
+
+// Check whether uring_fopen uses io_uring in this process
+int uring_available(void) {
+    pthread_once(&probe_once, probe);
+    return available;
+}
+
+// function to open a file on stdio with a large buffer, where io_uring
+// cannot be used
+static FILE *fallback_fopen(const char *path, const char *mode) {
+    FILE *file = fopen(path, mode);
+    if (!file) return NULL;
+
+    setvbuf(file, NULL, _IOFBF, URING_BUFFER_SIZE);
+    if (mode[0] == 'r') posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    return file;
+}
+
+// Open a file for reading front to back ("rb") or for writing from scratch
+// ("wb") through io_uring, falling back to stdio where it is unavailable.
+// A reader sees the file as it was when opened; a writer can only write
+// on and tell its position.
+FILE *uring_fopen(const char *path, const char *mode) {
+    int writable = mode[0] == 'w';
+    if ((!writable && mode[0] != 'r') || strchr(mode, '+')) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!uring_available()) return fallback_fopen(path, mode);
+
+    uring_stream_t *stream = calloc(1, sizeof(uring_stream_t));
+    if (!stream) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    stream->ring.fd = -1;
+    stream->writable = writable;
+    stream->fd = writable ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)
+                          : open(path, O_RDONLY | O_CLOEXEC);
+    if (stream->fd < 0) {
+        int error = errno;
+        free(stream);
+        errno = error;
+        return NULL;
+    }
+
+    struct stat st;
+    if (!writable && fstat(stream->fd, &st) != 0) {
+        free_stream(stream);
+        return NULL;
+    }
+    stream->size = writable ? 0 : (long)st.st_size;
+    if (!writable) posix_fadvise(stream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    void *buffers = NULL;
+    if (posix_memalign(&buffers, URING_ALIGNMENT,
+                       (size_t)URING_QUEUE_DEPTH * URING_BUFFER_SIZE) != 0) {
+        free_stream(stream);
+        errno = ENOMEM;
+        return NULL;
+    }
+    stream->buffers = buffers;
+
+    // a ring can still fail here (locked memory limits, say): use stdio
+    if (!ring_setup(&stream->ring)) {
+        free_stream(stream);
+        return fallback_fopen(path, mode);
+    }
+    if (!writable) fill_queue(stream);
+
+    cookie_io_functions_t functions = {stream_read, stream_write, stream_seek, stream_close};
+    FILE *file = fopencookie(stream, writable ? "w" : "r", functions);
+    if (!file) {
+        wait_for(stream, -1);
+        free_stream(stream);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, URING_BUFFER_SIZE);
+    return file;
+}
@@ -0,0 +1,27 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdio.h>
+
+// Bulk sequential file I/O on io_uring. Loading a whole chain file, saving
+// one and hashing a file go through uring_fopen, which hides a ring of
+// URING_QUEUE_DEPTH page-aligned buffers of URING_BUFFER_SIZE bytes behind
+// a FILE: a reader keeps that many reads of the file ahead of the caller in
+// flight, a writer hands each full buffer to the kernel and goes on filling
+// the next, so the disk always has a deep queue of large requests instead
+// of stdio's one small read or write at a time.
+//
+// The ring is set up with the raw system calls (no liburing). Where
+// io_uring is missing, too old (before Linux 5.6) or blocked, or when
+// BLOCKMED_IO_URING is "off", uring_fopen returns an ordinary stdio FILE
+// with a URING_BUFFER_SIZE buffer instead. Encrypted files keep using
+// cipher_fopen.
+#define URING_QUEUE_DEPTH 8
+#define URING_BUFFER_SIZE (1 << 20)
+#define URING_ALIGNMENT 4096
+
+// Function prototypes
+int uring_available(void);
+FILE *uring_fopen(const char *path, const char *mode);
+
+#endif
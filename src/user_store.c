@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L
+#include "user_store.h"
+#include "strdict.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define USERS_TMP_FILE USERS_FILE ".tmp"
+#define USERS_LOCK_FILE USERS_FILE ".lock"
+
+// in-memory copy of users.csv: records in file order, indexed by
+// lower-cased email through a string dictionary (dictionary id == record)
+static struct {
+    int loaded;
+    user_t *users;
+    int count;
+    int capacity;
+    strdict_t index;
+    struct stat file_stat;      // identity of the file the table was loaded from
+} store;
+
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// function to build the case-insensitive lookup key of an email
+static size_t email_key(const char *email, char *key) {
+    size_t length = 0;
+    for (; email[length] && length < MAX_EMAIL_SIZE - 1; length++) {
+        key[length] = (char)tolower((unsigned char)email[length]);
+    }
+    key[length] = '\0';
+    return length;
+}
+
+static user_role_t role_from_string(const char *role) {
+    if (strcmp(role, "STAFF") == 0) return ROLE_STAFF;
+    if (strcmp(role, "INTERN") == 0) return ROLE_INTERN;
+    if (strcmp(role, "STUDENT") == 0) return ROLE_STUDENT;
+    return ROLE_INVALID;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// function to drop the in-memory table
+static void reset_store(void) {
+    free(store.users);
+    if (store.loaded) {
+        strdict_free(&store.index);
+    }
+    store.users = NULL;
+    store.count = 0;
+    store.capacity = 0;
+    store.loaded = 0;
+}
+
+// function to insert a record into the table; returns -1 for a duplicate email
+static int insert_user(const user_t *user) {
+    char key[MAX_EMAIL_SIZE];
+    size_t length = email_key(user->email, key);
+
+    if (strdict_find(&store.index, key, length, NULL)) return -1;
+
+    if (store.count == store.capacity) {
+        int capacity = store.capacity ? store.capacity * 2 : 64;
+        user_t *users = realloc(store.users, capacity * sizeof(user_t));
+        if (!users) return 0;
+        store.users = users;
+        store.capacity = capacity;
+    }
+
+    if (strdict_intern(&store.index, key, length, NULL) < 0) return 0;
+    store.users[store.count++] = *user;
+    return 1;
+}
+
+// function to create users.csv with the default admin account
+static void create_default_users_file(void) {
+    FILE *file = fopen(USERS_FILE, "w");
+    if (file) {
+        char admin_hash[HASH_SIZE];
+        hash_password("admin123", admin_hash);
+        fprintf(file, "admin@alueducation.com,%s,STAFF\n", admin_hash);
+        fclose(file);
+    }
+}
+
+// function to (re)load the table from users.csv
+static int load_store(void) {
+    FILE *file = fopen(USERS_FILE, "r");
+    if (!file) {
+        create_default_users_file();
+        file = fopen(USERS_FILE, "r");
+        if (!file) return 0;
+    }
+
+    reset_store();
+    if (!strdict_init(&store.index)) {
+        fclose(file);
+        return 0;
+    }
+    store.loaded = 1;
+    fstat(fileno(file), &store.file_stat);
+
+    char line[512];
+    char role_str[20];
+    int duplicates = 0;
+    user_t user;
+
+    while (fgets(line, sizeof(line), file)) {
+        memset(&user, 0, sizeof(user));
+        if (sscanf(line, "%99[^,],%64[^,],%19s", user.email, user.password_hash, role_str) != 3) {
+            continue;
+        }
+        user.role = role_from_string(role_str);
+
+        // the first entry wins, later duplicates were never reachable by design
+        int result = insert_user(&user);
+        if (result < 0) {
+            duplicates++;
+        } else if (result == 0) {
+            fclose(file);
+            reset_store();
+            return 0;
+        }
+    }
+    fclose(file);
+
+    if (duplicates > 0) {
+        fprintf(stderr, "Warning: %d duplicate user entries ignored in %s\n", duplicates, USERS_FILE);
+    }
+    return 1;
+}
+
+// function to make sure the table reflects the current users.csv;
+// a single stat() decides whether another process replaced the file
+static int refresh_store(void) {
+    struct stat st;
+    if (store.loaded && stat(USERS_FILE, &st) == 0 && same_file(&st, &store.file_stat)) {
+        return 1;
+    }
+    return load_store();
+}
+
+// function to write the whole table to a temp file and rename it over users.csv
+static int write_store(void) {
+    FILE *file = fopen(USERS_TMP_FILE, "w");
+    if (!file) {
+        printf("Error: Could not write '%s': %s\n", USERS_TMP_FILE, strerror(errno));
+        return 0;
+    }
+
+    for (int i = 0; i < store.count; i++) {
+        fprintf(file, "%s,%s,%s\n", store.users[i].email, store.users[i].password_hash,
+                role_to_string(store.users[i].role));
+    }
+
+    int ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = 0;
+    if (ok && rename(USERS_TMP_FILE, USERS_FILE) != 0) ok = 0;
+
+    if (!ok) {
+        printf("Error: Could not update '%s': %s\n", USERS_FILE, strerror(errno));
+        remove(USERS_TMP_FILE);
+        return 0;
+    }
+
+    stat(USERS_FILE, &store.file_stat);
+    return 1;
+}
+
+// Look up a user by email (case-insensitive). Returns 1 if found.
+int user_store_lookup(const char *email, user_t *user) {
+    if (!email || !user) return 0;
+
+    pthread_mutex_lock(&store_lock);
+
+    int found = 0;
+    if (refresh_store()) {
+        char key[MAX_EMAIL_SIZE];
+        size_t length = email_key(email, key);
+        uint32_t id;
+
+        if (strdict_find(&store.index, key, length, &id)) {
+            *user = store.users[id];
+            found = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return found;
+}
+
+// Add a user and write the change through to users.csv. An exclusive lock
+// on a side file serialises registrations across processes, and the table
+// is refreshed under that lock so no concurrent registration is lost.
+// Returns 1 on success, -1 if the email is already registered, 0 on error.
+int user_store_add(const char *email, const char *password_hash, user_role_t role) {
+    if (!email || !password_hash) return 0;
+
+    int lock_fd = open(USERS_LOCK_FILE, O_RDWR | O_CREAT, 0600);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+        printf("Error: Could not lock user store: %s\n", strerror(errno));
+        if (lock_fd >= 0) close(lock_fd);
+        return 0;
+    }
+
+    pthread_mutex_lock(&store_lock);
+
+    int result = 0;
+    if (refresh_store()) {
+        user_t user;
+        memset(&user, 0, sizeof(user));
+        strncpy(user.email, email, sizeof(user.email) - 1);
+        strncpy(user.password_hash, password_hash, sizeof(user.password_hash) - 1);
+        user.role = role;
+
+        result = insert_user(&user);
+        if (result == 1 && !write_store()) {
+            // keep memory consistent with the file that is still on disk
+            load_store();
+            result = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return result;
+}
+
+// Number of users in the directory
+int user_store_count(void) {
+    pthread_mutex_lock(&store_lock);
+    int count = refresh_store() ? store.count : 0;
+    pthread_mutex_unlock(&store_lock);
+    return count;
+}
+
+// Release the in-memory directory
+void user_store_close(void) {
+    pthread_mutex_lock(&store_lock);
+    reset_store();
+    pthread_mutex_unlock(&store_lock);
+}
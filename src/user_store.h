@@ -0,0 +1,14 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include "auth.h"
+
+#define USERS_FILE "data/users.csv"
+
+// Function prototypes
+int user_store_lookup(const char *email, user_t *user);
+int user_store_add(const char *email, const char *password_hash, user_role_t role);
+int user_store_count(void);
+void user_store_close(void);
+
+#endif
@@ -1,10 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
 #include "utils.h"
 
+// when set, per-block progress output is suppressed (bulk and scripted use)
+static int quiet_mode = 0;
+
 // function to extract the current timestamp
 void get_timestamp(char *timestamp) {
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(timestamp, 20, "%Y-%m-%d %H:%M:%S", tm_info);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info); // reentrant: import and logging run on threads
+    strftime(timestamp, 20, "%Y-%m-%d %H:%M:%S", &tm_info);
 }
 
 // function to hash a string using SHA-256
@@ -59,3 +64,67 @@ void secure_input(char *buffer, size_t size) {
         sanitize_input(buffer);
     }
 }
+
+// function to read a file path from the user; unlike secure_input it keeps
+// slashes, only the line ending is stripped
+void read_path_input(char *buffer, size_t size) {
+    if (fgets(buffer, size, stdin)) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+    } else if (size > 0) {
+        buffer[0] = '\0';
+    }
+}
+
+// Enable or disable quiet mode
+void set_quiet_mode(int quiet) {
+    quiet_mode = quiet ? 1 : 0;
+}
+
+// Check whether quiet mode is enabled
+int is_quiet_mode(void) {
+    return quiet_mode;
+}
+
+// Write a CSV field, quoting it only when needed
+void write_csv_string(FILE *out, const char *value) {
+    if (!value[strcspn(value, ",\"\r\n")]) {
+        fputs(value, out);
+        return;
+    }
+
+    fputc('"', out);
+    const char *start = value;
+    const char *quote;
+    while ((quote = strchr(start, '"'))) {
+        fwrite(start, 1, quote - start + 1, out);
+        fputc('"', out);
+        start = quote + 1;
+    }
+    fputs(start, out);
+    fputc('"', out);
+}
+
+// Write a JSON string literal, escaping quotes, backslashes and control bytes
+void write_json_string(FILE *out, const char *value) {
+    fputc('"', out);
+    const char *start = value;
+    const char *p = value;
+
+    for (; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+
+        fwrite(start, 1, p - start, out);
+        switch (c) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+            default: fprintf(out, "\\u%04x", c); break;
+        }
+        start = p + 1;
+    }
+    fwrite(start, 1, p - start, out);
+    fputc('"', out);
+}
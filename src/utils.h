@@ -11,6 +11,7 @@
 // Constants
 #define MAX_INPUT_SIZE 1024
 #define HASH_SIZE 65
+#define MAX_PATIENT_ID_SIZE 50
 #define MAX_EMAIL_SIZE 100
 #define MAX_PASSWORD_SIZE 256
 #define MAX_DIAGNOSIS_SIZE 500
@@ -23,5 +24,10 @@ void sha256_hash(const char *input, char *output);
 void sanitize_input(char *input);
 int is_valid_email(const char *email);
 void secure_input(char *buffer, size_t size);
+void read_path_input(char *buffer, size_t size);
+void set_quiet_mode(int quiet);
+int is_quiet_mode(void);
+void write_csv_string(FILE *out, const char *value);
+void write_json_string(FILE *out, const char *value);
 
 #endif
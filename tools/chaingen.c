@@ -0,0 +1,365 @@
+#define _POSIX_C_SOURCE 200809L
+// chaingen: write a synthetic blockchain.dat for load testing and
+// benchmarks. Records follow the shape of real clinic data (a skewed mix of
+// returning patients, a doctor roster, a common-diagnosis vocabulary and
+// visit notes of varying length), and the same seed always produces the
+// same file.
+//
+//   make chaingen
+//   ./chaingen --blocks 1000000 --output big.dat [--seed 1] [--difficulty 4]
+//              [--no-pow] [--patients N] [--doctors N] [--quiet]
+#include "storage.h"
+#include "pow.h"
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define CHAINGEN_START_TIME 1577836800  // 2020-01-01 00:00:00 UTC
+#define CHAINGEN_MAX_GAP 1800           // seconds between visits
+#define CHAINGEN_PROGRESS_EVERY 100000
+#define CHAINGEN_BUFFER_SIZE (4 << 20)
+
+typedef struct {
+    long blocks;
+    const char *output;
+    uint64_t seed;
+    int difficulty;
+    int proof_of_work;
+    long patients;
+    long doctors;
+    int quiet;
+} chaingen_options_t;
+
+static const char *first_names[] = {
+    "amina", "kwame", "chidi", "fatima", "tendai", "wanjiru", "kofi", "ngozi",
+    "thabo", "zainab", "emeka", "aisha", "jabari", "nia", "sipho", "adaeze",
+    "musa", "imani", "olu", "zuri", "baraka", "lerato", "yaw", "halima"
+};
+
+static const char *last_names[] = {
+    "okafor", "mensah", "kamau", "diallo", "nkosi", "adeyemi", "mwangi", "banda",
+    "osei", "traore", "moyo", "abubakar", "otieno", "ndlovu", "eze", "kariuki",
+    "asante", "keita", "phiri", "bello"
+};
+
+// common diagnoses, most frequent first, each with its usual prescriptions
+typedef struct {
+    const char *diagnosis;
+    const char *prescriptions[3];
+} condition_t;
+
+static const condition_t conditions[] = {
+    {"Malaria", {"Artemether-lumefantrine 80/480mg twice daily for 3 days",
+                 "Artesunate 2.4mg/kg IV", "Paracetamol 1g every 6 hours"}},
+    {"Upper respiratory tract infection", {"Rest and fluids",
+                 "Paracetamol 500mg every 6 hours as needed", "Saline nasal spray"}},
+    {"Essential hypertension", {"Amlodipine 5mg once daily",
+                 "Hydrochlorothiazide 12.5mg once daily", "Lisinopril 10mg once daily"}},
+    {"Type 2 diabetes mellitus", {"Metformin 500mg twice daily with meals",
+                 "Glibenclamide 5mg once daily", "Dietary counselling"}},
+    {"Acute gastroenteritis", {"Oral rehydration salts after each loose stool",
+                 "Zinc 20mg daily for 10 days", "Metronidazole 400mg three times daily"}},
+    {"Urinary tract infection", {"Nitrofurantoin 100mg twice daily for 5 days",
+                 "Ciprofloxacin 500mg twice daily for 3 days", "Increase fluid intake"}},
+    {"Pneumonia", {"Amoxicillin 1g three times daily for 5 days",
+                 "Ceftriaxone 1g IV daily", "Azithromycin 500mg once daily"}},
+    {"Typhoid fever", {"Ciprofloxacin 500mg twice daily for 7 days",
+                 "Azithromycin 1g once daily", "Paracetamol as needed"}},
+    {"Iron deficiency anaemia", {"Ferrous sulphate 200mg three times daily",
+                 "Folic acid 5mg once daily", "Dietary counselling"}},
+    {"Asthma exacerbation", {"Salbutamol inhaler 2 puffs as needed",
+                 "Prednisolone 40mg once daily for 5 days", "Beclomethasone inhaler"}},
+    {"Tension headache", {"Ibuprofen 400mg every 8 hours as needed",
+                 "Paracetamol 1g as needed", "Sleep hygiene advice"}},
+    {"Peptic ulcer disease", {"Omeprazole 20mg once daily",
+                 "Amoxicillin, clarithromycin and omeprazole for 14 days", "Avoid NSAIDs"}},
+    {"Allergic rhinitis", {"Cetirizine 10mg once daily",
+                 "Fluticasone nasal spray", "Loratadine 10mg once daily"}},
+    {"Skin and soft tissue infection", {"Flucloxacillin 500mg four times daily",
+                 "Cloxacillin 500mg four times daily", "Wound dressing"}},
+    {"Low back pain", {"Diclofenac 50mg twice daily for 5 days",
+                 "Physiotherapy referral", "Paracetamol 1g as needed"}},
+    {"HIV - routine follow-up", {"Tenofovir/lamivudine/dolutegravir once daily",
+                 "Continue current regimen", "Co-trimoxazole 960mg once daily"}},
+    {"Tuberculosis - intensive phase", {"RHZE fixed-dose combination daily",
+                 "Pyridoxine 25mg daily", "Continue DOTS"}},
+    {"Antenatal check-up", {"Ferrous sulphate with folic acid daily",
+                 "Sulfadoxine-pyrimethamine IPTp", "Tetanus toxoid"}},
+    {"Conjunctivitis", {"Chloramphenicol eye drops four times daily",
+                 "Tetracycline eye ointment", "Cold compresses"}},
+    {"Otitis media", {"Amoxicillin 500mg three times daily for 7 days",
+                 "Paracetamol as needed", "Ear review in 1 week"}},
+    {"Gastro-oesophageal reflux", {"Omeprazole 20mg once daily",
+                 "Antacid as needed", "Lifestyle advice"}},
+    {"Sickle cell crisis", {"IV fluids and analgesia", "Morphine as needed",
+                 "Folic acid 5mg once daily"}},
+    {"Schistosomiasis", {"Praziquantel 40mg/kg single dose", "Follow-up urine test",
+                 "Health education"}},
+    {"Depression", {"Fluoxetine 20mg once daily", "Counselling referral",
+                 "Review in 4 weeks"}}
+};
+
+// fragments visit notes are assembled from
+static const char *note_phrases[] = {
+    "Patient presented with", "a two-day history of", "fever and chills",
+    "persistent cough", "mild dehydration", "no known drug allergies.",
+    "Vital signs stable.", "Temperature 38.2C.", "BP 142/91.", "Pulse 96 bpm.",
+    "Rapid diagnostic test positive.", "Chest clear on auscultation.",
+    "Advised to return if symptoms worsen.", "Counselled on adherence.",
+    "Follow-up in two weeks.", "Lab results reviewed with patient.",
+    "Reports good response to previous treatment.", "Weight 64kg.",
+    "Referred for further investigation.", "Family history noted.",
+    "Symptoms improving since last visit.", "Patient educated on warning signs.",
+    "Blood glucose 9.4 mmol/L.", "Haemoglobin 9.8 g/dL.", "Tolerating oral intake.",
+    "Next of kin informed.", "Discussed diet and exercise.", "No complications."
+};
+
+#define COUNT(array) ((long)(sizeof(array) / sizeof((array)[0])))
+
+// splitmix64: small, fast and fully determined by the seed
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// uniform value in [0, 1)
+static double random_unit(uint64_t *state) {
+    return (double)(next_random(state) >> 11) / 9007199254740992.0;
+}
+
+// index in [0, count) favouring small indexes: u^power puts most of the
+// mass on the first entries, like returning patients and common diagnoses
+static long skewed_index(uint64_t *state, long count, int power) {
+    double u = random_unit(state);
+    double skewed = u;
+    for (int i = 1; i < power; i++) skewed *= u;
+    long index = (long)(skewed * (double)count);
+    return index < count ? index : count - 1;
+}
+
+// function to write a deterministic timestamp in get_timestamp's format
+static void format_timestamp(time_t when, char *timestamp) {
+    struct tm tm_info;
+    gmtime_r(&when, &tm_info);
+    strftime(timestamp, 20, "%Y-%m-%d %H:%M:%S", &tm_info);
+}
+
+// function to build the doctor email for roster position `doctor`
+static void doctor_email(long doctor, char *email, size_t size) {
+    long first = doctor % COUNT(first_names);
+    long last = (doctor / COUNT(first_names)) % COUNT(last_names);
+    long round = doctor / (COUNT(first_names) * COUNT(last_names));
+
+    if (round == 0) {
+        snprintf(email, size, "%s.%s@alueducation.com", first_names[first], last_names[last]);
+    } else {
+        snprintf(email, size, "%s.%s%ld@alueducation.com", first_names[first], last_names[last], round);
+    }
+}
+
+// function to assemble a visit note: mostly a few sentences, sometimes a
+// long write-up close to the field size
+static void visit_note(uint64_t *state, char *note, size_t size) {
+    double u = random_unit(state);
+    size_t target = u < 0.05 ? size / 2 + (size_t)(random_unit(state) * (double)(size / 2))
+                             : 30 + (size_t)(random_unit(state) * random_unit(state) * 300);
+    if (target >= size) target = size - 1;
+
+    size_t used = 0;
+    note[0] = '\0';
+    while (used < target) {
+        const char *phrase = note_phrases[next_random(state) % COUNT(note_phrases)];
+        size_t length = strlen(phrase);
+        if (used + length + 1 >= size) break;
+        if (used > 0) note[used++] = ' ';
+        memcpy(note + used, phrase, length + 1);
+        used += length;
+    }
+}
+
+// function to fill in the record of one synthetic visit; the strings are
+// built in `fields` and `tx` points at them
+static void generate_transaction(uint64_t *state, const chaingen_options_t *opts,
+                                 const char *timestamp, transaction_record_t *fields,
+                                 medical_transaction_t *tx) {
+    snprintf(fields->patient_id, sizeof(fields->patient_id), "P-%07ld",
+             skewed_index(state, opts->patients, 3) + 1);
+    doctor_email(skewed_index(state, opts->doctors, 2), fields->doctor_email,
+                 sizeof(fields->doctor_email));
+
+    const condition_t *condition = &conditions[skewed_index(state, COUNT(conditions), 2)];
+    snprintf(fields->diagnosis, sizeof(fields->diagnosis), "%s", condition->diagnosis);
+    snprintf(fields->prescription, sizeof(fields->prescription), "%s",
+             condition->prescriptions[next_random(state) % 3]);
+    visit_note(state, fields->visit_note, sizeof(fields->visit_note));
+
+    tx->patient_id = fields->patient_id;
+    tx->doctor_email = fields->doctor_email;
+    tx->diagnosis = fields->diagnosis;
+    tx->prescription = fields->prescription;
+    tx->visit_note = fields->visit_note;
+    strcpy(tx->timestamp, timestamp);
+}
+
+// function to seal a block: real proof of work, or just its hash
+static void seal_block(block_t *block, const chaingen_options_t *opts) {
+    if (opts->proof_of_work) {
+        mine_block(block, opts->difficulty);
+    } else {
+        block->nonce = 0;
+        compute_block_hash(block, block->current_hash);
+    }
+}
+
+static int parse_long(const char *text, long min, long *value) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (errno != 0 || *end != '\0' || end == text || parsed < min) return 0;
+    *value = parsed;
+    return 1;
+}
+
+static void print_usage(void) {
+    printf("Usage: chaingen --blocks N --output FILE [--seed S] [--difficulty 1-8]\n"
+           "                [--no-pow] [--patients N] [--doctors N] [--quiet]\n");
+}
+
+// function to read the command line into `opts`
+static int parse_options(int argc, char *argv[], chaingen_options_t *opts) {
+    opts->blocks = 0;
+    opts->output = NULL;
+    opts->seed = 1;
+    opts->difficulty = DEFAULT_DIFFICULTY;
+    opts->proof_of_work = 1;
+    opts->patients = 0;
+    opts->doctors = 200;
+    opts->quiet = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *name = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        long number;
+
+        if (strcmp(name, "--no-pow") == 0) {
+            opts->proof_of_work = 0;
+            continue;
+        }
+        if (strcmp(name, "--quiet") == 0) {
+            opts->quiet = 1;
+            continue;
+        }
+        if (!value) {
+            printf("Error: %s needs a value\n", name);
+            return 0;
+        }
+        i++;
+
+        if (strcmp(name, "--output") == 0) {
+            opts->output = value;
+        } else if (strcmp(name, "--blocks") == 0 && parse_long(value, 1, &number) && number <= INT32_MAX) {
+            opts->blocks = number;
+        } else if (strcmp(name, "--seed") == 0 && parse_long(value, 0, &number)) {
+            opts->seed = (uint64_t)number;
+        } else if (strcmp(name, "--difficulty") == 0 && parse_long(value, 1, &number) && number <= 8) {
+            opts->difficulty = (int)number;
+        } else if (strcmp(name, "--patients") == 0 && parse_long(value, 1, &number)) {
+            opts->patients = number;
+        } else if (strcmp(name, "--doctors") == 0 && parse_long(value, 1, &number)) {
+            opts->doctors = number;
+        } else {
+            printf("Error: Invalid option %s %s\n", name, value);
+            return 0;
+        }
+    }
+
+    if (opts->blocks <= 0 || !opts->output) {
+        printf("Error: --blocks and --output are required\n");
+        return 0;
+    }
+    if (opts->patients == 0) {
+        // about eight visits per patient
+        opts->patients = opts->blocks / 8 > 100 ? opts->blocks / 8 : 100;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    chaingen_options_t opts;
+    if (!parse_options(argc, argv, &opts)) {
+        print_usage();
+        return 1;
+    }
+    set_quiet_mode(1);
+
+    FILE *file = fopen(opts.output, "wb");
+    if (!file) {
+        printf("Error: Could not open file '%s' for writing: %s\n", opts.output, strerror(errno));
+        return 1;
+    }
+    setvbuf(file, NULL, _IOFBF, CHAINGEN_BUFFER_SIZE);
+
+    // the length stays 0 until every record is written, so an interrupted
+    // run never looks like a complete chain
+    int length = 0;
+    int ok = fwrite(&length, sizeof(int), 1, file) == 1;
+
+    uint64_t state = opts.seed;
+    time_t when = CHAINGEN_START_TIME;
+    block_t block;
+    transaction_record_t fields;
+    memset(&block, 0, sizeof(block));
+
+    // genesis block, as create_genesis_block builds it but at a fixed time
+    format_timestamp(when, block.timestamp);
+    create_transaction(&block.transaction, "GENESIS", "system@alueducation.com",
+                       "Genesis Block", "No Prescription", "Initial Block in the chain");
+    strcpy(block.transaction.timestamp, block.timestamp);
+    strcpy(block.previous_hash, "0000000000000000000000000000000000000000000000000000000000000000");
+    block.nonce = 0;
+    compute_block_hash(&block, block.current_hash);
+    ok = ok && write_block_record(file, &block);
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    for (long i = 1; ok && i < opts.blocks; i++) {
+        char previous[HASH_SIZE];
+        strcpy(previous, block.current_hash);
+
+        when += 1 + (time_t)(next_random(&state) % CHAINGEN_MAX_GAP);
+        block.index = (int)i;
+        format_timestamp(when, block.timestamp);
+        generate_transaction(&state, &opts, block.timestamp, &fields, &block.transaction);
+        strcpy(block.previous_hash, previous);
+        seal_block(&block, &opts);
+        ok = write_block_record(file, &block);
+
+        if (!opts.quiet && (i + 1) % CHAINGEN_PROGRESS_EVERY == 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double seconds = (double)(now.tv_sec - started.tv_sec) +
+                             (double)(now.tv_nsec - started.tv_nsec) / 1e9;
+            fprintf(stderr, "%ld/%ld blocks (%.0f blocks/s)\n", i + 1, opts.blocks,
+                    seconds > 0 ? (double)i / seconds : 0.0);
+        }
+    }
+
+    length = (int)opts.blocks;
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    rewind(file);
+    ok = ok && fwrite(&length, sizeof(int), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok) {
+        printf("Error: Failed to write '%s': %s\n", opts.output, strerror(errno));
+        return 1;
+    }
+    if (!opts.quiet) {
+        printf("Wrote %ld blocks to '%s' (seed %llu, %s)\n", opts.blocks, opts.output,
+               (unsigned long long)opts.seed, opts.proof_of_work ? "mined" : "no proof of work");
+    }
+    return 0;
+}